@@ -117,3 +117,134 @@ bool b2BroadPhase::QueryCallback(int32 proxyId)
 
 	return true;
 }
+
+// Below this many moved proxies the queries aren't worth splitting up.
+static const int32 b2_minParallelMoves = 128;
+
+// Gathers the pairs for a range of the move buffer into its own buffer.
+struct b2PairRange
+{
+	b2Pair* pairs;
+	int32 count;
+	int32 capacity;
+	int32 queryProxyId;
+
+	bool QueryCallback(int32 proxyId)
+	{
+		if (proxyId == queryProxyId)
+		{
+			return true;
+		}
+
+		if (count == capacity)
+		{
+			b2Pair* oldBuffer = pairs;
+			capacity = b2Max(16, 2 * capacity);
+			pairs = (b2Pair*)b2Alloc(capacity * sizeof(b2Pair));
+			if (oldBuffer)
+			{
+				memcpy(pairs, oldBuffer, count * sizeof(b2Pair));
+				b2Free(oldBuffer);
+			}
+		}
+
+		pairs[count].proxyIdA = b2Min(proxyId, queryProxyId);
+		pairs[count].proxyIdB = b2Max(proxyId, queryProxyId);
+		++count;
+
+		return true;
+	}
+};
+
+struct b2PairQueryTask : public b2ParallelTask
+{
+	const b2DynamicTree* tree;
+	const int32* moves;
+	int32 moveCount;
+	int32 rangeCount;
+	b2PairRange* ranges;
+
+	void Run(int32 index)
+	{
+		b2PairRange* range = ranges + index;
+		const int32 begin = moveCount * index / rangeCount;
+		const int32 end = moveCount * (index + 1) / rangeCount;
+		for (int32 i = begin; i < end; ++i)
+		{
+			range->queryProxyId = moves[i];
+			if (range->queryProxyId == b2BroadPhase::e_nullProxy)
+			{
+				continue;
+			}
+			tree->Query(range, tree->GetFatAABB(range->queryProxyId));
+		}
+	}
+};
+
+void b2BroadPhase::QueryMoves(b2ParallelExecutor* executor)
+{
+	// Reset pair buffer
+	m_pairCount = 0;
+
+	if (executor == NULL || executor->GetThreadCount() < 2 || m_moveCount < b2_minParallelMoves)
+	{
+		for (int32 i = 0; i < m_moveCount; ++i)
+		{
+			m_queryProxyId = m_moveBuffer[i];
+			if (m_queryProxyId == e_nullProxy)
+			{
+				continue;
+			}
+
+			// We have to query the tree with the fat AABB so that
+			// we don't fail to create a pair that may touch later.
+			const b2AABB& fatAABB = m_tree.GetFatAABB(m_queryProxyId);
+
+			// Query tree, create pairs and add them pair buffer.
+			m_tree.Query(this, fatAABB);
+		}
+		return;
+	}
+
+	// The tree is only read while querying, so each range of moved proxies
+	// can collect its pairs separately. Joining the ranges in order gives
+	// the same buffer as the serial loop.
+	const int32 rangeCount = executor->GetThreadCount();
+	b2PairRange* ranges = (b2PairRange*)b2Alloc(rangeCount * sizeof(b2PairRange));
+	memset(ranges, 0, rangeCount * sizeof(b2PairRange));
+
+	b2PairQueryTask task;
+	task.tree = &m_tree;
+	task.moves = m_moveBuffer;
+	task.moveCount = m_moveCount;
+	task.rangeCount = rangeCount;
+	task.ranges = ranges;
+	executor->ParallelFor(rangeCount, &task);
+
+	int32 pairCount = 0;
+	for (int32 i = 0; i < rangeCount; ++i)
+	{
+		pairCount += ranges[i].count;
+	}
+
+	if (pairCount > m_pairCapacity)
+	{
+		b2Free(m_pairBuffer);
+		while (m_pairCapacity < pairCount)
+		{
+			m_pairCapacity *= 2;
+		}
+		m_pairBuffer = (b2Pair*)b2Alloc(m_pairCapacity * sizeof(b2Pair));
+	}
+
+	for (int32 i = 0; i < rangeCount; ++i)
+	{
+		if (ranges[i].pairs)
+		{
+			memcpy(m_pairBuffer + m_pairCount, ranges[i].pairs, ranges[i].count * sizeof(b2Pair));
+			m_pairCount += ranges[i].count;
+			b2Free(ranges[i].pairs);
+		}
+	}
+	b2Free(ranges);
+}
@@ -72,8 +72,11 @@ public:
 	int32 GetProxyCount() const;
 
 	/// Update the pairs. This results in pair callbacks. This can only add pairs.
+	/// If an executor is given the tree queries for moved proxies may run on
+	/// several threads. The callbacks are always made from the calling thread,
+	/// in the same order.
 	template <typename T>
-	void UpdatePairs(T* callback);
+	void UpdatePairs(T* callback, b2ParallelExecutor* executor = NULL);
 
 	/// Query an AABB for overlapping proxies. The callback class
 	/// is called for each proxy that overlaps the supplied AABB.
@@ -113,6 +116,9 @@ private:
 
 	bool QueryCallback(int32 proxyId);
 
+	// Fills the pair buffer with the pairs of every moved proxy.
+	void QueryMoves(b2ParallelExecutor* executor);
+
 	b2DynamicTree m_tree;
 
 	int32 m_proxyCount;
@@ -182,27 +188,10 @@ inline float32 b2BroadPhase::GetTreeQuality() const
 }
 
 template <typename T>
-void b2BroadPhase::UpdatePairs(T* callback)
+void b2BroadPhase::UpdatePairs(T* callback, b2ParallelExecutor* executor)
 {
-	// Reset pair buffer
-	m_pairCount = 0;
-
 	// Perform tree queries for all moving proxies.
-	for (int32 i = 0; i < m_moveCount; ++i)
-	{
-		m_queryProxyId = m_moveBuffer[i];
-		if (m_queryProxyId == e_nullProxy)
-		{
-			continue;
-		}
-
-		// We have to query the tree with the fat AABB so that
-		// we don't fail to create a pair that may touch later.
-		const b2AABB& fatAABB = m_tree.GetFatAABB(m_queryProxyId);
-
-		// Query tree, create pairs and add them pair buffer.
-		m_tree.Query(this, fatAABB);
-	}
+	QueryMoves(executor);
 
 	// Reset move buffer
 	m_moveCount = 0;
@@ -136,6 +136,34 @@ void b2Free(void* mem);
 /// Logging function.
 void b2Log(const char* string, ...);
 
+// Threading
+
+/// A unit of work run by a b2ParallelExecutor for a range of indexes.
+class b2ParallelTask
+{
+public:
+	virtual ~b2ParallelTask() {}
+
+	/// Do the work for one index. Different indexes may run concurrently.
+	virtual void Run(int32 index) = 0;
+};
+
+/// Implement this to let a world solve islands and find new pairs on several
+/// threads. Work is split into GetThreadCount() ranges in a fixed way, so the
+/// simulation does not depend on how the ranges are scheduled.
+class b2ParallelExecutor
+{
+public:
+	virtual ~b2ParallelExecutor() {}
+
+	/// The number of ranges to split work into, usually the number of threads.
+	virtual int32 GetThreadCount() const = 0;
+
+	/// Call task->Run(i) for every i in [0, count) and return once all the
+	/// calls have finished.
+	virtual void ParallelFor(int32 count, b2ParallelTask* task) = 0;
+};
+
 /// Version numbering scheme.
 /// See http://en.wikipedia.org/wiki/Software_versioning
 struct b2Version
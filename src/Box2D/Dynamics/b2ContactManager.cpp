@@ -32,6 +32,7 @@ b2ContactManager::b2ContactManager()
 	m_contactFilter = &b2_defaultFilter;
 	m_contactListener = &b2_defaultListener;
 	m_allocator = NULL;
+	m_parallelExecutor = NULL;
 }
 
 void b2ContactManager::Destroy(b2Contact* c)
@@ -171,7 +172,7 @@ void b2ContactManager::Collide()
 
 void b2ContactManager::FindNewContacts()
 {
-	m_broadPhase.UpdatePairs(this);
+	m_broadPhase.UpdatePairs(this, m_parallelExecutor);
 }
 
 void b2ContactManager::AddPair(void* proxyUserDataA, void* proxyUserDataB)
@@ -47,6 +47,9 @@ public:
 	b2ContactFilter* m_contactFilter;
 	b2ContactListener* m_contactListener;
 	b2BlockAllocator* m_allocator;
+	b2ParallelExecutor* m_parallelExecutor;
 };
 
+extern b2ContactListener b2_defaultListener;
+
 #endif
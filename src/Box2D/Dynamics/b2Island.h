@@ -57,6 +57,26 @@ public:
 		++m_bodyCount;
 	}
 
+	/// Add a body with the given solver index. Used when islands are solved
+	/// concurrently.
+	void Add(b2Body* body, int32 islandIndex)
+	{
+		b2Assert(m_bodyCount < m_bodyCapacity);
+		body->m_islandIndex = islandIndex;
+		m_bodies[m_bodyCount] = body;
+		++m_bodyCount;
+	}
+
+	/// Add a static body that may be in other islands being solved at the
+	/// same time. It keeps the solver index it was given beforehand.
+	void AddShared(b2Body* body)
+	{
+		b2Assert(m_bodyCount < m_bodyCapacity);
+		b2Assert(body->m_type == b2_staticBody);
+		m_bodies[m_bodyCount] = body;
+		++m_bodyCount;
+	}
+
 	void Add(b2Contact* contact)
 	{
 		b2Assert(m_contactCount < m_contactCapacity);
@@ -88,6 +108,10 @@ public:
 	int32 m_bodyCapacity;
 	int32 m_contactCapacity;
 	int32 m_jointCapacity;
+
+	/// Static bodies may be in other islands being solved at the same time,
+	/// so they are only read.
+	bool m_sharedStatics;
 };
 
 #endif
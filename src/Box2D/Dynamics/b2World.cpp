@@ -60,6 +60,9 @@ b2World::b2World(const b2Vec2& gravity)
 
 	m_contactManager.m_allocator = &m_blockAllocator;
 
+	m_workerAllocators = NULL;
+	m_workerAllocatorCount = 0;
+
 	memset(&m_profile, 0, sizeof(b2Profile));
 }
 
@@ -82,6 +85,12 @@ b2World::~b2World()
 
 		b = bNext;
 	}
+
+	for (int32 i = 0; i < m_workerAllocatorCount; ++i)
+	{
+		m_workerAllocators[i].~b2StackAllocator();
+	}
+	b2Free(m_workerAllocators);
 }
 
 void b2World::SetDestructionListener(b2DestructionListener* listener)
@@ -99,6 +108,11 @@ void b2World::SetContactListener(b2ContactListener* listener)
 	m_contactManager.m_contactListener = listener;
 }
 
+void b2World::SetParallelExecutor(b2ParallelExecutor* executor)
+{
+	m_contactManager.m_parallelExecutor = executor;
+}
+
 void b2World::SetDebugDraw(b2Draw* debugDraw)
 {
 	m_debugDraw = debugDraw;
@@ -389,13 +403,6 @@ void b2World::Solve(const b2TimeStep& step)
 	m_profile.solveVelocity = 0.0f;
 	m_profile.solvePosition = 0.0f;
 
-	// Size the island for the worst case.
-	b2Island island(m_bodyCount,
-					m_contactManager.m_contactCount,
-					m_jointCount,
-					&m_stackAllocator,
-					m_contactManager.m_contactListener);
-
 	// Clear all the island flags.
 	for (b2Body* b = m_bodyList; b; b = b->m_next)
 	{
@@ -410,6 +417,52 @@ void b2World::Solve(const b2TimeStep& step)
 		j->m_islandFlag = false;
 	}
 
+	b2ParallelExecutor* executor = m_contactManager.m_parallelExecutor;
+	if (executor != NULL && executor->GetThreadCount() > 1 &&
+		m_contactManager.m_contactListener == &b2_defaultListener)
+	{
+		SolveIslandsParallel(step);
+	}
+	else
+	{
+		SolveIslands(step);
+	}
+
+	{
+		b2Timer timer;
+		// Synchronize fixtures, check for out of range bodies.
+		for (b2Body* b = m_bodyList; b; b = b->GetNext())
+		{
+			// If a body was not in an island then it did not move.
+			if ((b->m_flags & b2Body::e_islandFlag) == 0)
+			{
+				continue;
+			}
+
+			if (b->GetType() == b2_staticBody)
+			{
+				continue;
+			}
+
+			// Update fixtures (for broad-phase).
+			b->SynchronizeFixtures();
+		}
+
+		// Look for new contacts.
+		m_contactManager.FindNewContacts();
+		m_profile.broadphase = timer.GetMilliseconds();
+	}
+}
+
+void b2World::SolveIslands(const b2TimeStep& step)
+{
+	// Size the island for the worst case.
+	b2Island island(m_bodyCount,
+					m_contactManager.m_contactCount,
+					m_jointCount,
+					&m_stackAllocator,
+					m_contactManager.m_contactListener);
+
 	// Build and simulate all awake islands.
 	int32 stackSize = m_bodyCount;
 	b2Body** stack = (b2Body**)m_stackAllocator.Allocate(stackSize * sizeof(b2Body*));
@@ -546,31 +599,313 @@ void b2World::Solve(const b2TimeStep& step)
 	}
 
 	m_stackAllocator.Free(stack);
+}
 
+// An island found by SolveIslandsParallel, as spans of its body, contact and
+// joint arrays.
+struct b2IslandSpan
+{
+	int32 bodyStart, bodyCount;
+	int32 contactStart, contactCount;
+	int32 jointStart, jointCount;
+};
+
+// Solves a contiguous range of islands per index.
+struct b2IslandSolveTask : public b2ParallelTask
+{
+	const b2IslandSpan* islands;
+	const int32* firstIsland;
+	b2Body** bodies;
+	b2Contact** contacts;
+	b2Joint** joints;
+	int32 staticCount;
+	b2StackAllocator* allocators;
+	b2Profile* profiles;
+	b2TimeStep step;
+	b2Vec2 gravity;
+	bool allowSleep;
+
+	void Run(int32 index)
 	{
-		b2Timer timer;
-		// Synchronize fixtures, check for out of range bodies.
-		for (b2Body* b = m_bodyList; b; b = b->GetNext())
+		b2Profile* total = profiles + index;
+		total->solveInit = 0.0f;
+		total->solveVelocity = 0.0f;
+		total->solvePosition = 0.0f;
+
+		for (int32 i = firstIsland[index]; i < firstIsland[index + 1]; ++i)
 		{
-			// If a body was not in an island then it did not move.
-			if ((b->m_flags & b2Body::e_islandFlag) == 0)
+			const b2IslandSpan& span = islands[i];
+
+			// Static bodies keep the slots they were given up front, the
+			// island's own bodies follow them.
+			b2Island island(staticCount + span.bodyCount, span.contactCount, span.jointCount, allocators + index, NULL);
+			island.m_sharedStatics = true;
+
+			int32 movingCount = 0;
+			for (int32 j = 0; j < span.bodyCount; ++j)
 			{
-				continue;
+				b2Body* b = bodies[span.bodyStart + j];
+				if (b->GetType() == b2_staticBody)
+				{
+					island.AddShared(b);
+				}
+				else
+				{
+					island.Add(b, staticCount + movingCount);
+					++movingCount;
+				}
+			}
+			for (int32 j = 0; j < span.contactCount; ++j)
+			{
+				island.Add(contacts[span.contactStart + j]);
+			}
+			for (int32 j = 0; j < span.jointCount; ++j)
+			{
+				island.Add(joints[span.jointStart + j]);
 			}
 
+			b2Profile profile;
+			island.Solve(&profile, step, gravity, allowSleep);
+			total->solveInit += profile.solveInit;
+			total->solveVelocity += profile.solveVelocity;
+			total->solvePosition += profile.solvePosition;
+		}
+	}
+};
+
+// Finds the same islands as SolveIslands, in the same order, then solves them
+// on the executor. Islands share nothing but static bodies, which the solver
+// only reads, so the result is the same as solving them one after another.
+void b2World::SolveIslandsParallel(const b2TimeStep& step)
+{
+	b2ParallelExecutor* executor = m_contactManager.m_parallelExecutor;
+
+	// A static body is added once to each island that touches it, through a
+	// contact or a joint.
+	const int32 bodyCapacity = m_bodyCount + m_contactManager.m_contactCount + m_jointCount;
+	b2Body** bodies = (b2Body**)m_stackAllocator.Allocate(bodyCapacity * sizeof(b2Body*));
+	b2Contact** contacts = (b2Contact**)m_stackAllocator.Allocate(m_contactManager.m_contactCount * sizeof(b2Contact*));
+	b2Joint** joints = (b2Joint**)m_stackAllocator.Allocate(m_jointCount * sizeof(b2Joint*));
+	b2IslandSpan* islands = (b2IslandSpan*)m_stackAllocator.Allocate(m_bodyCount * sizeof(b2IslandSpan));
+	b2Body** stack = (b2Body**)m_stackAllocator.Allocate(m_bodyCount * sizeof(b2Body*));
+
+	for (b2Body* b = m_bodyList; b; b = b->m_next)
+	{
+		if (b->GetType() == b2_staticBody)
+		{
+			b->m_islandIndex = -1;
+		}
+	}
+
+	int32 islandCount = 0;
+	int32 bodyCount = 0;
+	int32 contactCount = 0;
+	int32 jointCount = 0;
+	int32 staticCount = 0;
+	for (b2Body* seed = m_bodyList; seed; seed = seed->m_next)
+	{
+		if (seed->m_flags & b2Body::e_islandFlag)
+		{
+			continue;
+		}
+
+		if (seed->IsAwake() == false || seed->IsActive() == false)
+		{
+			continue;
+		}
+
+		// The seed can be dynamic or kinematic.
+		if (seed->GetType() == b2_staticBody)
+		{
+			continue;
+		}
+
+		b2IslandSpan* span = islands + islandCount++;
+		span->bodyStart = bodyCount;
+		span->contactStart = contactCount;
+		span->jointStart = jointCount;
+
+		int32 stackCount = 0;
+		stack[stackCount++] = seed;
+		seed->m_flags |= b2Body::e_islandFlag;
+
+		// Perform a depth first search (DFS) on the constraint graph.
+		while (stackCount > 0)
+		{
+			// Grab the next body off the stack and add it to the island.
+			b2Body* b = stack[--stackCount];
+			b2Assert(b->IsActive() == true);
+			b2Assert(bodyCount < bodyCapacity);
+			bodies[bodyCount++] = b;
+
+			// Make sure the body is awake.
+			b->SetAwake(true);
+
+			// To keep islands as small as possible, we don't
+			// propagate islands across static bodies.
 			if (b->GetType() == b2_staticBody)
 			{
+				if (b->m_islandIndex < 0)
+				{
+					b->m_islandIndex = staticCount++;
+				}
 				continue;
 			}
 
-			// Update fixtures (for broad-phase).
-			b->SynchronizeFixtures();
+			// Search all contacts connected to this body.
+			for (b2ContactEdge* ce = b->m_contactList; ce; ce = ce->next)
+			{
+				b2Contact* contact = ce->contact;
+
+				// Has this contact already been added to an island?
+				if (contact->m_flags & b2Contact::e_islandFlag)
+				{
+					continue;
+				}
+
+				// Is this contact solid and touching?
+				if (contact->IsEnabled() == false ||
+					contact->IsTouching() == false)
+				{
+					continue;
+				}
+
+				// Skip sensors.
+				bool sensorA = contact->m_fixtureA->m_isSensor;
+				bool sensorB = contact->m_fixtureB->m_isSensor;
+				if (sensorA || sensorB)
+				{
+					continue;
+				}
+
+				contacts[contactCount++] = contact;
+				contact->m_flags |= b2Contact::e_islandFlag;
+
+				b2Body* other = ce->other;
+
+				// Was the other body already added to this island?
+				if (other->m_flags & b2Body::e_islandFlag)
+				{
+					continue;
+				}
+
+				b2Assert(stackCount < m_bodyCount);
+				stack[stackCount++] = other;
+				other->m_flags |= b2Body::e_islandFlag;
+			}
+
+			// Search all joints connect to this body.
+			for (b2JointEdge* je = b->m_jointList; je; je = je->next)
+			{
+				if (je->joint->m_islandFlag == true)
+				{
+					continue;
+				}
+
+				b2Body* other = je->other;
+
+				// Don't simulate joints connected to inactive bodies.
+				if (other->IsActive() == false)
+				{
+					continue;
+				}
+
+				joints[jointCount++] = je->joint;
+				je->joint->m_islandFlag = true;
+
+				if (other->m_flags & b2Body::e_islandFlag)
+				{
+					continue;
+				}
+
+				b2Assert(stackCount < m_bodyCount);
+				stack[stackCount++] = other;
+				other->m_flags |= b2Body::e_islandFlag;
+			}
 		}
 
-		// Look for new contacts.
-		m_contactManager.FindNewContacts();
-		m_profile.broadphase = timer.GetMilliseconds();
+		span->bodyCount = bodyCount - span->bodyStart;
+		span->contactCount = contactCount - span->contactStart;
+		span->jointCount = jointCount - span->jointStart;
+
+		// Allow static bodies to participate in other islands.
+		for (int32 i = span->bodyStart; i < bodyCount; ++i)
+		{
+			if (bodies[i]->GetType() == b2_staticBody)
+			{
+				bodies[i]->m_flags &= ~b2Body::e_islandFlag;
+			}
+		}
+	}
+
+	if (islandCount > 0)
+	{
+		const int32 rangeCount = b2Min(executor->GetThreadCount(), islandCount);
+		if (m_workerAllocatorCount < rangeCount)
+		{
+			for (int32 i = 0; i < m_workerAllocatorCount; ++i)
+			{
+				m_workerAllocators[i].~b2StackAllocator();
+			}
+			b2Free(m_workerAllocators);
+
+			m_workerAllocators = (b2StackAllocator*)b2Alloc(rangeCount * sizeof(b2StackAllocator));
+			for (int32 i = 0; i < rangeCount; ++i)
+			{
+				new (m_workerAllocators + i) b2StackAllocator;
+			}
+			m_workerAllocatorCount = rangeCount;
+		}
+
+		// Split the islands into ranges of about the same amount of work.
+		// This only depends on the islands and the range count.
+		int32* firstIsland = (int32*)m_stackAllocator.Allocate((rangeCount + 1) * sizeof(int32));
+		b2Profile* profiles = (b2Profile*)m_stackAllocator.Allocate(rangeCount * sizeof(b2Profile));
+		const int32 totalWork = bodyCount + contactCount + jointCount;
+		int32 work = 0;
+		int32 island = 0;
+		for (int32 i = 0; i < rangeCount; ++i)
+		{
+			firstIsland[i] = island;
+			const int32 target = (int32)((float64)totalWork * (i + 1) / rangeCount);
+			while (island < islandCount && (work < target || island == firstIsland[i]))
+			{
+				work += islands[island].bodyCount + islands[island].contactCount + islands[island].jointCount;
+				++island;
+			}
+		}
+		firstIsland[rangeCount] = islandCount;
+
+		b2IslandSolveTask task;
+		task.islands = islands;
+		task.firstIsland = firstIsland;
+		task.bodies = bodies;
+		task.contacts = contacts;
+		task.joints = joints;
+		task.staticCount = staticCount;
+		task.allocators = m_workerAllocators;
+		task.profiles = profiles;
+		task.step = step;
+		task.gravity = m_gravity;
+		task.allowSleep = m_allowSleep;
+		executor->ParallelFor(rangeCount, &task);
+
+		for (int32 i = 0; i < rangeCount; ++i)
+		{
+			m_profile.solveInit += profiles[i].solveInit;
+			m_profile.solveVelocity += profiles[i].solveVelocity;
+			m_profile.solvePosition += profiles[i].solvePosition;
+		}
+
+		m_stackAllocator.Free(profiles);
+		m_stackAllocator.Free(firstIsland);
 	}
+
+	m_stackAllocator.Free(stack);
+	m_stackAllocator.Free(islands);
+	m_stackAllocator.Free(joints);
+	m_stackAllocator.Free(contacts);
+	m_stackAllocator.Free(bodies);
 }
 
 // Find TOI contacts and solve them.
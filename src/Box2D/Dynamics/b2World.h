@@ -61,6 +61,13 @@ public:
 	/// remain in scope.
 	void SetContactListener(b2ContactListener* listener);
 
+	/// Register an executor used to solve independent islands and to find new
+	/// contact pairs on several threads. The executor is owned by you and must
+	/// remain in scope. Pass NULL to step on the calling thread only. Islands
+	/// are only solved concurrently while no contact listener is registered,
+	/// as listeners are called from the solver.
+	void SetParallelExecutor(b2ParallelExecutor* executor);
+
 	/// Register a routine for debug drawing. The debug draw functions are called
 	/// inside with b2World::DrawDebugData method. The debug draw object is owned
 	/// by you and must remain in scope.
@@ -225,6 +232,8 @@ private:
 	friend class b2Controller;
 
 	void Solve(const b2TimeStep& step);
+	void SolveIslands(const b2TimeStep& step);
+	void SolveIslandsParallel(const b2TimeStep& step);
 	void SolveTOI(const b2TimeStep& step);
 
 	void DrawJoint(b2Joint* joint);
@@ -233,6 +242,10 @@ private:
 	b2BlockAllocator m_blockAllocator;
 	b2StackAllocator m_stackAllocator;
 
+	// One stack allocator per range of islands solved in parallel.
+	b2StackAllocator* m_workerAllocators;
+	int32 m_workerAllocatorCount;
+
 	int32 m_flags;
 
 	b2ContactManager m_contactManager;
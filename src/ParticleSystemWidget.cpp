@@ -67,6 +67,7 @@ namespace gui
 		delta_time = (last_process_time_ - current_time) / 1000.0f;
 		if(scene_) {
 			scene_->process(delta_time);
+			invalidate();
 		}
 		last_process_time_ = current_time;
 	}
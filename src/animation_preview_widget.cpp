@@ -417,6 +417,7 @@ namespace gui
 		obj_ = obj;
 		frame_.reset(f);
 		cycle_ = 0;
+		invalidate();
 	}
 
 
@@ -121,6 +121,7 @@ namespace gui
 	void AnimationWidget::handleProcess()
 	{
 		Widget::handleProcess();
+		invalidate();
 		if(++cycle_ >= frame_->duration()) {
 			cycle_ = 0;
 			if(++play_sequence_count_ > max_sequence_plays_) {
@@ -158,5 +159,6 @@ namespace gui
 			if(++obj.cycle_ >= obj.frame_->duration()) {
 				obj.cycle_ = 0;
 			}
+			obj.invalidate();
 	END_DEFINE_CALLABLE(AnimationWidget)
 }
@@ -69,6 +69,17 @@ namespace graphics
 			return KRE::DrawMode::POINTS;
 		}
 
+		//uploads nscalars values to attr, as many vertices as that makes
+		//given the attribute's components.
+		void update_attribute(const KRE::GenericAttributePtr& attr, const void* data, int nscalars, size_t scalar_size)
+		{
+			int divisor = 0;
+			for(auto& desc : attr->getAttrDesc()) {
+				divisor += desc.getNumElements();
+			}
+			attr->update(data, static_cast<int>(nscalars * scalar_size), nscalars / divisor);
+		}
+
 		class GetMvpMatrixFunction : public game_logic::FunctionExpression
 		{
 		public:
@@ -672,24 +683,28 @@ namespace graphics
 			if(cmd.value.is_callable()) {
 				game_logic::FloatArrayCallable* f = cmd.value.try_convert<game_logic::FloatArrayCallable>();
 				if(f != nullptr) {
-					int count = f->num_elements();
-					int divisor = 0;
-					for(auto& desc : cmd.attr_target->getAttrDesc()) {
-						divisor += desc.getNumElements();
-					}
-					count /= divisor;
-					cmd.attr_target->update(&f->floats()[0], f->num_elements() * sizeof(float), count);
+					update_attribute(cmd.attr_target, &f->floats()[0], f->num_elements(), sizeof(float));
 					continue;
 				}
 				game_logic::ShortArrayCallable* s = cmd.value.try_convert<game_logic::ShortArrayCallable>();
 				if(s != nullptr) {
-					int count = s->num_elements();
-					int divisor = 0;
+					update_attribute(cmd.attr_target, &s->shorts()[0], s->num_elements(), sizeof(short));
+					continue;
+				}
+				game_logic::TypedArrayCallable* t = cmd.value.try_convert<game_logic::TypedArrayCallable>();
+				if(t != nullptr) {
+					//attributes are floats, so an int32 array is converted,
+					//once, and kept in place of the original so the converted
+					//data outlives the draw. Float arrays are handed over as
+					//they are, without copying.
 					for(auto& desc : cmd.attr_target->getAttrDesc()) {
-						divisor += desc.getNumElements();
+						ASSERT_LOG(desc.getVarType() == KRE::AttrFormat::FLOAT, "Typed arrays can only be given to float attributes: " << cmd.name);
+					}
+					if(!t->isFloat()) {
+						cmd.value = variant(game_logic::TypedArrayCallable::create(game_logic::TypedArrayCallable::ElementType::FLOAT32, cmd.value));
+						t = cmd.value.try_convert<game_logic::TypedArrayCallable>();
 					}
-					count /= divisor;
-					cmd.attr_target->update(&s->shorts()[0], s->num_elements() * sizeof(short), count);
+					update_attribute(cmd.attr_target, t->floats(), t->numScalars(), sizeof(float));
 					continue;
 				}
 			} else {
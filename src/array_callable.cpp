@@ -0,0 +1,656 @@
+/*
+	Copyright (C) 2012-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include "array_callable.hpp"
+#include "unit_test.hpp"
+
+namespace game_logic
+{
+	bool TypedArrayCallable::parseElementType(const std::string& name, ElementType* type)
+	{
+		if(name == "float32") {
+			*type = ElementType::FLOAT32;
+		} else if(name == "int32") {
+			*type = ElementType::INT32;
+		} else if(name == "vec2") {
+			*type = ElementType::VEC2;
+		} else {
+			return false;
+		}
+
+		return true;
+	}
+
+	std::string TypedArrayCallable::elementTypeName(ElementType type)
+	{
+		switch(type) {
+		case ElementType::FLOAT32: return "float32";
+		case ElementType::INT32: return "int32";
+		case ElementType::VEC2: return "vec2";
+		}
+
+		return "";
+	}
+
+	TypedArrayCallable::TypedArrayCallable(ElementType type, int size)
+	  : type_(type), offset_(0), size_(size)
+	{
+		ASSERT_LOG(size >= 0, "Illegal typed array size: " << size);
+		if(isFloat()) {
+			floats_.reset(new std::vector<float>(numScalars()));
+		} else {
+			ints_.reset(new std::vector<int32_t>(numScalars()));
+		}
+	}
+
+	TypedArrayCallable::TypedArrayCallable(const TypedArrayCallable& base, int begin, int end)
+	  : type_(base.type_), floats_(base.floats_), ints_(base.ints_),
+	    offset_(base.offset_ + begin*base.numComponents()), size_(end - begin)
+	{
+	}
+
+	TypedArrayCallable* TypedArrayCallable::create(ElementType type, const variant& v)
+	{
+		if(v.is_int()) {
+			return new TypedArrayCallable(type, v.as_int());
+		}
+
+		if(v.is_callable()) {
+			const TypedArrayCallable* a = v.try_convert<TypedArrayCallable>();
+			if(a != nullptr) {
+				const int ncomponents = type == ElementType::VEC2 ? 2 : 1;
+				ASSERT_LOG(a->numScalars()%ncomponents == 0, "Cannot make a " << elementTypeName(type) << " array from " << a->numScalars() << " values");
+
+				TypedArrayCallable* result = new TypedArrayCallable(type, a->numScalars()/ncomponents);
+				const int n = a->numScalars();
+				if(result->isFloat() && a->isFloat()) {
+					std::copy(a->floats(), a->floats() + n, result->mutableFloats());
+				} else if(result->isFloat()) {
+					const int32_t* src = a->ints();
+					float* dst = result->mutableFloats();
+					for(int i = 0; i < n; ++i) {
+						dst[i] = static_cast<float>(src[i]);
+					}
+				} else if(a->isFloat()) {
+					const float* src = a->floats();
+					int32_t* dst = result->mutableInts();
+					for(int i = 0; i < n; ++i) {
+						dst[i] = static_cast<int32_t>(src[i]);
+					}
+				} else {
+					std::copy(a->ints(), a->ints() + n, result->mutableInts());
+				}
+
+				return result;
+			}
+
+			FloatArrayCallable* f = v.try_convert<FloatArrayCallable>();
+			if(f != nullptr) {
+				const int ncomponents = type == ElementType::VEC2 ? 2 : 1;
+				TypedArrayCallable* result = new TypedArrayCallable(type, f->num_elements()/ncomponents);
+				for(int i = 0; i < result->numScalars(); ++i) {
+					if(result->isFloat()) {
+						result->mutableFloats()[i] = f->floats()[i];
+					} else {
+						result->mutableInts()[i] = static_cast<int32_t>(f->floats()[i]);
+					}
+				}
+
+				return result;
+			}
+		}
+
+		ASSERT_LOG(v.is_list(), "Cannot make a typed array from " << v.write_json());
+
+		//vec2 arrays may be given as [[x,y],...] or as [x,y,x,y,...]
+		const bool nested = type == ElementType::VEC2 && v.num_elements() > 0 && v[0].is_list();
+		const int nscalars = nested ? v.num_elements()*2 : v.num_elements();
+		ASSERT_LOG(type != ElementType::VEC2 || nscalars%2 == 0, "A vec2 array needs an even number of values: " << v.write_json());
+
+		TypedArrayCallable* result = new TypedArrayCallable(type, type == ElementType::VEC2 ? nscalars/2 : nscalars);
+		for(int i = 0; i < nscalars; ++i) {
+			const variant& item = nested ? v[i/2][i%2] : v[i];
+			if(result->isFloat()) {
+				result->mutableFloats()[i] = item.as_float();
+			} else {
+				result->mutableInts()[i] = item.as_int();
+			}
+		}
+
+		return result;
+	}
+
+	TypedArrayCallable* TypedArrayCallable::slice(int begin, int end) const
+	{
+		begin = std::max(0, std::min(begin, size_));
+		end = std::max(begin, std::min(end, size_));
+		return new TypedArrayCallable(*this, begin, end);
+	}
+
+	variant TypedArrayCallable::element(int n) const
+	{
+		ASSERT_LOG(n >= 0 && n < size_, "Index into typed array out of bounds: " << n << " size " << size_);
+		switch(type_) {
+		case ElementType::FLOAT32:
+			return variant(floats()[n]);
+		case ElementType::INT32:
+			return variant(ints()[n]);
+		case ElementType::VEC2: {
+			std::vector<variant> v;
+			v.emplace_back(floats()[n*2]);
+			v.emplace_back(floats()[n*2+1]);
+			return variant(&v);
+		}
+		}
+
+		return variant();
+	}
+
+	variant TypedArrayCallable::toList() const
+	{
+		std::vector<variant> v;
+		v.reserve(size_);
+		for(int n = 0; n != size_; ++n) {
+			v.push_back(element(n));
+		}
+
+		return variant(&v);
+	}
+
+	BEGIN_DEFINE_CALLABLE_NOBASE(TypedArrayCallable)
+		DEFINE_FIELD(size, "int")
+			return variant(obj.size());
+		DEFINE_FIELD(type, "string")
+			return variant(TypedArrayCallable::elementTypeName(obj.elementType()));
+		DEFINE_FIELD(value, "[decimal|int|[decimal,decimal]]")
+			return obj.toList();
+	END_DEFINE_CALLABLE(TypedArrayCallable)
+
+	namespace typed_array
+	{
+		namespace
+		{
+			typedef TypedArrayCallable::ElementType ElementType;
+
+			struct add_op { template<typename T> T operator()(T a, T b) const { return a + b; } };
+			struct sub_op { template<typename T> T operator()(T a, T b) const { return a - b; } };
+			struct mul_op { template<typename T> T operator()(T a, T b) const { return a * b; } };
+			struct div_op { template<typename T> T operator()(T a, T b) const { return a / b; } };
+			struct min_op { template<typename T> T operator()(T a, T b) const { return a < b ? a : b; } };
+			struct max_op { template<typename T> T operator()(T a, T b) const { return a > b ? a : b; } };
+
+			template<typename T, typename Op>
+			void run_binary(Op op, const T* a, T a_scalar, const T* b, T b_scalar, T* out, int n)
+			{
+				if(a != nullptr && b != nullptr) {
+					for(int i = 0; i < n; ++i) {
+						out[i] = op(a[i], b[i]);
+					}
+				} else if(a != nullptr) {
+					for(int i = 0; i < n; ++i) {
+						out[i] = op(a[i], b_scalar);
+					}
+				} else {
+					for(int i = 0; i < n; ++i) {
+						out[i] = op(a_scalar, b[i]);
+					}
+				}
+			}
+
+			template<typename T>
+			void dispatch_binary(BinaryOp op, const T* a, T a_scalar, const T* b, T b_scalar, T* out, int n)
+			{
+				switch(op) {
+				case BinaryOp::ADD: run_binary(add_op(), a, a_scalar, b, b_scalar, out, n); break;
+				case BinaryOp::SUB: run_binary(sub_op(), a, a_scalar, b, b_scalar, out, n); break;
+				case BinaryOp::MUL: run_binary(mul_op(), a, a_scalar, b, b_scalar, out, n); break;
+				case BinaryOp::DIV: run_binary(div_op(), a, a_scalar, b, b_scalar, out, n); break;
+				case BinaryOp::MIN: run_binary(min_op(), a, a_scalar, b, b_scalar, out, n); break;
+				case BinaryOp::MAX: run_binary(max_op(), a, a_scalar, b, b_scalar, out, n); break;
+				}
+			}
+
+			//one side of a binary operation, either an array or a scalar, or
+			//for vec2 results an [x,y] pair.
+			struct operand
+			{
+				explicit operand(const variant& v) : array(nullptr), type(ElementType::INT32), int_value(0)
+				{
+					float_value[0] = float_value[1] = 0.0f;
+					if(v.is_callable()) {
+						array = v.try_convert<TypedArrayCallable>();
+						ASSERT_LOG(array != nullptr, "Expected a typed array or a number: " << v.write_json());
+						type = array->elementType();
+					} else if(v.is_int()) {
+						int_value = v.as_int();
+						float_value[0] = float_value[1] = static_cast<float>(int_value);
+					} else if(v.is_decimal()) {
+						type = ElementType::FLOAT32;
+						float_value[0] = float_value[1] = v.as_float();
+					} else {
+						ASSERT_LOG(v.is_list() && v.num_elements() == 2, "Expected a typed array, a number or an [x,y] pair: " << v.write_json());
+						type = ElementType::VEC2;
+						float_value[0] = v[0].as_float();
+						float_value[1] = v[1].as_float();
+					}
+				}
+
+				const TypedArrayCallable* array;
+				ElementType type;
+				int32_t int_value;
+				float float_value[2];
+
+				//the operand as nresult float values, or nullptr if it is a
+				//single value, which is put in scalar.
+				const float* as_floats(ElementType result_type, int nresult, std::vector<float>* buf, float* scalar) const
+				{
+					const bool per_component = result_type == ElementType::VEC2 && type != ElementType::VEC2;
+					if(array == nullptr) {
+						if(type != ElementType::VEC2) {
+							*scalar = float_value[0];
+							return nullptr;
+						}
+
+						buf->resize(nresult);
+						for(int i = 0; i < nresult; i += 2) {
+							(*buf)[i] = float_value[0];
+							(*buf)[i+1] = float_value[1];
+						}
+
+						return buf->data();
+					}
+
+					if(array->isFloat() && !per_component) {
+						return array->floats();
+					}
+
+					buf->resize(nresult);
+					const int step = per_component ? 2 : 1;
+					for(int i = 0; i < nresult; ++i) {
+						const int src = i/step;
+						(*buf)[i] = array->isFloat() ? array->floats()[src] : static_cast<float>(array->ints()[src]);
+					}
+
+					return buf->data();
+				}
+			};
+
+			template<typename Fn>
+			void map_floats(Fn fn, const float* a, float* out, int n)
+			{
+				for(int i = 0; i < n; ++i) {
+					out[i] = fn(a[i]);
+				}
+			}
+
+			const TypedArrayCallable& as_int_indices(const variant& indices, TypedArrayCallablePtr* holder)
+			{
+				const TypedArrayCallable* a = indices.is_callable() ? indices.try_convert<TypedArrayCallable>() : nullptr;
+				if(a == nullptr || a->elementType() != ElementType::INT32) {
+					holder->reset(TypedArrayCallable::create(ElementType::INT32, indices));
+					a = holder->get();
+				}
+
+				return *a;
+			}
+		}
+
+		bool parseBinaryOp(const std::string& name, BinaryOp* op)
+		{
+			static const char* names[] = { "+", "-", "*", "/", "min", "max" };
+			for(int n = 0; n != sizeof(names)/sizeof(*names); ++n) {
+				if(name == names[n]) {
+					*op = static_cast<BinaryOp>(n);
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		bool parseUnaryOp(const std::string& name, UnaryOp* op)
+		{
+			static const char* names[] = { "neg", "abs", "sqrt", "floor", "sin", "cos" };
+			for(int n = 0; n != sizeof(names)/sizeof(*names); ++n) {
+				if(name == names[n]) {
+					*op = static_cast<UnaryOp>(n);
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		bool parseReduction(const std::string& name, Reduction* op)
+		{
+			static const char* names[] = { "sum", "min", "max", "mean" };
+			for(int n = 0; n != sizeof(names)/sizeof(*names); ++n) {
+				if(name == names[n]) {
+					*op = static_cast<Reduction>(n);
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		variant binary(BinaryOp op, const variant& a_var, const variant& b_var)
+		{
+			const operand a(a_var), b(b_var);
+			ASSERT_LOG(a.array != nullptr || b.array != nullptr, "Typed array operation needs at least one array");
+
+			const bool is_vec2 = a.type == ElementType::VEC2 || b.type == ElementType::VEC2;
+			const bool is_float = is_vec2 || a.type == ElementType::FLOAT32 || b.type == ElementType::FLOAT32;
+			const ElementType result_type = is_vec2 ? ElementType::VEC2 : (is_float ? ElementType::FLOAT32 : ElementType::INT32);
+
+			const int size = a.array != nullptr ? a.array->size() : b.array->size();
+			if(a.array != nullptr && b.array != nullptr) {
+				ASSERT_LOG(a.array->size() == b.array->size(), "Typed arrays are of different sizes: " << a.array->size() << " and " << b.array->size());
+			}
+
+			TypedArrayCallablePtr result(new TypedArrayCallable(result_type, size));
+			const int n = result->numScalars();
+
+			if(is_float) {
+				std::vector<float> a_buf, b_buf;
+				float a_scalar = 0.0f, b_scalar = 0.0f;
+				const float* a_ptr = a.as_floats(result_type, n, &a_buf, &a_scalar);
+				const float* b_ptr = b.as_floats(result_type, n, &b_buf, &b_scalar);
+				dispatch_binary(op, a_ptr, a_scalar, b_ptr, b_scalar, result->mutableFloats(), n);
+			} else {
+				const int32_t* a_ptr = a.array != nullptr ? a.array->ints() : nullptr;
+				const int32_t* b_ptr = b.array != nullptr ? b.array->ints() : nullptr;
+				if(op == BinaryOp::DIV) {
+					if(b_ptr != nullptr) {
+						ASSERT_LOG(std::find(b_ptr, b_ptr + n, 0) == b_ptr + n, "Division by zero in typed array");
+					} else {
+						ASSERT_LOG(b.int_value != 0, "Division by zero in typed array");
+					}
+				}
+
+				dispatch_binary(op, a_ptr, a.int_value, b_ptr, b.int_value, result->mutableInts(), n);
+			}
+
+			return variant(result.get());
+		}
+
+		variant unary(UnaryOp op, const TypedArrayCallable& a)
+		{
+			const int n = a.numScalars();
+			if(!a.isFloat() && (op == UnaryOp::NEG || op == UnaryOp::ABS || op == UnaryOp::FLOOR)) {
+				TypedArrayCallablePtr result(new TypedArrayCallable(ElementType::INT32, a.size()));
+				const int32_t* src = a.ints();
+				int32_t* dst = result->mutableInts();
+				for(int i = 0; i < n; ++i) {
+					dst[i] = op == UnaryOp::NEG ? -src[i] : (op == UnaryOp::ABS ? std::abs(src[i]) : src[i]);
+				}
+
+				return variant(result.get());
+			}
+
+			TypedArrayCallablePtr result(new TypedArrayCallable(a.elementType() == ElementType::VEC2 ? ElementType::VEC2 : ElementType::FLOAT32, a.size()));
+
+			std::vector<float> buf;
+			const float* src = nullptr;
+			if(a.isFloat()) {
+				src = a.floats();
+			} else {
+				buf.assign(a.ints(), a.ints() + n);
+				src = buf.data();
+			}
+
+			float* dst = result->mutableFloats();
+			switch(op) {
+			case UnaryOp::NEG: map_floats([](float x) { return -x; }, src, dst, n); break;
+			case UnaryOp::ABS: map_floats([](float x) { return std::abs(x); }, src, dst, n); break;
+			case UnaryOp::SQRT: map_floats([](float x) { return std::sqrt(x); }, src, dst, n); break;
+			case UnaryOp::FLOOR: map_floats([](float x) { return std::floor(x); }, src, dst, n); break;
+			case UnaryOp::SIN: map_floats([](float x) { return std::sin(x); }, src, dst, n); break;
+			case UnaryOp::COS: map_floats([](float x) { return std::cos(x); }, src, dst, n); break;
+			}
+
+			return variant(result.get());
+		}
+
+		variant reduce(Reduction op, const TypedArrayCallable& a)
+		{
+			if(a.size() == 0) {
+				return op == Reduction::SUM ? variant(0) : variant();
+			}
+
+			const int ncomponents = a.numComponents();
+			std::vector<variant> results;
+			for(int c = 0; c != ncomponents; ++c) {
+				const int n = a.size();
+				if(a.isFloat()) {
+					const float* src = a.floats() + c;
+					double sum = 0.0;
+					float lo = src[0], hi = src[0];
+					for(int i = 0; i < n; ++i) {
+						const float x = src[i*ncomponents];
+						sum += x;
+						lo = x < lo ? x : lo;
+						hi = x > hi ? x : hi;
+					}
+
+					switch(op) {
+					case Reduction::SUM: results.emplace_back(sum); break;
+					case Reduction::MIN: results.emplace_back(lo); break;
+					case Reduction::MAX: results.emplace_back(hi); break;
+					case Reduction::MEAN: results.emplace_back(sum/n); break;
+					}
+				} else {
+					const int32_t* src = a.ints();
+					int64_t sum = 0;
+					int32_t lo = src[0], hi = src[0];
+					for(int i = 0; i < n; ++i) {
+						sum += src[i];
+						lo = src[i] < lo ? src[i] : lo;
+						hi = src[i] > hi ? src[i] : hi;
+					}
+
+					switch(op) {
+					case Reduction::SUM: results.emplace_back(static_cast<int>(sum)); break;
+					case Reduction::MIN: results.emplace_back(lo); break;
+					case Reduction::MAX: results.emplace_back(hi); break;
+					case Reduction::MEAN: results.emplace_back(static_cast<double>(sum)/n); break;
+					}
+				}
+			}
+
+			if(ncomponents == 1) {
+				return results.front();
+			}
+
+			return variant(&results);
+		}
+
+		variant dot(const TypedArrayCallable& a, const TypedArrayCallable& b)
+		{
+			const int n = a.numScalars();
+			ASSERT_LOG(n == b.numScalars(), "Typed arrays are of different sizes: " << n << " and " << b.numScalars());
+
+			if(!a.isFloat() && !b.isFloat()) {
+				const int32_t* x = a.ints();
+				const int32_t* y = b.ints();
+				int64_t sum = 0;
+				for(int i = 0; i < n; ++i) {
+					sum += static_cast<int64_t>(x[i])*y[i];
+				}
+
+				return variant(static_cast<int>(sum));
+			}
+
+			std::vector<float> a_buf, b_buf;
+			const float* x = a.isFloat() ? a.floats() : (a_buf.assign(a.ints(), a.ints() + n), a_buf.data());
+			const float* y = b.isFloat() ? b.floats() : (b_buf.assign(b.ints(), b.ints() + n), b_buf.data());
+			double sum = 0.0;
+			for(int i = 0; i < n; ++i) {
+				sum += x[i]*y[i];
+			}
+
+			return variant(sum);
+		}
+
+		variant gather(const TypedArrayCallable& a, const variant& indices_var)
+		{
+			TypedArrayCallablePtr holder;
+			const TypedArrayCallable& indices = as_int_indices(indices_var, &holder);
+
+			const int ncomponents = a.numComponents();
+			const int32_t* idx = indices.ints();
+			const int n = indices.size();
+			for(int i = 0; i < n; ++i) {
+				ASSERT_LOG(idx[i] >= 0 && idx[i] < a.size(), "Index into typed array out of bounds: " << idx[i] << " size " << a.size());
+			}
+
+			TypedArrayCallablePtr result(new TypedArrayCallable(a.elementType(), n));
+			if(a.isFloat()) {
+				const float* src = a.floats();
+				float* dst = result->mutableFloats();
+				for(int i = 0; i < n; ++i) {
+					for(int c = 0; c < ncomponents; ++c) {
+						dst[i*ncomponents + c] = src[idx[i]*ncomponents + c];
+					}
+				}
+			} else {
+				const int32_t* src = a.ints();
+				int32_t* dst = result->mutableInts();
+				for(int i = 0; i < n; ++i) {
+					dst[i] = src[idx[i]];
+				}
+			}
+
+			return variant(result.get());
+		}
+
+		variant scatter(const TypedArrayCallable& a, const variant& indices_var, const variant& values_var)
+		{
+			TypedArrayCallablePtr holder;
+			const TypedArrayCallable& indices = as_int_indices(indices_var, &holder);
+
+			const int32_t* idx = indices.ints();
+			const int n = indices.size();
+			for(int i = 0; i < n; ++i) {
+				ASSERT_LOG(idx[i] >= 0 && idx[i] < a.size(), "Index into typed array out of bounds: " << idx[i] << " size " << a.size());
+			}
+
+			TypedArrayCallablePtr result(TypedArrayCallable::create(a.elementType(), variant(&a)));
+
+			//the values as an array of the same type as a.
+			TypedArrayCallablePtr values;
+			const TypedArrayCallable* values_array = values_var.is_callable() ? values_var.try_convert<TypedArrayCallable>() : nullptr;
+			if(values_array != nullptr || (values_var.is_list() && values_var.num_elements() == n && (a.elementType() != ElementType::VEC2 || (values_var.num_elements() > 0 && values_var[0].is_list())))) {
+				values.reset(TypedArrayCallable::create(a.elementType(), values_var));
+				ASSERT_LOG(values->size() == n, "Scatter has " << n << " indices but " << values->size() << " values");
+			} else {
+				//a single value, used for every index.
+				std::vector<variant> repeated(n, values_var);
+				values.reset(TypedArrayCallable::create(a.elementType(), variant(&repeated)));
+			}
+
+			const int ncomponents = a.numComponents();
+			if(a.isFloat()) {
+				const float* src = values->floats();
+				float* dst = result->mutableFloats();
+				for(int i = 0; i < n; ++i) {
+					for(int c = 0; c < ncomponents; ++c) {
+						dst[idx[i]*ncomponents + c] = src[i*ncomponents + c];
+					}
+				}
+			} else {
+				const int32_t* src = values->ints();
+				int32_t* dst = result->mutableInts();
+				for(int i = 0; i < n; ++i) {
+					dst[idx[i]] = src[i];
+				}
+			}
+
+			return variant(result.get());
+		}
+	}
+}
+
+UNIT_TEST(typed_array)
+{
+	using namespace game_logic;
+	typedef TypedArrayCallable::ElementType ElementType;
+
+	std::vector<variant> values;
+	for(int n = 0; n != 8; ++n) {
+		values.push_back(variant(n));
+	}
+
+	TypedArrayCallablePtr ints(TypedArrayCallable::create(ElementType::INT32, variant(&values)));
+	TypedArrayCallablePtr floats(TypedArrayCallable::create(ElementType::FLOAT32, variant(ints.get())));
+
+	//int op int stays int, anything with a float becomes float.
+	variant sum = typed_array::binary(typed_array::BinaryOp::ADD, variant(ints.get()), variant(ints.get()));
+	CHECK(sum.convert_to<TypedArrayCallable>()->elementType() == ElementType::INT32, "int32 + int32 should stay int32");
+	CHECK_EQ(sum.convert_to<TypedArrayCallable>()->ints()[7], 14);
+
+	variant scaled = typed_array::binary(typed_array::BinaryOp::MUL, variant(floats.get()), variant(0.5));
+	CHECK_EQ(scaled.convert_to<TypedArrayCallable>()->floats()[3], 1.5f);
+
+	CHECK_EQ(typed_array::reduce(typed_array::Reduction::SUM, *ints), variant(28));
+	CHECK_EQ(typed_array::reduce(typed_array::Reduction::MAX, *ints), variant(7));
+	CHECK_EQ(typed_array::dot(*ints, *ints), variant(140));
+
+	//slices share storage and see only their own range.
+	TypedArrayCallablePtr middle(ints->slice(2, 5));
+	CHECK_EQ(middle->size(), 3);
+	CHECK_EQ(middle->ints(), ints->ints() + 2);
+	CHECK_EQ(typed_array::reduce(typed_array::Reduction::SUM, *middle), variant(9));
+
+	std::vector<variant> indices;
+	indices.push_back(variant(6));
+	indices.push_back(variant(1));
+	variant gathered = typed_array::gather(*ints, variant(&indices));
+	CHECK_EQ(gathered.convert_to<TypedArrayCallable>()->ints()[0], 6);
+	CHECK_EQ(gathered.convert_to<TypedArrayCallable>()->ints()[1], 1);
+
+	variant scattered = typed_array::scatter(*ints, variant(&indices), variant(-1));
+	CHECK_EQ(scattered.convert_to<TypedArrayCallable>()->ints()[6], -1);
+	CHECK_EQ(scattered.convert_to<TypedArrayCallable>()->ints()[2], 2);
+	CHECK_EQ(ints->ints()[6], 6);
+
+	//a vec2 array scaled per element by a float32 array.
+	TypedArrayCallablePtr points(TypedArrayCallable::create(ElementType::VEC2, variant(&values)));
+	CHECK_EQ(points->size(), 4);
+	TypedArrayCallablePtr weights(floats->slice(0, 4));
+	variant weighted = typed_array::binary(typed_array::BinaryOp::MUL, variant(points.get()), variant(weights.get()));
+	const TypedArrayCallable* w = weighted.convert_to<TypedArrayCallable>();
+	CHECK(w->elementType() == ElementType::VEC2, "vec2 * float32 should be vec2");
+	CHECK_EQ(w->floats()[6], 18.0f);
+	CHECK_EQ(w->floats()[7], 21.0f);
+
+	std::vector<variant> none;
+	variant unchanged = typed_array::scatter(*points, variant(&none), variant(&none));
+	CHECK_EQ(unchanged.convert_to<TypedArrayCallable>()->size(), 4);
+
+	TypedArrayCallablePtr empty(ints->slice(0, 0));
+	CHECK(typed_array::reduce(typed_array::Reduction::MEAN, *empty).is_null(), "mean of an empty array should be null");
+}
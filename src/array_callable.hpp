@@ -23,10 +23,13 @@
 
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 #include "asserts.hpp"
 #include "formula_callable.hpp"
+#include "formula_callable_definition.hpp"
 #include "variant.hpp"
 
 namespace game_logic 
@@ -103,4 +106,85 @@ namespace game_logic
 		std::vector<short> s_;
 	};
 
+	//An array of float32, int32 or vec2 (pairs of float32) values. Arrays
+	//are values, so never change once built; slices share their storage
+	//with the array they come from instead of copying it.
+	class TypedArrayCallable : public FormulaCallable
+	{
+	public:
+		enum class ElementType { FLOAT32, INT32, VEC2 };
+
+		static bool parseElementType(const std::string& name, ElementType* type);
+		static std::string elementTypeName(ElementType type);
+
+		//a new array of the given number of elements, all zero.
+		TypedArrayCallable(ElementType type, int size);
+
+		//builds an array from a list, a list of [x,y] pairs or a flat list
+		//for vec2, another array, or a size giving an array of zeros.
+		static TypedArrayCallable* create(ElementType type, const variant& v);
+
+		ElementType elementType() const { return type_; }
+		bool isFloat() const { return type_ != ElementType::INT32; }
+		int size() const { return size_; }
+		int numComponents() const { return type_ == ElementType::VEC2 ? 2 : 1; }
+		int numScalars() const { return size_*numComponents(); }
+
+		//the values, numScalars() of them. floats() is for FLOAT32 and VEC2
+		//arrays, ints() for INT32 arrays.
+		const float* floats() const { return floats_->data() + offset_; }
+		const int32_t* ints() const { return ints_->data() + offset_; }
+
+		//only for filling in an array that has just been made.
+		float* mutableFloats() { return floats_->data() + offset_; }
+		int32_t* mutableInts() { return ints_->data() + offset_; }
+
+		TypedArrayCallable* slice(int begin, int end) const;
+
+		variant element(int n) const;
+		variant toList() const;
+	private:
+		DECLARE_CALLABLE(TypedArrayCallable);
+
+		TypedArrayCallable(const TypedArrayCallable& base, int begin, int end);
+
+		ElementType type_;
+		std::shared_ptr<std::vector<float>> floats_;
+		std::shared_ptr<std::vector<int32_t>> ints_;
+
+		//where the array starts in the storage, in scalars, and its length
+		//in elements.
+		int offset_, size_;
+	};
+
+	typedef ffl::IntrusivePtr<TypedArrayCallable> TypedArrayCallablePtr;
+
+	//bulk operations on typed arrays. Each makes a new array; the loops over
+	//elements are kept free of branches and aliasing so they vectorize.
+	namespace typed_array
+	{
+		enum class BinaryOp { ADD, SUB, MUL, DIV, MIN, MAX };
+		enum class UnaryOp { NEG, ABS, SQRT, FLOOR, SIN, COS };
+		enum class Reduction { SUM, MIN, MAX, MEAN };
+
+		bool parseBinaryOp(const std::string& name, BinaryOp* op);
+		bool parseUnaryOp(const std::string& name, UnaryOp* op);
+		bool parseReduction(const std::string& name, Reduction* op);
+
+		//either operand may be a scalar, and a vec2 array may be combined
+		//with a float32 or int32 array of the same size or a single [x,y].
+		variant binary(BinaryOp op, const variant& a, const variant& b);
+		variant unary(UnaryOp op, const TypedArrayCallable& a);
+
+		//reductions of vec2 arrays give an [x,y] result. The sum of an empty
+		//array is 0; its min, max and mean are null.
+		variant reduce(Reduction op, const TypedArrayCallable& a);
+		variant dot(const TypedArrayCallable& a, const TypedArrayCallable& b);
+
+		//gather gives a[indices[n]] for each n; scatter gives a copy of a
+		//with a[indices[n]] set to values[n], or to values if it is a scalar.
+		variant gather(const TypedArrayCallable& a, const variant& indices);
+		variant scatter(const TypedArrayCallable& a, const variant& indices, const variant& values);
+	}
+
 }
@@ -22,6 +22,8 @@
 */
 
 #include <cstdarg>
+#include <iomanip>
+#include <iostream>
 
 #include "Canvas.hpp"
 #include "Font.hpp"
@@ -30,6 +32,10 @@
 #include "b2d_ffl.hpp"
 #include "json_parser.hpp"
 #include "level.hpp"
+#include "preferences.hpp"
+#include "profile_timer.hpp"
+#include "thread_pool.hpp"
+#include "unit_test.hpp"
 #include "variant_utils.hpp"
 
 #ifdef USE_BOX2D
@@ -63,6 +69,37 @@ namespace box2d
 			static joint_factory_map res;
 			return res;
 		}
+
+		PREF_INT(box2d_threads, 0, "Number of threads to solve Box2D islands on; 0 or 1 steps worlds on the main thread only");
+
+		// Runs Box2D's parallel work on the shared thread pool. Box2D splits
+		// the work into a fixed number of ranges, so results don't depend on
+		// how the pool schedules them.
+		class thread_pool_executor : public b2ParallelExecutor
+		{
+		public:
+			explicit thread_pool_executor(int nthreads) : nthreads_(nthreads) {}
+			int32 GetThreadCount() const override { return nthreads_; }
+			void ParallelFor(int32 count, b2ParallelTask* task) override {
+				threading::thread_pool::shared().parallel_for(count, [task](int n) { task->Run(n); });
+			}
+		private:
+			int nthreads_;
+		};
+
+		void set_world_threads(b2World& w, std::unique_ptr<b2ParallelExecutor>& executor, int nthreads)
+		{
+			if(nthreads <= 1) {
+				w.SetParallelExecutor(nullptr);
+				executor.reset();
+				return;
+			}
+			if(!executor || executor->GetThreadCount() != nthreads) {
+				w.SetParallelExecutor(nullptr);
+				executor.reset(new thread_pool_executor(nthreads));
+			}
+			w.SetParallelExecutor(executor.get());
+		}
 	}
 
 	struct body_destructor
@@ -181,6 +218,7 @@ namespace box2d
 	void world::step(float time_step)
 	{
 		set_dt(time_step);
+		set_world_threads(world_, executor_, g_box2d_threads);
 		get_world().Step(time_step, velocity_iterations_, position_iterations_);
 	}
 
@@ -1631,6 +1669,111 @@ namespace box2d
 		canvas->drawLineLoop(varray, 1.0f, KRE::Color(color.r, color.g, color.b));
 	}
 
+	void create_benchmark_scene(b2World& w, int piles, int boxes_per_pile)
+	{
+		const float pile_spacing = 3.0f;
+
+		b2BodyDef floor_def;
+		b2Body* floor = w.CreateBody(&floor_def);
+		b2EdgeShape floor_shape;
+		floor_shape.Set(b2Vec2(-pile_spacing, 0.0f), b2Vec2(pile_spacing * piles, 0.0f));
+		floor->CreateFixture(&floor_shape, 0.0f);
+
+		b2PolygonShape box;
+		box.SetAsBox(0.5f, 0.5f);
+		for(int pile = 0; pile != piles; ++pile) {
+			for(int n = 0; n != boxes_per_pile; ++n) {
+				b2BodyDef def;
+				def.type = b2_dynamicBody;
+				// Offset alternate boxes a little so that piles topple
+				// rather than come to rest straight away.
+				def.position.Set(pile * pile_spacing + ((n % 2) ? 0.1f : -0.1f), 0.5f + n * 1.05f);
+				b2Body* b = w.CreateBody(&def);
+				b->CreateFixture(&box, 1.0f);
+			}
+		}
+	}
+}
+
+namespace
+{
+	// Steps a benchmark scene and returns its bodies' positions.
+	std::vector<b2Vec2> step_benchmark_scene(int nthreads, int piles, int boxes_per_pile, int steps)
+	{
+		b2World w(b2Vec2(0.0f, -10.0f));
+		std::unique_ptr<b2ParallelExecutor> executor;
+		box2d::set_world_threads(w, executor, nthreads);
+		box2d::create_benchmark_scene(w, piles, boxes_per_pile);
+		for(int n = 0; n != steps; ++n) {
+			w.Step(1.0f / 60.0f, 8, 3);
+		}
+
+		std::vector<b2Vec2> res;
+		for(const b2Body* b = w.GetBodyList(); b != nullptr; b = b->GetNext()) {
+			res.push_back(b->GetPosition());
+		}
+		return res;
+	}
+}
+
+UNIT_TEST(box2d_parallel_step)
+{
+	const auto serial = step_benchmark_scene(1, 16, 12, 120);
+	for(int nthreads : { 2, 3, 8 }) {
+		const auto parallel = step_benchmark_scene(nthreads, 16, 12, 120);
+		CHECK(parallel.size() == serial.size(), "body count differs with " << nthreads << " threads");
+		for(size_t n = 0; n != serial.size(); ++n) {
+			CHECK(parallel[n].x == serial[n].x && parallel[n].y == serial[n].y, "body " << n << " moved differently with " << nthreads << " threads");
+		}
+	}
+}
+
+BENCHMARK_ARG(box2d_step_piles, int nthreads)
+{
+	b2World w(b2Vec2(0.0f, -10.0f));
+	std::unique_ptr<b2ParallelExecutor> executor;
+	box2d::set_world_threads(w, executor, nthreads);
+	box2d::create_benchmark_scene(w, 200, 10);
+	w.SetAllowSleeping(false);
+	BENCHMARK_LOOP {
+		w.Step(1.0f / 60.0f, 8, 3);
+	}
+}
+
+BENCHMARK_ARG_CALL(box2d_step_piles, serial, 1);
+BENCHMARK_ARG_CALL(box2d_step_piles, threads_4, 4);
+
+// Usage: box2d_benchmark [--piles N] [--boxes N] [--steps N] [--threads N]
+// Steps a benchmark scene and reports the time taken and a checksum of the
+// final body positions, which is the same for any thread count.
+COMMAND_LINE_UTILITY(box2d_benchmark)
+{
+	int piles = 200, boxes = 10, steps = 600, nthreads = 1;
+	for(size_t n = 0; n + 1 < args.size(); n += 2) {
+		const int value = atoi(args[n + 1].c_str());
+		if(args[n] == "--piles") {
+			piles = value;
+		} else if(args[n] == "--boxes") {
+			boxes = value;
+		} else if(args[n] == "--steps") {
+			steps = value;
+		} else if(args[n] == "--threads") {
+			nthreads = value;
+		} else {
+			ASSERT_LOG(false, "Unrecognized argument: " << args[n]);
+		}
+	}
+
+	const int start = profile::get_tick_time();
+	const auto positions = step_benchmark_scene(nthreads, piles, boxes, steps);
+	const int elapsed = profile::get_tick_time() - start;
+
+	double checksum = 0.0;
+	for(const auto& p : positions) {
+		checksum += p.x * 3.0 + p.y;
+	}
+	std::cout << piles << " piles of " << boxes << " boxes, " << steps << " steps on " << nthreads << " thread(s): "
+		<< elapsed << "ms, checksum " << std::setprecision(17) << checksum << std::endl;
 }
 
 #endif
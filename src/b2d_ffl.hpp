@@ -168,6 +168,8 @@ namespace box2d
 	private:
 		int velocity_iterations_;
 		int position_iterations_;
+		// Set on world_ while box2d_threads is above one.
+		std::unique_ptr<b2ParallelExecutor> executor_;
 		b2World world_;
 
 		float world_x1_, world_y1_;
@@ -183,6 +185,10 @@ namespace box2d
 
 		destruction_listener destruction_listener_;
 	};
+
+	// Fills w with a static floor and piles of boxes side by side, each pile
+	// its own island, for measuring and checking world stepping.
+	void create_benchmark_scene(b2World& w, int piles, int boxes_per_pile);
 }
 
 #endif
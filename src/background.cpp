@@ -38,6 +38,7 @@
 #include "preferences.hpp"
 #include "screen_handling.hpp"
 #include "surface_palette.hpp"
+#include "unit_test.hpp"
 #include "variant.hpp"
 #include "variant_utils.hpp"
 
@@ -48,6 +49,36 @@ namespace
 	typedef std::map<cache_key, std::shared_ptr<Background>> bg_cache;
 	bg_cache cache;
 
+	PREF_BOOL(background_layer_cache, false, "Build the quads for background layers once and scroll them by moving the layer, instead of rebuilding them every frame. Layers that tile vertically or scroll vertically at different rates at their top and bottom are always rebuilt.");
+
+	//calls fn(x1, x2, xpos1, xpos2) for each piece of image a horizontally
+	//tiled layer draws across [x, x+screen_width), starting xpos of the way
+	//through an image. Each image is followed by pad pixels of nothing.
+	template<typename Fn>
+	void for_each_layer_tile(int x, int screen_width, float xpos, int tile_width, int pad, Fn fn)
+	{
+		while(screen_width > 0) {
+			const int texture_blit_width = static_cast<int>((1.0f - xpos) * tile_width);
+			const int blit_width = std::min(texture_blit_width, screen_width);
+
+			if(blit_width > 0) {
+				fn(x, x + blit_width, xpos, xpos + static_cast<float>(blit_width) / tile_width);
+			}
+
+			x += blit_width + pad;
+
+			xpos = 0.0f;
+			screen_width -= blit_width + pad;
+		}
+	}
+
+	//where a cached layer, whose quads start with a whole image at 0, is
+	//put so that the left of the area is xpos of the way through an image.
+	float cached_layer_origin(int area_x, float xpos, int tile_width)
+	{
+		return area_x - xpos * tile_width;
+	}
+
 #ifndef NO_EDITOR
 	std::set<std::string> listening_for_files, files_updated;
 
@@ -173,7 +204,7 @@ Background::Background(variant node, int palette)
 		bg->setTexture(bg->texture);
 
 		if(palette_ != -1) {
-			bg->texture->setPalette(palette_);
+			graphics::set_texture_palette(bg->texture, palette_);
 		}
 
 		if(palette_ != -1 && !colors_mapped) {
@@ -182,9 +213,16 @@ Background::Background(variant node, int palette)
 			colors_mapped = true;
 		}
 
+		bg->tile_upwards = layer_node["tile_upwards"].as_bool(false);
+		bg->tile_downwards = layer_node["tile_downwards"].as_bool(false);
+
+		//a layer is a single band which only moves as the view moves, unless
+		//it stretches vertically or is tiled to fill the screen.
+		bg->cached = g_background_layer_cache && bg->yscale_top == bg->yscale_bot && !bg->tile_upwards && !bg->tile_downwards;
+
 		using namespace KRE;
 		auto ab = DisplayDevice::createAttributeSet(false, false, false);
-		bg->attr_ = std::make_shared<Attribute<short_vertex_texcoord>>(AccessFreqHint::DYNAMIC, AccessTypeHint::DRAW);
+		bg->attr_ = std::make_shared<Attribute<short_vertex_texcoord>>(bg->cached ? AccessFreqHint::STATIC : AccessFreqHint::DYNAMIC, AccessTypeHint::DRAW);
 		bg->attr_->addAttributeDesc(AttributeDesc(AttrType::POSITION, 2, AttrFormat::SHORT, false, sizeof(short_vertex_texcoord), offsetof(short_vertex_texcoord, vertex)));
 		bg->attr_->addAttributeDesc(AttributeDesc(AttrType::TEXTURE, 2, AttrFormat::FLOAT, false, sizeof(short_vertex_texcoord), offsetof(short_vertex_texcoord, tc)));
 		ab->addAttribute(bg->attr_);
@@ -227,8 +265,6 @@ Background::Background(variant node, int palette)
 		bg->y2 = layer_node["y2"].as_int();
 
 		bg->foreground = layer_node["foreground"].as_bool(false);
-		bg->tile_upwards = layer_node["tile_upwards"].as_bool(false);
-		bg->tile_downwards = layer_node["tile_downwards"].as_bool(false);
 		layers_.emplace_back(bg);
 	}
 }
@@ -238,7 +274,7 @@ void Background::refreshPalette()
 	for(auto bg : layers_) {
 		if(bg->texture) {
 			if(palette_ != -1) {
-				bg->texture->setPalette(palette_);
+				graphics::set_texture_palette(bg->texture, palette_);
 			}
 		}
 	}
@@ -381,6 +417,18 @@ void Background::drawLayers(int x, int y, const rect& area_ref, const std::vecto
 
 	for(auto& bg : layers_) {
 		if(bg->foreground == false) {
+			//the layer's texture is shared by every palette of it, so select
+			//ours before drawing.
+			if(palette_ != -1) {
+				graphics::set_texture_palette(bg->texture, palette_);
+			}
+
+			//cached layers are drawn whole; the opaque areas only save on
+			//rebuilding quads.
+			if(bg->cached) {
+				drawLayer(x, y, area_ref, rotation, xdelta, ydelta, *bg, cycle);
+				continue;
+			}
 
 			for(auto& a : areas) {
 				drawLayer(x, y, a, rotation, xdelta, ydelta, *bg, cycle);
@@ -397,7 +445,15 @@ void Background::drawForeground(int xpos, int ypos, float rotation, int cycle) c
 	auto wnd = KRE::WindowManager::getMainWindow();
 	for(auto& bg : layers_) {
 		if(bg->foreground) {
+			if(palette_ != -1) {
+				graphics::set_texture_palette(bg->texture, palette_);
+			}
+
 			drawLayer(xpos, ypos, rect(xpos, ypos, graphics::GameScreen::get().getVirtualWidth(), graphics::GameScreen::get().getVirtualHeight()), rotation, 0.0f, 0.0f, *bg, cycle);
+			if(bg->cached) {
+				continue;
+			}
+
 			if(bg->attr_->size() > 0) {
 				wnd->render(bg.get());
 			}
@@ -444,6 +500,8 @@ void Background::drawLayer(int x, int y, const rect& area, float rotation, float
 	float v1 = bg.texture->getTextureCoordH(0, bg.y1);
 	float v2 = bg.texture->getTextureCoordH(0, bg.y2);
 
+	const int layer_y1 = y1;
+
 	const int screen_h = graphics::GameScreen::get().getHeight();
 
 	if(y1 < area.y()) {
@@ -483,6 +541,13 @@ void Background::drawLayer(int x, int y, const rect& area, float rotation, float
 		}
 	}
 
+	if(bg.cached) {
+		if(y2 > area.y() && layer_y1 < area.y2()) {
+			drawCachedLayer(area, layer_y1, getLayerXPos(x, area, bg, cycle), bg);
+		}
+		return;
+	}
+
 	if(y2 > area.y2()) {
 		v2 -= (static_cast<float>(y2 - area.y2())/static_cast<float>(y2 - y1))*(v2 - v1);
 		y2 = area.y2();
@@ -510,8 +575,32 @@ void Background::drawLayer(int x, int y, const rect& area, float rotation, float
 		v2 = v1 + diff;
 	}
 
-	int screen_width = area.w();
+	std::vector<KRE::short_vertex_texcoord> q;
+
+	//the image is as wide as getLayerXPos() takes it to be, so that it
+	//lines up with the cached version of the layer.
+	const int tile_width = static_cast<int>(bg.texture->surfaceWidth() * ScaleImage);
+	for_each_layer_tile(area.x(), area.w(), getLayerXPos(x, area, bg, cycle), tile_width, static_cast<int>(bg.xpad * ScaleImage), [&](int tx1, int tx2, float xpos1, float xpos2) {
+		const short x1 = tx1;
+		const short x2 = tx2;
+
+		const float u1 = bg.texture->getNormalisedTextureCoordW<float>(0, xpos1);
+		const float u2 = bg.texture->getNormalisedTextureCoordW<float>(0, xpos2);
+
+		q.emplace_back(glm::i16vec2(x1, y1), glm::vec2(u1, v1));
+		q.emplace_back(glm::i16vec2(x2, y1), glm::vec2(u2, v1));
+		q.emplace_back(glm::i16vec2(x2, y2), glm::vec2(u2, v2));
 
+		q.emplace_back(glm::i16vec2(x2, y2), glm::vec2(u2, v2));
+		q.emplace_back(glm::i16vec2(x1, y1), glm::vec2(u1, v1));
+		q.emplace_back(glm::i16vec2(x1, y2), glm::vec2(u1, v2));
+	});
+	bg.attr_->update(&q, bg.attr_->end());
+}
+
+float Background::getLayerXPos(int x, const rect& area, const Background::Layer& bg, int cycle) const
+{
+	const float ScaleImage = 2.0f;
 	const float xscale = static_cast<float>(bg.xscale) / 100.0f;
 	float xpos = (-static_cast<float>(bg.xspeed)*static_cast<float>(cycle)/1000.0f + int(static_cast<float>(x + bg.xoffset)*xscale))
 		/ static_cast<float>((bg.texture->surfaceWidth()+bg.xpad)*ScaleImage) + static_cast<float>(area.x() - x)/static_cast<float>((bg.texture->surfaceWidth()+bg.xpad)*ScaleImage);
@@ -525,39 +614,78 @@ void Background::drawLayer(int x, int y, const rect& area, float rotation, float
 	}
 
 	if(bg.xpad > 0) {
-		xpos *= 1.0f + static_cast<float>(bg.xpad) / bg.texture->actualWidth();
+		xpos *= 1.0f + static_cast<float>(bg.xpad) / bg.texture->surfaceWidth();
 	}
 
-	x = area.x();
-
-	std::vector<KRE::short_vertex_texcoord> q;
-
-	while(screen_width > 0) {
-		const int texture_blit_width = static_cast<int>((1.0f - xpos) * bg.texture->actualWidth() * ScaleImage);
-		const int blit_width = std::min(texture_blit_width, screen_width);
-
-		if(blit_width > 0) {
-			const float xpos2 = xpos + static_cast<float>(blit_width) / (bg.texture->actualWidth() * 2.0f);
-
-			const short x1 = x;
-			const short x2 = (x1 + blit_width);
-
-			const float u1 = bg.texture->getNormalisedTextureCoordW<float>(0, xpos);
-			const float u2 = bg.texture->getNormalisedTextureCoordW<float>(0, xpos2);
+	return xpos;
+}
 
-			q.emplace_back(glm::i16vec2(x1, y1), glm::vec2(u1, v1));
-			q.emplace_back(glm::i16vec2(x2, y1), glm::vec2(u2, v1));
-			q.emplace_back(glm::i16vec2(x2, y2), glm::vec2(u2, v2));
+void Background::drawCachedLayer(const rect& area, int y1, float xpos, const Background::Layer& bg) const
+{
+	const float ScaleImage = 2.0f;
+	const int tile_width = static_cast<int>(bg.texture->surfaceWidth() * ScaleImage);
+	const int period = static_cast<int>(tile_width + bg.xpad * ScaleImage);
+	if(tile_width <= 0 || period <= 0) {
+		return;
+	}
 
-			q.emplace_back(glm::i16vec2(x2, y2), glm::vec2(u2, v2));
-			q.emplace_back(glm::i16vec2(x1, y1), glm::vec2(u1, v1));
-			q.emplace_back(glm::i16vec2(x1, y2), glm::vec2(u1, v2));
+	//the quads only depend on the width of the screen, covering it with one
+	//spare copy of the image, since the layer is moved by less than that.
+	if(bg.cached_width != area.w()) {
+		const short height = static_cast<short>((bg.y2 - bg.y1) * ScaleImage);
+		const float u1 = bg.texture->getNormalisedTextureCoordW<float>(0, 0.0f);
+		const float u2 = bg.texture->getNormalisedTextureCoordW<float>(0, 1.0f);
+		const float v1 = bg.texture->getTextureCoordH(0, bg.y1);
+		const float v2 = bg.texture->getTextureCoordH(0, bg.y2);
+
+		std::vector<KRE::short_vertex_texcoord> q;
+		for(int x = 0; x < area.w() + period; x += period) {
+			const short x1 = static_cast<short>(x);
+			const short x2 = static_cast<short>(x + tile_width);
+
+			q.emplace_back(glm::i16vec2(x1, 0), glm::vec2(u1, v1));
+			q.emplace_back(glm::i16vec2(x2, 0), glm::vec2(u2, v1));
+			q.emplace_back(glm::i16vec2(x2, height), glm::vec2(u2, v2));
+
+			q.emplace_back(glm::i16vec2(x2, height), glm::vec2(u2, v2));
+			q.emplace_back(glm::i16vec2(x1, 0), glm::vec2(u1, v1));
+			q.emplace_back(glm::i16vec2(x1, height), glm::vec2(u1, v2));
 		}
 
-		x += static_cast<int>(blit_width + bg.xpad * ScaleImage);
+		bg.attr_->clear();
+		bg.attr_->update(&q, bg.attr_->end());
+		bg.cached_width = area.w();
+	}
 
-		xpos = 0.0f;
-		screen_width -= static_cast<int>(blit_width + bg.xpad * ScaleImage);
+	//xpos is where in the image the left of the area falls, so the first
+	//copy starts that far to the left of it.
+	Layer& layer = const_cast<Layer&>(bg);
+	layer.setPosition(cached_layer_origin(area.x(), xpos, tile_width), static_cast<float>(y1));
+	KRE::WindowManager::getMainWindow()->render(&layer);
+}
+
+UNIT_TEST(background_cached_layer_matches_uncached)
+{
+	const int tile_width = 300, pad = 70, period = tile_width + pad;
+	const int area_x = 20, area_w = 1000;
+
+	//xpos runs past 1 when the area starts in the padding.
+	for(float xpos : { 0.0f, 0.25f, 0.5f, 0.99f, 1.0f, 1.1f, 1.2f }) {
+		const float origin = cached_layer_origin(area_x, xpos, tile_width);
+
+		//each piece drawn uncached must be where the cached quads put
+		//that part of an image.
+		int npieces = 0;
+		for_each_layer_tile(area_x, area_w, xpos, tile_width, pad, [&](int x1, int x2, float xpos1, float xpos2) {
+			const float image_x = x1 - xpos1 * tile_width;
+			const float copy = std::floor((image_x - origin) / period + 0.5f);
+			const float cached_x = origin + copy * period;
+
+			CHECK_LE(std::abs(image_x - cached_x), 1.0f);
+			CHECK_LE(std::abs(x2 - (cached_x + xpos2 * tile_width)), 1.0f);
+			++npieces;
+		});
+
+		CHECK_GE(npieces, area_w / period);
 	}
-	bg.attr_->update(&q, bg.attr_->end());
 }
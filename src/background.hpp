@@ -68,7 +68,7 @@ private:
 	point offset_;
 
 	struct Layer : public KRE::SceneObject {
-		Layer() : KRE::SceneObject("Background::Layer"), xscale(0), yscale_top(0), yscale_bot(0), xspeed(0), xpad(0), scale(0), xoffset(0), yoffset(0), y1(0), y2(0), foreground(false), blend(false), notile(false), tile_upwards(false), tile_downwards(false) {}
+		Layer() : KRE::SceneObject("Background::Layer"), xscale(0), yscale_top(0), yscale_bot(0), xspeed(0), xpad(0), scale(0), xoffset(0), yoffset(0), y1(0), y2(0), foreground(false), blend(false), notile(false), tile_upwards(false), tile_downwards(false), cached(false), cached_width(-1) {}
 		std::string image;
 		std::string image_formula;
 		mutable KRE::TexturePtr texture;
@@ -98,12 +98,23 @@ private:
 
 		bool tile_upwards, tile_downwards;
 
+		//if true the layer's quads are built once, for a screen of
+		//cached_width, and scrolled by moving the layer rather than being
+		//rebuilt every frame.
+		bool cached;
+		mutable int cached_width;
+
 		std::shared_ptr<KRE::Attribute<KRE::short_vertex_texcoord>> attr_;
 		mutable RectRenderable above_rect;
 		mutable RectRenderable below_rect;
 	};
 
 	void drawLayer(int x, int y, const rect& area, float rotation, float xdelta, float ydelta, const Layer& bg, int cycle) const;
+	void drawCachedLayer(const rect& area, int y1, float xpos, const Layer& bg) const;
+
+	//how far into the layer's image, as a fraction of its width, the left
+	//edge of the area is.
+	float getLayerXPos(int x, const rect& area, const Layer& bg, int cycle) const;
 
 	std::vector<std::shared_ptr<Layer>> layers_;
 	int palette_;
@@ -135,6 +135,7 @@ namespace gui
 	void BarWidget::setRotation(float rotate)
 	{
 		rotate_ = rotate;
+		invalidate();
 	}
 
 BEGIN_DEFINE_CALLABLE(BarWidget, Widget)
@@ -191,11 +192,13 @@ BEGIN_DEFINE_CALLABLE(BarWidget, Widget)
 		return variant(decimal(0.0));
 	DEFINE_SET_FIELD
 		obj.animation_current_position_ = value.as_float();
+		obj.invalidate();
 END_DEFINE_CALLABLE(BarWidget)
 
 	void BarWidget::handleProcess()
 	{
 		if(animating_) {
+			invalidate();
 			int end_point_unscaled = static_cast<int>(animation_end_point_unscaled_ * segment_length_);
 			if(animation_end_point_unscaled_ > 0) {
 				// gaining segments
@@ -114,5 +114,6 @@ namespace gui
 			return variant(obj.child_.get());
 		DEFINE_SET_FIELD
 			obj.child_ = widget_factory::create(value, obj.getEnvironment());
+			obj.invalidate();
 	END_DEFINE_CALLABLE(BorderWidget)
 }
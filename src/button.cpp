@@ -222,6 +222,7 @@ variant Button::getColorScheme()
 		if(width() == 0 && height() == 0) {
 			setDim(label_->width()+hpadding_*2,label_->height()+vpadding_*2);
 		}
+		invalidate();
 	}
 
 	void Button::handleDraw() const
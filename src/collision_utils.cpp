@@ -23,6 +23,7 @@
 
 #include "asserts.hpp"
 #include "collision_utils.hpp"
+#include "formula_profiler.hpp"
 #include "frame.hpp"
 #include "geometry.hpp"
 #include "level.hpp"
@@ -189,6 +190,12 @@ bool entity_collides(Level& lvl, const Entity& e, MOVE_DIRECTION dir, CollisionI
 		return false;
 	}
 
+	//this is called very often, so only time it when profiling.
+	formula_profiler::Instrument instrumentation;
+	if(formula_profiler::profiler_on) {
+		instrumentation.init("COLLISION", variant());
+	}
+
 	if(!e.allowLevelCollisions() && entity_collides_with_level(lvl, e, dir, info)) {
 		return true;
 	}
@@ -351,7 +358,7 @@ bool entity_collides_with_level(const Level& lvl, const Entity& e, MOVE_DIRECTIO
 	}
 
 	for(const ConstSolidMapPtr& m : s->solid()) {
-		if(lvl.solid(e, m->dir(dir), info ? &info->surf_info : nullptr)) {
+		if(lvl.solid(e, *m, dir, info ? &info->surf_info : nullptr)) {
 			if(info) {
 				info->readSurfInfo();
 			}
@@ -370,16 +377,9 @@ int entity_collides_with_level_count(const Level& lvl, const Entity& e, MOVE_DIR
 		return 0;
 	}
 
-	const Frame& f = e.getCurrentFrame();
 	int count = 0;
 	for(const ConstSolidMapPtr& m : s->solid()) {
-		const std::vector<point>& points = m->dir(dir);
-		for(const point& p : points) {
-			const int xpos = e.isFacingRight() ? e.x() + p.x : e.x() + f.width() - 1 - p.x;
-			if(lvl.solid(xpos, e.y() + p.y)) {
-				++count;
-			}
-		}
+		count += lvl.count_solid(e, *m, dir);
 	}
 
 	return count;
@@ -754,6 +754,8 @@ int get_collision_event_id(const std::string& area)
 
 void detect_user_collisions(Level& lvl)
 {
+	formula_profiler::Instrument instrumentation("USER_COLLISIONS");
+
 	std::vector<EntityPtr> chars;
 	chars.reserve(lvl.get_active_chars().size());
 	for(const EntityPtr& a : lvl.get_active_chars()) {
@@ -658,13 +658,16 @@ namespace gui
 		return obj.primary_.write();
 	DEFINE_SET_FIELD_TYPE("[int]|string")
 		obj.primary_ = KRE::Color(value);
+		obj.invalidate();
 	DEFINE_FIELD(color, "[int,int,int,int]")
 		return obj.primary_.write();
 	DEFINE_SET_FIELD_TYPE("[int]|string")
 		obj.primary_ = KRE::Color(value);
+		obj.invalidate();
 	DEFINE_FIELD(secondary, "[int,int,int,int]")
 		return obj.secondary_.write();
 	DEFINE_SET_FIELD_TYPE("[int]|string")
 		obj.secondary_ = KRE::Color(value);
+		obj.invalidate();
 	END_DEFINE_CALLABLE(ColorPicker)
 }
@@ -68,6 +68,7 @@
 #include "object_events.hpp"
 #include "playable_custom_object.hpp"
 #include "preferences.hpp"
+#include "random.hpp"
 #include "profile_timer.hpp"
 #include "rectangle_rotator.hpp"
 #include "screen_handling.hpp"
@@ -202,6 +203,8 @@ CustomObject::CustomObject(variant node)
 	editor_only_(node["editor_only"].as_bool(false)),
 	collides_with_level_(node["collides_with_level"].as_bool(type_->collidesWithLevel())),
 	currently_handling_die_event_(0),
+	parallel_process_cycle_(-1),
+	use_parallel_process_commands_(false),
 	use_absolute_screen_coordinates_(node["use_absolute_screen_coordinates"].as_bool(type_->useAbsoluteScreenCoordinates())),
 	paused_(false),
 	shader_flags_(0),
@@ -587,6 +590,8 @@ CustomObject::CustomObject(const std::string& type, int x, int y, bool face_righ
 	collides_with_level_(type_->collidesWithLevel()),
 	min_difficulty_(-1), max_difficulty_(-1),
 	currently_handling_die_event_(0),
+	parallel_process_cycle_(-1),
+	use_parallel_process_commands_(false),
 	use_absolute_screen_coordinates_(type_->useAbsoluteScreenCoordinates()),
 	paused_(false),
 	shader_flags_(0),
@@ -737,6 +742,8 @@ CustomObject::CustomObject(const CustomObject& o)
 	editor_only_(o.editor_only_),
 	collides_with_level_(o.collides_with_level_),
 	currently_handling_die_event_(0),
+	parallel_process_cycle_(-1),
+	use_parallel_process_commands_(false),
 	//do NOT copy widgets since they do not support deep copying
 	//and re-seating references is difficult.
 	//widgets_(o.widgets_),
@@ -2558,6 +2565,7 @@ void CustomObject::process(Level& lvl)
 		eff->process();
 	}
 	if(particles_) {
+		formula_profiler::Instrument instrumentation("PARTICLES");
 		particles_->process();
 	}
 
@@ -2575,7 +2583,15 @@ void CustomObject::process(Level& lvl)
 
 void CustomObject::staticProcess(Level& lvl)
 {
+	//objects processed earlier this cycle may have changed our handlers
+	//since the prepared commands were evaluated, in which case they're
+	//stale and the handler is evaluated again. Either way the commands go
+	//through handleEvent() so errors are dealt with as usual.
+	use_parallel_process_commands_ = parallel_process_cycle_ == lvl.cycle() && canProcessInParallel();
 	handleEvent(OBJECT_EVENT_PROCESS);
+	use_parallel_process_commands_ = false;
+	parallel_process_cycle_ = -1;
+	parallel_process_commands_ = variant();
 	handleEvent(frame_->processEventId());
 
 	if(type_->timerFrequency() > 0 && (cycle_%type_->timerFrequency()) == 0) {
@@ -2583,12 +2599,15 @@ void CustomObject::staticProcess(Level& lvl)
 		handleEvent(OBJECT_EVENT_TIMER);
 	}
 
-	for(std::map<std::string, ParticleSystemPtr>::iterator i = particle_systems_.begin(); i != particle_systems_.end(); ) {
-		i->second->process(*this);
-		if(i->second->isDestroyed()) {
-			particle_systems_.erase(i++);
-		} else {
-			++i;
+	if(particle_systems_.empty() == false) {
+		formula_profiler::Instrument instrumentation("PARTICLES");
+		for(std::map<std::string, ParticleSystemPtr>::iterator i = particle_systems_.begin(); i != particle_systems_.end(); ) {
+			i->second->process(*this);
+			if(i->second->isDestroyed()) {
+				particle_systems_.erase(i++);
+			} else {
+				++i;
+			}
 		}
 	}
 
@@ -5579,7 +5598,13 @@ bool CustomObject::handleEventInternal(int event, const FormulaCallable* context
 		
 		try {
 			formula_profiler::Instrument instrumentation("FFL", handler);
-			var = handler->execute(*this);
+			if(event == OBJECT_EVENT_PROCESS && use_parallel_process_commands_) {
+				//already evaluated by prepareParallelProcess().
+				use_parallel_process_commands_ = false;
+				var = parallel_process_commands_;
+			} else {
+				var = handler->execute(*this);
+			}
 		} catch(validation_failure_exception& e) {
 #ifndef DISABLE_FORMULA_PROFILER
 			event_call_stack.pop_back();
@@ -5632,6 +5657,49 @@ void CustomObject::resolveDelayedEvents()
 	delayed_commands_.clear();
 }
 
+bool CustomObject::canProcessInParallel() const
+{
+	if(!type_->isParallelProcess() || paused_ || hitpoints_ <= 0) {
+		return false;
+	}
+
+	//only a lone process handler can be evaluated ahead of time. With both
+	//an instance and a type handler the second must see the first's
+	//commands, and may not run at all, and an 'any' handler must run
+	//before either; those go through handleEvent() as usual.
+	const bool instance_handler = size_t(OBJECT_EVENT_PROCESS) < event_handlers_.size() && event_handlers_[OBJECT_EVENT_PROCESS];
+	const bool type_handler = type_->getEventHandler(OBJECT_EVENT_PROCESS).get() != nullptr;
+	if(instance_handler == type_handler) {
+		return false;
+	}
+
+	const bool any_handler = (size_t(OBJECT_EVENT_ANY) < event_handlers_.size() && event_handlers_[OBJECT_EVENT_ANY]) || type_->getEventHandler(OBJECT_EVENT_ANY);
+	return !any_handler;
+}
+
+void CustomObject::prepareParallelProcess(int cycle, unsigned int seed)
+{
+	//Only evaluate the handler here. Nothing that touches shared state,
+	//such as the profiler's event stack or executing commands, may happen
+	//since this can run on a worker thread alongside other objects.
+	parallel_process_cycle_ = -1;
+	parallel_process_commands_ = variant();
+
+	rng::LocalSeedScope seed_scope(seed);
+
+	//canProcessInParallel() made sure there is exactly one handler.
+	const game_logic::Formula* handler = size_t(OBJECT_EVENT_PROCESS) < event_handlers_.size() && event_handlers_[OBJECT_EVENT_PROCESS] ? event_handlers_[OBJECT_EVENT_PROCESS].get() : type_->getEventHandler(OBJECT_EVENT_PROCESS).get();
+
+	try {
+		parallel_process_commands_ = handler->execute(*this);
+		parallel_process_cycle_ = cycle;
+	} catch(...) {
+		//leave it to handleEvent() to evaluate the handler again during
+		//the object's turn, where errors are reported as usual.
+		parallel_process_commands_ = variant();
+	}
+}
+
 bool CustomObject::executeCommandOrFn(const variant& var)
 {
 	if(var.is_function()) {
@@ -215,6 +215,9 @@ public:
 
 	virtual void resolveDelayedEvents() override;
 
+	virtual bool canProcessInParallel() const override;
+	virtual void prepareParallelProcess(int cycle, unsigned int seed) override;
+
 	virtual bool serializable() const override;
 
 	void setSoundVolume(float volume, float nseconds=0.0) override;
@@ -559,6 +562,14 @@ private:
 
 	int currently_handling_die_event_;
 
+	//the process event's commands evaluated by prepareParallelProcess() for
+	//the given cycle. staticProcess() sets use_parallel_process_commands_
+	//when they're still valid, and handleEventInternal() then executes them
+	//in place of evaluating the handler.
+	variant parallel_process_commands_;
+	int parallel_process_cycle_;
+	bool use_parallel_process_commands_;
+
 	typedef std::set<gui::WidgetPtr, gui::WidgetSortZOrder> widget_list;
 	widget_list widgets_;
 
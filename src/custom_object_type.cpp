@@ -1393,6 +1393,7 @@ CustomObjectType::CustomObjectType(const std::string& id, variant node, const Cu
 	hidden_in_game_(node["hidden_in_game"].as_bool(false)),
 	auto_anchor_(node["auto_anchor"].as_bool(g_auto_anchor_objects)),
 	stateless_(node["stateless"].as_bool(false)),
+	parallel_process_(node["parallel_process"].as_bool(false)),
 	platform_offsets_(node["platform_offsets"].as_list_int_optional()),
 	slot_properties_base_(-1), 
 	use_absolute_screen_coordinates_(node["use_absolute_screen_coordinates"].as_bool(false)),
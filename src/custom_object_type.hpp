@@ -279,6 +279,7 @@ public:
 	bool editorForceStanding() const { return editor_force_standing_; }
 	bool isHiddenInGame() const { return hidden_in_game_; }
 	bool stateless() const { return stateless_; }
+	bool isParallelProcess() const { return parallel_process_; }
 
 	static void ReloadFilePaths();
 
@@ -432,6 +433,11 @@ private:
 	//later will not deep copy the object, just have another reference to it.
 	bool stateless_;
 
+	//the process event of the object only reads the object itself and
+	//level data that doesn't change during a cycle, so it may be
+	//evaluated ahead of the object's turn, on a worker thread.
+	bool parallel_process_;
+
 	std::vector<int> platform_offsets_;
 
 #ifdef USE_BOX2D
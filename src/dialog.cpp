@@ -303,6 +303,7 @@ namespace gui
 			tab_widgets_.erase(tw_it);
 		}
 		recalculateDimensions();
+		invalidate();
 	}
 
 	WidgetPtr Dialog::clone() const
@@ -321,6 +322,7 @@ namespace gui
 		widgets_.clear(); 
 		tab_widgets_.clear();
 		recalculateDimensions();
+		invalidate();
 	}
 
 	void Dialog::replaceWidget(WidgetPtr w_old, WidgetPtr w_new)
@@ -665,6 +667,7 @@ namespace gui
 			return variant(obj.bg_alpha_);
 		DEFINE_SET_FIELD
 			obj.bg_alpha_ = value.as_float();
+			obj.invalidate();
 	END_DEFINE_CALLABLE(Dialog)
 
 }
@@ -29,6 +29,7 @@
 #include "geometry.hpp"
 #include "WindowManager.hpp"
 
+#include "array_callable.hpp"
 #include "asserts.hpp"
 #include "draw_primitive.hpp"
 #include "level.hpp"
@@ -373,7 +374,7 @@ namespace graphics
 					result.push_back(variant(&pos));
 				}
 				return variant(&result);
-			DEFINE_SET_FIELD
+			DEFINE_SET_FIELD_TYPE("[[int|decimal,int|decimal]]|builtin TypedArrayCallable")
 				obj.setPoints(value);
 			DEFINE_FIELD(color, KRE::Color::getDefineFieldType())
 				return obj.color_.write();
@@ -410,6 +411,16 @@ namespace graphics
 
 		void ArrowPrimitive::setPoints(const variant& points)
 		{
+			if(points.is_callable()) {
+				const game_logic::TypedArrayCallable* a = points.try_convert<game_logic::TypedArrayCallable>();
+				ASSERT_LOG(a != nullptr && a->elementType() == game_logic::TypedArrayCallable::ElementType::VEC2, "arrow points is not a vec2 array: " << points.debug_location());
+
+				varray_.clear();
+				const glm::vec2* begin = reinterpret_cast<const glm::vec2*>(a->floats());
+				points_.assign(begin, begin + a->size());
+				return;
+			}
+
 			ASSERT_LOG(points.is_list(), "arrow points is not a list: " << points.debug_location());
 
 			varray_.clear();
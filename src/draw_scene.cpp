@@ -28,6 +28,7 @@
 #include <boost/lexical_cast.hpp>
 
 #include "Canvas.hpp"
+#include "DisplayDevice.hpp"
 #include "Font.hpp"
 #include "ModelMatrixScope.hpp"
 #include "RenderTarget.hpp"
@@ -52,6 +53,7 @@
 #include "speech_dialog.hpp"
 
 #include "tooltip.hpp"
+#include "widget.hpp"
 
 namespace 
 {
@@ -648,6 +650,16 @@ void draw_fps(const Level& lvl, const performance_data& data)
 
 	}
 
+	std::ostringstream widgets;
+	const gui::RetainedDrawStats widget_stats = gui::get_retained_draw_stats(true);
+	if(widget_stats.hits + widget_stats.misses > 0) {
+		widgets << "retained widgets: " << widget_stats.hits << " cache hits; " << widget_stats.misses << " re-renders";
+	}
+
+	std::ostringstream textures;
+	const KRE::TextureMemoryStats tex_stats = KRE::DisplayDevice::getCurrent()->getTextureMemoryStats();
+	textures << "textures: " << tex_stats.resident_textures << " (" << (tex_stats.resident_bytes/1024) << "KB); " << tex_stats.pending_uploads << " uploading (" << (tex_stats.pending_bytes/1024) << "KB); " << (tex_stats.uploaded_bytes/1024) << "KB uploaded last frame";
+
 	if(module::get_default_font() == "bitmap") {
 		ConstGraphicalFontPtr font(GraphicalFont::get("door_label"));
 		if(!font) {
@@ -658,6 +670,10 @@ void draw_fps(const Level& lvl, const performance_data& data)
 		if(!nets.str().empty()) {
 			area = font->draw(10, area.y2() + 5, nets.str());
 		}
+		if(!widgets.str().empty()) {
+			area = font->draw(10, area.y2() + 5, widgets.str());
+		}
+		area = font->draw(10, area.y2() + 5, textures.str());
 
 		if(!data.profiling_info.empty()) {
 			font->draw(10, area.y2() + 5, data.profiling_info);
@@ -674,6 +690,14 @@ void draw_fps(const Level& lvl, const performance_data& data)
 			canvas->blitTexture(t, 0, 10, y);
 			y += t->surfaceHeight() + 5;
 		}
+		if(!widgets.str().empty()) {
+			t = KRE::Font::getInstance()->renderText(widgets.str(), KRE::Color::colorWhite(), font_size, false, module::get_default_font());
+			canvas->blitTexture(t, 0, 10, y);
+			y += t->surfaceHeight() + 5;
+		}
+		t = KRE::Font::getInstance()->renderText(textures.str(), KRE::Color::colorWhite(), font_size, false, module::get_default_font());
+		canvas->blitTexture(t, 0, 10, y);
+		y += t->surfaceHeight() + 5;
 		if(!data.profiling_info.empty()) {
 			t = KRE::Font::getInstance()->renderText(data.profiling_info, KRE::Color::colorWhite(), font_size, false, module::get_default_font()); 
 			canvas->blitTexture(t, 0, 10, y);
@@ -534,6 +534,7 @@ namespace gui
 			return variant(obj.current_selection_);
 		DEFINE_SET_FIELD
 			obj.current_selection_ = value.as_int();
+			obj.invalidate();
 
 		DEFINE_FIELD(selected_item, "string|null")
 			if(obj.current_selection_ < 0 || static_cast<size_t>(obj.current_selection_) > obj.list_.size()) {
@@ -568,6 +569,7 @@ namespace gui
 			} else {
 				ASSERT_LOG(false, "Unrecognised type: " << s);
 			}
+			obj.invalidate();
 	END_DEFINE_CALLABLE(DropdownWidget)
 }
 
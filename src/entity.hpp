@@ -230,6 +230,11 @@ public:
 	virtual bool handleEventDelay(int id, const FormulaCallable* context=nullptr) { return false; }
 	virtual void resolveDelayedEvents() = 0;
 
+	//objects which may evaluate their process event ahead of their turn,
+	//on a worker thread. See Level::prepare_parallel_processing().
+	virtual bool canProcessInParallel() const { return false; }
+	virtual void prepareParallelProcess(int cycle, unsigned int seed) {}
+
 	//function which returns true if this object can be 'interacted' with.
 	//i.e. if the player ovelaps with the object and presses up if they will
 	//talk to or enter the object.
@@ -22,6 +22,7 @@
 */
 
 #include <iostream>
+#include <set>
 #include <sstream>
 #include <fstream>
 #include <algorithm>
@@ -52,6 +53,7 @@
 #include "profile_timer.hpp"
 #include "thread.hpp"
 #include "unit_test.hpp"
+#include "vfs.hpp"
 
 #ifdef __linux__
 #include <sys/inotify.h>
@@ -84,25 +86,32 @@ namespace sys
 		std::vector<std::string>* dirs)
 	{
 		path p(dir);
-		if(!is_directory(p) && !is_other(p)) {
-			return;
-		}
-		for(directory_iterator it = directory_iterator(p); it != directory_iterator(); ++it) {
-			if(is_directory(it->path()) || is_other(it->path())) {
-				if(dirs != nullptr) {
-					dirs->push_back(it->path().filename().generic_string());
-				}
-			} else {
-				if(files != nullptr) {
-					files->push_back(it->path().filename().generic_string());
+		if(is_directory(p) || is_other(p)) {
+			for(directory_iterator it = directory_iterator(p); it != directory_iterator(); ++it) {
+				if(is_directory(it->path()) || is_other(it->path())) {
+					if(dirs != nullptr) {
+						dirs->push_back(it->path().filename().generic_string());
+					}
+				} else {
+					if(files != nullptr) {
+						files->push_back(it->path().filename().generic_string());
+					}
 				}
 			}
 		}
-		if(files != nullptr)
+
+		//files in a mounted pack may also be in the directory on disk.
+		vfs::get_mounted_files_in_dir(dir, files, dirs);
+
+		if(files != nullptr) {
 			std::sort(files->begin(), files->end());
+			files->erase(std::unique(files->begin(), files->end()), files->end());
+		}
 
-		if (dirs != nullptr)
+		if (dirs != nullptr) {
 			std::sort(dirs->begin(), dirs->end());
+			dirs->erase(std::unique(dirs->begin(), dirs->end()), dirs->end());
+		}
 	}
 
 
@@ -111,6 +120,12 @@ namespace sys
 									const std::string& prefix)
 	{
 		ASSERT_LOG(file_map != nullptr, "get_unique_filenames_under_dir() passed a nullptr file_map");
+
+		//packed files go in first so any loose copy of them wins.
+		vfs::get_mounted_files_under_dir(dir, [file_map, &prefix](const std::string& fname, const std::string& full_path) {
+			(*file_map)[prefix + fname] = full_path;
+		});
+
 		path p(dir);
 		if(!is_directory(p)) {
 			return;
@@ -127,15 +142,22 @@ namespace sys
 									const std::string& prefix)
 	{
 		ASSERT_LOG(file_map != nullptr, "get_unique_filenames_under_dir() passed a nullptr file_map");
+		std::set<std::string> loose_files;
 		path p(dir);
-		if(!is_directory(p)) {
-			return;
-		}
-		for(recursive_directory_iterator it = recursive_directory_iterator(p); it != recursive_directory_iterator(); ++it) {
-			if(!is_directory(it->path())) {
-				file_map->insert(std::pair<std::string,std::string>(prefix + it->path().filename().generic_string(), it->path().generic_string()));
+		if(is_directory(p)) {
+			for(recursive_directory_iterator it = recursive_directory_iterator(p); it != recursive_directory_iterator(); ++it) {
+				if(!is_directory(it->path())) {
+					file_map->insert(std::pair<std::string,std::string>(prefix + it->path().filename().generic_string(), it->path().generic_string()));
+					loose_files.insert(it->path().generic_string());
+				}
 			}
 		}
+
+		vfs::get_mounted_files_under_dir(dir, [file_map, &prefix, &loose_files](const std::string& fname, const std::string& full_path) {
+			if(loose_files.count(full_path) == 0) {
+				file_map->insert(std::pair<std::string,std::string>(prefix + fname, full_path));
+			}
+		});
 	}
 
 	std::string get_dir(const std::string& dir)
@@ -151,6 +173,12 @@ namespace sys
 	std::string read_file(const std::string& fname)
 	{
 		std::ifstream file(fname.c_str(), std::ios_base::binary);
+		if(!file) {
+			std::string contents;
+			vfs::read_mounted_file(fname, &contents);
+			return contents;
+		}
+
 		std::stringstream ss;
 		ss << file.rdbuf();
 		return ss.str();
@@ -168,6 +196,9 @@ namespace sys
 		// Write the file.
 		std::ofstream file(fname.c_str(), std::ios_base::binary);
 		file << data;
+		file.close();
+
+		vfs::note_file_written(fname);
 	}
 
 	bool dir_exists(const std::string& fname)
@@ -179,7 +210,7 @@ namespace sys
 	bool file_exists(const std::string& fname)
 	{
 		path p(fname);
-		return exists(p) && is_regular_file(p);
+		return (exists(p) && is_regular_file(p)) || vfs::mounted_file_exists(fname);
 	}
 
 	std::string find_file(const std::string& fname)
@@ -199,31 +230,46 @@ namespace sys
 	long long file_mod_time(const std::string& fname)
 	{
 		path p(fname);
-		if(is_regular_file(p)) {
+		if(is_regular_file(p) || is_directory(p)) {
 			return static_cast<int64_t>(last_write_time(p));
 		} else {
 			return 0;
 		}
 	}
 
+	long long file_size(const std::string& fname)
+	{
+		path p(fname);
+		if(is_regular_file(p)) {
+			return static_cast<int64_t>(boost::filesystem::file_size(p));
+		} else {
+			return 0;
+		}
+	}
+
 	void move_file(const std::string& from, const std::string& to)
 	{
-		return rename(path(from), path(to));
+		rename(path(from), path(to));
+		vfs::invalidate_path(from);
+		vfs::note_file_written(to);
 	}
 
 	void remove_file(const std::string& fname)
 	{
 		remove(path(fname));
+		vfs::invalidate_path(fname);
 	}
 
 	void copy_file(const std::string& from, const std::string& to)
 	{
 		copy_file(path(from), path(to), copy_option::fail_if_exists);
+		vfs::note_file_written(to);
 	}
 
 	void rmdir_recursive(const std::string& fpath)
 	{
 		remove_all(path(fpath));
+		vfs::invalidate_path(fpath);
 	}
 
 	bool is_path_absolute(const std::string& fpath)
@@ -361,7 +407,9 @@ namespace sys
 
 #ifdef __linux__
 			for(int n = 0; n != new_files.size(); ++n) {
-				const int fd = inotify_add_watch(inotify_fd, new_files[n].c_str(), IN_CLOSE_WRITE);
+				//the create, delete and move events only happen on directories,
+				//for files in them.
+				const int fd = inotify_add_watch(inotify_fd, new_files[n].c_str(), IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO);
 				if(fd > 0) {
 					fd_to_path[fd] = new_files[n];
 				} else {
@@ -374,9 +422,17 @@ namespace sys
 			timeval tv = {1, 0};
 			const int select_res = select(inotify_fd+1, &read_set, nullptr, nullptr, &tv);
 			if(select_res > 0) {
-				inotify_event ev;
-				const int nbytes = read(inotify_fd, &ev, sizeof(ev));
-				if(nbytes == sizeof(ev)) {
+				//events on watched directories carry the name of the file
+				//in the directory, so they vary in size.
+				char buf[4096] __attribute__((aligned(__alignof__(inotify_event))));
+				const int nbytes = read(inotify_fd, buf, sizeof(buf));
+				if(nbytes < static_cast<int>(sizeof(inotify_event))) {
+					LOG_ERROR("READ FAILURE IN FILE NOTIFY");
+				}
+
+				for(int offset = 0; offset + static_cast<int>(sizeof(inotify_event)) <= nbytes; ) {
+					const inotify_event& ev = *reinterpret_cast<const inotify_event*>(buf + offset);
+					offset += sizeof(inotify_event) + ev.len;
 
 					const std::string path = fd_to_path[ev.wd];
 					LOG_INFO("LINUX FILE MOD: " << path);
@@ -392,8 +448,6 @@ namespace sys
 
 					threading::lock lck(get_mod_queue_mutex());
 					file_mod_notification_queue.insert(file_mod_notification_queue.end(), handlers.begin(), handlers.end());
-				} else {
-					LOG_ERROR("READ FAILURE IN FILE NOTIFY");
 				}
 			}
 
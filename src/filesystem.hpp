@@ -66,6 +66,7 @@ namespace sys
 	std::string find_file(const std::string& name);
 
 	long long file_mod_time(const std::string& fname);
+	long long file_size(const std::string& fname);
 
 	void move_file(const std::string& from, const std::string& to);
 	void remove_file(const std::string& fname);
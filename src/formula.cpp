@@ -72,7 +72,7 @@ namespace
 	PREF_BOOL(ffl_vm_opt_replace_where, true, "Try to replace trivial where calls.");
 
 	//the last formula that was executed; used for outputting debugging info.
-	const game_logic::Formula* last_executed_formula;
+	THREAD_LOCAL const game_logic::Formula* last_executed_formula;
 
 	bool g_verbatim_string_expressions = false;
 
@@ -1356,9 +1356,13 @@ namespace {
 
 		namespace 
 		{
-			int function_recursion_depth = 0;
+			THREAD_LOCAL int function_recursion_depth;
 
+			//the full expression stack isn't kept per-thread, so it can only
+			//be used when FFL runs on a single thread.
+			#ifndef MT_FFL
 			#define DEBUG_FULL_EXPRESSION_STACKS
+			#endif
 			#ifdef DEBUG_FULL_EXPRESSION_STACKS
 			std::vector<ExpressionPtr> g_expr_stack;
 			#endif // DEBUG_FULL_EXPRESSION_STACKS
@@ -5308,7 +5312,7 @@ variant Formula::execute(const FormulaCallable& variables) const
 	//
 	//Naturally if we throw an exception we DON'T want to restore the
 	//last_executed_formula since we want to report the error.
-	static int execution_stack = 0;
+	static THREAD_LOCAL int execution_stack;
 	const Formula* prev_executed = execution_stack ? last_executed_formula : nullptr;
 	last_executed_formula = this;
 	try {
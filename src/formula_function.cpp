@@ -46,6 +46,7 @@
 #include <iostream>
 #include <iomanip>
 #include <stack>
+#include <unordered_map>
 #include <cmath>
 #if defined(_MSC_VER)
 #include <boost/math/special_functions/round.hpp>
@@ -91,6 +92,7 @@
 #include "random.hpp"
 #include "rectangle_rotator.hpp"
 #include "string_utils.hpp"
+#include "thread_pool.hpp"
 #include "unit_test.hpp"
 #include "variant_callable.hpp"
 #include "controls.hpp"
@@ -403,21 +405,176 @@ namespace game_logic
 			return *caches;
 		}
 
+		//hashes a variant consistently with variant::operator==, so ints and
+		//decimals of equal value hash the same and objects hash by identity.
+		struct variant_hash
+		{
+			size_t operator()(const variant& v) const {
+				switch(v.type()) {
+				case variant::VARIANT_TYPE_NULL:
+					return 0;
+				case variant::VARIANT_TYPE_BOOL:
+					return v.as_bool() ? 1 : 2;
+				case variant::VARIANT_TYPE_INT:
+				case variant::VARIANT_TYPE_DECIMAL:
+					return std::hash<int64_t>()(v.as_decimal().value());
+				case variant::VARIANT_TYPE_STRING:
+					return std::hash<std::string>()(v.as_string());
+				case variant::VARIANT_TYPE_ENUM:
+					return std::hash<std::string>()(v.as_enum());
+				case variant::VARIANT_TYPE_LIST: {
+					size_t result = v.num_elements();
+					for(const variant& item : v.as_list()) {
+						result = combine(result, (*this)(item));
+					}
+					return result;
+				}
+				case variant::VARIANT_TYPE_MAP: {
+					size_t result = v.num_elements();
+					for(const auto& p : v.as_map()) {
+						result = combine(result, (*this)(p.first));
+						result = combine(result, (*this)(p.second));
+					}
+					return result;
+				}
+				case variant::VARIANT_TYPE_CALLABLE:
+					return std::hash<const void*>()(v.as_callable());
+				default:
+					return static_cast<size_t>(v.type());
+				}
+			}
+
+			static size_t combine(size_t seed, size_t h) {
+				return seed ^ (h + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+			}
+		};
+
+		//a rough count of the memory a cached value holds on to. Objects
+		//other than packed arrays are counted at a flat rate, since they are
+		//usually shared with the rest of the game.
+		int estimate_variant_bytes(const variant& v)
+		{
+			int result = static_cast<int>(sizeof(variant));
+			switch(v.type()) {
+			case variant::VARIANT_TYPE_STRING:
+				result += static_cast<int>(v.as_string().size());
+				break;
+			case variant::VARIANT_TYPE_LIST:
+				for(const variant& item : v.as_list()) {
+					result += estimate_variant_bytes(item);
+				}
+				break;
+			case variant::VARIANT_TYPE_MAP:
+				for(const auto& p : v.as_map()) {
+					result += estimate_variant_bytes(p.first) + estimate_variant_bytes(p.second) + 32;
+				}
+				break;
+			case variant::VARIANT_TYPE_CALLABLE: {
+				const TypedArrayCallable* typed = v.try_convert<TypedArrayCallable>();
+				if(typed != nullptr) {
+					result += typed->numScalars()*4;
+					break;
+				}
+
+				FloatArrayCallable* floats = v.try_convert<FloatArrayCallable>();
+				if(floats != nullptr) {
+					result += floats->num_elements()*static_cast<int>(sizeof(float));
+					break;
+				}
+
+				result += 256;
+				break;
+			}
+			default:
+				break;
+			}
+
+			return result;
+		}
+
+		//the result of query_cache_async(), filled in by a worker thread.
+		class ffl_cache_future : public FormulaCallable
+		{
+		public:
+			ffl_cache_future() : ready_(false)
+			{}
+
+			explicit ffl_cache_future(const variant& value) : ready_(true), value_(value)
+			{}
+
+			bool ready() const {
+				threading::lock l(mutex_);
+				return ready_;
+			}
+
+			//the value, or null if it isn't ready yet. Rethrows any error the
+			//worker ran into.
+			variant value() const {
+				threading::lock l(mutex_);
+				if(error_) {
+					std::rethrow_exception(error_);
+				}
+
+				return value_;
+			}
+
+			void setValue(const variant& value) {
+				threading::lock l(mutex_);
+				value_ = value;
+				ready_ = true;
+			}
+
+			void setError(std::exception_ptr error) {
+				threading::lock l(mutex_);
+				error_ = error;
+				ready_ = true;
+			}
+
+			bool failed() const {
+				threading::lock l(mutex_);
+				return error_ ? true : false;
+			}
+
+			void surrenderReferences(GarbageCollector* collector) override {
+				threading::lock l(mutex_);
+				collector->surrenderVariant(&value_);
+			}
+		private:
+			DECLARE_CALLABLE(ffl_cache_future);
+
+			mutable threading::mutex mutex_;
+			bool ready_;
+			variant value_;
+			std::exception_ptr error_;
+		};
+
+		BEGIN_DEFINE_CALLABLE_NOBASE(ffl_cache_future)
+		DEFINE_FIELD(ready, "bool")
+			return variant::from_bool(obj.ready());
+		DEFINE_FIELD(value, "any")
+			return obj.value();
+		END_DEFINE_CALLABLE(ffl_cache_future)
+
 		class ffl_cache : public FormulaCallable
 		{
 		public:
 			struct Entry {
-				Entry() : use_weak(false) {}
+				Entry() : use_weak(false), bytes(0) {}
 				variant key;
 				variant obj;
 				ffl::weak_ptr<FormulaCallable> weak;
 				bool use_weak;
+				int bytes;
 			};
 
 			void setName(const std::string& name) { name_ = name; }
 			const std::string& getName() const { return name_; }
 
-			explicit ffl_cache(int max_entries) : max_entries_(max_entries)
+			//max_bytes of zero leaves the cache limited only by its number
+			//of entries.
+			explicit ffl_cache(int max_entries, int max_bytes=0)
+			  : max_entries_(max_entries), max_bytes_(max_bytes), num_bytes_(0),
+			    hits_(0), misses_(0), evictions_(0)
 			{
 				get_all_ffl_caches().insert(this);
 			}
@@ -428,11 +585,15 @@ namespace game_logic
 			}
 
 			const variant* get(const variant& key) const {
-				std::map<variant, std::list<Entry>::iterator>::iterator i = cache_.find(key);
+				auto i = cache_.find(key);
+				if(i == cache_.end()) {
+					i = storeIfFinished(key);
+				}
+
 				if(i != cache_.end()) {
 					if(i->second->use_weak && i->second->weak.get() == nullptr) {
-						lru_.erase(i->second);
-						cache_.erase(i);
+						eraseEntry(i->second);
+						++misses_;
 						return nullptr;
 					} else if(i->second->use_weak) {
 						auto weak = i->second->weak.get();
@@ -442,18 +603,102 @@ namespace game_logic
 					}
 
 					lru_.splice(lru_.begin(), lru_, i->second);
+					++hits_;
 
 					const Entry& entry = *i->second;
 					return &entry.obj;
 				} else {
+					++misses_;
 					return nullptr;
 				}
 			}
 
-			void store(const variant& key, const variant& value) const {
+			//stores a value, estimating its size if bytes isn't given.
+			void store(const variant& key, const variant& value, int bytes=-1) const {
+				//a value stored directly supersedes one still being computed.
+				pending_.erase(key);
+				storeFinished();
+				storeEntry(key, value, bytes);
+			}
+
+			//computes the value for key with fn on a worker thread, unless it
+			//is cached or already being computed. Without thread safe FFL it
+			//is computed here, and the future returned is already finished.
+			ffl::IntrusivePtr<ffl_cache_future> getAsync(const variant& key, std::function<variant()> fn) const {
+				storeFinished();
+
+				const variant* cached = get(key);
+				if(cached != nullptr) {
+					return ffl::IntrusivePtr<ffl_cache_future>(new ffl_cache_future(*cached));
+				}
+
+				auto pending = pending_.find(key);
+				if(pending != pending_.end()) {
+					return pending->second;
+				}
+
+				ffl::IntrusivePtr<ffl_cache_future> future(new ffl_cache_future);
+#ifdef MT_FFL
+				pending_[key] = future;
+				threading::thread_pool::shared().submit([future, fn]() {
+					try {
+						future->setValue(fn());
+					} catch(...) {
+						future->setError(std::current_exception());
+					}
+				});
+#else
+				const variant value = fn();
+				future->setValue(value);
+				storeEntry(key, value, -1);
+#endif
+				return future;
+			}
+
+			void clear() {
+				lru_.clear();
+				cache_.clear();
+				pending_.clear();
+				num_bytes_ = 0;
+			}
+
+			void surrenderReferences(GarbageCollector* collector) override {
+				for(std::pair<const variant, std::list<Entry>::iterator>& p : cache_) {
+					collector->surrenderVariant(&p.first);
+					collector->surrenderVariant(&p.second->key);
+					collector->surrenderVariant(&p.second->obj);
+				}
+
+				for(auto& p : pending_) {
+					collector->surrenderVariant(&p.first);
+					collector->surrenderPtr(&p.second, "pending");
+				}
+			}
+
+			std::string debugObjectName() const override {
+				std::ostringstream s;
+				s << "ffl_cache(" << name_ << ", " << lru_.size() << "/" << max_entries_;
+				if(max_bytes_ > 0) {
+					s << ", " << num_bytes_ << "/" << max_bytes_ << " bytes";
+				}
+				s << ")";
+				return s.str();
+			}
+		private:
+			DECLARE_CALLABLE(ffl_cache);
+
+			typedef std::unordered_map<variant, std::list<Entry>::iterator, variant_hash> CacheMap;
+
+			void storeEntry(const variant& key, const variant& value, int bytes) const {
+				if(bytes < 0) {
+					bytes = estimate_variant_bytes(key) + estimate_variant_bytes(value);
+				}
+
 				lru_.push_front(Entry());
 				lru_.front().obj = value;
 				lru_.front().key = key;
+				lru_.front().bytes = bytes;
+				num_bytes_ += bytes;
 
 				bool succeeded = cache_.insert(std::pair<variant,std::list<Entry>::iterator>(key, lru_.begin())).second;
 				ASSERT_LOG(succeeded, "Inserted into cache when there is already a valid entry: " << key.write_json());
@@ -467,8 +712,8 @@ namespace game_logic
 						Entry& entry = *end;
 						if(entry.use_weak) {
 							if(entry.weak.get() == nullptr) {
-								cache_.erase(entry.key);
-								lru_.erase(end);
+								eraseEntry(end);
+								++evictions_;
 								--num_delete;
 							} else {
 								lru_.splice(lru_.begin(), lru_, end);
@@ -476,8 +721,8 @@ namespace game_logic
 						} else if( false && entry.obj.refcount() > 1) {
 							lru_.splice(lru_.begin(), lru_, end);
 						} else {
-							cache_.erase(entry.key);
-							lru_.erase(end);
+							eraseEntry(end);
+							++evictions_;
 							--num_delete;
 						}
 
@@ -495,33 +740,66 @@ namespace game_logic
 						LOG_ERROR("Failed to delete all objects from cache. " << cache_.size() << "/" << max_entries_ << " remain");
 					}
 				}
+
+				//the newest entry is kept even if it alone is over budget.
+				while(max_bytes_ > 0 && num_bytes_ > max_bytes_ && lru_.size() > 1) {
+					auto end = lru_.end();
+					--end;
+					eraseEntry(end);
+					++evictions_;
+				}
 			}
 
-			void clear() {
-				lru_.clear();
-				cache_.clear();
+			void eraseEntry(std::list<Entry>::iterator i) const {
+				num_bytes_ -= i->bytes;
+				cache_.erase(i->key);
+				lru_.erase(i);
 			}
 
-			void surrenderReferences(GarbageCollector* collector) override {
-				for(std::pair<const variant, std::list<Entry>::iterator>& p : cache_) {
-					collector->surrenderVariant(&p.first);
-					collector->surrenderVariant(&p.second->key);
-					collector->surrenderVariant(&p.second->obj);
+			//moves a value computed by a worker into the cache once it's
+			//ready. Returns the new entry, or cache_.end() if there is none.
+			CacheMap::iterator storeIfFinished(const variant& key) const {
+				auto pending = pending_.find(key);
+				if(pending == pending_.end() || pending->second->ready() == false) {
+					return cache_.end();
+				}
+
+				ffl::IntrusivePtr<ffl_cache_future> future = pending->second;
+				pending_.erase(pending);
+				if(future->failed()) {
+					return cache_.end();
 				}
+
+				storeEntry(key, future->value(), -1);
+				return cache_.find(key);
 			}
 
-			std::string debugObjectName() const override {
-				std::ostringstream s;
-				s << "ffl_cache(" << name_ << ", " << lru_.size() << "/" << max_entries_ << ")";
-				return s.str();
+			//moves every value the workers have finished into the cache, so
+			//they count against its limits rather than piling up in pending_
+			//until someone asks for them.
+			void storeFinished() const {
+				for(auto i = pending_.begin(); i != pending_.end(); ) {
+					if(i->second->ready() == false) {
+						++i;
+						continue;
+					}
+
+					const variant key = i->first;
+					ffl::IntrusivePtr<ffl_cache_future> future = i->second;
+					i = pending_.erase(i);
+					if(future->failed() == false && cache_.count(key) == 0) {
+						storeEntry(key, future->value(), -1);
+					}
+				}
 			}
-		private:
-			DECLARE_CALLABLE(ffl_cache);
 
 			mutable std::list<Entry> lru_;
-			mutable std::map<variant, std::list<Entry>::iterator> cache_;
+			mutable CacheMap cache_;
+			mutable std::unordered_map<variant, ffl::IntrusivePtr<ffl_cache_future>, variant_hash> pending_;
 			std::string name_;
-			int max_entries_;
+			int max_entries_, max_bytes_;
+			mutable int num_bytes_;
+			mutable int hits_, misses_, evictions_;
 		};
 
 		BEGIN_DEFINE_CALLABLE_NOBASE(ffl_cache)
@@ -546,6 +824,18 @@ namespace game_logic
 			return variant(obj.cache_.size());
 		DEFINE_FIELD(max_entries, "int")
 			return variant(obj.max_entries_);
+		DEFINE_FIELD(num_bytes, "int")
+			return variant(obj.num_bytes_);
+		DEFINE_FIELD(max_bytes, "int")
+			return variant(obj.max_bytes_);
+		DEFINE_FIELD(hits, "int")
+			return variant(obj.hits_);
+		DEFINE_FIELD(misses, "int")
+			return variant(obj.misses_);
+		DEFINE_FIELD(evictions, "int")
+			return variant(obj.evictions_);
+		DEFINE_FIELD(num_pending, "int")
+			return variant(static_cast<int>(obj.pending_.size()));
 		DEFINE_FIELD(all, "[builtin ffl_cache]")
 			std::vector<variant> v;
 			for(auto item : get_all_ffl_caches()) {
@@ -571,14 +861,15 @@ namespace game_logic
 			return variant::from_bool(result != nullptr);
 		END_DEFINE_FN
 
-		BEGIN_DEFINE_FN(store, "(any, any) ->commands")
+		BEGIN_DEFINE_FN(store, "(any, any, int|null=null) ->commands")
 			variant key = FN_ARG(0);
 			variant value = FN_ARG(1);
+			const int bytes = NUM_FN_ARGS > 2 ? FN_ARG(2).as_int(-1) : -1;
 
 			ffl::IntrusivePtr<ffl_cache> ptr(const_cast<ffl_cache*>(&obj));
 			return variant(new game_logic::FnCommandCallable("cache_store", [=]() {
 				if(ptr->get(key) == nullptr) {
-					ptr->store(key, value);
+					ptr->store(key, value, bytes);
 				}
 			}));
 		END_DEFINE_FN
@@ -589,6 +880,13 @@ namespace game_logic
 				ptr->clear();
 			}));
 		END_DEFINE_FN
+
+		BEGIN_DEFINE_FN(reset_stats, "() ->commands")
+			ffl::IntrusivePtr<ffl_cache> ptr(const_cast<ffl_cache*>(&obj));
+			return variant(new game_logic::FnCommandCallable("cache_reset_stats", [=]() {
+				ptr->hits_ = ptr->misses_ = ptr->evictions_ = 0;
+			}));
+		END_DEFINE_FN
 		END_DEFINE_CALLABLE(ffl_cache)
 
 		class Geometry : public game_logic::FormulaCallable {
@@ -847,10 +1145,11 @@ namespace game_logic
 			RETURN_TYPE("string");
 		END_FUNCTION_DEF(get_full_call_stack)
 
-		FUNCTION_DEF(create_cache, 0, 1, "create_cache(max_entries=4096): makes an FFL cache object")
+		FUNCTION_DEF(create_cache, 0, 1, "create_cache(max_entries=4096|{size, max_bytes, name}): makes an FFL cache object. With max_bytes the cache also evicts its least recently used entries to keep the estimated size of what it holds under that many bytes.")
 			Formula::failIfStaticContext();
 			std::string name = "";
 			int max_entries = 4096;
+			int max_bytes = 0;
 			if(NUM_ARGS >= 1) {
 				variant arg = EVAL_ARG(0);
 				if(arg.is_int()) {
@@ -858,15 +1157,16 @@ namespace game_logic
 				} else {
 					const std::map<variant,variant>& m = arg.as_map();
 					max_entries = arg[variant("size")].as_int(max_entries);
+					max_bytes = arg[variant("max_bytes")].as_int(max_bytes);
 					name = arg[variant("name")].as_string_default("");
 				}
 			}
 
-			auto cache = new ffl_cache(max_entries);
+			auto cache = new ffl_cache(max_entries, max_bytes);
 			cache->setName(name);
 			return variant(cache);
 		FUNCTION_ARGS_DEF
-			ARG_TYPE("int|{size: int|null, name: string|null}");
+			ARG_TYPE("int|{size: int|null, max_bytes: int|null, name: string|null}");
 			RETURN_TYPE("object");
 		END_FUNCTION_DEF(create_cache)
 
@@ -916,6 +1216,27 @@ namespace game_logic
 			return args()[2]->queryVariantType();
 		END_FUNCTION_DEF(query_cache)
 
+		FUNCTION_DEF_CTOR(query_cache_async, 3, 3, "query_cache_async(ffl_cache, key, expr) -> {ready: bool, value: any}: like query_cache, but on a miss expr is evaluated on a worker thread. The result's value is null until ready is true, and is moved into the cache, counting against its limits, the next time the cache is used after it finishes. expr must only read state that nothing changes while it runs. Without a thread safe FFL build expr is evaluated straight away.")
+		FUNCTION_DEF_MEMBERS
+			bool optimizeArgNumToVM(int narg) const override {
+				return narg != 2;
+			}
+		FUNCTION_DEF_IMPL
+			const variant key = EVAL_ARG(1);
+
+			variant cache_variant = EVAL_ARG(0);
+			const ffl_cache* cache = cache_variant.try_convert<ffl_cache>();
+			ASSERT_LOG(cache != nullptr, "ILLEGAL CACHE ARGUMENT TO query_cache_async");
+
+			const ExpressionPtr expr = args()[2];
+			const ConstFormulaCallablePtr vars(&variables);
+			return variant(cache->getAsync(key, [expr, vars]() { return expr->evaluate(*vars); }).get());
+
+		FUNCTION_DYNAMIC_ARGUMENTS
+		FUNCTION_ARGS_DEF
+			RETURN_TYPE("builtin ffl_cache_future")
+		END_FUNCTION_DEF(query_cache_async)
+
 		FUNCTION_DEF(game_preferences, 0, 0, "game_preferences() ->builtin game_preferences")
 			Formula::failIfStaticContext();
 			return preferences::ffl_interface();
@@ -2586,6 +2907,116 @@ FUNCTION_DEF_IMPL
 			ARG_TYPE("[int]");
 		END_FUNCTION_DEF(short_array)
 
+		namespace
+		{
+			const TypedArrayCallable& typed_array_arg(const variant& v, const char* fn)
+			{
+				const TypedArrayCallable* a = v.is_callable() ? v.try_convert<TypedArrayCallable>() : nullptr;
+				ASSERT_LOG(a != nullptr, fn << "() expects a typed array, found " << v.write_json());
+				return *a;
+			}
+		}
+
+		FUNCTION_DEF(float32_array, 1, 1, "float32_array(list|int|array) -> array: Makes a packed array of 32-bit floats from a list of numbers, another typed array, or a size giving an array of zeros.")
+			game_logic::Formula::failIfStaticContext();
+			return variant(TypedArrayCallable::create(TypedArrayCallable::ElementType::FLOAT32, EVAL_ARG(0)));
+		FUNCTION_ARGS_DEF
+			ARG_TYPE("[decimal|int]|int|builtin TypedArrayCallable");
+			RETURN_TYPE("builtin TypedArrayCallable")
+		END_FUNCTION_DEF(float32_array)
+
+		FUNCTION_DEF(int32_array, 1, 1, "int32_array(list|int|array) -> array: Makes a packed array of 32-bit integers from a list of numbers, another typed array, or a size giving an array of zeros.")
+			game_logic::Formula::failIfStaticContext();
+			return variant(TypedArrayCallable::create(TypedArrayCallable::ElementType::INT32, EVAL_ARG(0)));
+		FUNCTION_ARGS_DEF
+			ARG_TYPE("[decimal|int]|int|builtin TypedArrayCallable");
+			RETURN_TYPE("builtin TypedArrayCallable")
+		END_FUNCTION_DEF(int32_array)
+
+		FUNCTION_DEF(vec2_array, 1, 1, "vec2_array(list|int|array) -> array: Makes a packed array of [x,y] float pairs from a list of pairs, a flat list of x,y values, another typed array, or a size giving an array of zeros.")
+			game_logic::Formula::failIfStaticContext();
+			return variant(TypedArrayCallable::create(TypedArrayCallable::ElementType::VEC2, EVAL_ARG(0)));
+		FUNCTION_ARGS_DEF
+			ARG_TYPE("[[decimal|int,decimal|int]]|[decimal|int]|int|builtin TypedArrayCallable");
+			RETURN_TYPE("builtin TypedArrayCallable")
+		END_FUNCTION_DEF(vec2_array)
+
+		FUNCTION_DEF(array_op, 3, 3, "array_op(string op, a, b) -> array: Applies op, one of + - * / min max, element by element to two typed arrays of the same size, or to a typed array and a number. A vec2 array may be combined with a float32 or int32 array, applying each element to both components, or with an [x,y] pair.")
+			const std::string op_name = EVAL_ARG(0).as_string();
+			typed_array::BinaryOp op;
+			ASSERT_LOG(typed_array::parseBinaryOp(op_name, &op), "Unknown array_op operation: " << op_name);
+			return typed_array::binary(op, EVAL_ARG(1), EVAL_ARG(2));
+		FUNCTION_ARGS_DEF
+			ARG_TYPE("string");
+			ARG_TYPE("builtin TypedArrayCallable|decimal|int|[decimal|int,decimal|int]");
+			ARG_TYPE("builtin TypedArrayCallable|decimal|int|[decimal|int,decimal|int]");
+			RETURN_TYPE("builtin TypedArrayCallable")
+		END_FUNCTION_DEF(array_op)
+
+		FUNCTION_DEF(array_map, 2, 2, "array_map(string op, array) -> array: Applies op, one of neg abs sqrt floor sin cos, to every value in a typed array.")
+			const std::string op_name = EVAL_ARG(0).as_string();
+			typed_array::UnaryOp op;
+			ASSERT_LOG(typed_array::parseUnaryOp(op_name, &op), "Unknown array_map operation: " << op_name);
+			return typed_array::unary(op, typed_array_arg(EVAL_ARG(1), "array_map"));
+		FUNCTION_ARGS_DEF
+			ARG_TYPE("string");
+			ARG_TYPE("builtin TypedArrayCallable");
+			RETURN_TYPE("builtin TypedArrayCallable")
+		END_FUNCTION_DEF(array_map)
+
+		FUNCTION_DEF(array_reduce, 2, 2, "array_reduce(string op, array) -> number|[x,y]: Reduces a typed array with op, one of sum min max mean. vec2 arrays give an [x,y] result; min, max and mean of an empty array are null.")
+			const std::string op_name = EVAL_ARG(0).as_string();
+			typed_array::Reduction op;
+			ASSERT_LOG(typed_array::parseReduction(op_name, &op), "Unknown array_reduce operation: " << op_name);
+			return typed_array::reduce(op, typed_array_arg(EVAL_ARG(1), "array_reduce"));
+		FUNCTION_ARGS_DEF
+			ARG_TYPE("string");
+			ARG_TYPE("builtin TypedArrayCallable");
+			RETURN_TYPE("decimal|int|[decimal,decimal]|null")
+		END_FUNCTION_DEF(array_reduce)
+
+		FUNCTION_DEF(array_dot, 2, 2, "array_dot(a, b) -> number: The dot product of two typed arrays with the same number of values.")
+			const variant a = EVAL_ARG(0);
+			const variant b = EVAL_ARG(1);
+			return typed_array::dot(typed_array_arg(a, "array_dot"), typed_array_arg(b, "array_dot"));
+		FUNCTION_ARGS_DEF
+			ARG_TYPE("builtin TypedArrayCallable");
+			ARG_TYPE("builtin TypedArrayCallable");
+			RETURN_TYPE("decimal|int")
+		END_FUNCTION_DEF(array_dot)
+
+		FUNCTION_DEF(array_slice, 2, 3, "array_slice(array, int begin, int end=size) -> array: Elements begin up to end of a typed array. The slice shares the array's storage rather than copying it.")
+			const variant a = EVAL_ARG(0);
+			const TypedArrayCallable& array = typed_array_arg(a, "array_slice");
+			const int begin = EVAL_ARG(1).as_int();
+			const int end = NUM_ARGS > 2 ? EVAL_ARG(2).as_int() : array.size();
+			return variant(array.slice(begin, end));
+		FUNCTION_ARGS_DEF
+			ARG_TYPE("builtin TypedArrayCallable");
+			ARG_TYPE("int");
+			ARG_TYPE("int");
+			RETURN_TYPE("builtin TypedArrayCallable")
+		END_FUNCTION_DEF(array_slice)
+
+		FUNCTION_DEF(array_gather, 2, 2, "array_gather(array, indices) -> array: An array of array[indices[n]] for each of the indices.")
+			const variant a = EVAL_ARG(0);
+			return typed_array::gather(typed_array_arg(a, "array_gather"), EVAL_ARG(1));
+		FUNCTION_ARGS_DEF
+			ARG_TYPE("builtin TypedArrayCallable");
+			ARG_TYPE("[int]|builtin TypedArrayCallable");
+			RETURN_TYPE("builtin TypedArrayCallable")
+		END_FUNCTION_DEF(array_gather)
+
+		FUNCTION_DEF(array_scatter, 3, 3, "array_scatter(array, indices, values) -> array: A copy of array with array[indices[n]] set to values[n], or to values for every index if it is a single value.")
+			const variant a = EVAL_ARG(0);
+			return typed_array::scatter(typed_array_arg(a, "array_scatter"), EVAL_ARG(1), EVAL_ARG(2));
+		FUNCTION_ARGS_DEF
+			ARG_TYPE("builtin TypedArrayCallable");
+			ARG_TYPE("[int]|builtin TypedArrayCallable");
+			ARG_TYPE("any");
+			RETURN_TYPE("builtin TypedArrayCallable")
+		END_FUNCTION_DEF(array_scatter)
+
 		FUNCTION_DEF(generate_uuid, 0, 0, "generate_uuid() -> string: generates a unique string")
 			game_logic::Formula::failIfStaticContext();
 			return variant(write_uuid(generate_uuid()));
@@ -7307,3 +7738,18 @@ UNIT_TEST(str_for_non_str) {
 	const std::string output_as_string = output.as_string();
 	CHECK_EQ("42", output_as_string);
 }
+
+UNIT_TEST(ffl_cache_byte_budget) {
+	CHECK_EQ(variant_hash()(variant(3)), variant_hash()(variant(3.0)));
+
+	ffl::IntrusivePtr<ffl_cache> cache(new ffl_cache(100, 1000));
+	for(int n = 0; n != 10; ++n) {
+		cache->store(variant(n), variant(n), 300);
+	}
+
+	CHECK(cache->get(variant(9)) != nullptr, "newest entry was evicted");
+	CHECK(cache->get(variant(6)) == nullptr, "cache went over its byte budget");
+	CHECK(cache->get(variant(8.0)) != nullptr, "decimal key did not find int entry");
+	CHECK_EQ(cache->queryValue("evictions").as_int(), 7);
+	CHECK_EQ(cache->queryValue("num_bytes").as_int(), 900);
+}
@@ -24,6 +24,7 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/uuid/uuid_generators.hpp>
+#include <atomic>
 #include <map>
 #include <string>
 #include <stdio.h>
@@ -535,6 +536,15 @@ std::map<std::string, std::string>& class_path_map()
 		return def;
 	}
 
+	namespace
+	{
+		int next_class_generation()
+		{
+			static std::atomic<int> generation(0);
+			return ++generation;
+		}
+	}
+
 	class FormulaClass : public reference_counted_object
 	{
 	public:
@@ -567,12 +577,17 @@ std::map<std::string, std::string>& class_path_map()
 
 		bool is_library_only() const { return is_library_only_; }
 
+		//changes whenever the class's slots may have, so that anything
+		//cached about them can be told apart from a reloaded class.
+		int generation() const { return generation_; }
+
 		void update_class(FormulaClass* new_class) {
 			if(new_class == this) {
 				return;
 			}
 
 			new_class->previous_version_.reset(this);
+			generation_ = next_class_generation();
 
 			for(int i = 0; i < slots_.size() && i < new_class->slots_.size(); ++i) {
 				if(slots_[i].name == new_class->slots_[i].name &&
@@ -622,6 +637,8 @@ std::map<std::string, std::string>& class_path_map()
 		int nstate_slots_;
 		
 		bool is_library_only_;
+
+		int generation_;
 	};
 
 	bool is_class_derived_from(const std::string& derived, const std::string& base)
@@ -673,7 +690,8 @@ std::map<std::string, std::string>& class_path_map()
 	};
 
 	FormulaClass::FormulaClass(const std::string& class_name, const variant& node)
-	  : builtin_slots_(0), name_(class_name), name_variant_(class_name), nstate_slots_(0), is_library_only_(false)
+	  : builtin_slots_(0), name_(class_name), name_variant_(class_name), nstate_slots_(0), is_library_only_(false),
+	    generation_(next_class_generation())
 	{
 		if(node["base_type"].is_string()) {
 			std::string builtin = node["base_type"].as_string();
@@ -1750,6 +1768,40 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 		}
 	}
 
+	int FormulaObject::getPropertySlot(const std::string& key) const
+	{
+		for(int n = 0; n != NUM_BASE_FIELDS; ++n) {
+			if(key == BaseFields[n]) {
+				return n;
+			}
+		}
+
+		auto def = class_->getBuiltinDef();
+		if(def) {
+			const int slot = def->getSlot(key);
+			if(slot >= 0) {
+				return NUM_BASE_FIELDS + slot;
+			}
+		}
+
+		std::map<std::string, int>::const_iterator itor = class_->properties().find(key);
+		if(itor == class_->properties().end()) {
+			return -1;
+		}
+
+		return NUM_BASE_FIELDS + class_->getBuiltinSlots() + itor->second;
+	}
+
+	const reference_counted_object* FormulaObject::getClassKey() const
+	{
+		return class_.get();
+	}
+
+	int FormulaObject::getClassGeneration() const
+	{
+		return class_->generation();
+	}
+
 	variant FormulaObject::getValueBySlot(int slot) const
 	{
 		switch(slot) {
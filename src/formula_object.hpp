@@ -91,6 +91,14 @@ namespace game_logic
 
 		variant_type_ptr getPropertySetType(const std::string& key) const;
 
+		//slot which queryValueBySlot() maps to the same value as
+		//queryValue(key), or -1. Slots are shared by all objects whose
+		//getClassKey() and getClassGeneration() are the same, so callers
+		//may cache them per class. The key doesn't keep the class alive.
+		int getPropertySlot(const std::string& key) const;
+		const reference_counted_object* getClassKey() const;
+		int getClassGeneration() const;
+
 		bool getConstantValue(const std::string& id, variant* result) const override;
 
 #if defined(USE_LUA)
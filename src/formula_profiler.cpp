@@ -1066,12 +1066,27 @@ namespace formula_profiler
 	{
 		struct InstrumentationRecord 
 		{
-			InstrumentationRecord() : time_ns(0), nsamples(0)
+			InstrumentationRecord() : time_ns(0), self_ns(0), nsamples(0)
 			{}
-			uint64_t time_ns, nsamples;
+
+			//self_ns leaves out the time spent in instruments nested inside.
+			uint64_t time_ns, self_ns, nsamples;
 		};
 
 		std::map<const char*, InstrumentationRecord> g_instrumentation;
+
+		//for each running instrument, the time spent so far in the ones
+		//nested inside it.
+		std::vector<uint64_t> g_nested_ns;
+
+		//instruments are only recorded on this thread; work farmed out to
+		//worker threads is accounted for in the instrument that waits on it.
+		SDL_threadID g_instrumented_thread;
+
+		bool on_instrumented_thread()
+		{
+			return SDL_ThreadID() == g_instrumented_thread;
+		}
 	}
 
 	const char* Instrument::generate_id(const char* id, int num)
@@ -1090,10 +1105,12 @@ namespace formula_profiler
 	{
 	}
 
-	Instrument::Instrument(const char* id, const game_logic::Formula* formula) : id_(id)
+	Instrument::Instrument(const char* id, const game_logic::Formula* formula) : id_(nullptr)
 	{
 		t_ = SDL_GetPerformanceCounter();
-		if(profiler_on) {
+		if(profiler_on && on_instrumented_thread()) {
+			id_ = id;
+			g_nested_ns.push_back(0);
 			if(g_profiler_widget) {
 				g_profiler_widget->beginInstrument(id, t_, formula ? formula->strVal() : variant());
 			}
@@ -1102,8 +1119,10 @@ namespace formula_profiler
 
 	void Instrument::init(const char* id, variant info)
 	{
-		if(profiler_on) {
+		if(profiler_on && on_instrumented_thread()) {
 			id_ = id;
+			t_ = SDL_GetPerformanceCounter();
+			g_nested_ns.push_back(0);
 			if(g_profiler_widget) {
 				g_profiler_widget->beginInstrument(id, SDL_GetPerformanceCounter(), info);
 			}
@@ -1119,9 +1138,18 @@ namespace formula_profiler
 	{
 		if(profiler_on && id_) {
 			uint64_t end_t = SDL_GetPerformanceCounter();
+			const uint64_t elapsed_ns = tsc_to_ns(end_t) - tsc_to_ns(t_);
 			InstrumentationRecord& r = g_instrumentation[id_];
-			r.time_ns += tsc_to_ns(end_t) - tsc_to_ns(t_);
+			r.time_ns += elapsed_ns;
 			r.nsamples++;
+
+			if(g_nested_ns.empty() == false) {
+				r.self_ns += elapsed_ns - std::min(elapsed_ns, g_nested_ns.back());
+				g_nested_ns.pop_back();
+				if(g_nested_ns.empty() == false) {
+					g_nested_ns.back() += elapsed_ns;
+				}
+			}
 			if(g_profiler_widget) {
 				g_profiler_widget->endInstrument(id_, end_t);
 			}
@@ -1163,6 +1191,29 @@ namespace formula_profiler
 		prev_call = tv;
 	}
 
+	InstrumentationScope::InstrumentationScope() : was_on_(profiler_on)
+	{
+		profiler_on = true;
+		g_instrumented_thread = SDL_ThreadID();
+		g_instrumentation.clear();
+		g_nested_ns.clear();
+	}
+
+	InstrumentationScope::~InstrumentationScope()
+	{
+		profiler_on = was_on_;
+		g_instrumentation.clear();
+	}
+
+	void take_instrumentation_totals(std::map<std::string, uint64_t>* totals)
+	{
+		for(auto& i : g_instrumentation) {
+			(*totals)[i.first] += i.second.self_ns;
+		}
+
+		g_instrumentation.clear();
+	}
+
 	EventCallStackType event_call_stack;
 
 	namespace 
@@ -1269,6 +1320,7 @@ namespace formula_profiler
 	{
 		if(output_file && profiler_on == false) {
 			main_thread = SDL_ThreadID();
+			g_instrumented_thread = main_thread;
 
 			current_expression_call_stack.reserve(10000);
 			event_call_stack_samples.resize(max_samples);
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <map>
 #include <string>
 
 #include "SDL.h"
@@ -76,6 +77,15 @@ namespace formula_profiler
 	};
 
 	inline std::string get_profile_summary() { return ""; }
+
+	class InstrumentationScope
+	{
+	public:
+		InstrumentationScope() {}
+		~InstrumentationScope() {}
+	};
+
+	inline void take_instrumentation_totals(std::map<std::string, uint64_t>* totals) {}
 }
 
 #else
@@ -158,6 +168,22 @@ namespace formula_profiler
 	};
 
 	std::string get_profile_summary();
+
+	//Records the totals of all instruments while in scope, without
+	//running the sampling profiler. Used by headless benchmarks.
+	class InstrumentationScope
+	{
+	public:
+		InstrumentationScope();
+		~InstrumentationScope();
+	private:
+		bool was_on_;
+	};
+
+	//Gets the time in nanoseconds spent in each instrument since the
+	//last call and resets the totals. Times are exclusive: time spent in
+	//an instrument nested inside another only counts towards the inner one.
+	void take_instrumentation_totals(std::map<std::string, uint64_t>* totals);
 }
 
 #endif
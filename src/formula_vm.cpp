@@ -43,7 +43,7 @@ static bool incrementVec(std::vector<int>& v, const std::vector<int>& max_values
 	return false;
 }
 
-int g_vmDepth = 0;
+THREAD_LOCAL int g_vmDepth;
 
 struct VMOverflowGuard {
 	VMOverflowGuard() {
@@ -481,7 +481,7 @@ void Frame::setPalettes(unsigned int palettes)
 			break;
 		}
 	}
-	blit_target_.getTexture()->setPalette(palettes == 0 ? -1 : npalette);
+	graphics::set_texture_palette(blit_target_.getTexture(), palettes == 0 ? -1 : npalette);
 	//LOG_DEBUG("Set palette " << npalette << " on " << blit_target_.getTexture()->id() << " from selection: " << std::hex << palettes << ", " << graphics::get_palette_name(npalette));
 }
 
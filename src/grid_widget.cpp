@@ -266,6 +266,7 @@ namespace gui
 
 	Grid& Grid::addCol(const WidgetPtr& widget) {
 		new_row_.push_back(widget);
+		invalidate();
 		if(new_row_.size() == ncols_) {
 			addRow(new_row_);
 			new_row_.clear();
@@ -313,6 +314,7 @@ namespace gui
 	void Grid::resetContents(const variant& v)
 	{
 		cells_.clear();
+		invalidate();
 		if(v.is_null()) {
 			return;
 		}
@@ -21,6 +21,7 @@
 	   distribution.
 */
 
+#include <unordered_map>
 #include <boost/algorithm/string.hpp>
 
 #include "asserts.hpp"
@@ -31,6 +32,7 @@
 #include "hex_loader.hpp"
 #include "hex_renderable.hpp"
 #include "profile_timer.hpp"
+#include "thread.hpp"
 #include "tile_rules.hpp"
 #include "variant_utils.hpp"
 
@@ -40,6 +42,53 @@ namespace hex
 	{
 		const std::vector<point> even_q_odd_col{ point(0,-1), point(1,-1), point(1,0), point(0,1), point(-1,0), point(-1,-1) };
 		const std::vector<point> even_q_even_col{ point(0,-1), point(1,0), point(1,1), point(0,1), point(-1,1), point(-1,0) };
+
+		struct StringIds
+		{
+			threading::mutex mutex;
+			std::unordered_map<std::string, int> ids;
+		};
+
+		StringIds& terrain_ids()
+		{
+			static StringIds res;
+			return res;
+		}
+
+		StringIds& flag_ids()
+		{
+			static StringIds res;
+			return res;
+		}
+
+		int intern(StringIds& table, const std::string& str, bool add)
+		{
+			threading::lock lck(table.mutex);
+			auto it = table.ids.find(str);
+			if(it != table.ids.end()) {
+				return it->second;
+			} else if(!add) {
+				return -1;
+			}
+			const int id = static_cast<int>(table.ids.size());
+			table.ids[str] = id;
+			return id;
+		}
+	}
+
+	int get_terrain_id(const std::string& full_type)
+	{
+		return intern(terrain_ids(), full_type, true);
+	}
+
+	int get_flag_id(const std::string& flag)
+	{
+		return intern(flag_ids(), flag, true);
+	}
+
+	int find_flag_id(const std::string& flag)
+	{
+		return intern(flag_ids(), flag, false);
 	}
 
 	HexMap::HexMap(const std::string& filename)
@@ -174,12 +223,35 @@ namespace hex
 	void HexMap::build()
 	{
 		profile::manager pman("HexMap::build()");
+		applyRules(hex::get_terrain_rules());
+	}
+
+	void HexMap::applyRules(const std::vector<TerrainRulePtr>& rules)
+	{
 		for(auto& tile : tiles_) {
 			tile.clear();
 		}
-		auto& terrain_rules = hex::get_terrain_rules();
-		for(auto& tr : terrain_rules) {
-			tr->match(ffl::IntrusivePtr<HexMap>(this));
+
+		// Hexes indexed by terrain id, so that each rule only visits the
+		// hexes its centre tile can match.
+		std::vector<std::vector<HexObject*>> by_terrain;
+		std::vector<const HexObject*> terrains;
+		for(auto& tile : tiles_) {
+			const int id = tile.getTerrainId();
+			if(id < 0) {
+				continue;
+			}
+			if(id >= static_cast<int>(by_terrain.size())) {
+				by_terrain.resize(id + 1);
+				terrains.resize(id + 1);
+			}
+			by_terrain[id].emplace_back(&tile);
+			terrains[id] = &tile;
+		}
+
+		for(auto& tr : rules) {
+			tr->prepare(terrains);
+			tr->match(*this, by_terrain);
 		}
 	}
 
@@ -350,6 +422,7 @@ namespace hex
 		  type_str_(),
 		  mod_str_(),
 		  full_type_str_(),
+		  terrain_id_(-1),
 		  flags_(),
 		  temp_flags_(),
 		  images_()
@@ -370,9 +443,7 @@ namespace hex
 
 	void HexObject::setTempFlags() const
 	{
-		for(const auto& f : temp_flags_) {
-			flags_.emplace(f);
-		}
+		flags_.merge(temp_flags_);
 	}
 
 	void HexObject::clear()
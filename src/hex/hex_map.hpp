@@ -23,8 +23,10 @@
 
 #pragma once
 
+#include <cstdint>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "geometry.hpp"
 #include "hex_fwd.hpp"
@@ -36,6 +38,41 @@
 
 namespace hex
 {
+	// Terrain type strings and flag names are interned to small dense ids so
+	// that terrain rules can compare them and keep flags in bitsets. Ids are
+	// never reused and are safe to request from any thread.
+	int get_terrain_id(const std::string& full_type);
+	int get_flag_id(const std::string& flag);
+	// As get_flag_id() but returns -1 rather than interning unknown flags.
+	int find_flag_id(const std::string& flag);
+
+	class FlagSet
+	{
+	public:
+		bool test(int id) const {
+			const size_t word = id / 64;
+			return word < bits_.size() && ((bits_[word] >> (id % 64)) & 1) != 0;
+		}
+		void set(int id) {
+			const size_t word = id / 64;
+			if(word >= bits_.size()) {
+				bits_.resize(word + 1);
+			}
+			bits_[word] |= uint64_t(1) << (id % 64);
+		}
+		void merge(const FlagSet& other) {
+			if(other.bits_.size() > bits_.size()) {
+				bits_.resize(other.bits_.size());
+			}
+			for(size_t n = 0; n != other.bits_.size(); ++n) {
+				bits_[n] |= other.bits_[n];
+			}
+		}
+		void clear() { bits_.clear(); }
+	private:
+		std::vector<uint64_t> bits_;
+	};
+
 	struct ImageHolder 
 	{
 		std::string name;
@@ -59,6 +96,7 @@ namespace hex
 			full_type_str_ = full_type;
 			type_str_ = type;
 			mod_str_ = mods;
+			terrain_id_ = get_terrain_id(full_type);
 		}
 		const point& getPosition() const { return pos_; }
 		int getX() const { return pos_.x; }
@@ -66,11 +104,18 @@ namespace hex
 		const std::string& getTypeString() const { return type_str_; }
 		const std::string& getModString() const { return mod_str_; }
 		const std::string& getFullTypeString() const { return full_type_str_; }
+		// Id of the full type string, see get_terrain_id().
+		int getTerrainId() const { return terrain_id_; }
 		const HexObject* getTileAt(int x, int y) const;
 		const HexObject* getTileAt(const point& p) const; 
-		bool hasFlag(const std::string& flag) const { return flags_.find(flag) != flags_.end() || temp_flags_.find(flag) != temp_flags_.end(); }
-		void addFlag(const std::string& flag) { flags_.emplace(flag); }
-		void addTempFlag(const std::string& flag) const { temp_flags_.emplace(flag); }
+		bool hasFlag(const std::string& flag) const { 
+			const int id = find_flag_id(flag);
+			return id >= 0 && hasFlag(id);
+		}
+		bool hasFlag(int id) const { return flags_.test(id) || temp_flags_.test(id); }
+		void addFlag(const std::string& flag) { flags_.set(get_flag_id(flag)); }
+		void addTempFlag(const std::string& flag) const { temp_flags_.set(get_flag_id(flag)); }
+		void addTempFlag(int id) const { temp_flags_.set(id); }
 		void clearTempFlags() const { temp_flags_.clear(); }
 		void setTempFlags() const;
 		void clear();
@@ -87,8 +132,9 @@ namespace hex
 		std::string type_str_;
 		std::string mod_str_;
 		std::string full_type_str_;
-		mutable std::set<std::string> flags_;
-		mutable std::set<std::string> temp_flags_;
+		int terrain_id_;
+		mutable FlagSet flags_;
+		mutable FlagSet temp_flags_;
 		std::vector<ImageHolder> images_;
 	};
 
@@ -101,6 +147,8 @@ namespace hex
 
 		void build();
 		void build_single(HexObject*  obj);
+		// Clears the map's images and flags and applies the rules in order.
+		void applyRules(const std::vector<TerrainRulePtr>& rules);
 
 		const HexObject* getTileAt(int x, int y) const ;
 		const HexObject* getTileAt(const point& p) const ;
@@ -109,6 +157,8 @@ namespace hex
 
 		int getWidth() const { return width_; }
 		int getHeight() const { return height_; }
+		// Offset subtracted from co-ordinates passed to getTileAt().
+		point getOrigin() const { return point(x_, y_); }
 
 		static HexMapPtr create(const std::string& filename);
 		static HexMapPtr create(const variant& v);
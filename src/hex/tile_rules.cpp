@@ -21,7 +21,9 @@
 	   distribution.
 */
 
+#include <algorithm>
 #include <iomanip>
+#include <set>
 #include <boost/algorithm/string.hpp>
 
 #include "hex_helper.hpp"
@@ -29,11 +31,16 @@
 #include "hex_map.hpp"
 #include "tile_rules.hpp"
 
+#include "json_parser.hpp"
+#include "preferences.hpp"
 #include "random.hpp"
+#include "thread_pool.hpp"
 #include "unit_test.hpp"
 
 namespace 
 {
+	PREF_BOOL(hex_parallel_rules, true, "Match hex terrain rules that don't depend on their own flags on worker threads.");
+
 	std::string rot_replace(const std::string& str, const std::vector<std::string>& rotations, int rot)
 	{
 		//if(rot == 0) {
@@ -180,7 +187,10 @@ namespace hex
 		  tile_data_(),
 		  image_(),
 		  pos_offset_(),
-		  probability_(v["probability"].as_int32(100))
+		  probability_(v["probability"].as_int32(100)),
+		  independent_(false),
+		  center_tile_(-1),
+		  valid_rotations_()
 	{
 		if(v.has_key("x")) {
 			absolute_position_ = std::unique_ptr<point>(new point(v["x"].as_int32()));
@@ -432,6 +442,7 @@ namespace hex
 	{
 		auto tr = std::make_shared<TerrainRule>(v);
 		tr->preProcessMap(v["tile"]);
+		tr->compile();
 		return tr;
 	}
 
@@ -445,7 +456,13 @@ namespace hex
 		  has_flag_(),
 		  image_(nullptr),
 		  pos_rotations_(),
-		  min_pos_()
+		  min_pos_(),
+		  rot_types_(),
+		  rot_has_flags_(),
+		  rot_no_flags_(),
+		  rot_set_flags_(),
+		  types_vary_by_rotation_(false),
+		  terrain_matches_()
 	{
 		if(v.has_key("x") || v.has_key("y")) {
 			position_.emplace_back(v["x"].as_int32(0), v["y"].as_int32(0));
@@ -489,7 +506,13 @@ namespace hex
 		  has_flag_(),
 		  image_(nullptr),
 		  pos_rotations_(),
-		  min_pos_()
+		  min_pos_(),
+		  rot_types_(),
+		  rot_has_flags_(),
+		  rot_no_flags_(),
+		  rot_set_flags_(),
+		  types_vary_by_rotation_(false),
+		  terrain_matches_()
 	{
 		type_.emplace_back("*");
 	}
@@ -582,75 +605,129 @@ namespace hex
 		return ss.str();
 	}
 
-	bool TileRule::matchFlags(const HexObject* obj, TerrainRule* tr, const std::vector<std::string>& rs, int rot)
+	void TileRule::compile(const TerrainRule& tr)
 	{
-		const auto& has_flag = has_flag_.empty() ? tr->getHasFlags() : has_flag_;
-		for(auto& f : has_flag) {
-			if(!obj->hasFlag(rot_replace(f, rs, rot))) {
-				return false;
+		const auto& rs = tr.getRotations();
+		auto replace = [&rs](const std::string& str, int rot) {
+			return rs.empty() ? str : rot_replace(str, rs, rot);
+		};
+		auto to_ids = [&replace](const std::vector<std::string>& flags, int rot) {
+			std::vector<int> res;
+			for(const auto& f : flags) {
+				res.emplace_back(get_flag_id(replace(f, rot)));
 			}
-		}
-		const auto& no_flag = no_flag_.empty() ? tr->getNoFlags() : no_flag_;
-		for(auto& f : no_flag) {
-			if(obj->hasFlag(rot_replace(f, rs, rot))) {
-				return false;
+			return res;
+		};
+
+		const auto& has_flag = has_flag_.empty() ? tr.getHasFlags() : has_flag_;
+		const auto& no_flag = no_flag_.empty() ? tr.getNoFlags() : no_flag_;
+		const auto& set_flag = set_flag_.empty() ? tr.getSetFlags() : set_flag_;
+
+		const int max_loop = tr.numRotations();
+		rot_types_.clear();
+		rot_has_flags_.clear();
+		rot_no_flags_.clear();
+		rot_set_flags_.clear();
+		for(int rot = 0; rot != max_loop; ++rot) {
+			rot_types_.emplace_back();
+			for(const auto& type : type_) {
+				rot_types_.back().emplace_back(replace(type, rot));
 			}
+			rot_has_flags_.emplace_back(to_ids(has_flag, rot));
+			rot_no_flags_.emplace_back(to_ids(no_flag, rot));
+			rot_set_flags_.emplace_back(to_ids(set_flag, rot));
 		}
-		return true;
-	}
 
-	bool TileRule::match(const HexObject* obj, TerrainRule* tr, const std::vector<std::string>& rs, int rot)
-	{
-		if(obj == nullptr) {
-			/*for(auto& type : type_) {
-				if(type == "*") {
-					return true;
-				}
-			}*/
-			return false;
+		types_vary_by_rotation_ = false;
+		for(const auto& types : rot_types_) {
+			types_vary_by_rotation_ |= types != rot_types_.front();
 		}
+		terrain_matches_.clear();
+	}
 
-		const std::string& hex_type_full = obj->getFullTypeString();
-		const std::string& hex_type = obj->getTypeString();
+	bool TileRule::matchTypeStrings(const std::string& full_type, const std::string& type, int rot) const
+	{
 		bool invert_match = false;
 		bool tile_match = true;
-		for(auto& type : type_) {
-			type = rot_replace(type, rs, rot);
-			if(type == "!") {
+		for(const auto& t : rot_types_[rot]) {
+			if(t == "!") {
 				invert_match = !invert_match;
 				continue;
 			}
-			const bool matches = type == "*" || string_match(type, hex_type_full) || string_match(type, hex_type);
+			const bool matches = t == "*" || string_match(t, full_type) || string_match(t, type);
 			if(!matches) {
-				if(invert_match == true) {
-					tile_match = true;
-				} else {
-					tile_match = false;
-				}
+				tile_match = invert_match;
 			} else {
-				if(invert_match == false) {
-					tile_match = true;
-				} else {
-					tile_match = false;
-				}
+				tile_match = !invert_match;
 				break;
 			}
 		}
+		return tile_match;
+	}
 
-		if(tile_match) {
-			if(!matchFlags(obj, tr, rs, rot)) {
-				return false;
+	void TileRule::prepare(const std::vector<const HexObject*>& terrains)
+	{
+		const int tables = types_vary_by_rotation_ ? static_cast<int>(rot_types_.size()) : 1;
+		terrain_matches_.assign(tables, std::vector<signed char>(terrains.size(), -1));
+		for(int rot = 0; rot != tables; ++rot) {
+			for(int id = 0; id != static_cast<int>(terrains.size()); ++id) {
+				if(terrains[id] != nullptr) {
+					terrain_matches_[rot][id] = matchTypeStrings(terrains[id]->getFullTypeString(), terrains[id]->getTypeString(), rot) ? 1 : 0;
+				}
 			}
+		}
+	}
 
-			const auto& set_flag = set_flag_.empty() ? tr->getSetFlags() : set_flag_;
-			for(auto& f : set_flag) {
-				if(obj != nullptr) {
-					obj->addTempFlag(rot_replace(f, rs, rot));
-				}
+	int TileRule::matchTerrain(int terrain_id, int rot) const
+	{
+		if(terrain_matches_.empty() || terrain_id < 0) {
+			return -1;
+		}
+		const auto& table = terrain_matches_[types_vary_by_rotation_ ? rot : 0];
+		return terrain_id < static_cast<int>(table.size()) ? table[terrain_id] : -1;
+	}
+
+	bool TileRule::matchType(const HexObject* obj, int rot) const
+	{
+		const int res = matchTerrain(obj->getTerrainId(), rot);
+		if(res >= 0) {
+			return res != 0;
+		}
+		return matchTypeStrings(obj->getFullTypeString(), obj->getTypeString(), rot);
+	}
+
+	bool TileRule::matchFlags(const HexObject* obj, int rot) const
+	{
+		for(int f : rot_has_flags_[rot]) {
+			if(!obj->hasFlag(f)) {
+				return false;
+			}
+		}
+		for(int f : rot_no_flags_[rot]) {
+			if(obj->hasFlag(f)) {
+				return false;
 			}
 		}
+		return true;
+	}
 
-		return tile_match;
+	bool TileRule::match(const HexObject* obj, int rot) const
+	{
+		if(obj == nullptr) {
+			return false;
+		}
+		if(!matchType(obj, rot) || !matchFlags(obj, rot)) {
+			return false;
+		}
+		addSetFlags(obj, rot);
+		return true;
+	}
+
+	void TileRule::addSetFlags(const HexObject* obj, int rot) const
+	{
+		for(int f : rot_set_flags_[rot]) {
+			obj->addTempFlag(f);
+		}
 	}
 
 	void TileRule::applyImage(HexObject* hex, int rot)
@@ -725,7 +802,7 @@ namespace hex
 		return it->second[rng::generate() % it->second.size()];
 	}
 
-	bool TileImage::isValidForRotation(int rot)
+	bool TileImage::isValidForRotation(int rot) const
 	{
 		return image_files_.find(rot) != image_files_.end();
 	}
@@ -864,9 +941,70 @@ namespace hex
 		return name;
 	}
 
+	void TerrainRule::compile()
+	{
+		for(auto& td : tile_data_) {
+			td->compile(*this);
+		}
+
+		center_tile_ = -1;
+		for(int n = 0; n != static_cast<int>(tile_data_.size()) && center_tile_ < 0; ++n) {
+			for(const auto& p : tile_data_[n]->getPosition()) {
+				if(p == center_) {
+					center_tile_ = n;
+					break;
+				}
+			}
+		}
+
+		// A rule whose matches don't depend on random numbers or on flags it
+		// sets itself gives the same result whichever order hexes are tried in.
+		std::set<int> read_flags;
+		std::set<int> set_flags;
+		for(const auto& td : tile_data_) {
+			for(int rot = 0; rot != numRotations(); ++rot) {
+				read_flags.insert(td->getHasFlagIds(rot).begin(), td->getHasFlagIds(rot).end());
+				read_flags.insert(td->getNoFlagIds(rot).begin(), td->getNoFlagIds(rot).end());
+				set_flags.insert(td->getSetFlagIds(rot).begin(), td->getSetFlagIds(rot).end());
+			}
+		}
+		independent_ = probability_ == 100;
+		for(int f : set_flags) {
+			if(read_flags.find(f) != read_flags.end()) {
+				independent_ = false;
+				break;
+			}
+		}
+	}
+
+	bool TerrainRule::isValidRotation(int rot) const
+	{
+		if(image_.empty()) {
+			return true;
+		}
+		for(const auto& img : image_) {
+			if(img->isValidForRotation(rot)) {
+				return true;
+			}
+		}
+		// XXX should we check for images in tile tags?
+		return false;
+	}
+
+	void TerrainRule::prepare(const std::vector<const HexObject*>& terrains)
+	{
+		for(auto& td : tile_data_) {
+			td->prepare(terrains);
+		}
+		valid_rotations_.resize(numRotations());
+		for(int rot = 0; rot != numRotations(); ++rot) {
+			valid_rotations_[rot] = isValidRotation(rot);
+		}
+	}
+
 	bool TerrainRule::match(HexObject* hex)
 	{
-		const int max_loop = rotations_.empty() ? 1 : rotations_.size();
+		const int max_loop = numRotations();
 
 		for(int rot = 0; rot != max_loop; ++rot) {
 			if(mod_position_) {
@@ -880,15 +1018,8 @@ namespace hex
 			// We expect tiles to have position data.
 			bool tile_match = true;
 
-			if(!image_.empty()) {
-				bool res = false;
-				for(const auto& img : image_) {
-					res |= img->isValidForRotation(rot);
-				}
-				if(!res) {
-					// XXX should we check for images in tile tags?
-					continue;
-				}
+			if(!isValidRotation(rot)) {
+				continue;
 			}
 
 			bool match_pos = true;
@@ -902,7 +1033,7 @@ namespace hex
 					//point rot_p = sub_hex_coord(add_hex_coord(hex.getPosition(), rotate_point(rot, center_, p)), center_);
 					point rot_p = rotate_point(rot, add_hex_coord(center_, hex->getPosition()), add_hex_coord(p, hex->getPosition()));
 					auto new_obj = const_cast<HexObject*>(hex->getTileAt(rot_p));
-					if(td->match(new_obj, this, rotations_, rot)) {
+					if(td->match(new_obj, rot)) {
 						//match_pos = true;
 						if(new_obj) {
 							obj_to_set_flags.emplace_back(std::make_pair(new_obj, td.get()));
@@ -947,22 +1078,124 @@ namespace hex
 		return false;
 	}
 
-	bool TerrainRule::match(const HexMapPtr& hmap)
+	// As match(HexObject*) for a single rotation, but only reads the map:
+	// the tiles that would be changed are returned in objs.
+	bool TerrainRule::matchAt(const HexObject* hex, int rot, std::vector<std::pair<HexObject*, TileRule*>>* objs) const
+	{
+		for(const auto& td : tile_data_) {
+			ASSERT_LOG(td->hasPosition(), "tile data doesn't have an x,y position.");
+			for(const auto& p : td->getPosition()) {
+				point rot_p = rotate_point(rot, add_hex_coord(center_, hex->getPosition()), add_hex_coord(p, hex->getPosition()));
+				auto new_obj = const_cast<HexObject*>(hex->getTileAt(rot_p));
+				if(new_obj == nullptr || !td->matchType(new_obj, rot) || !td->matchFlags(new_obj, rot)) {
+					return false;
+				}
+				objs->emplace_back(new_obj, td.get());
+			}
+		}
+		return true;
+	}
+
+	void TerrainRule::applyMatch(HexObject* hex, const Match& m)
+	{
+		applyImage(hex, m.rot);
+		for(auto& obj : m.objs) {
+			obj.second->addSetFlags(obj.first, m.rot);
+			obj.first->setTempFlags();
+			obj.second->applyImage(obj.first, m.rot);
+		}
+	}
+
+	void TerrainRule::findCandidates(HexMap& hmap, const std::vector<std::vector<HexObject*>>& by_terrain, std::vector<HexObject*>* res) const
+	{
+		auto& tiles = hmap.getTilesMutable();
+		if(center_tile_ < 0) {
+			for(auto& hex : tiles) {
+				res->emplace_back(&hex);
+			}
+			return;
+		}
+
+		// Every rotation maps the centre tile to the hex at center_ from the
+		// one being matched, so only hexes that far from a terrain the centre
+		// tile accepts can match.
+		const auto& td = tile_data_[center_tile_];
+		const point origin = hmap.getOrigin();
+		for(int id = 0; id != static_cast<int>(by_terrain.size()); ++id) {
+			if(by_terrain[id].empty()) {
+				continue;
+			}
+			bool may_match = false;
+			for(int rot = 0; rot != numRotations() && !may_match; ++rot) {
+				may_match = valid_rotations_[rot] && td->matchTerrain(id, rot) != 0;
+			}
+			if(!may_match) {
+				continue;
+			}
+			for(auto anchor : by_terrain[id]) {
+				const point p = sub_hex_coord(anchor->getPosition() + origin, center_);
+				auto hex = hmap.getTileAt(p + origin);
+				if(hex != nullptr) {
+					res->emplace_back(const_cast<HexObject*>(hex));
+				}
+			}
+		}
+		// Keep map order, which is the order the rule would be applied in.
+		std::sort(res->begin(), res->end());
+		res->erase(std::unique(res->begin(), res->end()), res->end());
+	}
+
+	void TerrainRule::match(HexMap& hmap, const std::vector<std::vector<HexObject*>>& by_terrain)
 	{
 		if(absolute_position_) {
 			ASSERT_LOG(tile_data_.size() != 1, "Number of tiles is not correct in rule.");
-			if(!tile_data_[0]->match(hmap->getTileAt(*absolute_position_), this, std::vector<std::string>(), 0)) {
-				return false;
+			if(!tile_data_[0]->match(hmap.getTileAt(*absolute_position_), 0)) {
+				return;
 			}
 		}
 
 		// check rotations.
 		ASSERT_LOG(rotations_.size() == 6 || rotations_.empty(), "Set of rotations not of size 6(" << rotations_.size() << ").");
 
-		for(auto& hex : hmap->getTilesMutable()) {
-			match(&hex);
+		std::vector<HexObject*> candidates;
+		findCandidates(hmap, by_terrain, &candidates);
+
+		if(!independent_ || !g_hex_parallel_rules || candidates.size() < 256) {
+			for(auto hex : candidates) {
+				match(hex);
+			}
+			return;
+		}
+
+		// Matching only reads the map, so it can be split across threads.
+		// The matches are then applied in map order, as images use the
+		// random number generator.
+		std::vector<std::vector<Match>> matches(candidates.size());
+		threading::thread_pool::shared().parallel_for(static_cast<int>(candidates.size()), [&](int n) {
+			const HexObject* hex = candidates[n];
+			if(mod_position_) {
+				auto& pos = hex->getPosition();
+				if((pos.x % mod_position_->x) != 0 || (pos.y % mod_position_->y) != 0) {
+					return;
+				}
+			}
+			for(int rot = 0; rot != numRotations(); ++rot) {
+				if(!valid_rotations_[rot]) {
+					continue;
+				}
+				Match m;
+				m.rot = rot;
+				if(matchAt(hex, rot, &m.objs)) {
+					matches[n].emplace_back(std::move(m));
+				}
+			}
+		});
+
+		for(int n = 0; n != static_cast<int>(candidates.size()); ++n) {
+			for(const auto& m : matches[n]) {
+				applyMatch(candidates[n], m);
+			}
 		}
-		return false;
 	}
 }
 
@@ -1004,3 +1237,90 @@ UNIT_TEST(pixel_distance)
 	CHECK_EQ(pixel_distance(point(0,0), point(1,0), 72), point(54, -36));
 }
 
+namespace hex
+{
+	void load_tile_data(const variant& v);
+}
+
+namespace
+{
+	std::vector<hex::TerrainRulePtr> test_rules()
+	{
+		static bool tiles_loaded = false;
+		if(!tiles_loaded) {
+			hex::load_tile_data(json::parse("{\"terrain_type\": [{\"string\": \"Zzg\"}, {\"string\": \"Zzw\"}, {\"string\": \"Zzh\"}]}"));
+			tiles_loaded = true;
+		}
+		const char* rules[] = {
+			// order independent, indexed by its centre tile.
+			"{\"rotations\": [\"n\",\"ne\",\"se\",\"s\",\"sw\",\"nw\"], \"tile\": ["
+				"{\"x\": 0, \"y\": 0, \"type\": [\"Zzg\"], \"set_flag\": [\"beach-@R0\"]},"
+				"{\"x\": 0, \"y\": -1, \"type\": [\"Zzw\"], \"set_flag\": [\"shore-@R3\"]}]}",
+			// reads the flags it sets so must be matched in order.
+			"{\"tile\": ["
+				"{\"x\": 0, \"y\": 0, \"type\": [\"Zzh\"], \"set_no_flag\": [\"hill\"]},"
+				"{\"x\": 0, \"y\": -1, \"type\": [\"!\", \"Zzw\"], \"set_no_flag\": [\"hill\"]}]}",
+			// reads flags set by an earlier rule.
+			"{\"tile\": [{\"x\": 0, \"y\": 0, \"type\": [\"*\"], \"has_flag\": [\"beach-n\"], \"set_flag\": [\"coast\"]}]}",
+		};
+		std::vector<hex::TerrainRulePtr> res;
+		for(auto r : rules) {
+			res.emplace_back(hex::TerrainRule::create(json::parse(r)));
+		}
+		return res;
+	}
+
+	hex::HexMapPtr test_map(int width, int height)
+	{
+		const char* types[] = { "Zzg", "Zzw", "Zzh" };
+		std::vector<variant> tiles;
+		for(int y = 0; y != height; ++y) {
+			for(int x = 0; x != width; ++x) {
+				tiles.emplace_back(types[(x*7 + y*13 + (x*y)/5) % 3]);
+			}
+		}
+		std::map<variant, variant> m;
+		m[variant("width")] = variant(width);
+		m[variant("tiles")] = variant(&tiles);
+		return hex::HexMap::create(variant(&m));
+	}
+}
+
+UNIT_TEST(hex_parallel_rules)
+{
+	const auto rules = test_rules();
+	auto hmap = test_map(64, 64);
+	const char* flags[] = { "beach-n", "beach-se", "shore-s", "shore-nw", "hill", "coast" };
+
+	const bool prev = g_hex_parallel_rules;
+	std::vector<std::vector<bool>> results;
+	for(bool parallel : { false, true }) {
+		g_hex_parallel_rules = parallel;
+		hmap->applyRules(rules);
+		results.emplace_back();
+		for(const auto& hex : hmap->getTiles()) {
+			for(auto f : flags) {
+				results.back().push_back(hex.hasFlag(f));
+			}
+		}
+	}
+	g_hex_parallel_rules = prev;
+
+	CHECK(results[0] == results[1], "parallel rule matching gave different flags");
+	CHECK(std::find(results[0].begin(), results[0].end(), true) != results[0].end(), "no rule matched");
+}
+
+BENCHMARK_ARG(hex_apply_rules, bool parallel)
+{
+	const auto rules = test_rules();
+	auto hmap = test_map(256, 256);
+	const bool prev = g_hex_parallel_rules;
+	g_hex_parallel_rules = parallel;
+	BENCHMARK_LOOP {
+		hmap->applyRules(rules);
+	}
+	g_hex_parallel_rules = prev;
+}
+
+BENCHMARK_ARG_CALL(hex_apply_rules, sequential, false);
+BENCHMARK_ARG_CALL(hex_apply_rules, parallel, true);
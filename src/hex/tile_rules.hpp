@@ -60,7 +60,7 @@ namespace hex
 		bool eliminate(const std::vector<std::string>& rotations);
 		std::string toString() const;
 		const std::string& getNameForRotation(int rot);
-		bool isValidForRotation(int rot);
+		bool isValidForRotation(int rot) const;
 		ImageHolder genHolder(int rot, const point& offs);
 	private:
 		int layer_;
@@ -89,10 +89,26 @@ namespace hex
 		const std::vector<point>& getPosition() const { return position_; }
 		void addPosition(const point& p) { position_.emplace_back(p); }
 		int getMapPos() const { return pos_; }
-		bool match(const HexObject* obj, TerrainRule* tr, const std::vector<std::string>& rotations, int rot);
+		// Resolves rotations and the parent rule's default flags into
+		// interned ids. Must be called once the parent rule is complete.
+		void compile(const TerrainRule& tr);
+		// Caches which of the given terrains (indexed by terrain id) each
+		// rotation's type list accepts.
+		void prepare(const std::vector<const HexObject*>& terrains);
+		// 1 or 0 if the rotation's type list is known to accept the terrain
+		// or not, -1 if the terrain wasn't seen by prepare().
+		int matchTerrain(int terrain_id, int rot) const;
+		bool matchType(const HexObject* obj, int rot) const;
+		bool matchFlags(const HexObject* obj, int rot) const;
+		// matchType() and matchFlags(); on success the tile's flags are set
+		// on obj as temporary flags.
+		bool match(const HexObject* obj, int rot) const;
+		void addSetFlags(const HexObject* obj, int rot) const;
+		const std::vector<int>& getSetFlagIds(int rot) const { return rot_set_flags_[rot]; }
+		const std::vector<int>& getHasFlagIds(int rot) const { return rot_has_flags_[rot]; }
+		const std::vector<int>& getNoFlagIds(int rot) const { return rot_no_flags_[rot]; }
 		std::string toString();
 		void applyImage(HexObject* hex, int rot);
-		bool matchFlags(const HexObject* hex, TerrainRule* tr, const std::vector<std::string>& rs=std::vector<std::string>(), int rot=0);
 		void center(const point& from_center, const point& to_center);
 		bool eliminate(const std::vector<std::string>& rotations);
 		bool hasImage() const { return image_ != nullptr; }
@@ -109,6 +125,18 @@ namespace hex
 		std::unique_ptr<TileImage> image_;
 		std::vector<std::vector<point>> pos_rotations_;
 		point min_pos_;
+
+		// Filled by compile(), indexed by rotation.
+		std::vector<std::vector<std::string>> rot_types_;
+		std::vector<std::vector<int>> rot_has_flags_;
+		std::vector<std::vector<int>> rot_no_flags_;
+		std::vector<std::vector<int>> rot_set_flags_;
+		bool types_vary_by_rotation_;
+		// Filled by prepare(): per rotation (or just one when the types
+		// don't vary by rotation), per terrain id, 1/0/-1 as matchTerrain().
+		std::vector<std::vector<signed char>> terrain_matches_;
+
+		bool matchTypeStrings(const std::string& full_type, const std::string& type, int rot) const;
 	};
 
 	typedef std::unique_ptr<TileRule> TileRulePtr;
@@ -124,9 +152,15 @@ namespace hex
 		const std::vector<std::string>& getMap() const { return map_; }
 		const std::vector<std::unique_ptr<TileImage>>& getImages() const { return image_; }
 
-		bool match(const HexMapPtr& hmap);
+		// Applies the rule to every hex of the map it may match, in map
+		// order. by_terrain lists the map's hexes indexed by terrain id.
+		void match(HexMap& hmap, const std::vector<std::vector<HexObject*>>& by_terrain);
 		bool match(HexObject* obj);
 		void preProcessMap(const variant& tiles);
+		// See TileRule::prepare(). Must be called before match(HexMap&, ...)
+		// whenever the set of terrains may have changed.
+		void prepare(const std::vector<const HexObject*>& terrains);
+		int numRotations() const { return rotations_.empty() ? 1 : static_cast<int>(rotations_.size()); }
 
 		static TerrainRulePtr create(const variant& v);
 		void applyImage(HexObject* hex, int rot);
@@ -151,5 +185,24 @@ namespace hex
 		std::vector<std::unique_ptr<TileImage>> image_;
 		std::vector<point> pos_offset_;
 		int probability_;
+
+		// true if applying the rule at one hex can't change whether it
+		// matches at another, so matches may be found in parallel.
+		bool independent_;
+		// Index into tile_data_ of the tile at center_, or -1.
+		int center_tile_;
+		// Filled by prepare().
+		std::vector<char> valid_rotations_;
+
+		struct Match
+		{
+			int rot;
+			std::vector<std::pair<HexObject*, TileRule*>> objs;
+		};
+		void compile();
+		bool isValidRotation(int rot) const;
+		bool matchAt(const HexObject* hex, int rot, std::vector<std::pair<HexObject*, TileRule*>>* objs) const;
+		void applyMatch(HexObject* hex, const Match& m);
+		void findCandidates(HexMap& hmap, const std::vector<std::vector<HexObject*>>& by_terrain, std::vector<HexObject*>* res) const;
 	};
 }
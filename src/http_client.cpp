@@ -228,6 +228,10 @@ void http_client::send_connection_request(connection_ptr conn)
 	if(session_id_ != -1) {
 		msg << "Cookie: session=" << session_id_ << "\r\n";
 	}
+
+	for(const auto& p : request_headers_) {
+		msg << p.first << ": " << p.second << "\r\n";
+	}
 	// replace all the tab characters with spaces before calculating the request size, so 
 	// some http server doesn't get all upset about the length being wrong.
 	boost::replace_all(conn->request, "\t", "    ");
@@ -431,6 +435,7 @@ void http_client::handle_receive(connection_ptr conn, const boost::system::error
 		LOG_INFO("http_client::handle_recv: " << (void*)this << " @" << SDL_GetTicks() << " payload_str.size() = " << payload_str.size() << "\n");
 
 		conn->aborted = true;
+		response_headers_ = conn->headers;
 		conn->handler(payload_str);
 		usable_connections_.push_back(conn->socket);
 	} else {
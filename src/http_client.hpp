@@ -60,6 +60,13 @@ public:
 
 	void set_timeout_and_retry(bool value=true) { timeout_and_retry_ = value; }
 
+	//an extra header to send with every request made after this call.
+	void set_request_header(const std::string& name, const std::string& value) { request_headers_[name] = value; }
+
+	//the headers of the most recent response, with lower-cased keys. Valid
+	//while the response handler is running.
+	const std::map<std::string, std::string>& response_headers() const { return response_headers_; }
+
 private:
 	DECLARE_CALLABLE(http_client)
 	int session_id_;
@@ -131,5 +138,7 @@ private:
 	bool allow_keepalive_;
 	bool timeout_and_retry_;
 
+	std::map<std::string, std::string> request_headers_, response_headers_;
+
 	std::vector<std::weak_ptr<Connection> > connections_monitor_timeout_;
 };
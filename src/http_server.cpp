@@ -437,11 +437,20 @@ namespace http
 			compressed_buf = zip::compress(msg_ref);
 			msg_ptr = &compressed_buf;
 
-			compress_header = "Content-Encoding: deflate\r\n"; 
+			compress_header = "Content-Encoding: deflate"; 
 		}
 
 		const std::string& msg = *msg_ptr;
 
+		std::shared_ptr<std::string> str(new std::string(build_header(type, msg.size(), compress_header.empty() || header_parms.empty() ? compress_header + header_parms : compress_header + "\r\n" + header_parms)));
+		*str += msg;
+
+		boost::asio::async_write(socket->socket, boost::asio::buffer(*str),
+								 std::bind(&web_server::handle_send, this, socket, std::placeholders::_1, std::placeholders::_2, str->size(), str));
+	}
+
+	std::string web_server::build_header(const std::string& type, size_t content_length, const std::string& header_parms) const
+	{
 		std::stringstream buf;
 		buf <<
 			"HTTP/1.1 200 OK\r\n"
@@ -450,18 +459,57 @@ namespace http
 			"Server: Wizard/1.0\r\n"
 			"Accept-Ranges: bytes\r\n"
 			"Access-Control-Allow-Origin: *\r\n"
-			"Content-Type: " << type << "\r\n"
-			"Content-Length: " << std::dec << (int)msg.size() << "\r\n" <<
-			compress_header <<
+			"Content-Type: " << type << "\r\n";
+		if(content_length != UnknownContentLength) {
+			buf << "Content-Length: " << std::dec << content_length << "\r\n";
+		}
+		buf <<
 			"Last-Modified: " << get_http_datetime() << "\r\n" <<
 			(header_parms.empty() ? "" : header_parms + "\r\n")
 			<< "\r\n";
+		return buf.str();
+	}
 
-		std::shared_ptr<std::string> str(new std::string(buf.str()));
-		*str += msg;
-
+	void web_server::send_stream(socket_ptr socket, const std::string& type, size_t content_length, const std::string& header_parms, std::function<bool(std::string*)> next_piece)
+	{
+		std::shared_ptr<std::string> str(new std::string(build_header(type, content_length, header_parms)));
 		boost::asio::async_write(socket->socket, boost::asio::buffer(*str),
-								 std::bind(&web_server::handle_send, this, socket, std::placeholders::_1, std::placeholders::_2, str->size(), str));
+			std::bind(&web_server::send_next_piece, this, socket, std::placeholders::_1, content_length, next_piece, str));
+	}
+
+	void web_server::send_next_piece(socket_ptr socket, const boost::system::error_code& e, size_t remaining, std::function<bool(std::string*)> next_piece, std::shared_ptr<std::string> buf)
+	{
+		if(e) {
+			disconnect(socket);
+			return;
+		}
+
+		//reuse the buffer just written, so a stream only ever holds one piece.
+		buf->clear();
+		if(!next_piece(buf.get())) {
+			if(remaining == UnknownContentLength) {
+				//closing the connection is what marks the end of the body.
+				disconnect(socket);
+			} else if(remaining != 0) {
+				LOG_ERROR("Stream ended " << remaining << " bytes short of its content length");
+				disconnect(socket);
+			} else {
+				keepalive_socket(socket);
+			}
+			return;
+		}
+
+		if(remaining != UnknownContentLength) {
+			if(buf->size() > remaining) {
+				LOG_ERROR("Stream overran its content length by " << (buf->size() - remaining) << " bytes");
+				disconnect(socket);
+				return;
+			}
+
+			remaining -= buf->size();
+		}
+		boost::asio::async_write(socket->socket, boost::asio::buffer(*buf),
+			std::bind(&web_server::send_next_piece, this, socket, std::placeholders::_1, remaining, next_piece, buf));
 	}
 
 	void web_server::send_404(socket_ptr socket)
@@ -25,6 +25,7 @@
 
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
+#include <functional>
 #include <map>
 
 #include "variant.hpp"
@@ -65,6 +66,15 @@ namespace http
 		void handle_accept(socket_ptr socket, const boost::system::error_code& error);
 
 		void send_msg(socket_ptr socket, const std::string& mime_type, const std::string& msg, const std::string& header_parms);
+
+		//sends a response of content_length bytes without holding it all in
+		//memory. next_piece is called each time the previous piece has been
+		//written, and should replace its argument with the next piece of the
+		//body, returning false once there is nothing left. If the length
+		//isn't known up front, pass UnknownContentLength; the body then ends
+		//when the connection is closed.
+		static const size_t UnknownContentLength = static_cast<size_t>(-1);
+		void send_stream(socket_ptr socket, const std::string& mime_type, size_t content_length, const std::string& header_parms, std::function<bool(std::string*)> next_piece);
 		void send_404(socket_ptr socket);
 
 		void handle_send(socket_ptr socket, const boost::system::error_code& e, size_t nbytes, size_t max_bytes, std::shared_ptr<std::string> buf);
@@ -95,6 +105,9 @@ namespace http
 
 		void handle_message(socket_ptr socket, receive_buf_ptr recv_buf);
 
+		std::string build_header(const std::string& mime_type, size_t content_length, const std::string& header_parms) const;
+		void send_next_piece(socket_ptr socket, const boost::system::error_code& e, size_t remaining, std::function<bool(std::string*)> next_piece, std::shared_ptr<std::string> buf);
+
 		virtual variant parse_message(const std::string& msg) const;
 
 		boost::asio::io_service& io_service_;
@@ -107,16 +107,17 @@ namespace gui
 			} else {
 				obj.texture_ = KRE::Texture::createTexture(value);
 			}
+			obj.invalidate();
 			
 		DEFINE_FIELD(area, "[int,int,int,int]")
 			return obj.area_.write();
 		DEFINE_SET_FIELD
-			obj.area_ = rect(value);
+			obj.setArea(rect(value));
 
 		DEFINE_FIELD(rotation, "decimal")
 			return variant(obj.rotate_);
 		DEFINE_SET_FIELD
-			obj.rotate_ = value.as_float();
+			obj.setRotation(value.as_float());
 
 		DEFINE_FIELD(width, "int")
 			return variant(obj.texture_->width());
@@ -161,6 +162,7 @@ namespace gui
 	void GuiSectionWidget::setGuiSection(const std::string& id)
 	{
 		section_ = GuiSection::get(id);
+		invalidate();
 	}
 
 	void GuiSectionWidget::handleDraw() const
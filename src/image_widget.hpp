@@ -42,8 +42,8 @@ namespace gui
 		const rect& area() const { return area_; }
 		const KRE::TexturePtr& tex() const { return texture_; }
 
-		void setRotation(float rotate) { rotate_ = rotate; }
-		void setArea(const rect& area) { area_ = area; }
+		void setRotation(float rotate) { rotate_ = rotate; invalidate(); }
+		void setArea(const rect& area) { area_ = area; invalidate(); }
 
 		WidgetPtr clone() const override;
 	private:
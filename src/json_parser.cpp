@@ -22,6 +22,12 @@
 */
 
 #include <algorithm>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <unordered_map>
 
 #include "asserts.hpp"
 #include "code_editor_dialog.hpp"
@@ -39,8 +45,10 @@
 #include "preferences.hpp"
 #include "preprocessor.hpp"
 #include "string_utils.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 #include "variant_utils.hpp"
+#include "vfs.hpp"
 #include "wml_formula_callable.hpp"
 
 namespace game_logic 
@@ -53,6 +61,14 @@ namespace json
 	namespace 
 	{
 		std::map<std::string, std::string> pseudo_file_contents;
+
+		//files may be parsed from level loading worker threads, so the
+		//cache of parsed files is guarded by this.
+		threading::mutex& parse_cache_mutex()
+		{
+			static threading::mutex* m = new threading::mutex;
+			return *m;
+		}
 	}
 
 	void set_file_contents(const std::string& path, const std::string& contents)
@@ -274,7 +290,9 @@ namespace json
 				macros = &macros_buf;
 			}
 
-			bool use_preprocessor = options == JSON_PARSE_OPTIONS::USE_PREPROCESSOR;
+			//a document without any '@' can't contain preprocessor directives,
+			//so preprocessing it would leave it unchanged.
+			bool use_preprocessor = options == JSON_PARSE_OPTIONS::USE_PREPROCESSOR && doc.find('@') != std::string::npos;
 
 			std::set<std::string>::const_iterator filename_itor = filename_registry.insert(fname).first;
 
@@ -570,6 +588,366 @@ namespace json
 		}
 	}
 
+	namespace 
+	{
+		//Parses a document from a stream, reading it a chunk at a time. Only
+		//the unparsed remainder of the current chunk is kept, growing when a
+		//token spans more than one chunk.
+		class StreamParser
+		{
+		public:
+			//thrown when reject_directives is set and the document contains a
+			//string the preprocessor would act on.
+			struct NeedsPreprocessor {};
+
+			StreamParser(std::istream& in, const std::string& fname, int chunk_size, bool reject_directives=false)
+				: in_(in), fname_(fname), chunk_size_(std::max(chunk_size, 1)), reject_directives_(reject_directives),
+				  buf_(1, '\0'), pos_(0), end_(0), mark_(0), eof_(false), line_(1), column_(1)
+			{
+				debug_info_.filename = &*filename_registry.insert(fname).first;
+			}
+
+			variant parse() {
+				variant result = parseValue(next());
+				const Token t = next();
+				checkParse(t.type == Token::TYPE::NUM_TYPES, "Unexpected characters at end of input");
+				return result;
+			}
+		private:
+			//keys and list elements up to this long are interned, as they're
+			//mostly names and enum-like values repeated throughout a document.
+			static const size_t MaxInternedLength = 32;
+
+			void checkParse(bool cond, const std::string& msg) {
+				if(!cond) {
+					throw ParseError(msg, fname_, line_, column_);
+				}
+			}
+
+			//discards the consumed part of the buffer and reads another chunk
+			//after the rest. Returns false at the end of the stream.
+			bool fill() {
+				if(eof_) {
+					return false;
+				}
+
+				advance(&buf_[mark_], &buf_[pos_]);
+				buf_.erase(buf_.begin(), buf_.begin() + pos_);
+				end_ -= pos_;
+				pos_ = mark_ = 0;
+
+				//the tokenizer may look one past the end, so keep a terminator.
+				buf_.resize(end_ + chunk_size_ + 1);
+				in_.read(&buf_[end_], chunk_size_);
+				const size_t nread = static_cast<size_t>(in_.gcount());
+				end_ += nread;
+				buf_.resize(end_ + 1);
+				buf_[end_] = '\0';
+
+				if(nread == 0) {
+					eof_ = true;
+					return false;
+				}
+
+				return true;
+			}
+
+			void advance(const char* i1, const char* i2) {
+				for(; i1 != i2; ++i1) {
+					if(*i1 == '\n') {
+						++line_;
+						column_ = 0;
+					} else {
+						++column_;
+					}
+				}
+			}
+
+			//The returned token points into the buffer, so is only valid
+			//until the next call.
+			Token next() {
+				for(;;) {
+					const char* begin = &buf_[pos_];
+					const char* i1 = begin;
+					const char* i2 = &buf_[end_];
+					Token t;
+					try {
+						t = get_token(i1, i2);
+					} catch(TokenizerError& e) {
+						//the token may just be cut off at the end of the chunk.
+						if(fill()) {
+							continue;
+						}
+
+						advance(&buf_[mark_], e.loc);
+						checkParse(false, e.msg);
+					}
+
+					//a token that reaches the end of the chunk may continue in
+					//the next one, so read more and tokenize it again.
+					if((t.type == Token::TYPE::NUM_TYPES || i1 == i2) && fill()) {
+						continue;
+					}
+
+					if(t.type != Token::TYPE::NUM_TYPES) {
+						advance(&buf_[mark_], t.begin);
+						mark_ = t.begin - &buf_[0];
+					}
+
+					pos_ += i1 - begin;
+					return t;
+				}
+			}
+
+			//where the string token t is, as the full parser gives it.
+			variant::debug_info stringDebugInfo(const Token& t) const {
+				variant::debug_info info = debug_info_;
+				info.line = info.end_line = line_;
+				info.column = info.end_column = column_;
+				for(const char* i = t.begin; i != t.end; ++i) {
+					if(*i == '\n') {
+						info.end_line++;
+						info.end_column = 0;
+					} else {
+						info.end_column++;
+					}
+				}
+
+				return info;
+			}
+
+			std::string stringText(const Token& t) {
+				std::string s(t.begin, t.end);
+				if(std::find(t.begin, t.end, '\\') != t.end) {
+					escape_string(s);
+				}
+
+				if(reject_directives_ && !s.empty() && s[0] == '@') {
+					throw NeedsPreprocessor();
+				}
+
+				return s;
+			}
+
+			variant internedString(const std::string& s) {
+				if(s.size() > MaxInternedLength) {
+					return variant(s);
+				}
+
+				variant& v = interned_[s];
+				if(v.is_null()) {
+					v = variant(s);
+				}
+
+				return v;
+			}
+
+			//the values of attributes get the file and line they're at, as
+			//the full parser gives them, so errors in FFL from them can be
+			//traced. The debug info belongs to the string, so those can't be
+			//shared.
+			variant stringValue(const Token& t, bool with_debug_info) {
+				if(t.translate || with_debug_info) {
+					const variant::debug_info info = stringDebugInfo(t);
+					variant v = t.translate ? variant::create_translated_string(stringText(t)) : variant(stringText(t));
+					v.setDebugInfo(info);
+					return v;
+				}
+
+				return internedString(stringText(t));
+			}
+
+			variant parseValue(const Token& t, bool is_attribute=false) {
+				switch(t.type) {
+				case Token::TYPE::LCURLY: return parseObject();
+				case Token::TYPE::LSQUARE: return parseArray();
+				case Token::TYPE::STRING: return stringValue(t, is_attribute);
+				case Token::TYPE::NUMBER: {
+					std::string s(t.begin, t.end);
+					if(std::count(s.begin(), s.end(), '.')) {
+						return variant(decimal::from_string(s));
+					}
+
+					return variant(atoi(s.c_str()));
+				}
+				case Token::TYPE::TRUE_VALUE: return variant::from_bool(true);
+				case Token::TYPE::FALSE_VALUE: return variant::from_bool(false);
+				case Token::TYPE::NULL_VALUE: return variant();
+				case Token::TYPE::NUM_TYPES:
+					checkParse(false, "Unexpected end of input");
+				default:
+					checkParse(false, "Unexpected characters: " + std::string(t.begin, t.end));
+				}
+
+				return variant();
+			}
+
+			variant parseObject() {
+				variant::debug_info info = debug_info_;
+				info.line = line_;
+				info.column = column_;
+
+				std::map<variant, variant> obj;
+				for(Token t = next(); t.type != Token::TYPE::RCURLY; t = next()) {
+					checkParse(t.type == Token::TYPE::STRING || t.type == Token::TYPE::IDENTIFIER, t.type == Token::TYPE::NUM_TYPES ? "Unexpected end of input" : "Unexpected characters, when expecting an attribute name");
+
+					const variant::debug_info key_info = stringDebugInfo(t);
+					const std::string key_text = stringText(t);
+					const bool translate_key = t.translate;
+
+					variant key = translate_key ? variant::create_translated_string(key_text) : internedString(key_text);
+					checkParse(obj.count(key) == 0, "Repeated attribute: " + key.write_json());
+
+					t = next();
+					checkParse(t.type == Token::TYPE::COLON, "Unexpected characters, when expecting a ':'");
+
+					const variant value = parseValue(next(), true);
+
+					//only string attributes hold FFL, so only their keys need
+					//to know where they are, as the full parser's keys do.
+					//The keys of everything else stay shared, as the same few
+					//names make up much of a large data file.
+					const bool shared = translate_key == false && key_text.size() <= MaxInternedLength;
+					if(shared && value.is_string()) {
+						key = variant(key_text);
+					}
+
+					if(shared == false || value.is_string()) {
+						key.setDebugInfo(key_info);
+					}
+
+					obj[key] = value;
+
+					t = next();
+					if(t.type == Token::TYPE::RCURLY) {
+						break;
+					}
+
+					checkParse(t.type == Token::TYPE::COMMA, "Unexpected characters, when expecting a ','");
+				}
+
+				info.end_line = line_;
+				info.end_column = column_;
+
+				variant v(&obj);
+				v.setDebugInfo(info);
+				return v;
+			}
+
+			variant parseArray() {
+				variant::debug_info info = debug_info_;
+				info.line = line_;
+				info.column = column_;
+
+				std::vector<variant> array;
+				for(Token t = next(); t.type != Token::TYPE::RSQUARE; t = next()) {
+					array.push_back(parseValue(t));
+
+					t = next();
+					if(t.type == Token::TYPE::RSQUARE) {
+						break;
+					}
+
+					checkParse(t.type == Token::TYPE::COMMA, "Unexpected characters, when expecting a ','");
+				}
+
+				info.end_line = line_;
+				info.end_column = column_;
+
+				variant v(&array);
+				v.setDebugInfo(info);
+				return v;
+			}
+
+			std::istream& in_;
+			std::string fname_;
+			size_t chunk_size_;
+			bool reject_directives_;
+
+			//pos_ is where tokenizing resumes. line_ and column_ are those of
+			//mark_, the start of the last token.
+			std::vector<char> buf_;
+			size_t pos_, end_, mark_;
+			bool eof_;
+
+			variant::debug_info debug_info_;
+			int line_, column_;
+
+			std::unordered_map<std::string, variant> interned_;
+		};
+	}
+
+	variant parse_stream(std::istream& in, const std::string& fname, int chunk_size)
+	{
+		StreamParser parser(in, fname, chunk_size);
+		return parser.parse();
+	}
+
+	namespace
+	{
+		//files at least this big are parsed a chunk at a time rather than
+		//being read into memory whole.
+		const std::streamoff StreamParseMinSize = 256*1024;
+		const int StreamParseChunkSize = 65536;
+
+		//opens fname to be parsed a chunk at a time, if it's a large file on
+		//disk, or stored in a mounted pack, whose contents don't need
+		//checking against the checksums.
+		std::unique_ptr<std::istream> open_large_file(const std::string& fname)
+		{
+			if(checksum::is_verified() || pseudo_file_contents.count(fname)) {
+				return std::unique_ptr<std::istream>();
+			}
+
+			const std::string path = module::map_file(fname);
+			std::unique_ptr<std::istream> in(new std::ifstream(path.c_str(), std::ios_base::binary));
+			if(!*in) {
+				//a packed file is read in place in the pack's mapping.
+				in = vfs::open_mounted_file(path);
+				if(!in) {
+					return std::unique_ptr<std::istream>();
+				}
+			}
+
+			in->seekg(0, std::ios_base::end);
+			const std::streamoff size = in->tellg();
+			in->seekg(0, std::ios_base::beg);
+			if(size < StreamParseMinSize) {
+				return std::unique_ptr<std::istream>();
+			}
+
+			return in;
+		}
+
+		//the same digest md5::sum() gives for the stream's contents, leaving
+		//the stream rewound to the start.
+		std::string stream_md5(std::istream& in)
+		{
+			md5::MD5Context ctx;
+			md5::MD5Init(&ctx);
+
+			std::vector<char> buf(StreamParseChunkSize);
+			while(in.read(&buf[0], buf.size()) || in.gcount() > 0) {
+				md5::MD5Update(&ctx, reinterpret_cast<unsigned char*>(&buf[0]), static_cast<unsigned>(in.gcount()));
+			}
+
+			uint8_t digest[16];
+			md5::MD5Final(digest, &ctx);
+
+			in.clear();
+			in.seekg(0, std::ios_base::beg);
+
+			std::string output;
+			for(const uint8_t c : digest) {
+				char hex[3];
+				sprintf(hex, "%02x", c);
+				output += hex;
+			}
+
+			return output;
+		}
+	}
+
 	variant parse(const std::string& doc, JSON_PARSE_OPTIONS options)
 	{
 		return parse_internal(doc, "", options, nullptr, nullptr);
@@ -578,27 +956,50 @@ namespace json
 	variant parse_from_file(const std::string& fname, JSON_PARSE_OPTIONS options)
 	{
 		try {
-			std::string data = get_file_contents(fname);
+			//large files are parsed straight from disk, so only the digest
+			//is needed up front.
+			std::unique_ptr<std::istream> stream = open_large_file(fname);
+
+			std::string data;
+			if(!stream) {
+				data = get_file_contents(fname);
+			}
 
 			typedef std::pair<std::string, JSON_PARSE_OPTIONS> CacheKey;
 			static std::map<CacheKey, variant> cache;
 
-			CacheKey key(md5::sum(data), options);
-			std::map<CacheKey, variant>::iterator cache_itor = cache.find(key);
-			if(cache_itor != cache.end()) {
-				return cache_itor->second;
+			CacheKey key(stream ? stream_md5(*stream) : md5::sum(data), options);
+			{
+				threading::lock lck(parse_cache_mutex());
+				std::map<CacheKey, variant>::iterator cache_itor = cache.find(key);
+				if(cache_itor != cache.end()) {
+					return cache_itor->second;
+				}
 			}
 
-			checksum::verify_file(fname, data);
+			if(!stream) {
+				checksum::verify_file(fname, data);
 
-			if(data.empty()) {
-				throw ParseError(formatter() << "Could not find file " << fname);
+				if(data.empty()) {
+					throw ParseError(formatter() << "Could not find file " << fname);
+				}
 			}
 
 			variant result;
 		
 			try {
-				result = parse_internal(data, fname, options, nullptr, nullptr);
+				if(stream) {
+					try {
+						StreamParser parser(*stream, fname, StreamParseChunkSize, options == JSON_PARSE_OPTIONS::USE_PREPROCESSOR);
+						result = parser.parse();
+					} catch(StreamParser::NeedsPreprocessor&) {
+						//the document has directives, so needs the full parser.
+						stream.reset();
+						result = parse_internal(get_file_contents(fname), fname, options, nullptr, nullptr);
+					}
+				} else {
+					result = parse_internal(data, fname, options, nullptr, nullptr);
+				}
 			} catch(ParseError& e) {
 				if(!preferences::edit_and_continue()) {
 					throw e;
@@ -617,6 +1018,7 @@ namespace json
 				return parse_from_file(fname, options);
 			}
 
+			threading::lock lck(parse_cache_mutex());
 			for(std::map<CacheKey, variant>::iterator i = cache.begin(); i != cache.end(); ) {
 				if(i->second.refcount() == 1) {
 					cache.erase(i++);
@@ -720,4 +1122,156 @@ namespace json
 		CHECK_EQ(v["b"]["a"], variant(4));
 		CHECK_EQ(v["b"]["z"], variant(5));
 	}
+
+	UNIT_TEST(json_parse_stream)
+	{
+		const std::string docs[] = {
+			"{a: 5, \"b\": [1, 2.5, 'x', true, false, null], c: {d: \"e\\\"f\", g: []}, \"\"\"h\"\"\": \"\"\"multi\nline\"\"\"}",
+			"# comment\n[ {type: \"ant\", x: 100, y: -200}, /* nested /* comment */ */ {type: \"ant\", x: 7, y: 8,}, ]",
+			"\"just a string\"",
+		};
+
+		for(const std::string& doc : docs) {
+			const variant expected = parse(doc, JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+
+			//small chunks make tokens straddle chunk boundaries.
+			for(int chunk_size : { 1, 3, 7, 4096 }) {
+				std::istringstream in(doc);
+				CHECK_EQ(parse_stream(in, "", chunk_size), expected);
+			}
+		}
+
+		//attribute values, such as FFL, know where they are, as they do when
+		//parsed whole.
+		const std::string formula_doc = "{\n  a: 1,\n  on_process: \"set(x, 5)\",\n  b: [\"set(x, 5)\"]\n}";
+		const variant whole = parse(formula_doc, JSON_PARSE_OPTIONS::NO_PREPROCESSOR)[variant("on_process")];
+		for(int chunk_size : { 1, 5, 4096 }) {
+			std::istringstream in(formula_doc);
+			const variant streamed = parse_stream(in, "", chunk_size)[variant("on_process")];
+			CHECK(whole.get_debug_info() != nullptr && streamed.get_debug_info() != nullptr, "Missing debug info");
+			CHECK_EQ(streamed.get_debug_info()->line, whole.get_debug_info()->line);
+			CHECK_EQ(streamed.get_debug_info()->column, whole.get_debug_info()->column);
+		}
+
+		//keys of string attributes know where they are; the keys of other
+		//attributes are shared between maps.
+		const std::string keys_str = "[{a: 1, f: \"x\"}, {a: 2, f: \"y\"}]";
+		std::istringstream keys_in(keys_str);
+		const variant keys_doc = parse_stream(keys_in);
+		const variant whole_key = parse(keys_str, JSON_PARSE_OPTIONS::NO_PREPROCESSOR)[0].getKeys()[1];
+		const std::vector<variant> first_keys = keys_doc[0].getKeys().as_list(), second_keys = keys_doc[1].getKeys().as_list();
+		CHECK(&first_keys[0].as_string() == &second_keys[0].as_string(), "Key of a number wasn't shared");
+		CHECK(first_keys[0].get_debug_info() == nullptr, "Shared key has debug info");
+		CHECK(first_keys[1].get_debug_info() != nullptr, "Key of a string has no debug info");
+		CHECK_EQ(first_keys[1].get_debug_info()->line, whole_key.get_debug_info()->line);
+		CHECK_EQ(first_keys[1].get_debug_info()->column, whole_key.get_debug_info()->column);
+
+		std::istringstream in("{a: 1, a: 2}");
+		bool error = false;
+		try {
+			parse_stream(in);
+		} catch(ParseError&) {
+			error = true;
+		}
+
+		CHECK(error, "Repeated attribute wasn't reported");
+
+		//parse_from_file() relies on directives being caught, so it can hand
+		//those documents to the full parser.
+		std::istringstream directive_in("{a: [1, {b: \"@eval 2+2\"}]}");
+		bool needs_preprocessor = false;
+		try {
+			StreamParser(directive_in, "", 3, true).parse();
+		} catch(StreamParser::NeedsPreprocessor&) {
+			needs_preprocessor = true;
+		}
+
+		CHECK(needs_preprocessor, "Preprocessor directive wasn't detected");
+	}
+
+	namespace 
+	{
+		//a document shaped like a level's list of objects, with the same
+		//keys and many of the same values repeated.
+		const std::string& benchmark_document()
+		{
+			static std::string doc;
+			if(doc.empty()) {
+				std::ostringstream s;
+				s << "{id: \"benchmark.cfg\", character: [\n";
+				for(int n = 0; n != 2000; ++n) {
+					s << "  {type: \"" << (n%3 == 0 ? "ant_black" : "ant_red") << "\", x: " << n*32 << ", y: " << (n%40)*16
+					  << ", face_right: " << (n%2 ? "true" : "false") << ", label: \"_" << n << "\", time_in_frame: 0.5,"
+					  << " vars: {health: 5, state: \"walking\"}},\n";
+				}
+				s << "]}";
+				doc = s.str();
+			}
+
+			return doc;
+		}
+	}
+
+	namespace
+	{
+		//the string data a parsed document keeps alive, counting strings
+		//shared between several places once.
+		void count_strings(const variant& v, std::set<const std::string*>& seen, size_t& bytes)
+		{
+			if(v.is_string()) {
+				if(seen.insert(&v.as_string()).second) {
+					bytes += v.as_string().size();
+				}
+			} else if(v.is_list()) {
+				for(const variant& item : v.as_list()) {
+					count_strings(item, seen, bytes);
+				}
+			} else if(v.is_map()) {
+				for(const variant_pair& p : v.as_map()) {
+					count_strings(p.first, seen, bytes);
+					count_strings(p.second, seen, bytes);
+				}
+			}
+		}
+	}
+
+	//compares what the two parsers hold on to for the benchmark document:
+	//the full parser needs the whole text at once and gives every string
+	//its own allocation, while the stream parser needs a chunk at a time
+	//and shares keys and short values. Run alongside the json_parse and
+	//json_parse_stream benchmarks, and tokenizer_bench, for their speed.
+	UNIT_TEST(json_parse_stream_memory)
+	{
+		const std::string& doc = benchmark_document();
+		const int chunk_size = 4096;
+
+		std::set<const std::string*> whole_strings, streamed_strings;
+		size_t whole_bytes = 0, streamed_bytes = 0;
+		count_strings(parse(doc, JSON_PARSE_OPTIONS::NO_PREPROCESSOR), whole_strings, whole_bytes);
+
+		std::istringstream in(doc);
+		count_strings(parse_stream(in, "", chunk_size), streamed_strings, streamed_bytes);
+
+		LOG_INFO("json_parse: " << doc.size() << " bytes of input held, " << whole_strings.size() << " strings of " << whole_bytes << " bytes");
+		LOG_INFO("json_parse_stream: " << chunk_size << " bytes of input held, " << streamed_strings.size() << " strings of " << streamed_bytes << " bytes");
+
+		CHECK(streamed_strings.size() < whole_strings.size(), "Streamed document doesn't share its strings");
+	}
+
+	BENCHMARK(json_parse)
+	{
+		const std::string& doc = benchmark_document();
+		BENCHMARK_LOOP {
+			parse(doc);
+		}
+	}
+
+	BENCHMARK(json_parse_stream)
+	{
+		const std::string& doc = benchmark_document();
+		BENCHMARK_LOOP {
+			std::istringstream in(doc);
+			parse_stream(in);
+		}
+	}
 }
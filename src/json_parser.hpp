@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <iosfwd>
 #include <string>
 #include "variant.hpp"
 
@@ -35,6 +36,15 @@ namespace json
 	variant parse(const std::string& doc, JSON_PARSE_OPTIONS options=JSON_PARSE_OPTIONS::USE_PREPROCESSOR);
 	variant parse_from_file(const std::string& fname, JSON_PARSE_OPTIONS options=JSON_PARSE_OPTIONS::USE_PREPROCESSOR);
 	variant parse_from_file_or_die(const std::string& fname, JSON_PARSE_OPTIONS options=JSON_PARSE_OPTIONS::USE_PREPROCESSOR);
+
+	// Parses a document read from in a chunk at a time, so the whole text
+	// is never held in memory. No preprocessing is done, so it suits large
+	// data files without @ directives; parse_from_file() uses it for large
+	// files on disk, falling back to the full parser when it meets one.
+	// Debug info is attached as the full parser does it, except to the keys
+	// of attributes whose values aren't strings, which can't hold FFL. Those
+	// keys and short strings in lists are interned.
+	variant parse_stream(std::istream& in, const std::string& fname="", int chunk_size=65536);
 	bool file_exists_and_is_valid(const std::string& fname);
 
 	struct ParseError 
@@ -90,6 +90,27 @@ namespace KRE
 		BGRA_INT,
 	};
 
+	// Texture memory and upload queue figures, for debug displays.
+	struct TextureMemoryStats
+	{
+		TextureMemoryStats() 
+			: resident_textures(0), 
+			  resident_bytes(0), 
+			  pending_uploads(0), 
+			  pending_bytes(0), 
+			  uploaded_bytes(0) 
+		{
+		}
+		// Textures that have GPU storage allocated and the bytes they hold.
+		int resident_textures;
+		size_t resident_bytes;
+		// Textures whose pixels are still queued for upload.
+		int pending_uploads;
+		size_t pending_bytes;
+		// Bytes streamed to the GPU during the last frame.
+		size_t uploaded_bytes;
+	};
+
 	class DisplayDevice
 	{
 	public:
@@ -158,6 +179,8 @@ namespace KRE
 
 		virtual int queryParameteri(DisplayDeviceParameters param) = 0;
 
+		virtual TextureMemoryStats getTextureMemoryStats() const { return TextureMemoryStats(); }
+
 		virtual BlendEquationImplBasePtr getBlendEquationImpl() = 0;
 
 		virtual EffectPtr createEffect(const variant& node) = 0;
@@ -255,7 +255,14 @@ namespace KRE
 
 	void DisplayDeviceOpenGL::swap()
 	{
-		// This is a no-action.
+		// Buffers are swapped by the window, we just stream the textures
+		// that are waiting to be uploaded.
+		OpenGLTexture::processUploads();
+	}
+
+	TextureMemoryStats DisplayDeviceOpenGL::getTextureMemoryStats() const
+	{
+		return OpenGLTexture::getMemoryStats();
 	}
 
 	ShaderProgramPtr DisplayDeviceOpenGL::getDefaultShader()
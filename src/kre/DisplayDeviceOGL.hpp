@@ -78,6 +78,8 @@ namespace KRE
 
 		int queryParameteri(DisplayDeviceParameters param) override;
 
+		TextureMemoryStats getTextureMemoryStats() const override;
+
 		void setViewPort(const rect& vp) override;
 		void setViewPort(int x, int y, int width, int height) override;
 		const rect& getViewPort() const override;
@@ -21,7 +21,9 @@
 	   distribution.
 */
 
+#include <atomic>
 #include <future>
+#include <mutex>
 #include <thread>
 #include <tuple>
 
@@ -46,9 +48,17 @@ namespace KRE
 			return res;
 		}
 
+		// Surfaces may be decoded from files on worker threads, so the cache
+		// and the set of all surfaces are guarded by this.
+		std::mutex& get_surface_mutex()
+		{
+			static std::mutex* res = new std::mutex;
+			return *res;
+		}
+
 		unsigned get_next_id()
 		{
-			static unsigned id = 1;
+			static std::atomic<unsigned> id(1);
 			return id++;
 		}
 
@@ -65,7 +75,11 @@ namespace KRE
 		}
 	}
 
-	const std::set<const Surface*>& Surface::getAllSurfaces() { return getAllSurfacesMutable(); }
+	std::set<const Surface*> Surface::getAllSurfaces()
+	{
+		std::lock_guard<std::mutex> lock(get_surface_mutex());
+		return getAllSurfacesMutable();
+	}
 
 	Surface::Surface()
 		: flags_(SurfaceFlags::NONE),
@@ -75,11 +89,13 @@ namespace KRE
 		  id_(get_next_id()),
 		  alpha_borders_{}
 	{
+		std::lock_guard<std::mutex> lock(get_surface_mutex());
 		getAllSurfacesMutable().insert(this);
 	}
 
 	Surface::~Surface()
 	{
+		std::lock_guard<std::mutex> lock(get_surface_mutex());
 		getAllSurfacesMutable().erase(this);
 	}
 
@@ -136,15 +152,24 @@ namespace KRE
 		ASSERT_LOG(get_surface_creator().empty() == false, "No resources registered to surfaces images from files.");
 		auto create_fn_tuple = get_surface_creator().begin()->second;
 		if(!(flags & SurfaceFlags::NO_CACHE)) {
-			auto it = get_surface_cache().find(filename);
-			if(it != get_surface_cache().end()) {
-				return it->second;
+			{
+				std::lock_guard<std::mutex> lock(get_surface_mutex());
+				auto it = get_surface_cache().find(filename);
+				if(it != get_surface_cache().end()) {
+					return it->second;
+				}
 			}
+
+			// decode without holding the lock so that several threads can
+			// decode different images at once. If another thread decoded
+			// the same image meanwhile, the one cached first wins.
 			auto surface = std::get<0>(create_fn_tuple)(filename, fmt, flags, convert);
 			surface->name_ = filename;
-			get_surface_cache()[filename] = surface;
 			surface->init();
-			return surface;
+
+			std::lock_guard<std::mutex> lock(get_surface_mutex());
+			auto it = get_surface_cache().insert(std::make_pair(filename, surface)).first;
+			return it->second;
 		} 
 		auto surf = std::get<0>(create_fn_tuple)(filename, fmt, flags, convert);
 		surf->name_ = filename;
@@ -312,7 +337,11 @@ namespace KRE
 
 	void Surface::resetSurfaceCache()
 	{
-		get_surface_cache().clear();
+		SurfaceCacheType cache;
+		{
+			std::lock_guard<std::mutex> lock(get_surface_mutex());
+			cache.swap(get_surface_cache());
+		}
 	}
 
 	void Surface::fillRect(const rect& dst_rect, const Color& color)
@@ -21,7 +21,11 @@
 	   distribution.
 */
 
+#include <algorithm>
+#include <deque>
+
 #include "asserts.hpp"
+#include "preferences.hpp"
 #include "profile_timer.hpp"
 #include "DisplayDevice.hpp"
 #include "TextureOGL.hpp"
@@ -54,28 +58,26 @@ namespace KRE
 			return GL_TEXTURE_2D;
 		}
 
+		PREF_BOOL(kre_stream_texture_uploads, true, "Stream the pixels of image textures to the GPU over several frames, rather than uploading them when the texture is created.");
+		PREF_INT(kre_texture_upload_budget_kb, 4096, "Kilobytes of texture data streamed to the GPU each frame.");
+
+		// The id cache and the upload queue are reached from the deleters of
+		// texture ids, which may run during static destruction, so neither
+		// is ever destroyed.
 		typedef std::map<unsigned, std::weak_ptr<GLuint>> texture_id_cache;
 		texture_id_cache& get_id_cache()
 		{
-			static texture_id_cache res;
-			return res;
+			static texture_id_cache* res = new texture_id_cache;
+			return *res;
 		}
 
-		void check_purge_texture_id_cache()
+		// Called when a texture id is released, entries for ids that are
+		// still alive (another texture replaced it) are left alone.
+		void forget_cached_id(unsigned surface_id)
 		{
-			static int ncheck = 0;
-			if(get_id_cache().size() > 512) {
-				if(++ncheck%512 == 0) {
-					auto it = get_id_cache().begin();
-					auto end_it = get_id_cache().end();
-					while(it != end_it) {
-						if(it->second.expired()) {
-							get_id_cache().erase(it++);
-						} else {
-							++it;
-						}
-					}
-				}
+			auto it = get_id_cache().find(surface_id);
+			if(it != get_id_cache().end() && it->second.expired()) {
+				get_id_cache().erase(it);
 			}
 		}
 
@@ -84,12 +86,205 @@ namespace KRE
 			static GLuint res = -1;
 			return res;
 		}
+
+		struct MemoryCounters
+		{
+			MemoryCounters() : resident_textures(0), resident_bytes(0), uploaded_bytes(0), uploaded_bytes_last_frame(0) {}
+			int resident_textures;
+			size_t resident_bytes;
+			size_t uploaded_bytes;
+			size_t uploaded_bytes_last_frame;
+		};
+
+		MemoryCounters& get_memory_counters()
+		{
+			static MemoryCounters* res = new MemoryCounters;
+			return *res;
+		}
+
+		// Pixels of a 2D texture that are still to be sent to the GPU. The
+		// texture's storage is already allocated, rows are uploaded in
+		// order starting at next_row.
+		struct PendingUpload
+		{
+			std::weak_ptr<GLuint> id;
+			SurfacePtr surface;
+			GLenum format;
+			GLenum type;
+			int width;
+			int height;
+			int row_pitch;
+			int unpack_alignment;
+			int next_row;
+		};
+
+		typedef std::map<GLuint, PendingUpload> pending_upload_map;
+		pending_upload_map& get_pending_uploads()
+		{
+			static pending_upload_map* res = new pending_upload_map;
+			return *res;
+		}
+
+		// Order in which textures were queued. Ids that have since been
+		// finished or released are skipped.
+		std::deque<GLuint>& get_upload_order()
+		{
+			static std::deque<GLuint>* res = new std::deque<GLuint>;
+			return *res;
+		}
+
+		const uint8_t* get_row_pixels(const PendingUpload& pu, int row)
+		{
+			return reinterpret_cast<const uint8_t*>(pu.surface->pixels()) + static_cast<size_t>(row) * pu.row_pitch;
+		}
+
+		// Sends nrows rows starting at pu.next_row. pixels points at client
+		// memory, or is an offset into the bound pixel unpack buffer.
+		void upload_rows(GLuint id, PendingUpload& pu, int nrows, const void* pixels)
+		{
+			// This binds on whichever unit is active, which says nothing about
+			// the other units a texture uses, so forget what's bound and have
+			// the next bind() set up every unit again.
+			glBindTexture(GL_TEXTURE_2D, id);
+			get_current_bound_texture() = static_cast<GLuint>(-1);
+			if(pu.unpack_alignment != 4) {
+				glPixelStorei(GL_UNPACK_ALIGNMENT, pu.unpack_alignment);
+			}
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, pu.next_row, pu.width, nrows, pu.format, pu.type, pixels);
+			if(pu.unpack_alignment != 4) {
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			}
+			pu.next_row += nrows;
+			get_memory_counters().uploaded_bytes += static_cast<size_t>(nrows) * pu.row_pitch;
+		}
+
+		// Pixel unpack buffer that queued rows are copied into before being
+		// uploaded, so the driver can transfer them without stalling us.
+		// With ARB_buffer_storage it stays mapped and is split into segments
+		// that are reused once a fence says the GPU has finished with them;
+		// otherwise it is orphaned and re-mapped each frame.
+		class StagingBuffer
+		{
+		public:
+			StagingBuffer() : pbo_(0), segment_size_(0), persistent_(nullptr), segment_(0), offset_(0), mapped_(false) {
+				for(auto& f : fences_) {
+					f = nullptr;
+				}
+			}
+
+			// Returns where to write up to bytes for this frame, or nullptr if
+			// pixel buffers can't be used and rows come from client memory.
+			uint8_t* map(size_t bytes, size_t segment_size) {
+				if(!GLEW_VERSION_2_1 && !GLEW_ARB_pixel_buffer_object) {
+					return nullptr;
+				}
+				if(bytes > segment_size) {
+					return nullptr;
+				}
+				if(pbo_ == 0 || segment_size != segment_size_) {
+					create(segment_size);
+				}
+
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+				if(persistent_ != nullptr) {
+					segment_ = (segment_ + 1) % num_segments;
+					if(fences_[segment_] != nullptr) {
+						glClientWaitSync(fences_[segment_], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+						glDeleteSync(fences_[segment_]);
+						fences_[segment_] = nullptr;
+					}
+					offset_ = segment_ * segment_size_;
+					return persistent_ + offset_;
+				}
+
+				offset_ = 0;
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, segment_size_, nullptr, GL_STREAM_DRAW);
+				void* p = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+				if(p == nullptr) {
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					return nullptr;
+				}
+				mapped_ = true;
+				return static_cast<uint8_t*>(p);
+			}
+
+			// Call when the rows have been written. Returns false if the
+			// contents were lost and rows have to come from client memory.
+			bool unmap() {
+				if(!mapped_) {
+					return true;
+				}
+				mapped_ = false;
+				if(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE) {
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					return false;
+				}
+				return true;
+			}
+
+			const void* source(size_t offset) const {
+				return reinterpret_cast<const void*>(offset_ + offset);
+			}
+
+			// Call after the uploads reading from the buffer have been issued.
+			void finish() {
+				if(persistent_ != nullptr) {
+					fences_[segment_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				}
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+		private:
+			void create(size_t segment_size) {
+				if(pbo_ != 0) {
+					for(auto& f : fences_) {
+						if(f != nullptr) {
+							glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+							glDeleteSync(f);
+							f = nullptr;
+						}
+					}
+					glDeleteBuffers(1, &pbo_);
+				}
+				segment_size_ = segment_size;
+				persistent_ = nullptr;
+				glGenBuffers(1, &pbo_);
+				if(GLEW_ARB_buffer_storage && GLEW_ARB_sync) {
+					const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+					glBufferStorage(GL_PIXEL_UNPACK_BUFFER, segment_size_ * num_segments, nullptr, flags);
+					persistent_ = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, segment_size_ * num_segments, flags));
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					if(persistent_ == nullptr) {
+						// fall back to re-mapping, which needs a fresh buffer
+						// as storage can't be re-specified.
+						glDeleteBuffers(1, &pbo_);
+						glGenBuffers(1, &pbo_);
+					}
+				}
+			}
+
+			static const int num_segments = 3;
+			GLuint pbo_;
+			size_t segment_size_;
+			uint8_t* persistent_;
+			int segment_;
+			size_t offset_;
+			bool mapped_;
+			GLsync fences_[num_segments];
+		};
+
+		StagingBuffer& get_staging_buffer()
+		{
+			static StagingBuffer* res = new StagingBuffer;
+			return *res;
+		}
 	}
 
 	OpenGLTexture::OpenGLTexture(const variant& node, const std::vector<SurfacePtr>& surfaces)
 		: Texture(node, surfaces),
 		  texture_data_(),
-		  is_yuv_planar_(false)
+		  is_yuv_planar_(false),
+		  stream_uploads_(true)
 	{
 		int max_tex_units = DisplayDevice::getCurrent()->queryParameteri(DisplayDeviceParameters::MAX_TEXTURE_UNITS);
 		if(max_tex_units > 0) {
@@ -109,7 +304,8 @@ namespace KRE
 	OpenGLTexture::OpenGLTexture(const std::vector<SurfacePtr>& surfaces, TextureType type, int mipmap_levels)
 		: Texture(surfaces, type, mipmap_levels), 
 		  texture_data_(),
-		  is_yuv_planar_(false)
+		  is_yuv_planar_(false),
+		  stream_uploads_(true)
 	{
 		int max_tex_units = DisplayDevice::getCurrent()->queryParameteri(DisplayDeviceParameters::MAX_TEXTURE_UNITS);
 		if(max_tex_units > 0) {
@@ -128,7 +324,8 @@ namespace KRE
 	OpenGLTexture::OpenGLTexture(int count, int width, int height, int depth, PixelFormat::PF fmt, TextureType type)
 		: Texture(count, width, height, depth, fmt, type),
 		  texture_data_(),
-		  is_yuv_planar_(fmt == PixelFormat::PF::PIXELFORMAT_YV12 ? true : false)
+		  is_yuv_planar_(fmt == PixelFormat::PF::PIXELFORMAT_YV12 ? true : false),
+		  stream_uploads_(false)
 	{
 		int max_tex_units = DisplayDevice::getCurrent()->queryParameteri(DisplayDeviceParameters::MAX_TEXTURE_UNITS);
 		if(max_tex_units > 0) {
@@ -153,6 +350,7 @@ namespace KRE
 
 	void OpenGLTexture::update(int n, int x, int width, void* pixels)
 	{
+		finishUploads();
 		auto& td = texture_data_[n];
 		ASSERT_LOG(is_yuv_planar_ == false, "Use updateYUV to update a YUV texture.");
 		glBindTexture(GetGLTextureType(getType(n)), *td.id);
@@ -170,6 +368,7 @@ namespace KRE
 	// Add a 2D update function which has single stride, but doesn't support planar YUV.
 	void OpenGLTexture::update2D(int n, int x, int y, int width, int height, int stride, const void* pixels)
 	{
+		finishUploads();
 		ASSERT_LOG(is_yuv_planar_ == false, "Use updateYUV to update a YUV texture.");
 		auto& td = texture_data_[n];
 		glBindTexture(GetGLTextureType(getType(n)), *td.id);
@@ -188,6 +387,7 @@ namespace KRE
 
 	void OpenGLTexture::update(int n, int x, int y, int width, int height, const void* pixels)
 	{
+		finishUploads();
 		ASSERT_LOG(is_yuv_planar_ == false, "Use updateYUV to update a YUV texture.");
 		auto& td = texture_data_[n];
 		glBindTexture(GetGLTextureType(getType(n)), *td.id);
@@ -246,6 +446,7 @@ namespace KRE
 
 	void OpenGLTexture::update(int n, int x, int y, int z, int width, int height, int depth, void* pixels)
 	{
+		finishUploads();
 		ASSERT_LOG(is_yuv_planar_ == false, "3D Texture Update function called on YUV planar format.");
 		auto& td = texture_data_[n];
 		glBindTexture(GetGLTextureType(getType(n)), *td.id);
@@ -623,27 +824,71 @@ namespace KRE
 			}
 		}
 
+		unsigned w = is_yuv_planar_ && n>0 ? surfaceWidth(n)/2 : surfaceWidth(n);
+		unsigned h = is_yuv_planar_ && n>0 ? surfaceHeight(n)/2 : surfaceHeight(n);
+		unsigned d = is_yuv_planar_ && n>0 ? actualDepth(n)/2 : actualDepth(n);
+
+		const void* pixels = surf != nullptr ? surf->pixels() : 0;
+
+		// Roughly what the texture takes up on the GPU, for the memory stats.
+		size_t nbytes = pixels != nullptr ? static_cast<size_t>(surf->rowPitch()) * std::max(surf->height(), 1) : static_cast<size_t>(w) * std::max(h, 1U) * 4;
+		if(getType(n) == TextureType::TEXTURE_3D) {
+			nbytes *= std::max(d, 1U);
+		}
+
 		GLuint new_id;
 		glGenTextures(1, &new_id);
-		auto id_ptr = std::shared_ptr<GLuint>(new GLuint(new_id), [](GLuint* id) { glDeleteTextures(1, id); delete id; });
+		const unsigned surface_id = surf != nullptr ? surf->id() : 0;
+		auto id_ptr = std::shared_ptr<GLuint>(new GLuint(new_id), [surface_id, nbytes](GLuint* id) { 
+			glDeleteTextures(1, id); 
+			delete id; 
+			auto& counters = get_memory_counters();
+			--counters.resident_textures;
+			counters.resident_bytes -= nbytes;
+			if(surface_id != 0) {
+				forget_cached_id(surface_id);
+			}
+		});
 		td.id = id_ptr;
 		if(surf) {
 			get_id_cache()[surf->id()] = id_ptr;
-			check_purge_texture_id_cache();
 		}
+		++get_memory_counters().resident_textures;
+		get_memory_counters().resident_bytes += nbytes;
 
 		glBindTexture(GetGLTextureType(getType(n)), *td.id);
 		get_current_bound_texture() = *td.id;
 
-		unsigned w = is_yuv_planar_ && n>0 ? surfaceWidth(n)/2 : surfaceWidth(n);
-		unsigned h = is_yuv_planar_ && n>0 ? surfaceHeight(n)/2 : surfaceHeight(n);
-		unsigned d = is_yuv_planar_ && n>0 ? actualDepth(n)/2 : actualDepth(n);
+		// Storage for image textures is allocated now and the pixels queued
+		// for processUploads(). Mipmapped textures are excluded as their
+		// mipmaps are generated from the pixels in init().
+		const bool stream = stream_uploads_ 
+			&& g_kre_stream_texture_uploads 
+			&& pixels != nullptr 
+			&& getType(n) == TextureType::TEXTURE_2D 
+			&& getMipMapLevels(n) == 0 
+			&& !is_yuv_planar_;
+		if(stream) {
+			PendingUpload pu;
+			pu.id = id_ptr;
+			pu.surface = surf;
+			pu.format = td.format;
+			pu.type = td.type;
+			pu.width = surf->width();
+			pu.height = surf->height();
+			pu.row_pitch = surf->rowPitch();
+			pu.unpack_alignment = getUnpackAlignment(n);
+			pu.next_row = 0;
+			get_pending_uploads()[new_id] = pu;
+			get_upload_order().emplace_back(new_id);
+			glTexImage2D(GL_TEXTURE_2D, 0, td.internal_format, surf->width(), surf->height(), 0, td.format, td.type, 0);
+			return;
+		}
 
 		if(getUnpackAlignment(n) != 4) {
 			glPixelStorei(GL_UNPACK_ALIGNMENT, getUnpackAlignment(n));
 		}
 
-		const void* pixels = surf != nullptr ? surf->pixels() : 0;
 		switch(getType(n)) {
 			case TextureType::TEXTURE_1D:
 				if(pixels == nullptr) {
@@ -765,6 +1010,7 @@ namespace KRE
 
 	void OpenGLTexture::bind(int binding_point) 
 	{
+		finishUploads();
 		// XXX fix this fore multiple texture binding.
 		if(get_current_bound_texture() == *texture_data_[0].id) {
 			return;
@@ -820,8 +1066,127 @@ namespace KRE
 		get_id_cache().clear();
 	}
 
+	void OpenGLTexture::finishUploads() const
+	{
+		auto& pending = get_pending_uploads();
+		if(pending.empty()) {
+			return;
+		}
+		for(auto& td : texture_data_) {
+			if(td.id == nullptr) {
+				continue;
+			}
+			auto it = pending.find(*td.id);
+			if(it == pending.end()) {
+				continue;
+			}
+			auto& pu = it->second;
+			if(!pu.id.expired()) {
+				upload_rows(*td.id, pu, pu.height - pu.next_row, get_row_pixels(pu, pu.next_row));
+			}
+			pending.erase(it);
+		}
+	}
+
+	void OpenGLTexture::processUploads()
+	{
+		auto& counters = get_memory_counters();
+		auto& pending = get_pending_uploads();
+		auto& order = get_upload_order();
+
+		struct Chunk {
+			GLuint id;
+			PendingUpload* upload;
+			int nrows;
+			size_t offset;
+		};
+		std::vector<Chunk> chunks;
+
+		// Work out which rows fit into this frame's budget. Textures are
+		// taken in the order they were queued.
+		const size_t budget = static_cast<size_t>(std::max(g_kre_texture_upload_budget_kb, 1)) * 1024;
+		size_t used = 0;
+		auto oit = order.begin();
+		while(oit != order.end() && used < budget) {
+			auto it = pending.find(*oit);
+			if(it == pending.end() || it->second.id.expired()) {
+				if(it != pending.end()) {
+					pending.erase(it);
+				}
+				oit = order.erase(oit);
+				continue;
+			}
+			auto& pu = it->second;
+			const int rows_left = pu.height - pu.next_row;
+			int nrows = static_cast<int>((budget - used) / pu.row_pitch);
+			if(nrows == 0) {
+				if(used != 0) {
+					break;
+				}
+				// a single row larger than the budget still has to go.
+				nrows = 1;
+			}
+			nrows = std::min(nrows, rows_left);
+			chunks.push_back(Chunk{ *oit, &pu, nrows, used });
+			used += static_cast<size_t>(nrows) * pu.row_pitch;
+			if(nrows != rows_left) {
+				break;
+			}
+			++oit;
+		}
+
+		if(!chunks.empty()) {
+			auto& staging = get_staging_buffer();
+			uint8_t* dst = staging.map(used, budget);
+			if(dst != nullptr) {
+				for(auto& c : chunks) {
+					memcpy(dst + c.offset, get_row_pixels(*c.upload, c.upload->next_row), static_cast<size_t>(c.nrows) * c.upload->row_pitch);
+				}
+				if(!staging.unmap()) {
+					dst = nullptr;
+				}
+			}
+			for(auto& c : chunks) {
+				const void* src = dst != nullptr ? staging.source(c.offset) : get_row_pixels(*c.upload, c.upload->next_row);
+				upload_rows(c.id, *c.upload, c.nrows, src);
+			}
+			if(dst != nullptr) {
+				staging.finish();
+			}
+
+			for(auto& c : chunks) {
+				if(c.upload->next_row == c.upload->height) {
+					pending.erase(c.id);
+				}
+			}
+			while(!order.empty() && pending.find(order.front()) == pending.end()) {
+				order.pop_front();
+			}
+		}
+
+		counters.uploaded_bytes_last_frame = counters.uploaded_bytes;
+		counters.uploaded_bytes = 0;
+	}
+
+	TextureMemoryStats OpenGLTexture::getMemoryStats()
+	{
+		auto& counters = get_memory_counters();
+		TextureMemoryStats stats;
+		stats.resident_textures = counters.resident_textures;
+		stats.resident_bytes = counters.resident_bytes;
+		stats.uploaded_bytes = counters.uploaded_bytes_last_frame;
+		for(auto& p : get_pending_uploads()) {
+			if(!p.second.id.expired()) {
+				++stats.pending_uploads;
+				stats.pending_bytes += static_cast<size_t>(p.second.height - p.second.next_row) * p.second.row_pitch;
+			}
+		}
+		return stats;
+	}
+
 	SurfacePtr OpenGLTexture::extractTextureToSurface(int n) const
 	{
+		finishUploads();
 		auto& td = texture_data_[n];
 		std::vector<uint8_t> new_data;
 		
@@ -26,6 +26,7 @@
 #include <GL/glew.h>
 
 #include "AlignedAllocator.hpp"
+#include "DisplayDevice.hpp"
 #include "Texture.hpp"
 
 namespace KRE
@@ -55,12 +56,20 @@ namespace KRE
 
 		TexturePtr clone() override;
 		static void handleClearTextures();
+
+		// Image textures are allocated straight away but their pixels are
+		// streamed to the GPU a few rows at a time, within a per-frame byte
+		// budget. Call once per frame. A texture whose pixels haven't all
+		// arrived yet is finished on the spot when it is bound or updated.
+		static void processUploads();
+		static TextureMemoryStats getMemoryStats();
 	private:
 		void createTexture(int n);
 		void updatePaletteRow(int index, SurfacePtr new_palette_surface, int palette_width, const std::vector<glm::u8vec4>& pixels);
 		void rebuild() override;
 		void handleAddPalette(int index, const SurfacePtr& palette) override;
 		void handleInit(int n);
+		void finishUploads() const;
 
 		// For YUV family textures we need two more texture id's
 		// since we hold them in seperate textures.
@@ -92,5 +101,8 @@ namespace KRE
 
 		// Set for YUV style textures;
 		bool is_yuv_planar_;
+		// Set for textures created from image surfaces, whose pixel data
+		// may be queued rather than uploaded in createTexture().
+		bool stream_uploads_;
 	};
 }
@@ -331,6 +331,8 @@ namespace KRE
 			}
 #endif
 			if(getDisplayDevice()->ID() == DisplayDevice::DISPLAY_DEVICE_OPENGL || getDisplayDevice()->ID() == DisplayDevice::DISPLAY_DEVICE_OPENGLES) {
+				// let the display device do its end of frame work first.
+				getDisplayDevice()->swap();
 				SDL_GL_SwapWindow(window_.get());
 			} else {
 				// default to delegating to the display device.
@@ -214,6 +214,7 @@ namespace gui
 		if(border_color_) {
 			border_texture_ = KRE::Font::getInstance()->renderText(currentText(), *border_color_, size_, true, font_);
 		}
+		invalidate();
 	}
 
 	void Label::handleDraw() const
@@ -235,6 +236,7 @@ namespace gui
 
 	void Label::setTexture(KRE::TexturePtr t) {
 		texture_ = t;
+		invalidate();
 	}
 
 	bool Label::handleEvent(const SDL_Event& event, bool claimed)
@@ -432,6 +434,7 @@ namespace gui
 			return variant(obj.stages_);
 		DEFINE_SET_FIELD
 			obj.stages_ = value.as_int();
+			obj.invalidate();
 	END_DEFINE_CALLABLE(DialogLabel)
 
 	LabelFactory::LabelFactory(const KRE::Color& color, int size)
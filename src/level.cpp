@@ -71,6 +71,7 @@
 #include "string_utils.hpp"
 #include "surface_palette.hpp"
 #include "thread.hpp"
+#include "thread_pool.hpp"
 #include "tile_map.hpp"
 #include "unit_test.hpp"
 #include "variant_utils.hpp"
@@ -93,6 +94,15 @@ namespace
 	PREF_INT(debug_skip_draw_zorder_begin, INT_MIN, "Avoid drawing the given zorder");
 	PREF_INT(debug_skip_draw_zorder_end, INT_MIN, "Avoid drawing the given zorder");
 	PREF_BOOL(debug_shadows, false, "Show debug visualization of shadow drawing");
+	PREF_INT(parallel_process_threads, 0, "Number of worker threads used to evaluate the process event of objects marked parallel_process ahead of their turn. 0, the default, handles it during their turn. Requires a build with MT_FFL.");
+
+#ifdef MT_FFL
+	threading::thread_pool& get_process_thread_pool()
+	{
+		static threading::thread_pool* pool = new threading::thread_pool("process_objects", g_parallel_process_threads, threading::THREAD_ALLOCATES_COLLECTIBLE_OBJECTS);
+		return *pool;
+	}
+#endif
 
 	LevelPtr& get_current_level() 
 	{
@@ -511,6 +521,7 @@ Level::Level(const std::string& level_cfg, variant node)
 	LOG_INFO("done building..." << profile::get_tick_time());
 
 	auto begin_tile_index = tiles_.size();
+	std::vector<const TileMap*> tile_maps_in_file_order;
 	for(variant tile_node : node["tile_map"].as_list()) {
 		variant tiles_value = tile_node["tiles"];
 		if(!tiles_value.is_string()) {
@@ -533,9 +544,13 @@ Level::Level(const std::string& level_cfg, variant node)
 		TileMap m(tile_node);
 		ASSERT_LOG(tile_maps_.count(m.zorder()) == 0, "repeated zorder in tile map: " << m.zorder());
 		tile_maps_[m.zorder()] = m;
+		tile_maps_in_file_order.push_back(&tile_maps_[m.zorder()]);
+	}
+
+	{
 		const auto before = tiles_.size();
-		tile_maps_[m.zorder()].buildTiles(&tiles_);
-		LOG_INFO("LAYER " << m.zorder() << " BUILT " << (tiles_.size() - before) << " tiles");
+		TileMap::buildTiles(tile_maps_in_file_order, &tiles_);
+		LOG_INFO("BUILT " << (tiles_.size() - before) << " tiles from " << tile_maps_in_file_order.size() << " layers");
 	}
 
 	LOG_INFO("done building tile_map..." << profile::get_tick_time());
@@ -557,6 +572,9 @@ Level::Level(const std::string& level_cfg, variant node)
 		layers_.insert(tiles_[i].zorder);
 	}
 
+	solid_.compact();
+	standable_.compact();
+
 	if(std::adjacent_find(tiles_.rbegin(), tiles_.rend(), level_tile_zorder_pos_comparer()) != tiles_.rend()) {
 		std::sort(tiles_.begin(), tiles_.end(), level_tile_zorder_pos_comparer());
 	}
@@ -851,6 +869,8 @@ void Level::finishLoading()
 				for(const LevelTile& t : sub_level->tiles_) {
 					sub_level->add_tile_solid(t);
 				}
+				sub_level->solid_.compact();
+				sub_level->standable_.compact();
 				sub_level->prepare_tiles_for_drawing();
 
 				sub_level_data data;
@@ -1292,10 +1312,13 @@ void Level::rebuildTiles()
 	}
 
 	tiles_.clear();
+	std::vector<const TileMap*> maps;
 	for(auto& i : tile_maps_) {
-		i.second.buildTiles(&tiles_);
+		maps.push_back(&i.second);
 	}
 
+	TileMap::buildTiles(maps, &tiles_);
+
 	complete_tiles_refresh();
 }
 
@@ -1311,6 +1334,9 @@ void Level::complete_tiles_refresh()
 		layers_.insert(t.zorder);
 	}
 
+	solid_.compact();
+	standable_.compact();
+
 	//LOG_INFO("sorting... " << (profile::get_tick_time() - start));
 
 	if(std::adjacent_find(tiles_.rbegin(), tiles_.rend(), level_tile_zorder_pos_comparer()) != tiles_.rend()) {
@@ -1836,6 +1862,8 @@ void Level::draw_layer(int layer, int x, int y, int w, int h) const
 		return;
 	}
 
+	formula_profiler::Instrument instrumentation("TILES");
+
 	for(auto& i : sub_levels_) {
 		if(i.second.active) {
 			KRE::ModelManager2D matrix_scope(i.second.xoffset, i.second.yoffset);
@@ -2540,8 +2568,13 @@ void Level::draw_debug_solid(int x, int y, int w, int h) const
 				std::vector<glm::u16vec2> v;
 
 				for(int suby = 0; suby != TileSize; ++suby) {
+					const solid_word row = info->bitmap.row(suby);
+					if(row == 0) {
+						continue;
+					}
+
 					for(int subx = 0; subx != TileSize; ++subx) {
-						if(info->bitmap.test(suby*TileSize + subx)) {
+						if((row >> subx)&1) {
 							v.emplace_back(xpixel + subx + 1, ypixel + suby + 1);
 						}
 					}
@@ -2799,6 +2832,7 @@ void Level::do_processing()
 	formula_profiler::Instrument instrumentation("CHARS_PROCESS");
 	while(!active_chars.empty()) {
 		new_chars_.clear();
+		prepare_parallel_processing(active_chars);
 		for(const EntityPtr& c : active_chars) {
 			if(!c->destroyed()) {
 				c->process(*this);
@@ -2819,12 +2853,53 @@ void Level::do_processing()
 	}
 
 	if(water_) {
+		formula_profiler::Instrument instrumentation("WATER");
 		water_->process(*this);
 	}
 
 	solid_chars_.clear();
 }
 
+void Level::prepare_parallel_processing(const std::vector<EntityPtr>& chars)
+{
+	//Objects of types marked parallel_process have their process event
+	//evaluated here on the worker pool, before any object in this batch
+	//gets its turn, and their commands are executed during their turn in
+	//the normal order. The handlers see the state from before the batch
+	//rather than after the object moved, so this is only done when worker
+	//threads are asked for; otherwise every process event is handled
+	//during the object's turn as usual. With workers, nothing is modified
+	//while the events are evaluated, so the result doesn't depend on how
+	//many there are.
+#ifdef MT_FFL
+	if(g_parallel_process_threads <= 0) {
+		return;
+	}
+
+	std::vector<EntityPtr> parallel_chars;
+	for(const EntityPtr& c : chars) {
+		if(!c->destroyed() && c->canProcessInParallel()) {
+			parallel_chars.push_back(c);
+		}
+	}
+
+	if(parallel_chars.empty()) {
+		return;
+	}
+
+	formula_profiler::Instrument instrumentation("PARALLEL_PROCESS");
+
+	//each object gets its own random sequence, based on its position in
+	//the processing order, so the order the threads run in doesn't matter.
+	const unsigned int cycle_seed = static_cast<unsigned int>(cycle_)*2654435761u;
+	auto prepare = [&parallel_chars, cycle_seed, this](int n) {
+		parallel_chars[n]->prepareParallelProcess(cycle_, cycle_seed ^ (static_cast<unsigned int>(n)*40503u));
+	};
+
+	get_process_thread_pool().parallel_for(static_cast<int>(parallel_chars.size()), prepare);
+#endif
+}
+
 void Level::erase_char(EntityPtr c)
 {
 	c->beingRemoved();
@@ -2894,8 +2969,7 @@ bool Level::isSolid(const LevelSolidMap& map, const Entity& e, const std::vector
 				return true;
 			}
 		
-			const int index = y*TileSize + x;
-			if(info->bitmap.test(index)) {
+			if(info->bitmap.test(x, y)) {
 				if(surf_info) {
 					*surf_info = &info->info;
 				}
@@ -2936,8 +3010,7 @@ bool Level::isSolid(const LevelSolidMap& map, int x, int y, const SurfaceInfo**
 			return true;
 		}
 		
-		const int index = y*TileSize + x;
-		if(info->bitmap.test(index)) {
+		if(info->bitmap.test(x, y)) {
 			if(surf_info) {
 				*surf_info = &info->info;
 			}
@@ -2951,16 +3024,109 @@ bool Level::isSolid(const LevelSolidMap& map, int x, int y, const SurfaceInfo**
 	return false;
 }
 
-bool Level::standable(const rect& r, const SurfaceInfo** info) const
+namespace
 {
-	const int ybegin = r.y();
-	const int yend = r.y2();
-	const int xbegin = r.x();
-	const int xend = r.x2();
+	//the tile containing the given pixel coordinate.
+	int pixel_to_tile(int n)
+	{
+		return n >= 0 ? n/TileSize : (n+1)/TileSize - 1;
+	}
+
+	//the lowest set bit of w, or 0 if w is 0.
+	solid_word lowest_bit(solid_word w)
+	{
+		return w & (~w + 1);
+	}
+}
+
+int Level::isSolid(const LevelSolidMap& map, const Entity& e, const std::vector<SolidMap::PointRow>& rows, const SurfaceInfo** surf_info, bool count_all) const
+{
+	const bool face_right = e.isFacingRight();
+	const int frame_width = e.getCurrentFrame().width();
+
+	int count = 0;
+	for(const SolidMap::PointRow& row : rows) {
+		//the level pixels covered by the row are [begin, begin + row.width)
+		//with bit n of bits covering pixel begin + n.
+		const int begin = face_right ? e.x() + row.x : e.x() + frame_width - row.x - row.width;
+		const std::vector<uint64_t>& bits = face_right ? row.bits : row.mirrored;
+
+		const int y = e.y() + row.y;
+		const int tile_y = pixel_to_tile(y);
+		const int suby = y - tile_y*TileSize;
+
+		//visit tiles in the order the points would be visited one at a
+		//time, so surf_info comes from the same tile.
+		const int first_tile = pixel_to_tile(begin);
+		const int last_tile = pixel_to_tile(begin + row.width - 1);
+		for(int n = 0; n <= last_tile - first_tile; ++n) {
+			const int tile_x = face_right ? first_tile + n : last_tile - n;
+			const TileSolidInfo* info = map.find(tile_pos(tile_x, tile_y));
+			if(info == nullptr) {
+				continue;
+			}
+
+			const solid_word points = extract_solid_bits(bits, tile_x*TileSize - begin, TileSize);
+			const solid_word hits = info->all_solid ? points : (points & info->bitmap.row(suby));
+			if(hits == 0) {
+				continue;
+			}
+
+			if(surf_info && count == 0) {
+				*surf_info = &info->info;
+			}
+
+			if(!count_all) {
+				return 1;
+			}
+
+			count += solid_word_popcount(hits);
+		}
+	}
+
+	return count;
+}
+
+bool Level::isSolid(const LevelSolidMap& map, const LevelSolidMap* map2, const rect& r, const SurfaceInfo** surf_info) const
+{
+	if(r.w() <= 0 || r.h() <= 0) {
+		return false;
+	}
+
+	const int first_tile_x = pixel_to_tile(r.x());
+	const int last_tile_x = pixel_to_tile(r.x2() - 1);
+	const int first_tile_y = pixel_to_tile(r.y());
+	const int last_tile_y = pixel_to_tile(r.y2() - 1);
+
+	for(int tile_y = first_tile_y; tile_y <= last_tile_y; ++tile_y) {
+		const int ypixel = tile_y*TileSize;
+		const int ybegin = std::max(r.y(), ypixel) - ypixel;
+		const int yend = std::min(r.y2(), ypixel + TileSize) - ypixel;
+
+		for(int y = ybegin; y != yend; ++y) {
+			for(int tile_x = first_tile_x; tile_x <= last_tile_x; ++tile_x) {
+				const tile_pos pos(tile_x, tile_y);
+				const TileSolidInfo* a = map.find(pos);
+				const TileSolidInfo* b = map2 ? map2->find(pos) : nullptr;
+				if(a == nullptr && b == nullptr) {
+					continue;
+				}
+
+				const int xpixel = tile_x*TileSize;
+				const solid_word mask = solid_word_mask(std::max(r.x(), xpixel) - xpixel, std::min(r.x2(), xpixel + TileSize) - xpixel);
+				const solid_word bits_a = a == nullptr ? 0 : (a->all_solid ? mask : (a->bitmap.row(y) & mask));
+				const solid_word bits_b = b == nullptr ? 0 : (b->all_solid ? mask : (b->bitmap.row(y) & mask));
+				if(bits_a == 0 && bits_b == 0) {
+					continue;
+				}
+
+				if(surf_info) {
+					//the leftmost solid pixel is the one found first, with
+					//map taking precedence over map2 at the same pixel.
+					const bool use_a = bits_a != 0 && (bits_b == 0 || lowest_bit(bits_a) <= lowest_bit(bits_b));
+					*surf_info = use_a ? &a->info : &b->info;
+				}
 
-	for(int y = ybegin; y != yend; ++y) {
-		for(int x = xbegin; x != xend; ++x) {
-			if(standable(x, y, info)) {
 				return true;
 			}
 		}
@@ -2969,6 +3135,11 @@ bool Level::standable(const rect& r, const SurfaceInfo** info) const
 	return false;
 }
 
+bool Level::standable(const rect& r, const SurfaceInfo** info) const
+{
+	return isSolid(solid_, &standable_, r, info);
+}
+
 bool Level::standable(int x, int y, const SurfaceInfo** info) const
 {
 	if(isSolid(solid_, x, y, info) || isSolid(standable_, x, y, info)) {
@@ -2998,39 +3169,28 @@ bool Level::solid(const Entity& e, const std::vector<point>& points, const Surfa
 	return isSolid(solid_, e, points, info);
 }
 
-bool Level::solid(int xbegin, int ybegin, int w, int h, const SurfaceInfo** info) const
+bool Level::solid(const Entity& e, const SolidMap& m, MOVE_DIRECTION dir, const SurfaceInfo** info) const
 {
-	const int xend = xbegin + w;
-	const int yend = ybegin + h;
+	return isSolid(solid_, e, m.dirRows(dir), info, false) != 0;
+}
 
-	for(int y = ybegin; y != yend; ++y) {
-		for(int x = xbegin; x != xend; ++x) {
-			if(solid(x, y, info)) {
-				return true;
-			}
-		}
+int Level::count_solid(const Entity& e, const SolidMap& m, MOVE_DIRECTION dir) const
+{
+	return isSolid(solid_, e, m.dirRows(dir), nullptr, true);
+}
+
+bool Level::solid(int xbegin, int ybegin, int w, int h, const SurfaceInfo** info) const
+{
+	if(w <= 0 || h <= 0) {
+		return false;
 	}
 
-	return false;
+	return isSolid(solid_, nullptr, rect(xbegin, ybegin, w, h), info);
 }
 
 bool Level::solid(const rect& r, const SurfaceInfo** info) const
 {
-	//TODO: consider optimizing this function.
-	const int ybegin = r.y();
-	const int yend = r.y2();
-	const int xbegin = r.x();
-	const int xend = r.x2();
-
-	for(int y = ybegin; y != yend; ++y) {
-		for(int x = xbegin; x != xend; ++x) {
-			if(solid(x, y, info)) {
-				return true;
-			}
-		}
-	}
-
-	return false;
+	return isSolid(solid_, nullptr, r, info);
 }
 
 bool Level::may_be_solid_in_rect(const rect& r) const
@@ -3513,7 +3673,6 @@ void Level::setSolid(LevelSolidMap& map, int x, int y, int friction, int tractio
 		pos.second--;
 		y += TileSize;
 	}
-	const int index = y*TileSize + x;
 	TileSolidInfo& info = map.insertOrFind(pos);
 
 	if(info.info.damage >= 0) {
@@ -3525,14 +3684,14 @@ void Level::setSolid(LevelSolidMap& map, int x, int y, int friction, int tractio
 	if(solid) {
 		info.info.friction = friction;
 		info.info.traction = traction;
-		info.bitmap.set(index);
+		info.bitmap.set(x, y);
 	} else {
 		if(info.all_solid) {
 			info.all_solid = false;
-			info.bitmap.set();
+			info.bitmap.setAll();
 		}
 
-		info.bitmap.reset(index);
+		info.bitmap.reset(x, y);
 	}
 
 	if(info_str.empty() == false) {
@@ -5094,6 +5253,16 @@ BENCHMARK(level_solid)
 	}
 }
 
+BENCHMARK(level_solid_rect)
+{
+	//benchmark which tells us how long Level::solid takes for an
+	//object-sized rect, which tests a row of a tile at a time.
+	static Level* lvl = new Level("stairway-to-heaven.cfg");
+	BENCHMARK_LOOP {
+		lvl->solid(rect(rng::generate()%1000, rng::generate()%1000, 40, 60));
+	}
+}
+
 BENCHMARK(load_nene)
 {
 	BENCHMARK_LOOP {
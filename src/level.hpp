@@ -50,6 +50,7 @@
 #include "level_object.hpp"
 #include "level_solid_map.hpp"
 #include "random.hpp"
+#include "solid_map.hpp"
 #include "speech_dialog.hpp"
 #include "tile_map.hpp"
 #include "variant.hpp"
@@ -122,6 +123,12 @@ public:
 	bool standable_tile(int x, int y, const SurfaceInfo** info=nullptr) const;
 	bool solid(int x, int y, const SurfaceInfo** info=nullptr) const;
 	bool solid(const Entity& e, const std::vector<point>& points, const SurfaceInfo** info=nullptr) const;
+
+	//whether any of the points on the given side of an object's solid map
+	//are solid, and how many. Equivalent to testing m.dir(dir) point by
+	//point, but tests a row of points against a tile at a time.
+	bool solid(const Entity& e, const SolidMap& m, MOVE_DIRECTION dir, const SurfaceInfo** info=nullptr) const;
+	int count_solid(const Entity& e, const SolidMap& m, MOVE_DIRECTION dir) const;
 	bool solid(const rect& r, const SurfaceInfo** info=nullptr) const;
 	bool solid(int xbegin, int ybegin, int w, int h, const SurfaceInfo** info=nullptr) const;
 	bool may_be_solid_in_rect(const rect& r) const;
@@ -455,6 +462,7 @@ private:
 	void prepare_tiles_for_drawing();
 
 	void do_processing();
+	void prepare_parallel_processing(const std::vector<EntityPtr>& chars);
 
 	void calculateLighting(int x, int y, int w, int h) const;
 
@@ -499,6 +507,12 @@ private:
 
 	bool isSolid(const LevelSolidMap& map, int x, int y, const SurfaceInfo** surf_info) const;
 	bool isSolid(const LevelSolidMap& map, const Entity& e, const std::vector<point>& points, const SurfaceInfo** surf_info) const;
+	int isSolid(const LevelSolidMap& map, const Entity& e, const std::vector<SolidMap::PointRow>& rows, const SurfaceInfo** surf_info, bool count_all) const;
+
+	//whether any pixel in r is solid in map, or in map2 if given. surf_info
+	//is set as if the pixels had been tested one at a time, left to right
+	//and top to bottom, testing map before map2.
+	bool isSolid(const LevelSolidMap& map, const LevelSolidMap* map2, const rect& r, const SurfaceInfo** surf_info) const;
 
 	void setSolid(LevelSolidMap& map, int x, int y, int friction, int traction, int damage, const std::string& info, bool solid=true);
 
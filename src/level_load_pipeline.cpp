@@ -0,0 +1,424 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+
+#include "Surface.hpp"
+
+#include "asserts.hpp"
+#include "custom_object_type.hpp"
+#include "json_parser.hpp"
+#include "level.hpp"
+#include "level_load_pipeline.hpp"
+#include "load_level.hpp"
+#include "loading_screen.hpp"
+#include "thread_pool.hpp"
+
+namespace
+{
+	threading::thread_pool& loader_pool()
+	{
+#ifdef MT_FFL
+		return threading::thread_pool::shared();
+#else
+		//only ever decodes images, so it needn't be able to run FFL.
+		static threading::thread_pool* pool = new threading::thread_pool("level_loader", std::max(1, SDL_GetCPUCount() - 1));
+		return *pool;
+#endif
+	}
+
+	//whether a stage which creates variants may run on a worker.
+	bool variant_stages_on_workers(const std::string& level_cfg)
+	{
+#ifdef MT_FFL
+		//save files set the save slot preference as they're read, so keep
+		//them on the main thread.
+		return level_cfg != "autosave.cfg" && level_cfg.substr(0, 4) != "save";
+#else
+		return false;
+#endif
+	}
+
+	bool is_image_name(const std::string& s)
+	{
+		static const char* const extensions[] = { ".png", ".jpg", ".jpeg" };
+		for(const char* ext : extensions) {
+			const size_t len = strlen(ext);
+			if(s.size() > len && std::equal(s.end() - len, s.end(), ext)) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	//finds every image named by an 'image' or 'images' attribute anywhere in
+	//the given document.
+	void collect_images(const variant& v, std::set<std::string>* images)
+	{
+		if(v.is_list()) {
+			for(const variant& item : v.as_list()) {
+				collect_images(item, images);
+			}
+		} else if(v.is_map()) {
+			for(const auto& p : v.as_map()) {
+				if(p.first.is_string() && (p.first.as_string() == "image" || p.first.as_string() == "images")) {
+					if(p.second.is_string() && is_image_name(p.second.as_string())) {
+						images->insert(p.second.as_string());
+					} else if(p.second.is_list()) {
+						for(const variant& item : p.second.as_list()) {
+							if(item.is_string() && is_image_name(item.as_string())) {
+								images->insert(item.as_string());
+							}
+						}
+					}
+				} else {
+					collect_images(p.second, images);
+				}
+			}
+		}
+	}
+
+	std::string object_file_id(const std::string& type)
+	{
+		return std::string(type.begin(), std::find(type.begin(), type.end(), '.'));
+	}
+}
+
+std::shared_ptr<LevelLoadPipeline> LevelLoadPipeline::create(const std::string& level_cfg)
+{
+	return std::shared_ptr<LevelLoadPipeline>(new LevelLoadPipeline(level_cfg));
+}
+
+LevelLoadPipeline::LevelLoadPipeline(const std::string& level_cfg)
+	: level_cfg_(level_cfg), jobs_outstanding_(0)
+{
+	//make sure the object paths are loaded here, not lazily on a worker.
+	CustomObjectType::getObjectPath("");
+
+	const bool on_workers = variant_stages_on_workers(level_cfg);
+
+	addStage(STAGE::PARSE, "Loading level", !on_workers, std::vector<STAGE>(),
+		[]() { return 1; },
+		[this](int) { parse(); });
+
+	addStage(STAGE::OBJECT_FILES, "Loading objects", !on_workers, { STAGE::PARSE },
+		[this]() { object_nodes_.resize(object_files_.size()); return static_cast<int>(object_files_.size()); },
+		[this](int n) { loadObjectFile(n); });
+
+	addStage(STAGE::SURFACES, "Loading images", false, { STAGE::PARSE, STAGE::OBJECT_FILES },
+		[this]() {
+			std::sort(images_.begin(), images_.end());
+			images_.erase(std::unique(images_.begin(), images_.end()), images_.end());
+			return static_cast<int>(images_.size());
+		},
+		[this](int n) { decodeSurface(n); });
+
+	addStage(STAGE::OBJECT_TYPES, "Loading objects", true, { STAGE::OBJECT_FILES },
+		[this]() { return static_cast<int>(object_types_.size()); },
+		[this](int n) { loadObjectType(n); });
+
+	addStage(STAGE::UPLOAD, "Building level", true, { STAGE::PARSE, STAGE::OBJECT_TYPES, STAGE::SURFACES },
+		[]() { return 1; },
+		[this](int) { upload(); });
+}
+
+LevelLoadPipeline::~LevelLoadPipeline()
+{
+	threading::lock l(mutex_);
+	while(jobs_outstanding_ > 0) {
+		item_done_.wait(mutex_);
+	}
+}
+
+void LevelLoadPipeline::addStage(STAGE id, const char* message, bool main_thread, const std::vector<STAGE>& depends, std::function<int()> count, std::function<void(int)> run)
+{
+	Stage& s = stages_[static_cast<int>(id)];
+	s.message = message;
+	s.main_thread = main_thread;
+	s.depends = depends;
+	s.count = count;
+	s.run = run;
+}
+
+void LevelLoadPipeline::start()
+{
+	std::vector<std::function<void()>> jobs;
+	{
+		threading::lock l(mutex_);
+		startReadyStages(&jobs);
+	}
+
+	for(auto& job : jobs) {
+		loader_pool().submit(job);
+	}
+}
+
+bool LevelLoadPipeline::isReady(const Stage& s) const
+{
+	if(s.started) {
+		return false;
+	}
+
+	for(STAGE dep : s.depends) {
+		if(stages_[static_cast<int>(dep)].done() == false) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void LevelLoadPipeline::startReadyStages(std::vector<std::function<void()>>* jobs)
+{
+	if(error_) {
+		return;
+	}
+
+	//starting a stage with no items completes it at once, which may make
+	//further stages ready, so keep going until nothing changes.
+	bool started_any = true;
+	while(started_any) {
+		started_any = false;
+		for(int id = 0; id != static_cast<int>(STAGE::NUM_STAGES); ++id) {
+			Stage& s = stages_[id];
+			if(s.main_thread || !isReady(s)) {
+				continue;
+			}
+
+			s.started = true;
+			s.items = s.count();
+			started_any = true;
+
+			jobs_outstanding_ += s.items;
+			for(int n = 0; n != s.items; ++n) {
+				jobs->push_back([this, id, n]() {
+					std::exception_ptr error;
+					try {
+						stages_[id].run(n);
+					} catch(...) {
+						error = std::current_exception();
+					}
+
+					std::vector<std::function<void()>> next_jobs;
+					{
+						threading::lock l(mutex_);
+						completeItem(static_cast<STAGE>(id), error);
+						startReadyStages(&next_jobs);
+					}
+
+					for(auto& job : next_jobs) {
+						loader_pool().submit(job);
+					}
+
+					threading::lock l(mutex_);
+					--jobs_outstanding_;
+					item_done_.notify_all();
+				});
+			}
+		}
+	}
+}
+
+void LevelLoadPipeline::completeItem(STAGE id, std::exception_ptr error)
+{
+	++stages_[static_cast<int>(id)].completed;
+	if(error && !error_) {
+		error_ = error;
+	}
+
+	item_done_.notify_all();
+}
+
+void LevelLoadPipeline::drawProgress(LoadingScreen* screen, const char* message)
+{
+	int items = 0, completed = 0;
+	{
+		threading::lock l(mutex_);
+		for(const Stage& s : stages_) {
+			//a stage that hasn't started yet counts as a single item.
+			items += s.started ? s.items : 1;
+			completed += s.completed;
+		}
+	}
+
+	screen->setNumberOfItems(items);
+	screen->setStatus(completed);
+	screen->draw(message);
+}
+
+void LevelLoadPipeline::runMainStage(Stage& s, LoadingScreen* screen)
+{
+	const STAGE id = static_cast<STAGE>(&s - stages_);
+	for(int n = 0; n != s.items; ++n) {
+		if(screen) {
+			drawProgress(screen, s.message);
+		}
+
+		std::exception_ptr error;
+		try {
+			s.run(n);
+		} catch(...) {
+			error = std::current_exception();
+		}
+
+		threading::lock l(mutex_);
+		completeItem(id, error);
+	}
+
+	//this may have made worker stages ready.
+	start();
+}
+
+bool LevelLoadPipeline::canPreload(const std::string& level_cfg)
+{
+	return variant_stages_on_workers(level_cfg);
+}
+
+void LevelLoadPipeline::preload()
+{
+	//parsing on the calling thread would stall the game while it plays, so
+	//only preload when every stage up to SURFACES can run in the background.
+	if(!canPreload(level_cfg_)) {
+		return;
+	}
+
+	start();
+}
+
+ffl::IntrusivePtr<Level> LevelLoadPipeline::finish(LoadingScreen* screen)
+{
+	start();
+
+	for(;;) {
+		Stage* main_stage = nullptr;
+		const char* message = "Loading level";
+		{
+			threading::lock l(mutex_);
+			if(error_) {
+				while(jobs_outstanding_ > 0) {
+					item_done_.wait(mutex_);
+				}
+
+				std::rethrow_exception(error_);
+			}
+
+			if(stages_[static_cast<int>(STAGE::UPLOAD)].done()) {
+				break;
+			}
+
+			for(Stage& s : stages_) {
+				if(s.main_thread && isReady(s)) {
+					s.started = true;
+					s.items = s.count();
+					main_stage = &s;
+					break;
+				}
+
+				if(s.started && !s.done()) {
+					message = s.message;
+				}
+			}
+
+			if(main_stage == nullptr) {
+				item_done_.wait_timeout(mutex_, screen ? 30 : 1000);
+			}
+		}
+
+		if(main_stage != nullptr) {
+			runMainStage(*main_stage, screen);
+		} else if(screen) {
+			drawProgress(screen, message);
+		}
+	}
+
+	//the parsed object files were only kept for the object type stage.
+	object_nodes_.clear();
+
+	return level_;
+}
+
+void LevelLoadPipeline::parse()
+{
+	node_ = load_level_wml_nowait(level_cfg_);
+
+	std::set<std::string> types, images;
+	for(const variant& c : node_["character"].as_list()) {
+		if(c["type"].is_string()) {
+			types.insert(c["type"].as_string());
+		}
+	}
+
+	collect_images(node_, &images);
+
+	object_types_.assign(types.begin(), types.end());
+	images_.assign(images.begin(), images.end());
+
+	std::set<std::string> files;
+	for(const std::string& type : object_types_) {
+		files.insert(object_file_id(type));
+	}
+
+	object_files_.assign(files.begin(), files.end());
+}
+
+void LevelLoadPipeline::loadObjectFile(int n)
+{
+	const std::string* path = CustomObjectType::getObjectPath(object_files_[n] + ".cfg");
+	if(path == nullptr) {
+		//leave it for loading the type to report.
+		return;
+	}
+
+	const variant node = json::parse_from_file(*path);
+	object_nodes_[n] = node;
+
+	std::set<std::string> images;
+	collect_images(node, &images);
+
+	threading::lock l(mutex_);
+	images_.insert(images_.end(), images.begin(), images.end());
+}
+
+void LevelLoadPipeline::decodeSurface(int n)
+{
+	try {
+		KRE::Surface::create(images_[n]);
+	} catch(KRE::ImageLoadError&) {
+		//reported when the level actually tries to use the image.
+	}
+}
+
+void LevelLoadPipeline::loadObjectType(int n)
+{
+	CustomObjectType::get(object_types_[n]);
+}
+
+void LevelLoadPipeline::upload()
+{
+	level_.reset(new Level(level_cfg_, node_));
+	level_->finishLoading();
+}
@@ -0,0 +1,146 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "thread.hpp"
+#include "variant.hpp"
+
+class Level;
+class LoadingScreen;
+
+// Loads a level as a set of stages, each of which starts as soon as the
+// stages it depends on are done:
+//
+//   PARSE         read and parse the level file.
+//   OBJECT_FILES  read and parse the files of the object types the level
+//                 places. (PARSE)
+//   SURFACES      decode every image named by the level or its object
+//                 types into the surface cache. (PARSE, OBJECT_FILES)
+//   OBJECT_TYPES  load the object types, compiling their FFL. (OBJECT_FILES)
+//   UPLOAD        construct the level, building its tile maps and
+//                 uploading its textures. (PARSE, OBJECT_TYPES, SURFACES)
+//
+// SURFACES runs on worker threads, one job per image. PARSE and
+// OBJECT_FILES create variants, so they run on a worker thread only when
+// FFL is built to be thread safe (MT_FFL). OBJECT_TYPES and UPLOAD create
+// textures and so always run on the main thread.
+class LevelLoadPipeline
+{
+public:
+	enum class STAGE { PARSE, OBJECT_FILES, SURFACES, OBJECT_TYPES, UPLOAD, NUM_STAGES };
+
+	static std::shared_ptr<LevelLoadPipeline> create(const std::string& level_cfg);
+
+	// Waits for any work still running on worker threads.
+	~LevelLoadPipeline();
+
+	// Starts any stages which may run off the main thread and are ready.
+	// Returns immediately.
+	void start();
+
+	// Whether preload() can do anything for the given level: PARSE and
+	// OBJECT_FILES have to be able to run on workers.
+	static bool canPreload(const std::string& level_cfg);
+
+	// Gets as much going in the background as possible for a level that
+	// will be loaded later. Never runs a stage on the calling thread, so
+	// this does nothing unless canPreload() is true. Must be called from
+	// the main thread.
+	void preload();
+
+	// Runs the main thread stages and waits for the rest, then returns the
+	// loaded level, with finishLoading() called. Must be called from the
+	// main thread. If screen is given, progress is drawn to it.
+	ffl::IntrusivePtr<Level> finish(LoadingScreen* screen=nullptr);
+
+	const std::string& levelCfg() const { return level_cfg_; }
+private:
+	explicit LevelLoadPipeline(const std::string& level_cfg);
+	LevelLoadPipeline(const LevelLoadPipeline&);
+	void operator=(const LevelLoadPipeline&);
+
+	struct Stage {
+		Stage() : message(""), main_thread(true), started(false), items(0), completed(0)
+		{}
+
+		const char* message;
+		std::vector<STAGE> depends;
+		bool main_thread;
+
+		// Called once the stage's dependencies are done to find how many
+		// items of work it has. The items of a stage off the main thread
+		// may be run in parallel with each other.
+		std::function<int()> count;
+		std::function<void(int)> run;
+
+		bool started;
+		int items, completed;
+
+		bool done() const { return started && completed == items; }
+	};
+
+	void addStage(STAGE id, const char* message, bool main_thread, const std::vector<STAGE>& depends, std::function<int()> count, std::function<void(int)> run);
+
+	// These must be called with mutex_ locked.
+	bool isReady(const Stage& s) const;
+	void startReadyStages(std::vector<std::function<void()>>* jobs);
+	void completeItem(STAGE id, std::exception_ptr error);
+
+	void drawProgress(LoadingScreen* screen, const char* message);
+
+	// Runs every item of a main thread stage which is ready.
+	void runMainStage(Stage& s, LoadingScreen* screen);
+
+	void parse();
+	void loadObjectFile(int n);
+	void decodeSurface(int n);
+	void loadObjectType(int n);
+	void upload();
+
+	std::string level_cfg_;
+	Stage stages_[static_cast<int>(STAGE::NUM_STAGES)];
+
+	threading::mutex mutex_;
+	threading::condition item_done_;
+	int jobs_outstanding_;
+	std::exception_ptr error_;
+
+	variant node_;
+	std::vector<std::string> object_types_;
+	std::vector<std::string> object_files_;
+
+	// holds the parsed object files until their types are loaded, so the
+	// parse cache keeps them.
+	std::vector<variant> object_nodes_;
+
+	std::vector<std::string> images_;
+
+	ffl::IntrusivePtr<Level> level_;
+};
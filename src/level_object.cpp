@@ -906,7 +906,7 @@ void LevelObject::setPalette(unsigned int palette)
 		int id = 0;
 		while(p != 0) {
 			if(p & 1) {
-				t_->setPalette(id);
+				graphics::set_texture_palette(t_, id);
 				LOG_DEBUG("set palette to id: " << id << "(" << graphics::get_palette_name(id) << ") on texture: " << image_ << ", result: " << t_->getPalette(0) << ", has_palette: " << (t_->isPaletteized() ? "true" : "false"));
 				break;
 			}
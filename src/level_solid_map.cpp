@@ -21,12 +21,15 @@
 	   distribution.
 */
 
-
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <set>
 
+#include "asserts.hpp"
 #include "level_solid_map.hpp"
 #include "preferences.hpp"
+#include "unit_test.hpp"
 
 namespace 
 {
@@ -47,199 +50,297 @@ const std::string* SurfaceInfo::get_info_str(const std::string& key)
 	return &*info_set.insert(key).first;
 }
 
-LevelSolidMap::LevelSolidMap()
+bool TileBitmap::any() const
 {
-}
+	if(!rows_) {
+		return false;
+	}
 
-LevelSolidMap::LevelSolidMap(const LevelSolidMap& m)
-{
+	for(int y = 0; y != TileSize; ++y) {
+		if(rows_->words[y]) {
+			return true;
+		}
+	}
+
+	return false;
 }
 
-LevelSolidMap& LevelSolidMap::operator=(const LevelSolidMap& m)
+void TileBitmap::reset(int x, int y)
 {
-	return *this;
+	if(rows_) {
+		mutableRows()[y] &= ~(solid_word(1) << x);
+	}
 }
 
-LevelSolidMap::~LevelSolidMap()
+void TileBitmap::setAll()
 {
-	clear();
+	solid_word* words = mutableRows();
+	const solid_word full = solid_word_mask(0, TileSize);
+	for(int y = 0; y != TileSize; ++y) {
+		words[y] = full;
+	}
 }
 
-TileSolidInfo& LevelSolidMap::insertOrFind(const tile_pos& pos)
+void TileBitmap::merge(const TileBitmap& b)
 {
-	TileSolidInfo** result = insertRaw(pos);
-	if(!*result) {
-		*result = new TileSolidInfo;
+	if(!b.rows_ || rows_ == b.rows_) {
+		return;
 	}
 
-	return **result;
+	if(!rows_) {
+		rows_ = b.rows_;
+		return;
+	}
+
+	solid_word* words = mutableRows();
+	for(int y = 0; y != TileSize; ++y) {
+		words[y] |= b.rows_->words[y];
+	}
 }
 
-TileSolidInfo** LevelSolidMap::insertRaw(const tile_pos& pos)
+bool TileBitmap::operator==(const TileBitmap& b) const
 {
-	row* r = nullptr;
-	if(pos.second >= 0) {
-		if(positive_rows_.size() <= static_cast<unsigned>(pos.second)) {
-			positive_rows_.resize(pos.second + 1);
-		}
+	if(rows_ == b.rows_) {
+		return true;
+	}
 
-		r = &positive_rows_[pos.second];
-	} else {
-		const int index = -(pos.second+1);
-		if(negative_rows_.size() <= static_cast<unsigned>(index)) {
-			negative_rows_.resize(index + 1);
+	for(int y = 0; y != TileSize; ++y) {
+		if(row(y) != b.row(y)) {
+			return false;
 		}
+	}
+
+	return true;
+}
 
-		r = &negative_rows_[index];
+solid_word* TileBitmap::mutableRows()
+{
+	if(!rows_) {
+		ASSERT_LOG(TileSize <= MAX_TILE_SIZE, "Tile size " << TileSize << " is larger than the maximum of " << MAX_TILE_SIZE);
+		rows_ = std::make_shared<Rows>();
+	} else if(rows_.use_count() > 1) {
+		rows_ = std::make_shared<Rows>(*rows_);
 	}
 
-	if(pos.first >= 0) {
-		if(r->positive_cells.size() <= static_cast<unsigned>(pos.first)) {
-			r->positive_cells.resize(pos.first + 1);
-		}
+	return rows_->words;
+}
 
-		return &r->positive_cells[pos.first];
-	} else {
-		const int index = -(pos.first+1);
-		if(r->negative_cells.size() <= static_cast<unsigned>(index)) {
-			r->negative_cells.resize(index + 1);
-		}
+LevelSolidMap::LevelSolidMap() : x_(0), y_(0), w_(0), h_(0)
+{
+}
 
-		return &r->negative_cells[index];
-	}
+LevelSolidMap::LevelSolidMap(const LevelSolidMap& m) : x_(0), y_(0), w_(0), h_(0)
+{
 }
 
-const TileSolidInfo* LevelSolidMap::find(const tile_pos& pos) const
+LevelSolidMap& LevelSolidMap::operator=(const LevelSolidMap& m)
 {
-	const row* r = nullptr;
-	if(pos.second >= 0) {
-		if(static_cast<unsigned>(pos.second) < positive_rows_.size()) {
-			r = &positive_rows_[pos.second];
-		} else {
-			return nullptr;
-		}
-	} else {
-		const int index = -(pos.second+1);
-		if(static_cast<unsigned>(index) < negative_rows_.size()) {
-			r = &negative_rows_[index];
-		} else {
-			return nullptr;
-		}
-	}
+	return *this;
+}
 
-	if(pos.first >= 0) {
-		if(static_cast<unsigned>(pos.first) < r->positive_cells.size()) {
-			return r->positive_cells[pos.first];
-		} else {
-			return nullptr;
-		}
-	} else {
-		const int index = -(pos.first+1);
-		if(static_cast<unsigned>(index) < r->negative_cells.size()) {
-			return r->negative_cells[index];
+LevelSolidMap::~LevelSolidMap()
+{
+}
+
+TileSolidInfo& LevelSolidMap::insertOrFind(const tile_pos& pos)
+{
+	reserve(pos);
+
+	int& index = cells_[(pos.second - y_)*w_ + pos.first - x_];
+	if(index < 0) {
+		if(free_.empty() == false) {
+			index = free_.back();
+			free_.pop_back();
 		} else {
-			return nullptr;
+			index = static_cast<int>(tiles_.size());
+			tiles_.push_back(TileSolidInfo());
 		}
 	}
-}
 
-void LevelSolidMap::erase(const tile_pos& pos)
-{
-	TileSolidInfo** info = insertRaw(pos);
-	delete *info;
-	*info = nullptr;
+	return tiles_[index];
 }
 
-void LevelSolidMap::clear()
+void LevelSolidMap::reserve(const tile_pos& pos)
 {
-	for(row& r : positive_rows_) {
-		for(TileSolidInfo* info : r.positive_cells) {
-			delete info;
-		}
+	if(pos.first >= x_ && pos.second >= y_ && pos.first < x_ + w_ && pos.second < y_ + h_) {
+		return;
+	}
 
-		for(TileSolidInfo* info : r.negative_cells) {
-			delete info;
-		}
+	int x1 = x_, y1 = y_, x2 = x_ + w_, y2 = y_ + h_;
+	if(w_ == 0) {
+		x1 = x2 = pos.first;
+		y1 = y2 = pos.second;
+		++x2;
+		++y2;
 	}
 
-	for(row& r : negative_rows_) {
-		for(TileSolidInfo* info : r.positive_cells) {
-			delete info;
-		}
+	//grow by at least half again in any direction we grow in, so a map
+	//built up a tile at a time isn't copied for every tile.
+	const int xslack = std::max(4, w_/2);
+	const int yslack = std::max(4, h_/2);
+	if(pos.first < x1) {
+		x1 = pos.first - xslack;
+	} else if(pos.first >= x2) {
+		x2 = pos.first + 1 + xslack;
+	}
 
-		for(TileSolidInfo* info : r.negative_cells) {
-			delete info;
-		}
+	if(pos.second < y1) {
+		y1 = pos.second - yslack;
+	} else if(pos.second >= y2) {
+		y2 = pos.second + 1 + yslack;
+	}
+
+	std::vector<int> cells((x2 - x1)*(y2 - y1), -1);
+	for(int y = 0; y != h_; ++y) {
+		std::copy(cells_.begin() + y*w_, cells_.begin() + (y+1)*w_, cells.begin() + (y + y_ - y1)*(x2 - x1) + x_ - x1);
 	}
 
-	positive_rows_.clear();
-	negative_rows_.clear();
+	cells_.swap(cells);
+	x_ = x1;
+	y_ = y1;
+	w_ = x2 - x1;
+	h_ = y2 - y1;
 }
 
-void LevelSolidMap::merge(const LevelSolidMap& map, int xoffset, int yoffset)
+void LevelSolidMap::erase(const tile_pos& pos)
 {
-	for(int n = 0; n != map.negative_rows_.size(); ++n) {
-		for(int m = 0; m != map.negative_rows_[n].negative_cells.size(); ++m) {
-			const tile_pos pos(-m - 1 + xoffset, -n - 1 + yoffset);
-			TileSolidInfo& dst = insertOrFind(pos);
-			const TileSolidInfo* src = map.negative_rows_[n].negative_cells[m];
-			if(!src) {
-				continue;
-			}
+	if(find(pos) == nullptr) {
+		return;
+	}
 
-			dst.all_solid = dst.all_solid || src->all_solid;
-			merge_SurfaceInfo(dst.info, src->info);
-			if(!dst.all_solid) {
-				dst.bitmap = dst.bitmap | src->bitmap;
-			}
-		}
+	int& index = cells_[(pos.second - y_)*w_ + pos.first - x_];
+	tiles_[index] = TileSolidInfo();
+	free_.push_back(index);
+	index = -1;
+}
 
-		for(int m = 0; m != map.negative_rows_[n].positive_cells.size(); ++m) {
-			const tile_pos pos(m + xoffset, -n - 1 + yoffset);
-			TileSolidInfo& dst = insertOrFind(pos);
-			const TileSolidInfo* src = map.negative_rows_[n].positive_cells[m];
-			if(!src) {
+void LevelSolidMap::clear()
+{
+	x_ = y_ = w_ = h_ = 0;
+	cells_.clear();
+	tiles_.clear();
+	free_.clear();
+}
+
+void LevelSolidMap::merge(const LevelSolidMap& map, int xoffset, int yoffset)
+{
+	for(int y = 0; y != map.h_; ++y) {
+		for(int x = 0; x != map.w_; ++x) {
+			const int index = map.cells_[y*map.w_ + x];
+			if(index < 0) {
 				continue;
 			}
 
-			dst.all_solid = dst.all_solid || src->all_solid;
-			merge_SurfaceInfo(dst.info, src->info);
+			const TileSolidInfo& src = map.tiles_[index];
+			TileSolidInfo& dst = insertOrFind(tile_pos(map.x_ + x + xoffset, map.y_ + y + yoffset));
+
+			dst.all_solid = dst.all_solid || src.all_solid;
+			merge_SurfaceInfo(dst.info, src.info);
 			if(!dst.all_solid) {
-				dst.bitmap = dst.bitmap | src->bitmap;
+				dst.bitmap.merge(src.bitmap);
 			}
 		}
 	}
+}
 
-	for(int n = 0; n != map.positive_rows_.size(); ++n) {
-		for(int m = 0; m != map.positive_rows_[n].negative_cells.size(); ++m) {
-			const tile_pos pos(-m - 1 + xoffset, n + yoffset);
-			TileSolidInfo& dst = insertOrFind(pos);
-			const TileSolidInfo* src = map.positive_rows_[n].negative_cells[m];
-			if(!src) {
-				continue;
-			}
+void LevelSolidMap::compact()
+{
+	struct RowsLess {
+		bool operator()(const TileBitmap::Rows* a, const TileBitmap::Rows* b) const {
+			return memcmp(a->words, b->words, TileSize*sizeof(solid_word)) < 0;
+		}
+	};
 
-			dst.all_solid = dst.all_solid || src->all_solid;
-			merge_SurfaceInfo(dst.info, src->info);
-			if(!dst.all_solid) {
-				dst.bitmap = dst.bitmap | src->bitmap;
-			}
+	std::map<const TileBitmap::Rows*, std::shared_ptr<TileBitmap::Rows>, RowsLess> unique_rows;
+
+	const solid_word full = solid_word_mask(0, TileSize);
+	for(TileSolidInfo& info : tiles_) {
+		if(!info.bitmap.rows_) {
+			continue;
 		}
 
-		for(int m = 0; m != map.positive_rows_[n].positive_cells.size(); ++m) {
-			const tile_pos pos(m + xoffset, n + yoffset);
-			const TileSolidInfo* src = map.positive_rows_[n].positive_cells[m];
-			if(!src) {
-				continue;
-			}
+		bool empty = true, all_solid = true;
+		for(int y = 0; y != TileSize; ++y) {
+			const solid_word w = info.bitmap.rows_->words[y];
+			empty = empty && w == 0;
+			all_solid = all_solid && w == full;
+		}
 
-			TileSolidInfo& dst = insertOrFind(pos);
+		if(empty || all_solid || info.all_solid) {
+			info.all_solid = info.all_solid || all_solid;
+			info.bitmap.rows_.reset();
+			continue;
+		}
 
-			dst.all_solid = dst.all_solid || src->all_solid;
-			merge_SurfaceInfo(dst.info, src->info);
-			if(!dst.all_solid) {
-				dst.bitmap = dst.bitmap | src->bitmap;
-			}
+		auto itor = unique_rows.find(info.bitmap.rows_.get());
+		if(itor == unique_rows.end()) {
+			unique_rows[info.bitmap.rows_.get()] = info.bitmap.rows_;
+		} else {
+			info.bitmap.rows_ = itor->second;
 		}
 	}
 }
+
+int LevelSolidMap::numDistinctBitmaps() const
+{
+	std::set<const TileBitmap::Rows*> rows;
+	for(const TileSolidInfo& info : tiles_) {
+		if(info.bitmap.rows_) {
+			rows.insert(info.bitmap.rows_.get());
+		}
+	}
+
+	return static_cast<int>(rows.size());
+}
+
+UNIT_TEST(level_solid_map_bits)
+{
+	std::vector<solid_word> words(2);
+	words[0] = solid_word(1) << 63;
+	words[1] = 0x5;
+
+	CHECK_EQ(extract_solid_bits(words, 63, 4), 0xB);
+	CHECK_EQ(extract_solid_bits(words, -2, 4), 0);
+	CHECK_EQ(extract_solid_bits(words, -1, 64), 0);
+	CHECK_EQ(extract_solid_bits(words, 64, 64), 0x5);
+	CHECK_EQ(extract_solid_bits(words, 65, 8), 0x2);
+	CHECK_EQ(extract_solid_bits(words, 200, 8), 0);
+	CHECK_EQ(solid_word_mask(2, 5), 0x1C);
+	CHECK_EQ(solid_word_mask(0, 64), ~solid_word(0));
+	CHECK_EQ(solid_word_popcount(0xF0F0), 8);
+}
+
+UNIT_TEST(level_solid_map_compact)
+{
+	LevelSolidMap map;
+	for(int n = -3; n != 3; ++n) {
+		TileSolidInfo& info = map.insertOrFind(tile_pos(n*7, n));
+		info.bitmap.set(1, 2);
+		info.bitmap.set(TileSize-1, TileSize-1);
+	}
+
+	map.insertOrFind(tile_pos(100, 0)).bitmap.setAll();
+	map.insertOrFind(tile_pos(101, 0)).bitmap.set(0, 0);
+	map.insertOrFind(tile_pos(101, 0)).bitmap.reset(0, 0);
+
+	CHECK_EQ(map.numTiles(), 8);
+	CHECK_EQ(map.numDistinctBitmaps(), 8);
+
+	map.compact();
+
+	CHECK_EQ(map.numTiles(), 8);
+	CHECK_EQ(map.numDistinctBitmaps(), 1);
+	CHECK(map.find(tile_pos(100, 0))->all_solid, "full tile not made all_solid");
+	CHECK(map.find(tile_pos(101, 0))->bitmap.empty(), "empty tile kept its bitmap");
+	CHECK(map.find(tile_pos(1, 0)) == nullptr, "unexpected tile");
+
+	//writing to a shared bitmap must not affect the tiles sharing it.
+	map.insertOrFind(tile_pos(0, 0)).bitmap.reset(1, 2);
+	CHECK(map.find(tile_pos(0, 0))->bitmap.test(1, 2) == false, "bitmap not written");
+	CHECK(map.find(tile_pos(7, 1))->bitmap.test(1, 2), "shared bitmap modified");
+	CHECK(map.find(tile_pos(-21, -3))->bitmap.test(TileSize-1, TileSize-1), "shared bitmap modified");
+
+	map.erase(tile_pos(7, 1));
+	CHECK(map.find(tile_pos(7, 1)) == nullptr, "tile not erased");
+	CHECK_EQ(map.numTiles(), 7);
+}
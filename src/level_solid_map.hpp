@@ -23,10 +23,16 @@
 
 #pragma once
 
-#include <boost/dynamic_bitset.hpp>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #ifndef MAX_TILE_SIZE
 #define MAX_TILE_SIZE 64
 #endif
@@ -37,7 +43,63 @@ extern int g_tile_size;
 #define TileSize (g_tile_size*g_tile_scale)
 
 typedef std::pair<int,int> tile_pos;
-typedef boost::dynamic_bitset<> tile_bitmap;
+
+//solidity is stored as one word per row of a tile, so a tile can't be
+//wider than a word.
+typedef uint64_t solid_word;
+static_assert(MAX_TILE_SIZE <= 64, "MAX_TILE_SIZE must fit in a solid_word");
+
+inline int solid_word_popcount(solid_word w)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+	return static_cast<int>(__popcnt64(w));
+#elif defined(_MSC_VER)
+	return static_cast<int>(__popcnt(static_cast<uint32_t>(w)) + __popcnt(static_cast<uint32_t>(w >> 32)));
+#else
+	return __builtin_popcountll(w);
+#endif
+}
+
+//a mask with bits [begin, end) set.
+inline solid_word solid_word_mask(int begin, int end)
+{
+	const solid_word upto_end = end >= 64 ? ~solid_word(0) : ((solid_word(1) << end) - 1);
+	return upto_end & ~((solid_word(1) << begin) - 1);
+}
+
+//the bits [offset, offset+count) of the bit string held in words, shifted
+//down to start at bit 0. Bits outside the string, including at negative
+//offsets, read as zero. count must be at most 64.
+inline solid_word extract_solid_bits(const std::vector<solid_word>& words, int offset, int count)
+{
+	int shift = 0;
+	if(offset < 0) {
+		shift = -offset;
+		if(shift >= count) {
+			return 0;
+		}
+
+		offset = 0;
+	}
+
+	const size_t word = offset/64;
+	const int bit = offset%64;
+
+	solid_word result = 0;
+	if(word < words.size()) {
+		result = words[word] >> bit;
+		if(bit && word+1 < words.size()) {
+			result |= words[word+1] << (64 - bit);
+		}
+	}
+
+	result <<= shift;
+	if(count < 64) {
+		result &= (solid_word(1) << count) - 1;
+	}
+
+	return result;
+}
 
 struct SurfaceInfo 
 {
@@ -48,15 +110,50 @@ struct SurfaceInfo
 	static const std::string* get_info_str(const std::string& key);
 };
 
+//The solid pixels of a tile, as one word per row with bit x of row y set
+//when pixel (x,y) is solid. A tile with no solid pixels has no storage at
+//all. The rows are copy-on-write, so tiles with identical bitmaps can
+//share them; see LevelSolidMap::compact().
+class TileBitmap
+{
+public:
+	bool empty() const { return !rows_; }
+	solid_word row(int y) const { return rows_ ? rows_->words[y] : 0; }
+	bool test(int x, int y) const { return ((row(y) >> x)&1) != 0; }
+	bool any() const;
+
+	void set(int x, int y) { mutableRows()[y] |= solid_word(1) << x; }
+	void reset(int x, int y);
+	void setAll();
+	void merge(const TileBitmap& b);
+	bool operator==(const TileBitmap& b) const;
+private:
+	friend class LevelSolidMap;
+
+	struct Rows {
+		solid_word words[MAX_TILE_SIZE];
+	};
+
+	solid_word* mutableRows();
+
+	std::shared_ptr<Rows> rows_;
+};
+
 struct TileSolidInfo 
 {
-	TileSolidInfo() : bitmap(TileSize*TileSize), all_solid(false)
+	TileSolidInfo() : all_solid(false)
 	{}
-	tile_bitmap bitmap;
+	TileBitmap bitmap;
 	SurfaceInfo info;
 	bool all_solid;
 };
 
+//Solidity of a level, by tile. Tiles are kept in one contiguous array with
+//a grid of indexes into it covering the bounding box of the tiles stored,
+//so a lookup is a bounds check and two array reads.
+//
+//Pointers and references returned remain valid until the next call to a
+//non-const member.
 class LevelSolidMap 
 {
 public:
@@ -65,18 +162,38 @@ public:
 	LevelSolidMap& operator=(const LevelSolidMap& m);
 	~LevelSolidMap();
 	TileSolidInfo& insertOrFind(const tile_pos& pos);
-	const TileSolidInfo* find(const tile_pos& pos) const;
+	const TileSolidInfo* find(const tile_pos& pos) const {
+		const unsigned x = static_cast<unsigned>(pos.first - x_);
+		const unsigned y = static_cast<unsigned>(pos.second - y_);
+		if(x >= static_cast<unsigned>(w_) || y >= static_cast<unsigned>(h_)) {
+			return nullptr;
+		}
+
+		const int index = cells_[y*w_ + x];
+		return index < 0 ? nullptr : &tiles_[index];
+	}
+
 	void erase(const tile_pos& pos);
 	void clear();
 
 	void merge(const LevelSolidMap& m, int xoffset, int yoffset);
-private:
 
-	TileSolidInfo** insertRaw(const tile_pos& pos);
+	//Makes tiles with identical bitmaps share them, drops the storage of
+	//tiles with no solid pixels and turns tiles with every pixel solid into
+	//all_solid tiles. Call after building the map.
+	void compact();
 
-	struct row {
-		std::vector<TileSolidInfo*> positive_cells, negative_cells;
-	};
+	int numTiles() const { return static_cast<int>(tiles_.size() - free_.size()); }
+	int numDistinctBitmaps() const;
+private:
+	void reserve(const tile_pos& pos);
+
+	//the grid covers tiles [x_, x_+w_) x [y_, y_+h_), each cell holding the
+	//index of the tile in tiles_ or -1.
+	int x_, y_, w_, h_;
+	std::vector<int> cells_;
+	std::vector<TileSolidInfo> tiles_;
 
-	std::vector<row> positive_rows_, negative_rows_;
+	//indexes in tiles_ of erased tiles, available for reuse.
+	std::vector<int> free_;
 };
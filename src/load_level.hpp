@@ -26,6 +26,7 @@
 #include "variant.hpp"
 
 class Level;
+class LoadingScreen;
 
 struct load_level_manager 
 {
@@ -43,6 +44,8 @@ variant load_level_wml(const std::string& lvl);
 variant load_level_wml_nowait(const std::string& lvl);
 
 void preload_level(const std::string& lvl);
-ffl::IntrusivePtr<Level> load_level(const std::string& lvl);
+// Loads a level, using the work already done if it was preloaded. If
+// screen is given, loading progress is drawn to it.
+ffl::IntrusivePtr<Level> load_level(const std::string& lvl, LoadingScreen* screen=nullptr);
 
 std::vector<std::string> get_known_levels();
@@ -21,10 +21,14 @@
 	   distribution.
 */
 
+#include <map>
+#include <memory>
+
 #include "asserts.hpp"
 #include "filesystem.hpp"
 #include "json_parser.hpp"
 #include "level.hpp"
+#include "level_load_pipeline.hpp"
 #include "load_level.hpp"
 #include "module.hpp"
 #include "preferences.hpp"
@@ -38,10 +42,48 @@ namespace
 		static std::map<std::string,std::string> res;
 		return res;
 	}
+
+	struct PreloadedLevel
+	{
+		std::shared_ptr<LevelLoadPipeline> pipeline;
+
+		//preloads are evicted oldest first.
+		int sequence;
+
+		//the level file's modification time and size when it was preloaded,
+		//so a preload of a level that has since been edited isn't used.
+		long long mod_time;
+		long long file_size;
+	};
+
+	//levels which have been preloaded but not loaded yet.
+	std::map<std::string, PreloadedLevel>& preloaded_levels() {
+		static std::map<std::string, PreloadedLevel> res;
+		return res;
+	}
+
+	const size_t MaxPreloadedLevels = 4;
+
+	void level_file_fingerprint(const std::string& lvl, long long* mod_time, long long* size)
+	{
+		*mod_time = 0;
+		*size = 0;
+		auto itor = module::find(get_level_paths(), lvl);
+		if(itor != get_level_paths().end()) {
+			*mod_time = sys::file_mod_time(itor->second);
+			*size = sys::file_size(itor->second);
+		}
+	}
+
+	bool is_save_file(const std::string& lvl)
+	{
+		return lvl == "autosave.cfg" || (lvl.size() >= 7 && lvl.substr(0,4) == "save" && lvl.substr(lvl.size()-4) == ".cfg");
+	}
 }
 
 void reload_level_paths() 
 {
+	preloaded_levels().clear();
 	get_level_paths().clear();
 	load_level_paths();
 }
@@ -97,17 +139,58 @@ load_level_manager::load_level_manager()
 
 load_level_manager::~load_level_manager()
 {
+	preloaded_levels().clear();
 }
 
 void preload_level(const std::string& lvl)
 {
+	//save files may change before they're loaded, so aren't worth preloading.
+	if(is_save_file(lvl) || preloaded_levels().count(lvl) || !LevelLoadPipeline::canPreload(lvl)) {
+		return;
+	}
+
+	//the pipeline may look the level up from a worker thread.
+	if(get_level_paths().empty()) {
+		load_level_paths();
+	}
+
+	if(preloaded_levels().size() >= MaxPreloadedLevels) {
+		auto oldest = preloaded_levels().begin();
+		for(auto i = preloaded_levels().begin(); i != preloaded_levels().end(); ++i) {
+			if(i->second.sequence < oldest->second.sequence) {
+				oldest = i;
+			}
+		}
+		preloaded_levels().erase(oldest);
+	}
+
+	static int sequence = 0;
+
+	PreloadedLevel& entry = preloaded_levels()[lvl];
+	entry.sequence = sequence++;
+	level_file_fingerprint(lvl, &entry.mod_time, &entry.file_size);
+	entry.pipeline = LevelLoadPipeline::create(lvl);
+	entry.pipeline->preload();
 }
 
-ffl::IntrusivePtr<Level> load_level(const std::string& lvl)
+ffl::IntrusivePtr<Level> load_level(const std::string& lvl, LoadingScreen* screen)
 {
-	ffl::IntrusivePtr<Level> res(new Level(lvl));
-	res->finishLoading();
-	return res;
+	std::shared_ptr<LevelLoadPipeline> pipeline;
+	auto itor = preloaded_levels().find(lvl);
+	if(itor != preloaded_levels().end()) {
+		long long mod_time = 0, file_size = 0;
+		level_file_fingerprint(lvl, &mod_time, &file_size);
+		if(mod_time == itor->second.mod_time && file_size == itor->second.file_size) {
+			pipeline = itor->second.pipeline;
+		}
+		preloaded_levels().erase(itor);
+	}
+
+	if(!pipeline) {
+		pipeline = LevelLoadPipeline::create(lvl);
+	}
+
+	return pipeline->finish(screen);
 }
 
 namespace 
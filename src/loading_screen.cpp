@@ -144,6 +144,11 @@ void LoadingScreen::setNumberOfItems(int items)
 	items_ = items;
 }
 
+void LoadingScreen::setStatus(int status)
+{
+	status_ = status;
+}
+
 void LoadingScreen::finishLoading()
 {
 	// display the splash screen for a minimum amount of time, if there is one.
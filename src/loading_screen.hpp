@@ -39,6 +39,7 @@ public:
 	void incrementStatus();
 	void drawAndIncrement(const std::string& message) {draw(message); incrementStatus();}
 	void setNumberOfItems(int items);
+	void setStatus(int status);
 
 	void finishLoading();
 	
@@ -24,8 +24,10 @@
 #if defined(USE_LUA)
 
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <functional>
+#include <memory>
 #ifdef _MSC_VER
 #include <boost/math/special_functions/round.hpp>
 #endif
@@ -45,6 +47,7 @@
 #include "level.hpp"
 #include "module.hpp"
 #include "playable_custom_object.hpp"
+#include "preferences.hpp"
 #include "variant_type.hpp"
 #include "unit_test.hpp"
 
@@ -85,6 +88,8 @@ namespace lua
 		const char* const callable_str = "anura.callable";
 		const char* const lib_functions_str = "anura.lib";
 		const char* const object_str = "anura.object";
+		const char* const list_proxy_str = "anura.list";
+		const char* const map_proxy_str = "anura.map";
 
 		const char* const error_handler_fcn_reg_key = "error_handler";
 
@@ -390,11 +395,132 @@ namespace lua
 
 	namespace
 	{
+		PREF_BOOL(lua_proxy_tables, false, "Pass FFL lists and maps to Lua as lazily indexed proxies rather than copying them into tables. Scripts then see userdata, so type(), next, rawget and the table library don't work on them");
+
 		struct ffl_variant_lib_userdata
 		{
 			variant value;
 		};
 
+		static variant lua_value_to_variant(lua_State* L, int ndx, variant_type_ptr desired_type = nullptr);
+
+		// Lua view of an FFL list or map. Reads go straight to the shared variant; the first
+		// write from Lua copies it, so the FFL value that was passed in is never changed.
+		struct ffl_proxy_userdata
+		{
+			explicit ffl_proxy_userdata(const variant& v) : value(v), modified(false)
+			{}
+
+			bool isList() const { return value.is_list(); }
+
+			int size() const {
+				if(list) {
+					return static_cast<int>(list->size());
+				} else if(map) {
+					return static_cast<int>(map->size());
+				}
+				return value.num_elements();
+			}
+
+			const std::map<variant,variant>& getMap() const {
+				return map ? *map : value.as_map();
+			}
+
+			variant get(int n) const {
+				if(n < 0 || n >= size()) {
+					return variant();
+				}
+				return list ? (*list)[n] : value[n];
+			}
+
+			variant get(const variant& key) const {
+				const std::map<variant,variant>& m = getMap();
+				auto it = m.find(key);
+				return it == m.end() ? variant() : it->second;
+			}
+
+			void detach() {
+				if(isList() && !list) {
+					list.reset(new std::vector<variant>(value.as_list()));
+				} else if(!isList() && !map) {
+					map.reset(new std::map<variant,variant>(value.as_map()));
+				}
+				modified = true;
+			}
+
+			variant toVariant() const {
+				if(list) {
+					std::vector<variant> v(*list);
+					return variant(&v);
+				} else if(map) {
+					std::map<variant,variant> m(*map);
+					return variant(&m);
+				}
+				return value;
+			}
+
+			variant value;
+			std::unique_ptr<std::vector<variant>> list;
+			std::unique_ptr<std::map<variant,variant>> map;
+			bool modified;
+		};
+
+		static void push_proxy(lua_State* L, const variant& value)
+		{
+			void* mem = lua_newuserdata(L, sizeof(ffl_proxy_userdata));		// (-0,+1,e)
+			new (mem) ffl_proxy_userdata(value);
+			luaL_setmetatable(L, value.is_list() ? list_proxy_str : map_proxy_str);
+		}
+
+		static ffl_proxy_userdata* test_proxy(lua_State* L, int ndx)
+		{
+			if(auto ud = static_cast<ffl_proxy_userdata*>(luaL_testudata(L, ndx, list_proxy_str))) {
+				return ud;
+			}
+			return static_cast<ffl_proxy_userdata*>(luaL_testudata(L, ndx, map_proxy_str));
+		}
+
+		static ffl_proxy_userdata* check_proxy(lua_State* L, int ndx)
+		{
+			ffl_proxy_userdata* ud = test_proxy(L, ndx);
+			if(ud == nullptr) {
+				luaL_argerror(L, ndx, "expected: FFL list or map");
+			}
+			return ud;
+		}
+
+		// Converts a proxy back to a variant. Nested proxies handed out by __index are kept in
+		// the uservalue table, so any writes made through them are folded in here.
+		static variant proxy_to_variant(lua_State* L, int ndx)
+		{
+			ASSERT_STACK_NEUTRAL(L);
+			ndx = lua_absindex(L, ndx);
+			ffl_proxy_userdata* ud = check_proxy(L, ndx);
+
+			lua_getuservalue(L, ndx);							// (-0,+1,-)
+			if(lua_istable(L, -1)) {
+				lua_pushnil(L);
+				while(lua_next(L, -2)) {
+					variant child = proxy_to_variant(L, -1);
+					if(check_proxy(L, -1)->modified) {
+						ud->detach();
+						if(ud->isList()) {
+							const int n = static_cast<int>(lua_tointeger(L, -2)) - 1;
+							if(n >= 0 && n < ud->size()) {
+								(*ud->list)[n] = child;
+							}
+						} else {
+							(*ud->map)[lua_value_to_variant(L, -2)] = child;
+						}
+					}
+					lua_pop(L, 1);
+				}
+			}
+			lua_pop(L, 1);										// (-1,+0,-)
+
+			return ud->toVariant();
+		}
+
 		static int variant_to_lua_value(lua_State* L, const variant& value)
 		{
 			switch(value.type()) {
@@ -411,6 +537,10 @@ namespace lua
 					lua_pushnumber(L, value.as_decimal().as_float());
 					break;
 				case variant::VARIANT_TYPE_LIST: {
+					if(g_lua_proxy_tables) {
+						push_proxy(L, value);						// (-0,+1,e)
+						break;
+					}
 					lua_newtable(L);								// (-0,+1,-)
 					for(int n = 0; n != value.num_elements(); ++n) {
 						lua_pushnumber(L, n+1);						// (-0,+1,-)
@@ -425,6 +555,10 @@ namespace lua
 					break;
 				}
 				case variant::VARIANT_TYPE_MAP: {
+					if(g_lua_proxy_tables) {
+						push_proxy(L, value);						// (-0,+1,e)
+						break;
+					}
 					lua_newtable(L);								// (-0,+1,-)
 					auto m = value.as_map();
 					for(auto it : m) {
@@ -474,7 +608,7 @@ namespace lua
 			char* name;
 		};
 
-		static variant lua_value_to_variant(lua_State* L, int ndx, variant_type_ptr desired_type = nullptr)
+		static variant lua_value_to_variant(lua_State* L, int ndx, variant_type_ptr desired_type)
 		{
 			ASSERT_STACK_NEUTRAL(L);
 
@@ -564,6 +698,25 @@ namespace lua
 					return variant(&temp);
 				}
 				case LUA_TUSERDATA:
+					if (test_proxy(L, ndx)) {
+						variant value = proxy_to_variant(L, ndx);
+
+						// Honour the desired type the same way a table would be converted.
+						if (desired_type && desired_type->is_list_of() && value.is_map()) {
+							std::vector<variant> temp;
+							for (int i = 1; value.has_key(variant(i)); ++i) {
+								temp.push_back(value[variant(i)]);
+							}
+							return variant(&temp);
+						} else if (desired_type && desired_type->is_map_of().first && value.is_list()) {
+							std::map<variant, variant> temp;
+							for (int i = 0; i != value.num_elements(); ++i) {
+								temp[variant(i+1)] = value[i];
+							}
+							return variant(&temp);
+						}
+						return value;
+					}
 					if (auto callable_ptr_ptr = static_cast<FormulaCallablePtr*>(luaL_testudata(L, ndx, callable_str))) {
 						return variant(callable_ptr_ptr->get());
 					}
@@ -778,12 +931,18 @@ namespace lua
 			return 1;
 		}
 
+		LuaContext*& get_lua_context(lua_State* L);
+
 		static int get_object_index(lua_State* L)
 		{
 			// takes table, key on stack, returns result
 			auto object = *static_cast<FormulaObjectPtr*>(luaL_checkudata(L, 1, object_str));
 			const char * name = lua_tostring(L, 2);
-			variant value = object->queryValue(name);
+			if (!name) {
+				luaL_argerror(L, 2, "expected: string");
+			}
+			const int slot = get_lua_context(L)->getObjectPropertySlot(*object, name);
+			variant value = slot >= 0 ? object->queryValueBySlot(slot) : object->queryValue(name);
 			return variant_to_lua_value(L, value);
 		}
 
@@ -838,6 +997,148 @@ namespace lua
 			return 0;
 		}
 
+		// Pushes the element of the proxy at ud_ndx stored under the Lua key at key_ndx.
+		// Nested lists and maps are remembered in the proxy's uservalue table so that
+		// repeated reads give the same proxy and writes through it are not lost.
+		static void push_proxy_element(lua_State* L, int ud_ndx, int key_ndx)
+		{
+			ud_ndx = lua_absindex(L, ud_ndx);
+			key_ndx = lua_absindex(L, key_ndx);
+			ffl_proxy_userdata* ud = check_proxy(L, ud_ndx);
+
+			lua_getuservalue(L, ud_ndx);						// (-0,+1,-)
+			if(lua_istable(L, -1)) {
+				lua_pushvalue(L, key_ndx);						// (-0,+1,-)
+				lua_rawget(L, -2);								// (-1,+1,-)
+				if(!lua_isnil(L, -1)) {
+					lua_remove(L, -2);							// (-1,+0,-)
+					return;
+				}
+				lua_pop(L, 1);									// (-1,+0,-)
+			}
+
+			variant element;
+			if(ud->isList()) {
+				if(lua_type(L, key_ndx) == LUA_TNUMBER) {
+					element = ud->get(static_cast<int>(lua_tointeger(L, key_ndx)) - 1);
+				}
+			} else {
+				element = ud->get(lua_value_to_variant(L, key_ndx));
+			}
+
+			variant_to_lua_value(L, element);					// (-0,+1,e)
+			if(test_proxy(L, -1) == nullptr) {
+				lua_remove(L, -2);
+				return;
+			}
+
+			if(!lua_istable(L, -2)) {
+				lua_newtable(L);								// (-0,+1,m)
+				lua_pushvalue(L, -1);
+				lua_setuservalue(L, ud_ndx);					// (-1,+0,-)
+				lua_replace(L, -3);
+			}
+			lua_pushvalue(L, key_ndx);
+			lua_pushvalue(L, -2);
+			lua_rawset(L, -4);									// (-2,+0,m)
+			lua_remove(L, -2);
+		}
+
+		static int get_proxy_index(lua_State* L)
+		{
+			// stack -- proxy, key
+			push_proxy_element(L, 1, 2);
+			return 1;
+		}
+
+		static int set_proxy_index(lua_State* L)
+		{
+			// stack -- proxy, key, value
+			ffl_proxy_userdata* ud = check_proxy(L, 1);
+			ud->detach();
+
+			// A nested proxy cached under this key no longer belongs to us.
+			lua_getuservalue(L, 1);
+			if(lua_istable(L, -1)) {
+				lua_pushvalue(L, 2);
+				lua_pushnil(L);
+				lua_rawset(L, -3);
+			}
+			lua_pop(L, 1);
+
+			if(ud->isList()) {
+				const int n = static_cast<int>(luaL_checkinteger(L, 2));
+				const int size = ud->size();
+				if(lua_isnil(L, 3) && n == size && size > 0) {
+					ud->list->pop_back();
+				} else if(n >= 1 && n <= size) {
+					(*ud->list)[n-1] = lua_value_to_variant(L, 3);
+				} else if(n == size + 1) {
+					ud->list->push_back(lua_value_to_variant(L, 3));
+				} else {
+					luaL_error(L, "index %d out of range for FFL list of size %d", n, size);
+				}
+			} else {
+				variant key = lua_value_to_variant(L, 2);
+				if(lua_isnil(L, 3)) {
+					ud->map->erase(key);
+				} else {
+					(*ud->map)[key] = lua_value_to_variant(L, 3);
+				}
+			}
+			return 0;
+		}
+
+		static int proxy_len(lua_State* L)
+		{
+			lua_pushinteger(L, check_proxy(L, 1)->size());
+			return 1;
+		}
+
+		static int proxy_next(lua_State* L)
+		{
+			// stack -- proxy, previous key
+			ffl_proxy_userdata* ud = check_proxy(L, 1);
+			if(ud->isList()) {
+				const int n = lua_isnil(L, 2) ? 1 : static_cast<int>(luaL_checkinteger(L, 2)) + 1;
+				if(n > ud->size()) {
+					return 0;
+				}
+				lua_pushinteger(L, n);
+			} else {
+				const std::map<variant,variant>& m = ud->getMap();
+				auto it = lua_isnil(L, 2) ? m.begin() : m.upper_bound(lua_value_to_variant(L, 2));
+				if(it == m.end()) {
+					return 0;
+				}
+				variant_to_lua_value(L, it->first);
+			}
+			push_proxy_element(L, 1, -1);
+			return 2;
+		}
+
+		static int proxy_pairs(lua_State* L)
+		{
+			check_proxy(L, 1);
+			lua_pushcfunction(L, proxy_next);
+			lua_pushvalue(L, 1);
+			lua_pushnil(L);
+			return 3;
+		}
+
+		static int serialize_proxy(lua_State* L)
+		{
+			variant value = proxy_to_variant(L, 1);
+			lua_pushstring(L, value.write_json().c_str());
+			return 1;
+		}
+
+		static int gc_proxy(lua_State* L)
+		{
+			check_proxy(L, 1)->~ffl_proxy_userdata();
+			return 0;
+		}
+
 		const luaL_Reg gFFLFunctions[] = {
 			{"__call", call_function},
 			{"__gc", gc_function},
@@ -873,6 +1174,17 @@ namespace lua
 			{nullptr, nullptr},
 		};
 
+		const luaL_Reg gProxyFunctions[] = {
+			{"__index", get_proxy_index},
+			{"__newindex", set_proxy_index},
+			{"__len", proxy_len},
+			{"__pairs", proxy_pairs},
+			{"__ipairs", proxy_pairs},
+			{"__tostring", serialize_proxy},
+			{"__gc", gc_proxy},
+			{nullptr, nullptr},
+		};
+
 		static int get_level(lua_State* L)
 		{
 			Level& lvl = Level::current();
@@ -967,6 +1279,29 @@ namespace lua
 		lua_close(state_);
 	}
 
+	// Lua interns its strings, so the same property name read from a script
+	// arrives as the same pointer each time; combined with the object's class
+	// that makes a cheap key for remembering the property's slot. The cache
+	// belongs to the context, so states never share it, and holds the class
+	// only by address, checking its generation in case the class was reloaded
+	// and the address reused.
+	int LuaContext::getObjectPropertySlot(const FormulaObject& object, const char* name)
+	{
+		const reference_counted_object* class_key = object.getClassKey();
+		const int class_generation = object.getClassGeneration();
+		const uintptr_t hash = (reinterpret_cast<uintptr_t>(class_key) >> 4) ^ (reinterpret_cast<uintptr_t>(name) >> 3);
+		PropertySlotCacheEntry& entry = property_slots_[hash%256];
+		if(entry.class_key == class_key && entry.class_generation == class_generation && entry.name == name) {
+			return entry.slot;
+		}
+
+		entry.class_key = class_key;
+		entry.class_generation = class_generation;
+		entry.name = name;
+		entry.slot = object.getPropertySlot(entry.name);
+		return entry.slot;
+	}
+
 	void LuaContext::init()
 	{
 		lua_State * L = getState();
@@ -1016,6 +1351,20 @@ namespace lua
 		lua_rawset(L, -3);
 		lua_pop(L, 1);
 
+		luaL_newmetatable(L, list_proxy_str);
+		luaL_setfuncs(L, gProxyFunctions, 0);
+		lua_pushliteral(L, "__metatable");
+		lua_pushliteral(L, "FFL list");
+		lua_rawset(L, -3);
+		lua_pop(L, 1);
+
+		luaL_newmetatable(L, map_proxy_str);
+		luaL_setfuncs(L, gProxyFunctions, 0);
+		lua_pushliteral(L, "__metatable");
+		lua_pushliteral(L, "FFL map");
+		lua_rawset(L, -3);
+		lua_pop(L, 1);
+
 		luaL_newmetatable(L, lib_functions_str);
 		luaL_setfuncs(L, gLibMetaFunctions, 0);
 		lua_pushliteral(L, "__metatable");
@@ -1394,6 +1743,54 @@ UNIT_TEST(lua_to_ffl_conversions) {
 	}
 }
 
+UNIT_TEST(lua_proxy_tables) {
+	using namespace game_logic;
+	using namespace lua;
+
+	LuaContextPtr test_context = new LuaContext();
+	lua_State * L = test_context->getState();
+
+	lua_settop(L, 0);
+
+	const bool lazy = g_lua_proxy_tables;
+	g_lua_proxy_tables = true;
+
+	variant original = Formula(variant("{ 'a' : [1, 2, 3], 'b' : 'x', 'c' : { 'd' : [4] } }")).execute();
+
+	{
+		ASSERT_STACK_NEUTRAL(L);
+
+		variant_to_lua_value(L, original);
+		lua_setglobal(L, "t");
+
+		CHECK_EQ(luaL_dostring(L, "return #t.a + t.a[2], t.b, t.a[4], t.c.d[1]"), LUA_OK);
+		CHECK_EQ(lua_tointeger(L, 1), 5);
+		CHECK_EQ(lua_tostring(L, 2), std::string("x"));
+		CHECK_EQ(lua_isnil(L, 3), true);
+		CHECK_EQ(lua_tointeger(L, 4), 4);
+		lua_settop(L, 0);
+
+		CHECK_EQ(luaL_dostring(L, "local s = 0 for i, v in ipairs(t.a) do s = s + i * v end "
+		                          "local n = 0 for k, v in pairs(t) do n = n + 1 end return s, n"), LUA_OK);
+		CHECK_EQ(lua_tointeger(L, 1), 14);
+		CHECK_EQ(lua_tointeger(L, 2), 3);
+		lua_settop(L, 0);
+
+		lua_getglobal(L, "t");
+		CHECK_EQ(lua_value_to_variant(L, 1), original);
+		lua_pop(L, 1);
+
+		CHECK_EQ(luaL_dostring(L, "t.a[4] = 4; t.b = nil; t.c.d[1] = 5"), LUA_OK);
+		lua_getglobal(L, "t");
+		CHECK_EQ(lua_value_to_variant(L, 1), Formula(variant("{ 'a' : [1, 2, 3, 4], 'c' : { 'd' : [5] } }")).execute());
+		lua_pop(L, 1);
+
+		CHECK_EQ(original, Formula(variant("{ 'a' : [1, 2, 3], 'b' : 'x', 'c' : { 'd' : [4] } }")).execute());
+	}
+
+	g_lua_proxy_tables = lazy;
+}
+
 UNIT_TEST(lua_persist) {
 	using namespace lua;
 //	lua::LuaContextPtr ctxt = new lua::LuaContext();
@@ -1536,6 +1933,42 @@ UNIT_TEST(lua_with_ffl_objects) {
 	CHECK_EQ(i.as_callable()->queryValue("a"), variant("c"));
 }
 
+BENCHMARK_ARG(lua_bridge_list, bool lazy)
+{
+	using namespace game_logic;
+	using namespace lua;
+
+	LuaContextPtr ctx = new LuaContext();
+	lua_State * L = ctx->getState();
+	lua_settop(L, 0);
+
+	std::vector<variant> items;
+	for(int n = 0; n != 10000; ++n) {
+		std::map<variant, variant> item;
+		item[variant("x")] = variant(n);
+		item[variant("y")] = variant(n*2);
+		items.push_back(variant(&item));
+	}
+	variant input(&items);
+
+	luaL_loadstring(L, "return function(t) return t[100].y end");
+	lua_call(L, 0, 1);
+
+	const bool prev = g_lua_proxy_tables;
+	g_lua_proxy_tables = lazy;
+	BENCHMARK_LOOP {
+		lua_pushvalue(L, 1);
+		variant_to_lua_value(L, input);
+		lua_call(L, 1, 1);
+		lua_pop(L, 1);
+	}
+	g_lua_proxy_tables = prev;
+	lua_settop(L, 0);
+}
+
+BENCHMARK_ARG_CALL(lua_bridge_list, eager, false);
+BENCHMARK_ARG_CALL(lua_bridge_list, lazy, true);
+
 /////////////////////////////////////////////////////////////////////
 // Standard Lua utilities packaged as anura command line utilities //
 /////////////////////////////////////////////////////////////////////
@@ -92,11 +92,27 @@ namespace lua
 		CompiledChunk* compileChunk(const std::string& name, const std::string& str);
 
 		std::string persist();
+
+		//the slot of the property name in object, or -1. Remembered per
+		//class, so that repeated lookups from scripts are cheap.
+		int getObjectPropertySlot(const game_logic::FormulaObject& object, const char* name);
 	private:
 		void init();
 
 		lua_State * state_;
 
+		struct PropertySlotCacheEntry
+		{
+			PropertySlotCacheEntry() : class_key(nullptr), class_generation(-1), slot(-1)
+			{}
+			const void* class_key;
+			int class_generation;
+			std::string name;
+			int slot;
+		};
+
+		PropertySlotCacheEntry property_slots_[256];
+
 		LuaContext(const LuaContext&);
 
 	};
@@ -1189,7 +1189,7 @@ int main(int argcount, char* argvec[])
 	LevelPtr lvl;
 	while(!quit && !show_title_screen(level_cfg)) {
 		if(!lvl) {
-			lvl = load_level(level_cfg);
+			lvl = load_level(level_cfg, &loader);
 		}
 		
 		//see if we're loading a multiplayer level, in which case we
@@ -42,6 +42,7 @@
 #include "unit_test.hpp"
 #include "uri.hpp"
 #include "variant_utils.hpp"
+#include "vfs.hpp"
 
 namespace module 
 {
@@ -60,6 +61,10 @@ namespace module
 		PREF_STRING(module_chunk_query, "POST /download_chunk?chunk_id=", "request to download a module chunk");
 		PREF_BOOL(module_chunk_deflate, false, "If true, module chunks are assumed compressed and will be deflated");
 
+		//chunks are fetched in pieces of this size, so an interrupted
+		//download only has to fetch the piece it was on again.
+		const size_t ChunkRangeSize = 256*1024;
+
 		bool module_chunk_query_is_get() {
 			return g_module_chunk_query.size() > 3 && std::equal(g_module_chunk_query.begin(), g_module_chunk_query.begin()+3, "GET");
 		}
@@ -138,8 +143,22 @@ namespace module
 			}
 
 			for(const std::string& base_path : p.base_path_) {
+				//the index answers lookups of existing files without touching
+				//the disk. A miss is final only while the indexed directories
+				//are watched; otherwise it's checked on disk, since files can
+				//be written without going through sys:: (e.g. saved images).
+				const vfs::IndexResult indexed = vfs::find_indexed_file(base_path, fname);
+				if(indexed == vfs::IndexResult::FOUND) {
+					return base_path + fname;
+				} else if(indexed == vfs::IndexResult::NOT_FOUND && vfs::index_misses_are_final()) {
+					continue;
+				}
+
 				const std::string path = sys::find_file(base_path + fname);
 				if(sys::file_exists(path)) {
+					if(indexed == vfs::IndexResult::NOT_FOUND) {
+						vfs::note_file_written(path);
+					}
 					return path;
 				}
 			}
@@ -399,6 +418,9 @@ namespace module
 		std::string abbrev = name;
 		std::string fname = make_base_module_path(name) + "module.cfg";
 		variant v = json::parse_from_file_or_die(fname);
+
+		//mount the module's pack before anything is read out of it.
+		vfs::mount_dir(make_base_module_path(name));
 		std::string def_font = "FreeSans";
 		std::string def_font_cjk = "unifont";
 		auto speech_dialog_bg_color = std::make_shared<KRE::Color>(85, 53, 53, 255);
@@ -1289,9 +1311,87 @@ static const int ModuleProtocolVersion = 1;
 		doc_pending_chunks_ = variant();
 	}
 
+	void client::request_chunk(variant chunk)
+	{
+		const std::string md5 = chunk["md5"].as_string();
+		const size_t begin = partial_chunks_[md5].data.size();
+		const size_t end = begin + ChunkRangeSize;
+
+		boost::shared_ptr<http_client> new_client(new http_client(g_module_chunk_server.empty() ? host_ : g_module_chunk_server, g_module_chunk_port.empty() ? port_ : g_module_chunk_port));
+		new_client->set_timeout_and_retry();
+
+		//a GET goes to a plain web server which understands Range, our own
+		//server takes the range as part of the request.
+		new_client->set_request_header("Range", formatter() << "bytes=" << begin << "-" << (end-1));
+
+		variant_builder request;
+		request.add("type", "download_chunk");
+		request.add("chunk_id", chunk["md5"]);
+		request.add("range_begin", static_cast<int>(begin));
+		request.add("range_end", static_cast<int>(end));
+
+		LOG_INFO("Module request chunk: " << md5 << " from " << begin << "\n");
+
+		const std::string url = g_module_chunk_query + md5;
+		const std::string doc = module_chunk_query_is_get() ? "" : request.build().write_json();
+		new_client->send_request(url, doc,
+					  std::bind(&client::on_chunk_response, this, url, chunk, new_client, _1),
+					  std::bind(&client::on_chunk_error, this, _1, url, doc, chunk, new_client),
+					  std::bind(&client::on_chunk_progress, this, url, _1, _2, _3)
+		);
+
+		chunk_clients_.push_back(new_client);
+	}
+
 	void client::on_chunk_response(std::string chunk_url, variant node, boost::shared_ptr<http_client> client, std::string response)
 	{
-		if(g_module_chunk_deflate) {
+		auto progress_itor = chunk_progress_.find(chunk_url);
+		if(progress_itor != chunk_progress_.end()) {
+			nbytes_transferred_ -= progress_itor->second;
+			chunk_progress_.erase(progress_itor);
+		}
+
+		chunk_clients_.erase(std::remove(chunk_clients_.begin(), chunk_clients_.end(), client), chunk_clients_.end());
+
+		bool deflated = g_module_chunk_deflate;
+
+		//a response with a Content-Range is one piece of the chunk, as it is
+		//stored on the server. Anything else is the whole chunk.
+		const std::map<std::string, std::string>& headers = client->response_headers();
+		auto range_itor = headers.find("content-range");
+		if(range_itor != headers.end()) {
+			const std::string md5 = node["md5"].as_string();
+			PartialChunk& partial = partial_chunks_[md5];
+
+			unsigned long begin = 0, end = 0, total = 0;
+			if(sscanf(range_itor->second.c_str(), "bytes %lu-%lu/%lu", &begin, &end, &total) != 3 || begin != partial.data.size()) {
+				LOG_ERROR("Unexpected range for chunk " << md5 << ": " << range_itor->second << " when we have " << partial.data.size() << " bytes");
+				nbytes_transferred_ -= partial.data.size();
+				partial_chunks_.erase(md5);
+				on_chunk_error("bad range", chunk_url, "", node, client);
+				return;
+			}
+
+			partial.data += response;
+			partial.total = total;
+			nbytes_transferred_ += response.size();
+
+			if(partial.data.size() < partial.total) {
+				request_chunk(node);
+				return;
+			}
+
+			nbytes_transferred_ -= partial.data.size();
+			partial.data.swap(response);
+			partial_chunks_.erase(md5);
+
+			auto encoding_itor = headers.find("chunk-encoding");
+			if(encoding_itor != headers.end() && encoding_itor->second == "deflate") {
+				deflated = true;
+			}
+		}
+
+		if(deflated) {
 			std::vector<char> data(response.begin(), response.end());
 			auto v = zip::decompress(data);
 			std::string(v.begin(), v.end()).swap(response);
@@ -1300,43 +1400,18 @@ static const int ModuleProtocolVersion = 1;
 		//write a copy of the response for this file to the update cache.
 		sys::write_file("update-cache/" + node["md5"].as_string(), response);
 
-		auto progress_itor = chunk_progress_.find(chunk_url);
-		if(progress_itor != chunk_progress_.end()) {
-			nbytes_transferred_ -= progress_itor->second;
-			chunk_progress_.erase(progress_itor);
-		}
-
 		nbytes_transferred_ += node["size"].as_int();
 
 		onChunkReceived(node);
 
-		chunk_clients_.erase(std::remove(chunk_clients_.begin(), chunk_clients_.end(), client), chunk_clients_.end());
 		if(chunks_to_get_.empty()) {
 			if(chunk_clients_.empty()) {
 				operation_ = OPERATION_PENDING_INSTALL;
 			}
 		} else {
-			boost::shared_ptr<http_client> new_client(new http_client(g_module_chunk_server.empty() ? host_ : g_module_chunk_server, g_module_chunk_port.empty() ? port_ : g_module_chunk_port));
-			new_client->set_timeout_and_retry();
-
 			variant chunk = chunks_to_get_.back();
 			chunks_to_get_.pop_back();
-
-			variant_builder request;
-			request.add("type", "download_chunk");
-			request.add("chunk_id", chunk["md5"]);
-
-			LOG_INFO("Module request chunk: " << chunk["md5"].as_string() << "\n");
-
-			const std::string url = g_module_chunk_query + chunk["md5"].as_string();
-			const std::string doc = module_chunk_query_is_get() ? "" : request.build().write_json();
-			new_client->send_request(url, doc,
-						  std::bind(&client::on_chunk_response, this, url, chunk, new_client, _1),
-						  std::bind(&client::on_chunk_error, this, _1, url, doc, chunk, new_client),
-						  std::bind(&client::on_chunk_progress, this, url, _1, _2, _3)
-			);
-
-			chunk_clients_.push_back(new_client);
+			request_chunk(chunk);
 		}
 	}
 
@@ -1371,16 +1446,8 @@ static const int ModuleProtocolVersion = 1;
 		}
 		else
 		{
-			boost::shared_ptr<http_client> new_client(new http_client(host_, port_));
-			new_client->set_timeout_and_retry();
-
-			new_client->send_request(url, doc,
-				std::bind(&client::on_chunk_response, this, url, chunk, new_client, _1),
-				std::bind(&client::on_chunk_error, this, _1, url, doc, chunk, new_client),
-				std::bind(&client::on_chunk_progress, this, url, _1, _2, _3)
-			);
-
-			chunk_clients_.push_back(new_client);
+			//picks up from the last piece we received.
+			request_chunk(chunk);
 		}
 	}
 
@@ -1584,22 +1651,7 @@ static const int ModuleProtocolVersion = 1;
 			while(chunk_clients_.size() < 8 && chunks_to_get_.empty() == false) {
 				variant chunk = chunks_to_get_.back();
 				chunks_to_get_.pop_back();
-
-				variant_builder request;
-				request.add("type", "download_chunk");
-				request.add("chunk_id", chunk["md5"]);
-
-				boost::shared_ptr<http_client> client(new http_client(g_module_chunk_server.empty() ? host_ : g_module_chunk_server, g_module_chunk_port.empty() ? port_ : g_module_chunk_port));
-				client->set_timeout_and_retry();
-
-				const std::string url = g_module_chunk_query + chunk["md5"].as_string();
-				const std::string doc = module_chunk_query_is_get() ? "" : request.build().write_json();
-				client->send_request(url, doc, 
-							  std::bind(&client::on_chunk_response, this, url, chunk, client, _1),
-							  std::bind(&client::on_chunk_error, this, _1, url, doc, chunk, client),
-							  std::bind(&client::on_chunk_progress, this, url, _1, _2, _3)
-				);
-				chunk_clients_.push_back(client);
+				request_chunk(chunk);
 			}
 
 			operation_ = OPERATION_GET_CHUNKS;
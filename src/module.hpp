@@ -215,8 +215,22 @@ namespace module
 		void on_chunk_response(std::string chunk_url, variant node, boost::shared_ptr<class http_client> client, std::string response);
 		void on_chunk_progress(std::string chunk_url, size_t received, size_t total, bool response);
 
+		//requests the next piece of a chunk, starting after whatever we
+		//already have of it.
+		void request_chunk(variant chunk);
+
 		std::map<std::string, size_t> chunk_progress_;
 
+		//chunks which have been partly downloaded, keyed by md5, so a
+		//failed download can resume rather than start over.
+		struct PartialChunk {
+			PartialChunk() : total(0) {}
+			std::string data;
+			size_t total;
+		};
+
+		std::map<std::string, PartialChunk> partial_chunks_;
+
 		std::function<void(std::string)> show_progress_fn_;
 
 		void show_progress(const std::string& msg) { if(show_progress_fn_) { show_progress_fn_(msg); } }
@@ -22,6 +22,7 @@
 */
 
 #include <algorithm>
+#include <cstring>
 #include <boost/algorithm/string/replace.hpp>
 #include <deque>
 #include <iostream>
@@ -45,6 +46,7 @@
 #include "unit_test.hpp"
 #include "variant.hpp"
 #include "variant_utils.hpp"
+#include "zlib.h"
 
 using boost::asio::ip::tcp;
 
@@ -54,6 +56,7 @@ ModuleWebServer::ModuleWebServer(const std::string& data_path, const std::string
 	nheartbeat_(0), 
 	data_path_(data_path), 
 	chunk_path_(chunk_path), 
+	precomputed_use_count_(0),
 	next_lock_id_(1)
 {
 	if(data_path_.empty() || data_path_[data_path_.size()-1] != '/') {
@@ -76,20 +79,166 @@ void ModuleWebServer::heartbeat()
 	timer_.async_wait(std::bind(&ModuleWebServer::heartbeat, this));
 }
 
-void ModuleWebServer::add_chunks_to_manifest(const std::string& data_path, variant manifest) const
+namespace {
+
+static const int ModuleProtocolVersion = 1;
+
+//how many module versions to keep precomputed responses for.
+static const int MaxPrecomputedModules = 8;
+
+//the size streamed responses are written in.
+static const size_t StreamPieceSize = 64*1024;
+
+//the largest piece of a chunk sent in answer to a ranged request.
+static const size_t MaxChunkRange = 4*1024*1024;
+
+//the members of a map as they appear in its JSON, without the braces.
+std::string write_members(const std::map<variant, variant>& m)
 {
-	for(auto p : manifest.as_map()) {
-		if(p.second["data"].is_null()) {
-			std::string chunk_id = p.second["md5"].as_string();
-			std::string data = zip::decompress(sys::read_file(getChunkPath(chunk_id)));
-			p.second.add_attr_mutation(variant("data"), variant(data));
+	const std::string s = variant(&const_cast<std::map<variant, variant>&>(m)).write_json();
+	return std::string(s.begin() + 1, s.end() - 1);
+}
+}
+
+ModuleWebServer::PrecomputedModulePtr ModuleWebServer::getPrecomputedModule(const std::string& module_path, const variant& version)
+{
+	const long long mod_time = sys::file_mod_time(module_path);
+
+	auto itor = precomputed_modules_.find(module_path);
+	if(itor != precomputed_modules_.end() && itor->second->mod_time == mod_time) {
+		itor->second->last_used = ++precomputed_use_count_;
+		return itor->second;
+	}
+
+	if(!sys::file_exists(module_path)) {
+		return PrecomputedModulePtr();
+	}
+
+	const int start_time = SDL_GetTicks();
+
+	PrecomputedModulePtr result(new PrecomputedModule);
+	result->mod_time = mod_time;
+	result->last_used = ++precomputed_use_count_;
+
+	variant module = json::parse(sys::read_file(module_path));
+	static const variant ManifestVariant("manifest");
+	static const variant DataVariant("data");
+	static const variant MD5Variant("md5");
+
+	std::map<variant, variant> members = module.as_map();
+	members.erase(ManifestVariant);
+	const std::string module_members = write_members(members);
+
+	result->header = "{\nstatus: \"ok\",\nversion: " + version.write_json() + ",\nmodule: {" + module_members + (module_members.empty() ? "" : ",") + "\"manifest\":{";
+
+	variant manifest = module[ManifestVariant];
+	if(manifest.is_map()) {
+		for(const auto& p : manifest.as_map()) {
+			PrecomputedModule::Entry e;
+			e.key = p.first;
+			e.md5 = p.second[MD5Variant];
+
+			std::map<variant, variant> m;
+			m[p.first] = p.second;
+			e.text = write_members(m);
+
+			if(p.second[DataVariant].is_null()) {
+				e.chunk_id = e.md5.as_string();
+			}
+
+			e.compat_size = -1;
+
+			result->entry_index[e.key] = static_cast<int>(result->entries.size());
+			result->entries.push_back(e);
+		}
+	}
+
+	result->full_response = result->header;
+	for(const PrecomputedModule::Entry& e : result->entries) {
+		if(&e != &result->entries.front()) {
+			result->full_response += ",";
 		}
+		result->full_response += e.text;
 	}
+	result->full_response += "}}\n}";
+
+	precomputed_modules_[module_path] = result;
+
+	while(precomputed_modules_.size() > MaxPrecomputedModules) {
+		auto oldest = precomputed_modules_.begin();
+		for(auto i = precomputed_modules_.begin(); i != precomputed_modules_.end(); ++i) {
+			if(i->second->last_used < oldest->second->last_used) {
+				oldest = i;
+			}
+		}
+
+		precomputed_modules_.erase(oldest);
+	}
+
+	LOG_INFO("Precomputed " << module_path << ": " << result->entries.size() << " files in " << (SDL_GetTicks() - start_time) << "ms");
+	return result;
 }
 
-namespace {
+std::string ModuleWebServer::getCompatEntry(const PrecomputedModule::Entry& e) const
+{
+	if(e.chunk_id.empty()) {
+		e.compat_size = static_cast<int>(e.text.size());
+		return e.text;
+	}
 
-static const int ModuleProtocolVersion = 1;
+	ASSERT_LOG(e.text.empty() == false && e.text.back() == '}', "Unexpected manifest entry: " << e.text);
+
+	const std::string data = zip::decompress(sys::read_file(getChunkPath(e.chunk_id)));
+
+	std::string result(e.text.begin(), e.text.end() - 1);
+	if(result.back() != '{') {
+		result += ",";
+	}
+
+	result += "\"data\":" + variant(data).write_json() + "}";
+	e.compat_size = static_cast<int>(result.size());
+	return result;
+}
+
+const std::string& ModuleWebServer::getCompatResponseDeflated(PrecomputedModule& module) const
+{
+	if(module.compat_response_deflated.empty() == false) {
+		return module.compat_response_deflated;
+	}
+
+	const int start_time = SDL_GetTicks();
+
+	//deflate it a file at a time, so the inflated response is never held
+	//in memory.
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	ASSERT_LOG(deflateInit(&stream, Z_DEFAULT_COMPRESSION) == Z_OK, "Could not initialize deflate");
+
+	std::string& out = module.compat_response_deflated;
+	std::vector<char> buf(StreamPieceSize);
+	auto add = [&stream, &out, &buf](const std::string& s, int flush) {
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(s.data()));
+		stream.avail_in = static_cast<uInt>(s.size());
+		do {
+			stream.next_out = reinterpret_cast<Bytef*>(&buf[0]);
+			stream.avail_out = static_cast<uInt>(buf.size());
+			deflate(&stream, flush);
+			out.append(&buf[0], buf.size() - stream.avail_out);
+		} while(stream.avail_out == 0);
+	};
+
+	add(module.header, Z_NO_FLUSH);
+	for(const PrecomputedModule::Entry& e : module.entries) {
+		if(&e != &module.entries.front()) {
+			add(",", Z_NO_FLUSH);
+		}
+		add(getCompatEntry(e), Z_NO_FLUSH);
+	}
+	add("}}\n}", Z_FINISH);
+	deflateEnd(&stream);
+
+	LOG_INFO("Deflated legacy response of " << module.entries.size() << " files to " << out.size() << " bytes in " << (SDL_GetTicks() - start_time) << "ms");
+	return out;
 }
 
 void ModuleWebServer::handlePost(socket_ptr socket, variant doc, const http::environment& env, const std::string& raw_msg)
@@ -147,66 +296,109 @@ void ModuleWebServer::handlePost(socket_ptr socket, variant doc, const http::env
 				module_path += ".cfg";
 			}
 
-			if(sys::file_exists(module_path)) {
+			PrecomputedModulePtr module = getPrecomputedModule(module_path, server_version);
+			if(module) {
 				const int start_time = SDL_GetTicks();
 
-				std::string response = "{\nstatus: \"ok\",\nversion: " + server_version.write_json() + ",\nmodule: ";
-				{
-					std::string contents = sys::read_file(module_path);
-					LOG_INFO("MANIFEST: " << static_cast<int>(doc.has_key("manifest")));
-					if(doc.has_key("manifest")) {
-						variant their_manifest = doc["manifest"];
-						variant module = json::parse(contents);
-						variant our_manifest = module["manifest"];
-
-						std::vector<variant> deletions;
-						for(auto p : their_manifest.as_map()) {
-							if(!our_manifest.has_key(p.first)) {
-								deletions.push_back(p.first);
-							}
+				//work out which files the client doesn't have already.
+				std::vector<const PrecomputedModule::Entry*> entries;
+				std::vector<variant> deletions;
+				const bool has_manifest = doc.has_key("manifest");
+				if(has_manifest) {
+					static const variant MD5Variant("md5");
+					variant their_manifest = doc["manifest"];
+					for(auto p : their_manifest.as_map()) {
+						if(module->entry_index.count(p.first) == 0) {
+							deletions.push_back(p.first);
 						}
+					}
 
-						if(!deletions.empty()) {
-							module.add_attr_mutation(variant("delete"), variant(&deletions));
+					for(const PrecomputedModule::Entry& e : module->entries) {
+						variant theirs = their_manifest[e.key];
+						if(theirs.is_map() == false || theirs[MD5Variant] != e.md5) {
+							entries.push_back(&e);
 						}
+					}
 
-						std::vector<variant> matches;
+					LOG_INFO("Sending " << entries.size() << " of " << module->entries.size() << " files, deleting " << deletions.size());
+				} else {
+					for(const PrecomputedModule::Entry& e : module->entries) {
+						entries.push_back(&e);
+					}
+				}
 
-						for(auto p : our_manifest.as_map()) {
-							if(!their_manifest.has_key(p.first)) {
-								LOG_WARN("their manifest does not have key: " << p.first.write_json().c_str());
-								continue;
-							}
+				std::string tail = "}";
+				if(!deletions.empty()) {
+					tail += ",\"delete\":" + variant(&deletions).write_json();
+				}
+				tail += "}\n}";
+
+				if(require_back_compat && !has_manifest && socket->supports_deflate) {
+					send_msg(socket, "text/json", getCompatResponseDeflated(*module), "Content-Encoding: deflate");
+				} else if(require_back_compat) {
+					//old clients want every file's data inline, which can be
+					//far too much to build in memory, so stream it out one
+					//file at a time, inflating each as it's needed. Entries
+					//an old client hasn't asked for before are measured
+					//first, so the response has a length.
+					size_t content_length = module->header.size() + tail.size();
+					for(const PrecomputedModule::Entry* e : entries) {
+						if(e->compat_size < 0) {
+							getCompatEntry(*e);
+						}
+						content_length += e->compat_size + (e == entries.front() ? 0 : 1);
+					}
 
-							if(p.second["md5"] != their_manifest[p.first]["md5"]) {
-								LOG_ERROR("their manifest mismatch key: " << p.first.write_json().c_str());
-								continue;
-							}
+					std::shared_ptr<size_t> next(new size_t(0));
+					std::shared_ptr<bool> sent_header(new bool(false));
+					std::shared_ptr<bool> sent_tail(new bool(false));
+					send_stream(socket, "text/json", content_length, "", [this, module, entries, tail, next, sent_header, sent_tail](std::string* buf) {
+						if(*sent_tail) {
+							return false;
+						}
 
-							matches.push_back(p.first);
+						if(!*sent_header) {
+							*buf = module->header;
+							*sent_header = true;
 						}
 
-						for(variant match : matches) {
-							our_manifest.remove_attr_mutation(match);
+						//always add at least one entry, so that a header or
+						//entry bigger than a piece can't stall the download.
+						const size_t first = *next;
+						while(*next < entries.size() && (*next == first || buf->size() < StreamPieceSize)) {
+							if(*next != 0) {
+								*buf += ",";
+							}
+							*buf += getCompatEntry(*entries[(*next)++]);
 						}
 
-						if(require_back_compat) {
-							add_chunks_to_manifest(data_path_, our_manifest);
+						if(*next == entries.size()) {
+							*buf += tail;
+							*sent_tail = true;
 						}
 
-						contents = module.write_json();
-					} else if(require_back_compat) {
-						variant module = json::parse(contents);
-						variant manifest = module["manifest"];
-						add_chunks_to_manifest(data_path_, manifest);
-						contents = module.write_json();
+						return true;
+					});
+				} else if(!has_manifest && socket->supports_deflate) {
+					if(module->full_response_deflated.empty()) {
+						module->full_response_deflated = zip::compress(module->full_response);
 					}
 
-					response += contents;
-				}
+					send_msg(socket, "text/json", module->full_response_deflated, "Content-Encoding: deflate");
+				} else if(!has_manifest) {
+					send_msg(socket, "text/json", module->full_response, "");
+				} else {
+					std::string response = module->header;
+					for(const PrecomputedModule::Entry* e : entries) {
+						if(e != entries.front()) {
+							response += ",";
+						}
+						response += e->text;
+					}
 
-				response += "\n}";
-				send_msg(socket, "text/json", response, "");
+					response += tail;
+					send_msg(socket, "text/json", response, "");
+				}
 
 				variant summary = data_[module_id];
 				if(summary.is_map()) {
@@ -229,6 +421,24 @@ void ModuleWebServer::handlePost(socket_ptr socket, variant doc, const http::env
 				return;
 			}
 
+			//a client which can resume downloads asks for a range of the
+			//stored, deflated, chunk. It gets the raw bytes, and inflates
+			//them itself once it has them all.
+			if(doc.has_key("range_begin")) {
+				const size_t begin = std::min<size_t>(doc["range_begin"].as_int(), data.size());
+				size_t end = data.size();
+				if(doc.has_key("range_end")) {
+					end = std::max(begin, std::min<size_t>(doc["range_end"].as_int(), end));
+				}
+
+				end = std::min(end, begin + MaxChunkRange);
+
+				std::ostringstream headers;
+				headers << "Content-Encoding: identity\r\nChunk-Encoding: deflate\r\nContent-Range: bytes " << begin << "-" << (end == begin ? begin : end - 1) << "/" << data.size();
+				send_msg(socket, "application/octet-stream", std::string(data.begin() + begin, data.begin() + end), headers.str());
+				return;
+			}
+
 			send_msg(socket, "application/octet-stream", data, "Content-Encoding: deflate");
 			return;
 		} else if(msg_type == "query_module_version") {
@@ -417,6 +627,7 @@ void ModuleWebServer::handlePost(socket_ptr socket, variant doc, const http::env
 			sys::write_file(module_path_tmp, contents);
 			const int rename_result = rename(module_path_tmp.c_str(), module_path.c_str());
 			ASSERT_LOG(rename_result == 0, "FAILED TO RENAME FILE: " << errno);
+			precomputed_modules_.erase(module_path);
 
 			response[variant("status")] = variant("ok");
 
@@ -493,6 +704,7 @@ void ModuleWebServer::handlePost(socket_ptr socket, variant doc, const http::env
 			sys::write_file(module_path_tmp, contents);
 			const int rename_result = rename(module_path_tmp.c_str(), dst_path.c_str());
 			ASSERT_LOG(rename_result == 0, "FAILED TO RENAME FILE: " << errno);
+			precomputed_modules_.erase(dst_path);
 
 			response[variant("status")] = variant("ok");
 
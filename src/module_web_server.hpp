@@ -24,6 +24,8 @@
 #pragma once
 
 #include <map>
+#include <memory>
+#include <vector>
 
 #include "http_server.hpp"
 #include "variant.hpp"
@@ -41,7 +43,51 @@ private:
 	virtual void handleGet(socket_ptr socket, const std::string& url, const std::map<std::string, std::string>& args) override;
 
 	std::string getChunkPath(const std::string& chunk_id) const;
-	void add_chunks_to_manifest(const std::string& data_path, variant manifest) const;
+
+	//A version of a module, broken down into the pieces responses to
+	//download_module are put together from. Worked out the first time the
+	//version is asked for and shared by every download after that.
+	struct PrecomputedModule 
+	{
+		struct Entry {
+			variant key, md5;
+
+			//the entry written out as a member of the manifest.
+			std::string text;
+
+			//the chunk holding the file's data, if it isn't in the entry.
+			std::string chunk_id;
+
+			//the size of the entry with its data inlined, for clients which
+			//need that, so their responses can have a Content-Length. -1
+			//until an old client first asks for the entry.
+			mutable int compat_size;
+		};
+
+		long long mod_time;
+		int last_used;
+
+		//everything in the response up to the start of the manifest.
+		std::string header;
+		std::vector<Entry> entries;
+		std::map<variant, int> entry_index;
+
+		//the response to a client with nothing installed, plain and deflated.
+		std::string full_response, full_response_deflated;
+
+		//the deflated response to an old client with nothing installed,
+		//built the first time one asks for it.
+		std::string compat_response_deflated;
+	};
+
+	typedef std::shared_ptr<PrecomputedModule> PrecomputedModulePtr;
+
+	PrecomputedModulePtr getPrecomputedModule(const std::string& module_path, const variant& version);
+	std::string getCompatEntry(const PrecomputedModule::Entry& e) const;
+	const std::string& getCompatResponseDeflated(PrecomputedModule& module) const;
+
+	std::map<std::string, PrecomputedModulePtr> precomputed_modules_;
+	int precomputed_use_count_;
 
 	boost::asio::deadline_timer timer_;
 	int nheartbeat_;
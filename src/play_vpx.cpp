@@ -23,11 +23,16 @@
 
 #if defined(USE_LIBVPX)
 
+#include <algorithm>
+
 #include "Canvas.hpp"
 
+#include "asserts.hpp"
 #include "module.hpp"
 #include "play_vpx.hpp"
 #include "preferences.hpp"
+#include "profile_timer.hpp"
+#include "thread.hpp"
 
 #pragma comment(lib, "vpxmt")
 
@@ -38,10 +43,17 @@ namespace movie
 {
 	namespace 
 	{
-		unsigned mem_get_le32(const std::vector<uint8_t>& mem) {
+		PREF_INT(vpx_decode_threads, 0, "Number of threads libvpx decodes video with; 0 uses one per core, up to four");
+		PREF_INT(vpx_frame_queue, 4, "Number of decoded video frames buffered ahead of presentation");
+
+		unsigned mem_get_le32(const uint8_t* mem) {
 			return (static_cast<unsigned>(mem[3]) << 24)|(static_cast<unsigned>(mem[2]) << 16)|(static_cast<unsigned>(mem[1]) << 8)|static_cast<unsigned>(mem[0]);
 		}
 
+		uint64_t mem_get_le64(const uint8_t* mem) {
+			return static_cast<uint64_t>(mem_get_le32(mem)) | (static_cast<uint64_t>(mem_get_le32(mem + 4)) << 32);
+		}
+
 		KRE::ShaderProgramPtr get_shader()
 		{
 			using namespace KRE;
@@ -64,12 +76,252 @@ namespace movie
 		}
 	}
 
+	// Reads and decodes an IVF file on its own thread into a bounded ring of
+	// frames. The decoder blocks when the ring is full; the widget takes frames
+	// out as they become due.
+	class vpx_decoder
+	{
+	public:
+		vpx_decoder(const std::string& file_name, bool loop);
+		~vpx_decoder();
+
+		// Swaps the newest frame due at 'now' (milliseconds since playback started)
+		// into frame, dropping any older due frames. Returns false if no new frame
+		// is due yet.
+		bool takeFrame(int now, vpx_frame* frame);
+		// Swaps the oldest decoded frame into frame whatever its time, to start
+		// playback from. Returns false if nothing has been decoded yet.
+		bool takeFirstFrame(vpx_frame* frame);
+		// True once a non-looping file has been fully decoded and every frame taken.
+		bool finished() const;
+	private:
+		void run();
+		void readFileHeader();
+		bool readFrame();
+		bool publishFrame(const vpx_image_t* img);
+		bool stopping() const;
+
+		std::string file_name_;
+		std::ifstream file_;
+		bool loop_;
+		vpx_codec_ctx_t codec_;
+
+		unsigned timebase_num_;
+		unsigned timebase_den_;
+		std::vector<uint8_t> frame_hdr_;
+		std::vector<uint8_t> data_;
+		// Presentation time of the frame in data_, and bookkeeping to keep time
+		// increasing across loops.
+		int pts_;
+		int loop_offset_;
+		int last_pts_;
+		int frame_interval_;
+		int frames_this_pass_;
+
+		threading::mutex mutex_;
+		threading::condition cond_;
+		std::vector<vpx_frame> ring_;
+		size_t head_;
+		size_t count_;
+		bool stop_;
+		bool eof_;
+
+		std::unique_ptr<threading::thread> thread_;
+	};
+
+	vpx_decoder::vpx_decoder(const std::string& file_name, bool loop)
+		: file_name_(file_name),
+		  loop_(loop),
+		  timebase_num_(1),
+		  timebase_den_(1000),
+		  pts_(0),
+		  loop_offset_(0),
+		  last_pts_(0),
+		  frame_interval_(0),
+		  frames_this_pass_(0),
+		  head_(0),
+		  count_(0),
+		  stop_(false),
+		  eof_(false)
+	{
+		file_.open(file_name_, std::ios::in | std::ios::binary);
+		ASSERT_LOG(file_.is_open(), "Unable to open file: " << file_name_);
+		readFileHeader();
+		frame_hdr_.resize(IVF_FRAME_HDR_SZ);
+
+		vpx_codec_dec_cfg_t cfg;
+		cfg.threads = g_vpx_decode_threads > 0 ? g_vpx_decode_threads : std::min(4, std::max(1, SDL_GetCPUCount()));
+		cfg.w = 0;
+		cfg.h = 0;
+		auto res = vpx_codec_dec_init(&codec_, vpx_codec_vp8_dx(), &cfg, 0);
+		ASSERT_LOG(res == 0, "Codec error: " << vpx_codec_error(&codec_));
+
+		ring_.resize(std::max(2, g_vpx_frame_queue));
+		thread_.reset(new threading::thread("vpx_decoder", [this]() { run(); }));
+	}
+
+	vpx_decoder::~vpx_decoder()
+	{
+		{
+			threading::lock lck(mutex_);
+			stop_ = true;
+			cond_.notify_all();
+		}
+		// Joins the decoding thread.
+		thread_.reset();
+		vpx_codec_destroy(&codec_);
+	}
+
+	void vpx_decoder::readFileHeader()
+	{
+		std::vector<uint8_t> hdr(IVF_FILE_HDR_SZ);
+		file_.read(reinterpret_cast<char*>(&hdr[0]), IVF_FILE_HDR_SZ);
+		ASSERT_LOG(hdr[0] == 'D' && hdr[1] == 'K' && hdr[2] == 'I' && hdr[3] == 'F', 
+			"Unknown file header found: " << std::string(&hdr[0], &hdr[4]));
+		// The time base is stored as denominator then numerator.
+		const unsigned den = mem_get_le32(&hdr[16]);
+		const unsigned num = mem_get_le32(&hdr[20]);
+		if(den != 0 && num != 0) {
+			timebase_den_ = den;
+			timebase_num_ = num;
+		}
+	}
+
+	bool vpx_decoder::stopping() const
+	{
+		threading::lock lck(mutex_);
+		return stop_;
+	}
+
+	bool vpx_decoder::readFrame()
+	{
+		file_.read(reinterpret_cast<char*>(&frame_hdr_[0]), IVF_FRAME_HDR_SZ);
+		if(!file_) {
+			if(!loop_ || frames_this_pass_ == 0) {
+				return false;
+			}
+			// Start again, carrying the clock on from the last frame.
+			file_.clear();
+			file_.seekg(0, std::ios::beg);
+			readFileHeader();
+			loop_offset_ = last_pts_ + frame_interval_;
+			frames_this_pass_ = 0;
+			file_.read(reinterpret_cast<char*>(&frame_hdr_[0]), IVF_FRAME_HDR_SZ);
+			if(!file_) {
+				return false;
+			}
+		}
+		const unsigned frame_size = mem_get_le32(&frame_hdr_[0]);
+		const uint64_t pts = mem_get_le64(&frame_hdr_[4]);
+		data_.resize(frame_size);
+		if(frame_size > 0) {
+			file_.read(reinterpret_cast<char*>(&data_[0]), frame_size);
+		}
+		pts_ = loop_offset_ + static_cast<int>(static_cast<double>(pts) * 1000.0 * timebase_num_ / timebase_den_);
+		++frames_this_pass_;
+		return true;
+	}
+
+	void vpx_decoder::run()
+	{
+		while(!stopping() && readFrame()) {
+			auto res = vpx_codec_decode(&codec_, data_.empty() ? nullptr : &data_[0], static_cast<unsigned>(data_.size()), nullptr, 0);
+			if(res != VPX_CODEC_OK) {
+				LOG_ERROR("Codec error decoding " << file_name_ << ": " << vpx_codec_error(&codec_) << " : " << vpx_codec_error_detail(&codec_));
+				break;
+			}
+			vpx_codec_iter_t iter = nullptr;
+			while(vpx_image_t* img = vpx_codec_get_frame(&codec_, &iter)) {
+				if(!publishFrame(img)) {
+					return;
+				}
+			}
+			if(pts_ > last_pts_) {
+				frame_interval_ = pts_ - last_pts_;
+			}
+			last_pts_ = pts_;
+		}
+
+		threading::lock lck(mutex_);
+		eof_ = true;
+		cond_.notify_all();
+	}
+
+	bool vpx_decoder::publishFrame(const vpx_image_t* img)
+	{
+		size_t slot;
+		{
+			threading::lock lck(mutex_);
+			while(count_ == ring_.size() && !stop_) {
+				cond_.wait(mutex_);
+			}
+			if(stop_) {
+				return false;
+			}
+			slot = (head_ + count_) % ring_.size();
+		}
+
+		// The slot isn't visible to the consumer until count_ is increased, so it
+		// is filled without holding the lock.
+		vpx_frame& frame = ring_[slot];
+		frame.pts = pts_;
+		frame.width = img->d_w;
+		frame.height = img->d_h;
+		frame.stride.assign(4, 0);
+		for(int n = 0; n != 3; ++n) {
+			const unsigned rows = n == 0 ? img->d_h : (img->d_h + img->y_chroma_shift) >> img->y_chroma_shift;
+			frame.stride[n] = img->stride[n];
+			frame.planes[n].assign(img->planes[n], img->planes[n] + img->stride[n] * rows);
+		}
+
+		threading::lock lck(mutex_);
+		++count_;
+		cond_.notify_all();
+		return true;
+	}
+
+	bool vpx_decoder::takeFrame(int now, vpx_frame* frame)
+	{
+		threading::lock lck(mutex_);
+		bool taken = false;
+		while(count_ > 0 && ring_[head_].pts <= now) {
+			// Swapping hands the previous frame's buffers back to the ring for reuse.
+			std::swap(*frame, ring_[head_]);
+			head_ = (head_ + 1) % ring_.size();
+			--count_;
+			taken = true;
+		}
+		if(taken) {
+			cond_.notify_all();
+		}
+		return taken;
+	}
+
+	bool vpx_decoder::takeFirstFrame(vpx_frame* frame)
+	{
+		threading::lock lck(mutex_);
+		if(count_ == 0) {
+			return false;
+		}
+		std::swap(*frame, ring_[head_]);
+		head_ = (head_ + 1) % ring_.size();
+		--count_;
+		cond_.notify_all();
+		return true;
+	}
+
+	bool vpx_decoder::finished() const
+	{
+		threading::lock lck(mutex_);
+		return eof_ && count_ == 0;
+	}
+
 	vpx::vpx(const std::string& file, int x, int y, int width, int height, bool loop, bool cancel_on_keypress)
 		: loop_(loop), 
 		  cancel_on_keypress_(cancel_on_keypress), 
+		  start_time_(-1),
 		  playing_(false), 
-		  flags_(0), 
-		  img_(nullptr)
+		  front_texture_(0)
 	{
 		file_name_ = module::map_file(file);
 		setLoc(x, y);
@@ -81,9 +333,9 @@ namespace movie
 		: Widget(v, e), 
 		  loop_(false), 
 		  cancel_on_keypress_(false), 
+		  start_time_(-1),
 		  playing_(false), 
-		  flags_(0), 
-		  img_(nullptr)
+		  front_texture_(0)
 	{
 		ASSERT_LOG(v.has_key("filename") && v["filename"].is_string(), "Must have at least a 'filename' key or type string");
 		file_name_ = module::map_file(v["filename"].as_string());
@@ -96,121 +348,72 @@ namespace movie
 		init();
 	}
 
-	void vpx::init()
-	{
-		file_.open(file_name_, std::ios::in | std::ios::binary);
-		ASSERT_LOG(file_.is_open(), "Unable to open file: " << file_name_);
-		file_hdr_.resize(IVF_FILE_HDR_SZ);
-		file_.read(&file_hdr_[0], IVF_FILE_HDR_SZ);
-		ASSERT_LOG(file_hdr_[0] == 'D' && file_hdr_[1] == 'K' && file_hdr_[2] == 'I' && file_hdr_[3] == 'F', 
-			"Unknown file header found: " << std::string(&file_hdr_[0], &file_hdr_[4]));
-		frame_hdr_.resize(IVF_FRAME_HDR_SZ);
-
-		auto res = vpx_codec_dec_init(&codec_, vpx_codec_vp8_dx(), nullptr, flags_);
-		ASSERT_LOG(res == 0, "Codec error: " << vpx_codec_error(&codec_));
-
-		frame_.resize(256 * 1024);
-		playing_ = true;
-		iter_ = nullptr;
-	}
-
 	vpx::vpx(const vpx& v)
 		: Widget(v),
-		  file_(),
 		  file_name_(v.file_name_),
 		  loop_(v.loop_),
 		  cancel_on_keypress_(v.cancel_on_keypress_),
-		  frame_cnt_(v.frame_cnt_),
-		  flags_(v.flags_),
-		  file_hdr_(v.file_hdr_),
-		  frame_hdr_(v.frame_hdr_),
-		  frame_size_(v.frame_size_),
-		  res_(v.res_),
-		  codec_(v.codec_),
-		  iter_(nullptr),
-		  img_(v.img_),
+		  start_time_(-1),
 		  playing_(false),
-		  texture_(nullptr)
+		  front_texture_(0)
 	{
 		init();
 	}
 
-	void vpx::genTextures()
+	vpx::~vpx()
 	{
-		ASSERT_LOG(img_ != nullptr, "img_ is null");
-		texture_ = KRE::Texture::createTexture2D(img_->d_w, img_->d_h, KRE::PixelFormat::PF::PIXELFORMAT_YV12);
-		texture_->setFiltering(0, KRE::Texture::Filtering::LINEAR, KRE::Texture::Filtering::LINEAR, KRE::Texture::Filtering::POINT);
-		texture_->setAddressModes(0, KRE::Texture::AddressMode::CLAMP, KRE::Texture::AddressMode::CLAMP, KRE::Texture::AddressMode::CLAMP);
+	}
+
+	void vpx::init()
+	{
+		decoder_.reset(new vpx_decoder(file_name_, loop_));
+		start_time_ = -1;
+		playing_ = true;
 	}
 
 	void vpx::stop()
 	{
 		playing_ = false;
+		decoder_.reset();
 	}
 
-	void vpx::decodeFrame()
+	void vpx::uploadFrame()
 	{
-		if(file_.eof()) {
-			// when file_ has been read call vpx_codec_decode with data as nullptr and sz as 0
-			vpx_codec_decode(&codec_, nullptr, 0, nullptr, 0);
-			if(loop_) {
-				file_.clear();
-				file_.seekg(0, std::ios::beg);
-				file_.read(&file_hdr_[0], IVF_FILE_HDR_SZ);
-				ASSERT_LOG(file_hdr_[0] == 'D' && file_hdr_[1] == 'K' && file_hdr_[2] == 'I' && file_hdr_[3] == 'F', 
-					"Unknown file header found: " << std::string(&file_hdr_[0], &file_hdr_[4]));
-				frame_hdr_.resize(IVF_FRAME_HDR_SZ);
-
-				iter_ = nullptr;
-				img_ = nullptr;
-			
-				file_.read(reinterpret_cast<char*>(&frame_hdr_[0]), IVF_FRAME_HDR_SZ);
-				frame_size_ = mem_get_le32(frame_hdr_);
-				++frame_cnt_;
-
-				frame_.resize(frame_size_);
-				file_.read(reinterpret_cast<char*>(&frame_[0]), frame_size_);
-
-				auto res = vpx_codec_decode(&codec_, &frame_[0], frame_size_, nullptr, 0);
-				ASSERT_LOG(res == 0, "Codec error: " << vpx_codec_error(&codec_) << " : " << vpx_codec_error_detail(&codec_));
-
-			} else {
-				playing_ = false;
-			}
-			/// test loop_ here.
-		} else {
-			file_.read(reinterpret_cast<char*>(&frame_hdr_[0]), IVF_FRAME_HDR_SZ);
-			frame_size_ = mem_get_le32(frame_hdr_);
-			++frame_cnt_;
-
-			frame_.resize(frame_size_);
-			file_.read(reinterpret_cast<char*>(&frame_[0]), frame_size_);
+		const int back = 1 - front_texture_;
+		KRE::TexturePtr& tex = textures_[back];
+		if(tex == nullptr || tex->width() != frame_.width || tex->height() != frame_.height) {
+			tex = KRE::Texture::createTexture2D(frame_.width, frame_.height, KRE::PixelFormat::PF::PIXELFORMAT_YV12);
+			tex->setFiltering(0, KRE::Texture::Filtering::LINEAR, KRE::Texture::Filtering::LINEAR, KRE::Texture::Filtering::POINT);
+			tex->setAddressModes(0, KRE::Texture::AddressMode::CLAMP, KRE::Texture::AddressMode::CLAMP, KRE::Texture::AddressMode::CLAMP);
+		}
 
-			auto res = vpx_codec_decode(&codec_, &frame_[0], frame_size_, nullptr, 0);
-			ASSERT_LOG(res == 0, "Codec error: " << vpx_codec_error(&codec_) << " : " << vpx_codec_error_detail(&codec_));
+		std::vector<void*> pixels(4, nullptr);
+		for(int n = 0; n != 3; ++n) {
+			pixels[n] = frame_.planes[n].empty() ? nullptr : &frame_.planes[n][0];
 		}
+		tex->updateYUV(0, 0, frame_.width, frame_.height, frame_.stride, pixels);
+		front_texture_ = back;
 	}
 
 	void vpx::handleProcess()
 	{
-		if(!playing_) {
+		if(!playing_ || decoder_ == nullptr) {
 			return;
 		}
 
-		bool done = false;
-		while(playing_ && !done) {
-			if(img_ == nullptr) {
-				decodeFrame();
-				iter_ = nullptr;
-			}
-			img_ = vpx_codec_get_frame(&codec_, &iter_);
-			if(img_ != nullptr) {
-				done = true;
+		// The clock starts with the first decoded frame, at that frame's time, so
+		// decoder start-up doesn't count as lateness and a file needn't start at
+		// time 0. Frames that fall behind the clock are dropped.
+		const int ticks = profile::get_tick_time();
+		const bool taken = start_time_ < 0 ? decoder_->takeFirstFrame(&frame_) : decoder_->takeFrame(ticks - start_time_, &frame_);
+		if(taken) {
+			if(start_time_ < 0) {
+				start_time_ = ticks - frame_.pts;
 			}
-		}
-
-		if(!texture_) {
-			genTextures();
+			uploadFrame();
+			invalidate();
+		} else if(decoder_->finished()) {
+			stop();
 		}
 	}
 
@@ -243,21 +446,14 @@ namespace movie
 
 	void vpx::handleDraw() const
 	{
-		if(img_ == nullptr) {
+		const KRE::TexturePtr& tex = textures_[front_texture_];
+		if(tex == nullptr) {
 			return;
 		}
 
-		static std::vector<int> stride(4);
-		static std::vector<void*> pixels(4);
-		for(int n = 0; n != 4; n++) {
-			stride[n] = img_->stride[n];
-			pixels[n] = img_->planes[n];
-		}
-		texture_->updateYUV(0, 0, img_->d_w, img_->d_h, stride, pixels);
-		
 		KRE::ShaderProgramPtr yuv_shader = get_shader();
 		KRE::Canvas::ShaderScope sm(yuv_shader);
-		KRE::Canvas::getInstance()->blitTexture(texture_, 0, rect(0, 0, width(), height()));
+		KRE::Canvas::getInstance()->blitTexture(tex, 0, rect(0, 0, width(), height()));
 	}
 
 	gui::WidgetPtr vpx::clone() const
@@ -30,6 +30,7 @@
 #include <fstream>
 #include <memory>
 #include <string>
+#include <vector>
 #include "SDL.h"
 
 #include "vpx/vpx_decoder.h"
@@ -41,44 +42,53 @@
 
 namespace movie
 {
+	class vpx_decoder;
+
+	// A single decoded frame, with its presentation time in milliseconds from the
+	// start of playback.
+	struct vpx_frame
+	{
+		vpx_frame() : pts(0), width(0), height(0) {}
+		int pts;
+		int width;
+		int height;
+		std::vector<int> stride;
+		std::vector<uint8_t> planes[3];
+	};
+
 	class vpx : public gui::Widget
 	{
 	public:
 		vpx(const std::string& file, int x, int y, int width, int height, bool loop, bool cancel_on_keypress);
 		vpx(const variant& v, game_logic::FormulaCallable* e);
 		vpx(const vpx& v);
+		~vpx();
 		gui::WidgetPtr clone() const override;
 	protected:
 		void init();
 		void stop();
-		void genTextures();
-		void decodeFrame();
+		void uploadFrame();
 	private:
 		virtual void handleProcess() override;
 		virtual bool handleEvent(const SDL_Event& event, bool claimed) override;
 		virtual void handleDraw() const override;
 
-		std::ifstream file_;
 		std::string file_name_;
 		bool loop_;
 		bool cancel_on_keypress_;
-		size_t frame_cnt_;
-		vpx_codec_flags_t flags_;
-		std::vector<char> file_hdr_;
-		std::vector<uint8_t> frame_hdr_;
-		int frame_size_;
-		std::vector<uint8_t> frame_;
-		vpx_codec_err_t res_;
-
-		vpx_codec_ctx_t  codec_;
-		vpx_codec_iter_t iter_;
-		vpx_image_t* img_;
 
-		bool playing_;
+		// Frames are decoded on a separate thread; handleProcess only picks up
+		// the frame that is due and uploads it.
+		std::unique_ptr<vpx_decoder> decoder_;
+		vpx_frame frame_;
+		int start_time_;
 
-		KRE::TexturePtr texture_;
+		bool playing_;
 
-		unsigned u_tex_[3];
+		// Frames are uploaded alternately into two textures so that an upload
+		// never has to wait for a draw still using the previous frame.
+		KRE::TexturePtr textures_[2];
+		int front_texture_;
 	};
 	typedef ffl::IntrusivePtr<vpx> vpx_ptr;
 }
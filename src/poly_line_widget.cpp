@@ -126,16 +126,19 @@ namespace gui
 				obj.points_.emplace_back(pp[0].as_float(), pp[1].as_float());
 			}
 			obj.calcCoords();
+			obj.invalidate();
 		
 		DEFINE_FIELD(width, "decimal")
 			return variant(obj.width_);
 		DEFINE_SET_FIELD_TYPE("int|decimal")
 			obj.width_ = value.as_float();
+			obj.invalidate();
 		
 		DEFINE_FIELD(color, "[int,int,int,int]")
 			return obj.color_.write();
 		DEFINE_SET_FIELD_TYPE("[int,int,int]|[int,int,int,int]|string") // Can also me a map
 			obj.color_ = KRE::Color(value);
+			obj.invalidate();
 	END_DEFINE_CALLABLE(PolyLineWidget)
 
 }
@@ -79,6 +79,7 @@ namespace gui
 	{
 		TileMap(value).buildTiles(&tiles_);
 		init();
+		invalidate();
 	}
 
 	WidgetPtr PreviewTilesetWidget::clone() const
@@ -91,6 +91,7 @@ namespace gui
 	{
 		progress_ = std::min(max_, value);
 		progress_ = std::max(min_, progress_);
+		invalidate();
 		if(progress_ >= max_ && completion_called_ == false) {
 			completion_called_ = true;
 			if(oncompletion_) {
@@ -103,6 +104,7 @@ namespace gui
 	{
 		progress_ = std::min(max_, progress_ + delta);
 		progress_ = std::max(min_, progress_);
+		invalidate();
 		if(progress_ >= max_ && completion_called_ == false) {
 			completion_called_ = true;
 			if(oncompletion_) {
@@ -120,16 +122,19 @@ namespace gui
 	{
 		progress_ = min_;
 		completion_called_ = false;
+		invalidate();
 	}
 
 	void ProgressBar::setMinValue(int min_val)
 	{
 		min_ = min_val;
+		invalidate();
 	}
 
 	void ProgressBar::setMaxValue(int max_val)
 	{
 		max_ = max_val;
+		invalidate();
 		if(progress_ < max_) {
 			completion_called_ = false;
 		} else if(completion_called_ == false) {
@@ -166,6 +171,7 @@ namespace gui
 			return variant(obj.upscale_ ? "double" : "normal");
 		DEFINE_SET_FIELD
 			obj.upscale_ = value.as_string_default("normal") == "normal" ? false : true;
+			obj.invalidate();
 
 		//DEFINE_FIELD(color, "builtin Color")
 		DEFINE_FIELD(padding, "[int,int]")
@@ -176,6 +182,7 @@ namespace gui
 		DEFINE_SET_FIELD
 			obj.hpad_ = value[0].as_int();
 			obj.vpad_ = value[1].as_int();
+			obj.invalidate();
 
 	END_DEFINE_CALLABLE(ProgressBar)
 
@@ -26,6 +26,7 @@
 #include <ctime>
 
 #include "random.hpp"
+#include "reference_counted_object.hpp"
 
 namespace rng 
 {
@@ -34,10 +35,16 @@ namespace rng
 		boost::random::mt19937 state;
 		boost::random::uniform_int_distribution<> generator(0,0xFFFFFF);
 		bool rng_init = false;
+
+		THREAD_LOCAL boost::random::mt19937* local_state;
 	}
 
 	int generate() 
 	{
+		if(local_state) {
+			return generator(*local_state);
+		}
+
 		if(!rng_init) {
 			// using std::time to initialise a mersienne twister is a really pitiful and inadequate idea.
 			seed_from_int(static_cast<unsigned int>(std::time(NULL)));
@@ -60,4 +67,14 @@ namespace rng
 	{
 		return state;
 	}
+
+	LocalSeedScope::LocalSeedScope(unsigned int seed) : state_(seed), prev_(local_state)
+	{
+		local_state = &state_;
+	}
+
+	LocalSeedScope::~LocalSeedScope()
+	{
+		local_state = prev_;
+	}
 }
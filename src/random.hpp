@@ -33,4 +33,21 @@ namespace rng
 	void seed_from_int(unsigned int seed);
 	void set_seed(const Seed& seed);
 	Seed get_seed();
+
+	//While in scope, generate() on the current thread draws from a private
+	//generator seeded with the given value instead of the global one. This
+	//lets work run on several threads with results that don't depend on
+	//which thread ran first.
+	class LocalSeedScope
+	{
+	public:
+		explicit LocalSeedScope(unsigned int seed);
+		~LocalSeedScope();
+	private:
+		LocalSeedScope(const LocalSeedScope&);
+		void operator=(const LocalSeedScope&);
+
+		Seed state_;
+		Seed* prev_;
+	};
 }
@@ -75,6 +75,7 @@ namespace gui
 		const int old = yscroll_;
 		yscroll_ = yscroll;
 		onSetYscroll(old, yscroll);
+		invalidate();
 	}
 
 	void ScrollableWidget::setDim(int w, int h)
@@ -94,6 +95,7 @@ namespace gui
 			setYscroll(height - this->height());
 		}
 		updateScrollbar();
+		invalidate();
 	}
 
 	void ScrollableWidget::setScrollStep(int step)
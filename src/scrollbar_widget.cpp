@@ -139,6 +139,7 @@ namespace gui
 		if(window_pos_ < 0 || window_pos_ > range_ - window_size_) {
 			window_pos_ = range_ - window_size_;
 		}
+		invalidate();
 	}
 
 	void ScrollBarWidget::setLoc(int x, int y)
@@ -366,31 +367,37 @@ namespace gui
 			return variant(obj.up_arrow_.get());
 		DEFINE_SET_FIELD_TYPE("map|builtin widget")
 			obj.up_arrow_ = widget_factory::create(value, obj.getEnvironment());
+			obj.invalidate();
 
 		DEFINE_FIELD(down_arrow, "builtin widget")
 			return variant(obj.down_arrow_.get());
 		DEFINE_SET_FIELD_TYPE("map|builtin widget")
 			obj.down_arrow_ = widget_factory::create(value, obj.getEnvironment());
+			obj.invalidate();
 
 		DEFINE_FIELD(handle, "builtin widget")
 			return variant(obj.handle_.get());
 		DEFINE_SET_FIELD_TYPE("map|builtin widget")
 			obj.handle_ = widget_factory::create(value, obj.getEnvironment());
+			obj.invalidate();
 
 		DEFINE_FIELD(handle_bottom, "builtin widget")
 			return variant(obj.handle_bot_.get());
 		DEFINE_SET_FIELD_TYPE("map|builtin widget")
 			obj.handle_bot_ = widget_factory::create(value, obj.getEnvironment());
+			obj.invalidate();
 
 		DEFINE_FIELD(handle_top, "builtin widget")
 			return variant(obj.handle_top_.get());
 		DEFINE_SET_FIELD_TYPE("map|builtin widget")
 			obj.handle_top_ = widget_factory::create(value, obj.getEnvironment());
+			obj.invalidate();
 
 		DEFINE_FIELD(background, "builtin widget")
 			return variant(obj.background_.get());
 		DEFINE_SET_FIELD_TYPE("map|builtin widget")
 			obj.background_ = widget_factory::create(value, obj.getEnvironment());
+			obj.invalidate();
 
 		DEFINE_FIELD(on_scroll, "null")
 			return variant();
@@ -42,7 +42,7 @@ namespace gui
 		explicit Slider(int width, ChangeFn onchange, float position=0.0f, int scale=2);
 		explicit Slider(const variant& v, game_logic::FormulaCallable* e);
 		float position() const {return position_;};
-		void setPosition (float position) {position_ = position;};
+		void setPosition (float position) {position_ = position; invalidate();};
 		void setDragEnd(DragEndFn ondragend) { ondragend_ = ondragend; }
 		WidgetPtr clone() const override;
 	private:
@@ -80,6 +80,7 @@ void SolidMap::createObjectSolidMaps(variant node, std::vector<ConstSolidMapPtr>
 		if(legs_height == 0) {
 			body_map->calculateSide(0, 1, body_map->bottom_);
 		}
+		body_map->calculateRows();
 		v.push_back(body_map);
 	} else {
 		legs_height = area.h();
@@ -105,6 +106,7 @@ void SolidMap::createObjectSolidMaps(variant node, std::vector<ConstSolidMapPtr>
 		legs_map->calculateSide(-1, 0, legs_map->left_);
 		legs_map->calculateSide(1, 0, legs_map->right_);
 		legs_map->calculateSide(-10000, 0, legs_map->all_);
+		legs_map->calculateRows();
 		v.push_back(legs_map);
 	}
 }
@@ -126,6 +128,7 @@ void SolidMap::createObjectPlatformMaps(const rect& area_ref, std::vector<ConstS
 	platform->calculateSide(-1, 0, platform->left_);
 	platform->calculateSide(1, 0, platform->right_);
 	platform->calculateSide(-100000, 0, platform->all_);
+	platform->calculateRows();
 	v.push_back(platform);
 }
 SolidMapPtr SolidMap::createFromTexture(const KRE::TexturePtr& t, const rect& area_rect)
@@ -237,6 +240,20 @@ const std::vector<point>& SolidMap::dir(MOVE_DIRECTION d) const
 	}
 }
 
+const std::vector<SolidMap::PointRow>& SolidMap::dirRows(MOVE_DIRECTION d) const
+{
+	switch(d) {
+		case MOVE_DIRECTION::LEFT: return left_rows_;
+		case MOVE_DIRECTION::RIGHT: return right_rows_;
+		case MOVE_DIRECTION::UP: return top_rows_;
+		case MOVE_DIRECTION::DOWN: return bottom_rows_;
+		case MOVE_DIRECTION::NONE: return all_rows_;
+		default:
+			assert(false);
+			return all_rows_;
+	}
+}
+
 void SolidMap::setSolid(int x, int y, bool value)
 {
 	ASSERT_EQ(solid_.size(), area_.w()*area_.h());
@@ -287,6 +304,48 @@ void SolidMap::calculateSide(int xdir, int ydir, std::vector<point>& points) con
 	}
 }
 
+namespace
+{
+	void points_to_rows(const std::vector<point>& points, std::vector<SolidMap::PointRow>& rows)
+	{
+		rows.clear();
+
+		auto begin = points.begin();
+		while(begin != points.end()) {
+			auto end = begin;
+			while(end != points.end() && end->y == begin->y) {
+				++end;
+			}
+
+			//points from calculateSide() are in order of x within a row.
+			SolidMap::PointRow row;
+			row.x = begin->x;
+			row.y = begin->y;
+			row.width = (end-1)->x - begin->x + 1;
+			row.bits.resize((row.width + 63)/64);
+			row.mirrored.resize(row.bits.size());
+			for(auto p = begin; p != end; ++p) {
+				const int n = p->x - row.x;
+				const int m = row.width - 1 - n;
+				row.bits[n/64] |= uint64_t(1) << (n%64);
+				row.mirrored[m/64] |= uint64_t(1) << (m%64);
+			}
+
+			rows.push_back(row);
+			begin = end;
+		}
+	}
+}
+
+void SolidMap::calculateRows()
+{
+	points_to_rows(left_, left_rows_);
+	points_to_rows(right_, right_rows_);
+	points_to_rows(top_, top_rows_);
+	points_to_rows(bottom_, bottom_rows_);
+	points_to_rows(all_, all_rows_);
+}
+
 ConstSolidInfoPtr SolidInfo::createFromSolidMaps(const std::vector<ConstSolidMapPtr>& solid)
 {
 	if(solid.empty()) {
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
 #include "geometry.hpp"
@@ -36,6 +37,14 @@ enum class MOVE_DIRECTION { LEFT, RIGHT, UP, DOWN, NONE };
 class SolidMap
 {
 public:
+	//a run of the points on one side of the map which share a row, as a bit
+	//string with bit n set if (x + n, y) is one of the points. mirrored is
+	//the same run reversed, for objects facing left.
+	struct PointRow {
+		int x, y, width;
+		std::vector<uint64_t> bits, mirrored;
+	};
+
 	static void createObjectSolidMaps(variant node, std::vector<ConstSolidMapPtr>& v);
 	static void createObjectPlatformMaps(const rect& area, std::vector<ConstSolidMapPtr>& v);
 	static SolidMapPtr createFromTexture(const KRE::TexturePtr& t, const rect& area);
@@ -51,6 +60,9 @@ public:
 	const std::vector<point>& top() const { return top_; }
 	const std::vector<point>& bottom() const { return bottom_; }
 	const std::vector<point>& all() const { return all_; }
+
+	//the points of dir(d) grouped into rows, in the same order.
+	const std::vector<PointRow>& dirRows(MOVE_DIRECTION d) const;
 private:
 	static ConstSolidMapPtr createObjectSolidMapFromSolidNode(variant node);
 
@@ -59,6 +71,7 @@ private:
 	void setSolid(int x, int y, bool value=true);
 
 	void calculateSide(int xdir, int ydir, std::vector<point>& points) const;
+	void calculateRows();
 
 	void applyOffsets(const std::vector<int>& offsets);
 
@@ -69,6 +82,7 @@ private:
 
 	//all the solid points that are on the different sides of the solid area.
 	std::vector<point> left_, right_, top_, bottom_, all_;
+	std::vector<PointRow> left_rows_, right_rows_, top_rows_, bottom_rows_, all_rows_;
 };
 
 class SolidInfo
@@ -22,6 +22,7 @@
 */
 
 #include <map>
+#include <mutex>
 #include <vector>
 
 #include <boost/bimap.hpp>
@@ -74,15 +75,56 @@ namespace graphics
 			static palette_texture_cache res;
 			return res;
 		}
+
+		//palette images are tiny and shared by every texture that uses them,
+		//so they are decoded once and kept for the life of the program.
+		//Textures are built from level loader threads too, hence the lock.
+		typedef std::map<int, KRE::SurfacePtr> palette_surface_cache;
+		palette_surface_cache& get_palette_surface_cache()
+		{
+			static palette_surface_cache res;
+			return res;
+		}
+
+		std::mutex& get_palette_surface_mutex()
+		{
+			static std::mutex* res = new std::mutex;
+			return *res;
+		}
 	}
 
 	KRE::SurfacePtr get_palette_surface(int palette)
 	{
+		{
+			std::lock_guard<std::mutex> lock(get_palette_surface_mutex());
+			auto it = get_palette_surface_cache().find(palette);
+			if(it != get_palette_surface_cache().end()) {
+				return it->second;
+			}
+		}
+
+		//decode without holding the lock; if another thread got there
+		//first, its surface is the one kept.
+		KRE::SurfacePtr surf;
 		auto& name = get_palette_name(palette);
-		if(name.empty()) {
-			return nullptr;
+		if(!name.empty()) {
+			surf = KRE::Surface::create(module::map_file("palette/" + name + ".png"));
+		}
+
+		std::lock_guard<std::mutex> lock(get_palette_surface_mutex());
+		return get_palette_surface_cache().insert(std::make_pair(palette, surf)).first->second;
+	}
+
+	void set_texture_palette(const KRE::TexturePtr& tex, int palette)
+	{
+		ASSERT_LOG(tex != nullptr, "Setting palette on a null texture.");
+		//only textures that were already converted to the indexed form get
+		//new palette rows. Others may not be convertible (too many colours,
+		//several surfaces), so they are left as they were.
+		if(palette >= 0 && tex->isPaletteized() && !tex->hasPaletteAt(palette)) {
+			tex->addPalette(palette, get_palette_surface(palette));
 		}
-		return KRE::Surface::create(module::map_file("palette/" + name + ".png"));
+		tex->setPalette(palette);
 	}
 
 
@@ -35,6 +35,10 @@ namespace graphics
 
 	KRE::SurfacePtr get_palette_surface(int palette);
 	
+	// Selects the palette used when drawing tex. A paletteized texture that
+	// doesn't have the palette yet gets its row added to its lookup table.
+	void set_texture_palette(const KRE::TexturePtr& tex, int palette);
+
 	KRE::SurfacePtr map_palette(KRE::SurfacePtr surface, int palette);
 
 	KRE::TexturePtr get_palette_texture(const std::string& name, const variant& node, int palette);
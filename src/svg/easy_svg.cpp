@@ -23,11 +23,15 @@
 
 #include <algorithm>
 #include <future>
+#include <map>
+#include <mutex>
 #include <thread>
 #include <cairo.h>
 
 #include "asserts.hpp"
+#include "Blittable.hpp"
 #include "easy_svg.hpp"
+#include "svg_mesh.hpp"
 #include "svg_parse.hpp"
 #include "stb_rect_pack.h"
 
@@ -106,6 +110,41 @@ namespace KRE
 		return ctx.render(ff(file));
 	}
 
+	namespace
+	{
+		SVG::mesh_ptr get_svg_mesh(const std::string& file)
+		{
+			// A null entry records that the file can't be tessellated.
+			static std::map<std::string, SVG::mesh_ptr> cache;
+			static std::mutex mutex;
+			std::lock_guard<std::mutex> guard(mutex);
+
+			auto it = cache.find(file);
+			if(it == cache.end()) {
+				auto ff = Surface::getFileFilter(FileFilterType::LOAD);
+				SVG::parse handle(ff(file));
+				it = cache.emplace(file, SVG::create_mesh(handle)).first;
+			}
+			return it->second;
+		}
+	}
+
+	bool svg_file_has_mesh(const std::string& file)
+	{
+		return get_svg_mesh(file) != nullptr;
+	}
+
+	SceneObjectPtr svg_renderable_from_file(const std::string& file, int width, int height)
+	{
+		SVG::mesh_ptr m = get_svg_mesh(file);
+		if(m == nullptr) {
+			return nullptr;
+		}
+		auto r = std::make_shared<SVG::mesh_renderable>(m);
+		r->set_size(width, height);
+		return r;
+	}
+
 	TexturePtr svgs_to_single_texture(const std::vector<std::string>& files, const std::vector<point>& wh, std::vector<rectf>* tex_coords)
 	{
 		ASSERT_LOG(files.size() == wh.size(), "Number of files is different from the number of sizes provided.");
@@ -23,12 +23,22 @@
 
 #pragma once
 
+#include "SceneFwd.hpp"
 #include "Texture.hpp"
 
 namespace KRE
 {
 	TexturePtr svg_texture_from_file(const std::string& file, int width, int height);
 
+	// Whether the SVG file can be drawn as a triangle mesh. Files using features the mesh
+	// can't reproduce have to be rasterised with svg_texture_from_file() instead.
+	bool svg_file_has_mesh(const std::string& file);
+
+	// Returns an object drawing the SVG file at width x height. The file is tessellated
+	// once into a triangle mesh that is only rescaled when the size changes. Returns
+	// nullptr if svg_file_has_mesh() is false for the file.
+	SceneObjectPtr svg_renderable_from_file(const std::string& file, int width, int height);
+
 	// Takes an array of SVG images and adds them to a single texture, populating a list of 
 	// texture coordinates if needed.
 	TexturePtr svgs_to_single_texture(const std::vector<std::string>& files, const std::vector<point>& wh, std::vector<rectf>* tex_coords = nullptr);
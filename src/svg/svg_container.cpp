@@ -24,6 +24,7 @@
 #include <boost/tokenizer.hpp>
 
 #include "svg_container.hpp"
+#include "svg_mesh.hpp"
 #include "svg_shapes.hpp"
 
 namespace KRE
@@ -97,6 +98,11 @@ namespace KRE
 
 		void container::render_children(render_context& ctx) const
 		{
+			if(ctx.mesh() && ctx.opacity_top() < 1.0) {
+				// Group opacity composites the children as a whole, which per-vertex
+				// alpha can't reproduce where they overlap.
+				ctx.mesh()->unsupported("group opacity");
+			}
 			cairo_push_group(ctx.cairo());
 			for(auto s : elements_) {
 				s->render(ctx);
@@ -23,6 +23,7 @@
 
 #include "svg_container.hpp"
 #include "svg_element.hpp"
+#include "svg_mesh.hpp"
 #include "svg_shapes.hpp"
 
 namespace KRE
@@ -114,7 +115,11 @@ namespace KRE
 			// XXX also need to process preserveAspectRatio value.
 			
 			context_save cs(ctx.cairo());
-			if(view_box_.w() != 0 && view_box_.h() != 0) {
+			const bool has_view_box = view_box_.w() != 0 && view_box_.h() != 0;
+			if(ctx.mesh()) {
+				ctx.mesh()->push_view_box(has_view_box);
+			}
+			if(has_view_box) {
 				cairo_scale(ctx.cairo(), ctx.width()/view_box_.w(), ctx.height()/view_box_.h());
 			}
 			if(view_box_.x() != 0 || view_box_.y() != 0) {
@@ -127,6 +132,9 @@ namespace KRE
 			attribute_manager ca1(ca(), ctx);
 			attribute_manager va1(va(), ctx);
 			handle_render(ctx);
+			if(ctx.mesh()) {
+				ctx.mesh()->pop_view_box();
+			}
 		}
 
 		void element::resolve()
@@ -0,0 +1,842 @@
+/*
+	Copyright (C) 2003-2013 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include "asserts.hpp"
+#include "DisplayDevice.hpp"
+#include "Shaders.hpp"
+#include "unit_test.hpp"
+
+#include "svg_mesh.hpp"
+#include "svg_parse.hpp"
+#include "svg_render.hpp"
+
+#ifndef M_PI
+#	define M_PI		3.1415926535897932384626433832795
+#endif
+
+namespace KRE
+{
+	namespace SVG
+	{
+		namespace 
+		{
+			// Documents are recorded on a square canvas of this many pixels. Curves are
+			// flattened to within flatten_tolerance of it, which keeps the error under
+			// a quarter pixel when the mesh is drawn at 4096 pixels.
+			const int reference_size = 1024;
+			const double flatten_tolerance = 0.05;
+			// Two x co-ordinates closer than this are treated as equal by the sweep.
+			const double sweep_epsilon = 1e-9;
+			// Limit on how finely a triangle is split to follow gradient stops.
+			const int max_gradient_subdivision = 6;
+
+			typedef std::vector<glm::dvec2> contour;
+
+			struct polyline
+			{
+				polyline() : closed(false), raw_points(0) {}
+				contour points;
+				bool closed;
+				int raw_points;
+			};
+
+			struct stroke_style
+			{
+				double half_width;
+				cairo_line_join_t join;
+				cairo_line_cap_t cap;
+				double miter_limit;
+				// Approximate scale from user space to device pixels, used to pick the
+				// number of segments in round joins and caps.
+				double device_scale;
+			};
+
+			struct edge
+			{
+				glm::dvec2 top;
+				glm::dvec2 bottom;
+				int winding;
+
+				double x_at(double y) const {
+					return top.x + (bottom.x - top.x) * (y - top.y) / (bottom.y - top.y);
+				}
+			};
+
+			struct span
+			{
+				double xa;
+				double xb;
+				const edge* e;
+			};
+
+			glm::dvec2 transform_point(const cairo_matrix_t& mtx, const glm::dvec2& p)
+			{
+				double x = p.x, y = p.y;
+				cairo_matrix_transform_point(&mtx, &x, &y);
+				return glm::dvec2(x, y);
+			}
+
+			double signed_area(const contour& c)
+			{
+				double area = 0;
+				for(size_t n = 0; n != c.size(); ++n) {
+					const glm::dvec2& p0 = c[n];
+					const glm::dvec2& p1 = c[(n + 1) % c.size()];
+					area += p0.x * p1.y - p1.x * p0.y;
+				}
+				return area / 2.0;
+			}
+
+			void emit_trapezoid(const span& l, const span& r, double y0, double y1, std::vector<glm::dvec2>* out)
+			{
+				const glm::dvec2 lt(l.xa, y0), rt(r.xa, y0), rb(r.xb, y1), lb(l.xb, y1);
+				if(r.xa - l.xa > sweep_epsilon) {
+					out->emplace_back(lt);
+					out->emplace_back(rt);
+					out->emplace_back(rb);
+				}
+				if(r.xb - l.xb > sweep_epsilon) {
+					out->emplace_back(lt);
+					out->emplace_back(rb);
+					out->emplace_back(lb);
+				}
+			}
+
+			// Triangulates the region enclosed by contours under the non-zero or
+			// even-odd rule. The plane is cut into horizontal slabs at every vertex
+			// and every edge crossing, so within a slab the edges keep their
+			// left-to-right order and the filled spans are simple trapezoids.
+			void tessellate_fill(const std::vector<contour>& contours, bool even_odd, std::vector<glm::dvec2>* out)
+			{
+				std::vector<edge> edges;
+				std::vector<double> ys;
+				for(const auto& c : contours) {
+					if(c.size() < 3) {
+						continue;
+					}
+					for(size_t n = 0; n != c.size(); ++n) {
+						const glm::dvec2& p0 = c[n];
+						const glm::dvec2& p1 = c[(n + 1) % c.size()];
+						ys.emplace_back(p0.y);
+						if(p0.y == p1.y) {
+							continue;
+						}
+						edge e;
+						e.top = p0.y < p1.y ? p0 : p1;
+						e.bottom = p0.y < p1.y ? p1 : p0;
+						e.winding = p0.y < p1.y ? 1 : -1;
+						edges.emplace_back(e);
+					}
+				}
+				if(edges.empty()) {
+					return;
+				}
+				std::sort(edges.begin(), edges.end(), [](const edge& a, const edge& b) { return a.top.y < b.top.y; });
+				std::sort(ys.begin(), ys.end());
+				ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+				std::vector<const edge*> active;
+				std::vector<span> spans;
+				size_t next_edge = 0;
+				for(size_t i = 0; i + 1 < ys.size(); ++i) {
+					double y0 = ys[i];
+					const double y_end = ys[i + 1];
+					while(next_edge < edges.size() && edges[next_edge].top.y <= y0) {
+						active.emplace_back(&edges[next_edge++]);
+					}
+					active.erase(std::remove_if(active.begin(), active.end(), [y0](const edge* e) { return e->bottom.y <= y0; }), active.end());
+					if(active.empty()) {
+						continue;
+					}
+
+					while(y0 < y_end) {
+						double y1 = y_end;
+						for(;;) {
+							spans.clear();
+							for(auto e : active) {
+								span s = { e->x_at(y0), e->x_at(y1), e };
+								spans.emplace_back(s);
+							}
+							// Sorting on the middle of the slab keeps edges that meet at the
+							// top or bottom in a consistent order. If the order at either end
+							// differs then some pair of neighbours crosses; cut the slab at the
+							// highest such crossing and try again.
+							std::sort(spans.begin(), spans.end(), [](const span& a, const span& b) {
+								return a.xa + a.xb < b.xa + b.xb;
+							});
+							double split = y1;
+							for(size_t k = 0; k + 1 < spans.size(); ++k) {
+								const span& a = spans[k];
+								const span& b = spans[k + 1];
+								if(a.xa - b.xa > sweep_epsilon || a.xb - b.xb > sweep_epsilon) {
+									const double t = (b.xa - a.xa) / ((a.xb - a.xa) - (b.xb - b.xa));
+									const double yc = y0 + (y1 - y0) * t;
+									if(yc > y0 && yc < split) {
+										split = yc;
+									}
+								}
+							}
+							if(split >= y1) {
+								break;
+							}
+							y1 = split;
+						}
+
+						int winding = 0;
+						size_t left = 0;
+						for(size_t k = 0; k != spans.size(); ++k) {
+							const bool was_inside = even_odd ? (winding & 1) != 0 : winding != 0;
+							winding += spans[k].e->winding;
+							const bool inside = even_odd ? (winding & 1) != 0 : winding != 0;
+							if(!was_inside && inside) {
+								left = k;
+							} else if(was_inside && !inside) {
+								emit_trapezoid(spans[left], spans[k], y0, y1, out);
+							}
+						}
+						y0 = y1;
+					}
+				}
+			}
+
+			int arc_segments(double radius, double sweep)
+			{
+				if(radius <= flatten_tolerance) {
+					return 1;
+				}
+				const double step = 2.0 * std::acos(1.0 - flatten_tolerance / radius);
+				return std::min(256, std::max(1, static_cast<int>(std::ceil(std::abs(sweep) / step))));
+			}
+
+			void append_arc(contour* c, const glm::dvec2& centre, double radius, double start, double sweep, int segments)
+			{
+				for(int n = 0; n <= segments; ++n) {
+					const double a = start + sweep * n / segments;
+					c->emplace_back(centre.x + radius * std::cos(a), centre.y + radius * std::sin(a));
+				}
+			}
+
+			glm::dvec2 perp(const glm::dvec2& d)
+			{
+				return glm::dvec2(-d.y, d.x);
+			}
+
+			void add_join(const glm::dvec2& p, const glm::dvec2& d_in, const glm::dvec2& d_out, const stroke_style& st, std::vector<contour>* pieces)
+			{
+				const double cross = d_in.x * d_out.y - d_in.y * d_out.x;
+				const double dot = glm::dot(d_in, d_out);
+				if(std::abs(cross) < 1e-12 && dot > 0) {
+					return;
+				}
+				// The gap to fill is on the side away from the turn.
+				const double s = cross > 0 ? -1.0 : 1.0;
+				const glm::dvec2 n_in = perp(d_in) * s;
+				const glm::dvec2 n_out = perp(d_out) * s;
+				const glm::dvec2 o_in = p + n_in * st.half_width;
+				const glm::dvec2 o_out = p + n_out * st.half_width;
+
+				contour c;
+				c.emplace_back(p);
+				c.emplace_back(o_in);
+				if(st.join == CAIRO_LINE_JOIN_ROUND) {
+					const double start = std::atan2(n_in.y, n_in.x);
+					const double sweep = std::atan2(n_in.x * n_out.y - n_in.y * n_out.x, glm::dot(n_in, n_out));
+					const int segments = arc_segments(st.half_width * st.device_scale, sweep);
+					append_arc(&c, p, st.half_width, start, sweep, segments);
+				} else if(st.join == CAIRO_LINE_JOIN_MITER) {
+					// Same test as cairo: the miter is drawn while 1/sin(theta/2) is within
+					// the limit, theta being the angle between the two segments.
+					const double sin_half = std::sqrt(std::max(0.0, (1.0 + dot) / 2.0));
+					const glm::dvec2 bisect = n_in + n_out;
+					if(sin_half > 0 && 1.0 / sin_half <= st.miter_limit && glm::length(bisect) > 1e-12) {
+						c.emplace_back(p + glm::normalize(bisect) * (st.half_width / sin_half));
+					}
+				}
+				c.emplace_back(o_out);
+				pieces->emplace_back(c);
+			}
+
+			void add_cap(const glm::dvec2& p, const glm::dvec2& dir, const stroke_style& st, std::vector<contour>* pieces)
+			{
+				const glm::dvec2 n = perp(dir) * st.half_width;
+				contour c;
+				if(st.cap == CAIRO_LINE_CAP_SQUARE) {
+					const glm::dvec2 ext = dir * st.half_width;
+					c.emplace_back(p + n);
+					c.emplace_back(p + n + ext);
+					c.emplace_back(p - n + ext);
+					c.emplace_back(p - n);
+				} else if(st.cap == CAIRO_LINE_CAP_ROUND) {
+					const int segments = arc_segments(st.half_width * st.device_scale, M_PI);
+					append_arc(&c, p, st.half_width, std::atan2(n.y, n.x), -M_PI, segments);
+				} else {
+					return;
+				}
+				pieces->emplace_back(c);
+			}
+
+			// Builds the outline of a stroke as a set of overlapping convex pieces:
+			// one quad per segment plus joins and caps. Filling them with the non-zero
+			// rule gives their union, so overlapping pieces are only painted once.
+			void stroke_outline(const std::vector<polyline>& paths, const stroke_style& st, std::vector<contour>* pieces)
+			{
+				for(const auto& pl : paths) {
+					contour pts;
+					for(const auto& p : pl.points) {
+						if(pts.empty() || glm::length(p - pts.back()) > 1e-12) {
+							pts.emplace_back(p);
+						}
+					}
+					if(pl.closed && pts.size() > 1 && glm::length(pts.front() - pts.back()) <= 1e-12) {
+						pts.pop_back();
+					}
+					if(pts.size() == 1) {
+						// A degenerate sub-path still gets its caps, but a lone move-to
+						// doesn't.
+						if(pl.raw_points > 1 && st.cap != CAIRO_LINE_CAP_BUTT) {
+							add_cap(pts[0], glm::dvec2(1, 0), st, pieces);
+							add_cap(pts[0], glm::dvec2(-1, 0), st, pieces);
+						}
+						continue;
+					} else if(pts.empty()) {
+						continue;
+					}
+
+					const size_t nsegs = pl.closed ? pts.size() : pts.size() - 1;
+					std::vector<glm::dvec2> dirs;
+					dirs.reserve(nsegs);
+					for(size_t n = 0; n != nsegs; ++n) {
+						const glm::dvec2& a = pts[n];
+						const glm::dvec2& b = pts[(n + 1) % pts.size()];
+						const glm::dvec2 d = glm::normalize(b - a);
+						const glm::dvec2 off = perp(d) * st.half_width;
+						contour q;
+						q.emplace_back(a + off);
+						q.emplace_back(b + off);
+						q.emplace_back(b - off);
+						q.emplace_back(a - off);
+						pieces->emplace_back(q);
+						dirs.emplace_back(d);
+					}
+					for(size_t n = 1; n < nsegs; ++n) {
+						add_join(pts[n], dirs[n - 1], dirs[n], st, pieces);
+					}
+					if(pl.closed) {
+						add_join(pts[0], dirs.back(), dirs.front(), st, pieces);
+					} else {
+						add_cap(pts.front(), -dirs.front(), st, pieces);
+						add_cap(pts.back(), dirs.back(), st, pieces);
+					}
+				}
+			}
+
+			std::vector<polyline> flatten_path(cairo_t* cairo)
+			{
+				std::vector<polyline> res;
+				cairo_path_t* path = cairo_copy_path_flat(cairo);
+				for(int n = 0; n < path->num_data; n += path->data[n].header.length) {
+					const cairo_path_data_t* data = &path->data[n];
+					switch(data->header.type) {
+						case CAIRO_PATH_MOVE_TO:
+							res.emplace_back();
+							// fallthrough
+						case CAIRO_PATH_LINE_TO:
+							if(res.empty()) {
+								res.emplace_back();
+							}
+							res.back().points.emplace_back(data[1].point.x, data[1].point.y);
+							++res.back().raw_points;
+							break;
+						case CAIRO_PATH_CLOSE_PATH:
+							if(!res.empty()) {
+								res.back().closed = true;
+							}
+							break;
+						default: break;
+					}
+				}
+				cairo_path_destroy(path);
+				return res;
+			}
+
+			// Colour source of a fill or stroke, evaluated per vertex in device space.
+			class paint_source
+			{
+			public:
+				paint_source() : linear_(false), color_(0.0), extend_(CAIRO_EXTEND_PAD) {
+					cairo_matrix_init_identity(&device_to_pattern_);
+				}
+
+				bool init(cairo_t* cairo, mesh_recorder* recorder) {
+					cairo_pattern_t* pattern = cairo_get_source(cairo);
+					switch(cairo_pattern_get_type(pattern)) {
+						case CAIRO_PATTERN_TYPE_SOLID:
+							cairo_pattern_get_rgba(pattern, &color_.r, &color_.g, &color_.b, &color_.a);
+							return true;
+						case CAIRO_PATTERN_TYPE_LINEAR: {
+							linear_ = true;
+							cairo_pattern_get_linear_points(pattern, &p0_.x, &p0_.y, &p1_.x, &p1_.y);
+							int count = 0;
+							cairo_pattern_get_color_stop_count(pattern, &count);
+							for(int n = 0; n != count; ++n) {
+								double offset;
+								glm::dvec4 c;
+								cairo_pattern_get_color_stop_rgba(pattern, n, &offset, &c.r, &c.g, &c.b, &c.a);
+								stops_.emplace_back(offset, c);
+							}
+							std::stable_sort(stops_.begin(), stops_.end(), [](const stop& a, const stop& b) { return a.first < b.first; });
+							extend_ = cairo_pattern_get_extend(pattern);
+
+							cairo_matrix_t ctm, pmtx;
+							cairo_get_matrix(cairo, &ctm);
+							cairo_pattern_get_matrix(pattern, &pmtx);
+							if(cairo_matrix_invert(&ctm) != CAIRO_STATUS_SUCCESS) {
+								recorder->unsupported("singular transform");
+								return false;
+							}
+							cairo_matrix_multiply(&device_to_pattern_, &ctm, &pmtx);
+							return true;
+						}
+						default:
+							recorder->unsupported("non-solid, non-linear paint");
+							return false;
+					}
+				}
+
+				glm::dvec4 color_at(const glm::dvec2& p) const {
+					if(!linear_) {
+						return color_;
+					}
+					if(stops_.empty()) {
+						return glm::dvec4(0.0);
+					}
+					double t = parameter(p);
+					if(extend_ == CAIRO_EXTEND_NONE && (t < 0 || t > 1)) {
+						return glm::dvec4(0.0);
+					}
+					t = wrap(t);
+					if(t <= stops_.front().first) {
+						return stops_.front().second;
+					}
+					for(size_t n = 1; n < stops_.size(); ++n) {
+						if(t <= stops_[n].first) {
+							const double range = stops_[n].first - stops_[n - 1].first;
+							const double f = range > 0 ? (t - stops_[n - 1].first) / range : 1.0;
+							return glm::mix(stops_[n - 1].second, stops_[n].second, f);
+						}
+					}
+					return stops_.back().second;
+				}
+
+				// Whether colours interpolated between the three corners would miss a
+				// gradient stop or a repeat boundary lying inside the triangle.
+				bool needs_split(const glm::dvec2& a, const glm::dvec2& b, const glm::dvec2& c) const {
+					if(!linear_) {
+						return false;
+					}
+					const double ta = parameter(a), tb = parameter(b), tc = parameter(c);
+					double lo = std::min(ta, std::min(tb, tc));
+					double hi = std::max(ta, std::max(tb, tc));
+					if(hi - lo < 1e-9) {
+						return false;
+					}
+					if(extend_ == CAIRO_EXTEND_PAD) {
+						lo = std::max(0.0, std::min(1.0, lo));
+						hi = std::max(0.0, std::min(1.0, hi));
+					} else {
+						if(std::floor(lo) != std::floor(hi)) {
+							return true;
+						}
+						const double wlo = wrap(lo), whi = wrap(hi);
+						lo = std::min(wlo, whi);
+						hi = std::max(wlo, whi);
+					}
+					for(const auto& s : stops_) {
+						if(s.first > lo && s.first < hi) {
+							return true;
+						}
+					}
+					return false;
+				}
+			private:
+				typedef std::pair<double, glm::dvec4> stop;
+
+				double parameter(const glm::dvec2& p) const {
+					const glm::dvec2 q = transform_point(device_to_pattern_, p);
+					const glm::dvec2 d = p1_ - p0_;
+					const double len2 = glm::dot(d, d);
+					return len2 > 0 ? glm::dot(q - p0_, d) / len2 : 0.0;
+				}
+
+				double wrap(double t) const {
+					switch(extend_) {
+						case CAIRO_EXTEND_REPEAT:
+							return t - std::floor(t);
+						case CAIRO_EXTEND_REFLECT: {
+							const double m = t - 2.0 * std::floor(t / 2.0);
+							return m > 1.0 ? 2.0 - m : m;
+						}
+						default:
+							return std::max(0.0, std::min(1.0, t));
+					}
+				}
+
+				bool linear_;
+				glm::dvec4 color_;
+				glm::dvec2 p0_;
+				glm::dvec2 p1_;
+				std::vector<stop> stops_;
+				cairo_extend_t extend_;
+				cairo_matrix_t device_to_pattern_;
+			};
+
+			glm::u8vec4 to_u8(const glm::dvec4& c)
+			{
+				const glm::dvec4 v = glm::clamp(c, 0.0, 1.0) * 255.0 + 0.5;
+				return glm::u8vec4(static_cast<uint8_t>(v.r), static_cast<uint8_t>(v.g), static_cast<uint8_t>(v.b), static_cast<uint8_t>(v.a));
+			}
+
+			void emit_triangle(const glm::dvec2& a, const glm::dvec2& b, const glm::dvec2& c, const paint_source& src, int depth, std::vector<vertex_color>* out)
+			{
+				if(depth < max_gradient_subdivision && src.needs_split(a, b, c)) {
+					const glm::dvec2 ab = (a + b) / 2.0, bc = (b + c) / 2.0, ca = (c + a) / 2.0;
+					emit_triangle(a, ab, ca, src, depth + 1, out);
+					emit_triangle(ab, b, bc, src, depth + 1, out);
+					emit_triangle(ca, bc, c, src, depth + 1, out);
+					emit_triangle(ab, bc, ca, src, depth + 1, out);
+					return;
+				}
+				out->emplace_back(glm::vec2(a), to_u8(src.color_at(a)));
+				out->emplace_back(glm::vec2(b), to_u8(src.color_at(b)));
+				out->emplace_back(glm::vec2(c), to_u8(src.color_at(c)));
+			}
+
+			void emit_triangles(const std::vector<glm::dvec2>& tris, const paint_source& src, std::vector<vertex_color>* out)
+			{
+				for(size_t n = 0; n + 2 < tris.size(); n += 3) {
+					emit_triangle(tris[n], tris[n + 1], tris[n + 2], src, 0, out);
+				}
+			}
+		}
+
+		mesh::mesh(std::vector<vertex_color>* vertices, bool scalable, int ref_width, int ref_height)
+			: scalable_(scalable),
+			  ref_width_(ref_width),
+			  ref_height_(ref_height)
+		{
+			vertices_.swap(*vertices);
+		}
+
+		AttributeSetPtr mesh::get_attribute_set() const
+		{
+			if(attribute_set_ == nullptr) {
+				auto as = DisplayDevice::createAttributeSet(true, false, false);
+				auto attribs = std::make_shared<Attribute<vertex_color>>(AccessFreqHint::STATIC, AccessTypeHint::DRAW);
+				attribs->addAttributeDesc(AttributeDesc(AttrType::POSITION, 2, AttrFormat::FLOAT, false, sizeof(vertex_color), offsetof(vertex_color, vertex)));
+				attribs->addAttributeDesc(AttributeDesc(AttrType::COLOR,  4, AttrFormat::UNSIGNED_BYTE, true, sizeof(vertex_color), offsetof(vertex_color, color)));
+				as->addAttribute(AttributeBasePtr(attribs));
+				as->setDrawMode(DrawMode::TRIANGLES);
+				attribs->update(vertices_);
+				attribute_set_ = as;
+			}
+			return attribute_set_;
+		}
+
+		mesh_recorder::mesh_recorder(int width, int height)
+			: width_(width),
+			  height_(height),
+			  hidden_depth_(0),
+			  view_box_depth_(0),
+			  scaled_content_(false),
+			  absolute_content_(false)
+		{
+		}
+
+		void mesh_recorder::fill(cairo_t* cairo)
+		{
+			if(hidden_depth_ > 0 || !is_supported()) {
+				return;
+			}
+			paint_source src;
+			if(!src.init(cairo, this)) {
+				return;
+			}
+			note_content();
+
+			// With an identity matrix the flattened path comes back in device space.
+			cairo_save(cairo);
+			cairo_identity_matrix(cairo);
+			auto paths = flatten_path(cairo);
+			cairo_restore(cairo);
+
+			std::vector<contour> contours;
+			for(auto& pl : paths) {
+				contours.emplace_back();
+				contours.back().swap(pl.points);
+			}
+			std::vector<glm::dvec2> tris;
+			tessellate_fill(contours, cairo_get_fill_rule(cairo) == CAIRO_FILL_RULE_EVEN_ODD, &tris);
+			emit_triangles(tris, src, &vertices_);
+		}
+
+		void mesh_recorder::stroke(cairo_t* cairo)
+		{
+			if(hidden_depth_ > 0 || !is_supported()) {
+				return;
+			}
+			if(cairo_get_dash_count(cairo) > 0) {
+				unsupported("dashed stroke");
+				return;
+			}
+			paint_source src;
+			if(!src.init(cairo, this)) {
+				return;
+			}
+			note_content();
+
+			cairo_matrix_t ctm;
+			cairo_get_matrix(cairo, &ctm);
+			stroke_style st;
+			st.half_width = cairo_get_line_width(cairo) / 2.0;
+			st.join = cairo_get_line_join(cairo);
+			st.cap = cairo_get_line_cap(cairo);
+			st.miter_limit = cairo_get_miter_limit(cairo);
+			st.device_scale = std::sqrt(std::max(ctm.xx * ctm.xx + ctm.yx * ctm.yx, ctm.xy * ctm.xy + ctm.yy * ctm.yy));
+			if(st.half_width <= 0) {
+				return;
+			}
+
+			// The pen is round in user space, so the outline is built there and then
+			// mapped to device space.
+			std::vector<contour> pieces;
+			stroke_outline(flatten_path(cairo), st, &pieces);
+			for(auto& c : pieces) {
+				for(auto& p : c) {
+					p = transform_point(ctm, p);
+				}
+				if(signed_area(c) < 0) {
+					std::reverse(c.begin(), c.end());
+				}
+			}
+			std::vector<glm::dvec2> tris;
+			tessellate_fill(pieces, false, &tris);
+			emit_triangles(tris, src, &vertices_);
+		}
+
+		void mesh_recorder::unsupported(const std::string& what)
+		{
+			if(unsupported_.empty() && hidden_depth_ == 0) {
+				unsupported_ = what;
+			}
+		}
+
+		void mesh_recorder::push_hidden(bool hidden)
+		{
+			hidden_stack_.emplace_back(hidden);
+			if(hidden) {
+				++hidden_depth_;
+			}
+		}
+
+		void mesh_recorder::pop_hidden()
+		{
+			ASSERT_LOG(!hidden_stack_.empty(), "Unbalanced mesh_recorder::pop_hidden()");
+			if(hidden_stack_.back()) {
+				--hidden_depth_;
+			}
+			hidden_stack_.pop_back();
+		}
+
+		void mesh_recorder::push_view_box(bool has_view_box)
+		{
+			view_box_stack_.emplace_back(has_view_box);
+			if(has_view_box) {
+				++view_box_depth_;
+			}
+		}
+
+		void mesh_recorder::pop_view_box()
+		{
+			ASSERT_LOG(!view_box_stack_.empty(), "Unbalanced mesh_recorder::pop_view_box()");
+			if(view_box_stack_.back()) {
+				--view_box_depth_;
+			}
+			view_box_stack_.pop_back();
+		}
+
+		void mesh_recorder::note_content()
+		{
+			if(view_box_depth_ > 0) {
+				scaled_content_ = true;
+			} else {
+				absolute_content_ = true;
+			}
+		}
+
+		mesh_ptr mesh_recorder::finish()
+		{
+			if(scaled_content_ && absolute_content_) {
+				unsupported("content both inside and outside a viewBox");
+			}
+			if(!is_supported()) {
+				return nullptr;
+			}
+			return std::make_shared<mesh>(&vertices_, !absolute_content_, width_, height_);
+		}
+
+		mesh_ptr create_mesh(const parse& doc)
+		{
+			// Nothing is rasterised while recording, so a 1x1 surface is enough to
+			// carry cairo's transform and path state.
+			cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+			cairo_t* cairo = cairo_create(surface);
+			cairo_set_tolerance(cairo, flatten_tolerance);
+
+			mesh_recorder recorder(reference_size, reference_size);
+			{
+				render_context ctx(cairo, reference_size, reference_size);
+				ctx.set_mesh_recorder(&recorder);
+				doc.render(ctx);
+			}
+			cairo_destroy(cairo);
+			cairo_surface_destroy(surface);
+
+			auto m = recorder.finish();
+			if(m == nullptr) {
+				LOG_DEBUG("SVG can't be drawn as a mesh, using raster fallback: " << recorder.unsupported_reason());
+			}
+			return m;
+		}
+
+		mesh_renderable::mesh_renderable(const mesh_ptr& m)
+			: SceneObject("SVGMeshRenderable"),
+			  mesh_(m)
+		{
+			ASSERT_LOG(mesh_ != nullptr, "mesh_renderable created without a mesh.");
+			setShader(ShaderProgram::getProgram("attr_color_shader"));
+			addAttributeSet(mesh_->get_attribute_set());
+		}
+
+		void mesh_renderable::set_size(int width, int height)
+		{
+			if(mesh_->is_scalable()) {
+				setScale(static_cast<float>(width) / mesh_->reference_width(), static_cast<float>(height) / mesh_->reference_height());
+			} else {
+				setScale(1.0f, 1.0f);
+			}
+		}
+	}
+}
+
+namespace
+{
+	double triangle_area(const std::vector<glm::dvec2>& tris)
+	{
+		double area = 0;
+		for(size_t n = 0; n + 2 < tris.size(); n += 3) {
+			const glm::dvec2 a = tris[n + 1] - tris[n];
+			const glm::dvec2 b = tris[n + 2] - tris[n];
+			area += std::abs(a.x * b.y - a.y * b.x) / 2.0;
+		}
+		return area;
+	}
+
+	std::vector<glm::dvec2> square(double x, double y, double size, bool clockwise)
+	{
+		std::vector<glm::dvec2> c;
+		c.emplace_back(x, y);
+		c.emplace_back(x + size, y);
+		c.emplace_back(x + size, y + size);
+		c.emplace_back(x, y + size);
+		if(!clockwise) {
+			std::reverse(c.begin(), c.end());
+		}
+		return c;
+	}
+}
+
+UNIT_TEST(svg_mesh_fill_rules) {
+	using namespace KRE::SVG;
+	// A square with a same-direction square inside: the hole only shows with even-odd.
+	std::vector<contour> contours;
+	contours.emplace_back(square(0, 0, 10, true));
+	contours.emplace_back(square(2, 2, 4, true));
+	std::vector<glm::dvec2> tris;
+	tessellate_fill(contours, false, &tris);
+	CHECK(std::abs(triangle_area(tris) - 100.0) < 1e-6, "non-zero fill area: " << triangle_area(tris));
+
+	tris.clear();
+	tessellate_fill(contours, true, &tris);
+	CHECK(std::abs(triangle_area(tris) - 84.0) < 1e-6, "even-odd fill area: " << triangle_area(tris));
+
+	// Reversing the inner square makes it a hole under non-zero too.
+	contours[1] = square(2, 2, 4, false);
+	tris.clear();
+	tessellate_fill(contours, false, &tris);
+	CHECK(std::abs(triangle_area(tris) - 84.0) < 1e-6, "non-zero hole area: " << triangle_area(tris));
+}
+
+UNIT_TEST(svg_mesh_self_intersecting) {
+	using namespace KRE::SVG;
+	// A bow-tie: two triangles of area 25 meeting at (5,5). The crossing has to be
+	// found for the area to come out right.
+	std::vector<contour> contours(1);
+	contours[0].emplace_back(0, 0);
+	contours[0].emplace_back(10, 10);
+	contours[0].emplace_back(10, 0);
+	contours[0].emplace_back(0, 10);
+	std::vector<glm::dvec2> tris;
+	tessellate_fill(contours, false, &tris);
+	CHECK(std::abs(triangle_area(tris) - 50.0) < 1e-6, "bow-tie area: " << triangle_area(tris));
+}
+
+UNIT_TEST(svg_mesh_stroke_union) {
+	using namespace KRE::SVG;
+	// An open right-angle polyline, 2 wide, with a miter join and butt caps. The two
+	// 2x10 segments overlap by 1x1 at the corner and the miter adds another 1x1, so
+	// the area only comes out at 40 if overlapping pieces are painted once.
+	std::vector<polyline> paths(1);
+	paths[0].points.emplace_back(0, 0);
+	paths[0].points.emplace_back(10, 0);
+	paths[0].points.emplace_back(10, 10);
+	paths[0].raw_points = 3;
+	stroke_style st;
+	st.half_width = 1.0;
+	st.join = CAIRO_LINE_JOIN_MITER;
+	st.cap = CAIRO_LINE_CAP_BUTT;
+	st.miter_limit = 4.0;
+	st.device_scale = 1.0;
+	std::vector<contour> pieces;
+	stroke_outline(paths, st, &pieces);
+	for(auto& c : pieces) {
+		if(signed_area(c) < 0) {
+			std::reverse(c.begin(), c.end());
+		}
+	}
+	std::vector<glm::dvec2> tris;
+	tessellate_fill(pieces, false, &tris);
+	CHECK(std::abs(triangle_area(tris) - 40.0) < 1e-6, "stroke area: " << triangle_area(tris));
+}
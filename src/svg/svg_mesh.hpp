@@ -0,0 +1,127 @@
+/*
+	Copyright (C) 2003-2013 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cairo.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AttributeSet.hpp"
+#include "SceneObject.hpp"
+#include "SceneUtil.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		class parse;
+
+		// Triangle list produced by tessellating an SVG document once. Vertices are in
+		// the pixel space of the reference canvas the document was recorded on, so the
+		// mesh can be drawn at any size by scaling it.
+		class mesh
+		{
+		public:
+			mesh(std::vector<vertex_color>* vertices, bool scalable, int ref_width, int ref_height);
+
+			const std::vector<vertex_color>& vertices() const { return vertices_; }
+			// False when the document has no viewBox, in which case it is drawn in
+			// absolute pixels regardless of the requested size.
+			bool is_scalable() const { return scalable_; }
+			int reference_width() const { return ref_width_; }
+			int reference_height() const { return ref_height_; }
+
+			// The vertex buffer is created on first use and shared by every renderable
+			// made from this mesh.
+			AttributeSetPtr get_attribute_set() const;
+		private:
+			std::vector<vertex_color> vertices_;
+			bool scalable_;
+			int ref_width_;
+			int ref_height_;
+			mutable AttributeSetPtr attribute_set_;
+		};
+		typedef std::shared_ptr<mesh> mesh_ptr;
+
+		// Installed on a render_context to capture fills and strokes as triangles
+		// instead of rasterising them. Anything that can't be expressed as a plain
+		// triangle mesh is reported through unsupported() and the caller falls back
+		// to raster rendering.
+		class mesh_recorder
+		{
+		public:
+			mesh_recorder(int width, int height);
+
+			// Tessellate the current cairo path using the current source and fill rule.
+			// The path is left intact.
+			void fill(cairo_t* cairo);
+			// Tessellate the outline of the current cairo path using the current
+			// source, line width, join, cap and miter limit. The path is left intact.
+			void stroke(cairo_t* cairo);
+
+			void unsupported(const std::string& what);
+			bool is_supported() const { return unsupported_.empty(); }
+			const std::string& unsupported_reason() const { return unsupported_; }
+
+			// Content between push_hidden(true) and the matching pop is not recorded.
+			void push_hidden(bool hidden);
+			void pop_hidden();
+			// Tracks whether content is drawn under a viewBox scale.
+			void push_view_box(bool has_view_box);
+			void pop_view_box();
+
+			// Returns the recorded mesh, or nullptr if unsupported content was seen.
+			mesh_ptr finish();
+		private:
+			void note_content();
+
+			int width_;
+			int height_;
+			std::vector<vertex_color> vertices_;
+			std::string unsupported_;
+			std::vector<bool> hidden_stack_;
+			int hidden_depth_;
+			std::vector<bool> view_box_stack_;
+			int view_box_depth_;
+			bool scaled_content_;
+			bool absolute_content_;
+		};
+
+		// Records the document into a mesh. Returns nullptr, with a debug log of the
+		// reason, if the document uses features the mesh path can't reproduce.
+		mesh_ptr create_mesh(const parse& doc);
+
+		class mesh_renderable : public SceneObject
+		{
+		public:
+			explicit mesh_renderable(const mesh_ptr& m);
+			// Scales the mesh so that a scalable document covers width x height pixels.
+			void set_size(int width, int height);
+		private:
+			mesh_ptr mesh_;
+		};
+		typedef std::shared_ptr<mesh_renderable> mesh_renderable_ptr;
+	}
+}
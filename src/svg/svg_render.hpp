@@ -36,6 +36,7 @@ namespace KRE
 	{
 		class paint;
 		typedef std::shared_ptr<paint> paint_ptr;
+		class mesh_recorder;
 
 		// Basically the concrete values that are set and stacked.
 		class font_attribs_set 
@@ -63,6 +64,7 @@ namespace KRE
 			// the drawing canvas.
 			render_context(cairo_t* cairo, unsigned width, unsigned height)
 				: cairo_(cairo),
+				  mesh_(nullptr),
 				  color_multiply_(1.0f, 1.0f, 1.0f, 1.0f),
 				  width_(width),
 				  height_(height),
@@ -80,6 +82,11 @@ namespace KRE
 			}
 
 			cairo_t* cairo() { return cairo_; }
+
+			// When set, shapes are tessellated into the recorder instead of being
+			// filled and stroked on the cairo context.
+			void set_mesh_recorder(mesh_recorder* recorder) { mesh_ = recorder; }
+			mesh_recorder* mesh() const { return mesh_; }
 			
 			void fill_color_push(const paint_ptr& p) {
 				fill_color_stack_.emplace(p);
@@ -138,6 +145,7 @@ namespace KRE
 			const Color& get_color_multiply() const {return color_multiply_; }
 		private:
 			cairo_t* cairo_;
+			mesh_recorder* mesh_;
 			ColorPtr current_color_;
 			Color color_multiply_;
 			std::stack<paint_ptr> fill_color_stack_;
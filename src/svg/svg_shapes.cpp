@@ -28,6 +28,7 @@
 
 #include "svg_shapes.hpp"
 #include "svg_element.hpp"
+#include "svg_mesh.hpp"
 
 #include "unit_test.hpp"
 
@@ -199,13 +200,22 @@ namespace KRE
 
 		void shape::stroke_and_fill(render_context& ctx) const
 		{
+			auto mesh = ctx.mesh();
 			auto fc = ctx.fill_color_top();
 			if(fc && fc->apply(parent(), ctx)) {
-				cairo_fill_preserve(ctx.cairo());
+				if(mesh) {
+					mesh->fill(ctx.cairo());
+				} else {
+					cairo_fill_preserve(ctx.cairo());
+				}
 			}
 			auto sc = ctx.stroke_color_top();
 			if(sc && sc->apply(parent(), ctx)) {
-				cairo_stroke(ctx.cairo());
+				if(mesh) {
+					mesh->stroke(ctx.cairo());
+				} else {
+					cairo_stroke(ctx.cairo());
+				}
 			}
 			// Clear the current path, regardless
 			cairo_new_path(ctx.cairo());
@@ -644,7 +654,12 @@ namespace KRE
 			render_line(ctx);
 			auto sc = ctx.stroke_color_top();
 			if(sc && sc->apply(parent(), ctx)) {
-				cairo_stroke(ctx.cairo());
+				if(ctx.mesh()) {
+					ctx.mesh()->stroke(ctx.cairo());
+					cairo_new_path(ctx.cairo());
+				} else {
+					cairo_stroke(ctx.cairo());
+				}
 			}
 			shape::render_path(ctx);
 		}
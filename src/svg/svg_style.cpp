@@ -29,6 +29,7 @@
 
 #include "asserts.hpp"
 #include "svg_element.hpp"
+#include "svg_mesh.hpp"
 #include "svg_style.hpp"
 
 namespace KRE
@@ -725,11 +726,17 @@ namespace KRE
 		{
 			// XXX
 			cairo_push_group(ctx.cairo());
+			if(ctx.mesh()) {
+				ctx.mesh()->push_hidden(display_ == Display::NONE);
+			}
 		}
 
 		void visual_attribs::clear(render_context& ctx) const
 		{
 			// XXX
+			if(ctx.mesh()) {
+				ctx.mesh()->pop_hidden();
+			}
 			auto patt = cairo_pop_group(ctx.cairo());
 			if(display_ == Display::NONE) {
 				cairo_pattern_destroy(patt);
@@ -833,6 +840,9 @@ namespace KRE
 			}
 			
 			if(path_ == FuncIriValue::FUNC_IRI && path_resolved_ != nullptr) {
+				if(ctx.mesh()) {
+					ctx.mesh()->unsupported("clip-path");
+				}
 				path_resolved_->clip(ctx);
 			}
 		}
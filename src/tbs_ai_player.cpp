@@ -22,17 +22,486 @@
 */
 
 #include <algorithm>
+#include <cmath>
+#include <memory>
 #include <numeric>
+#include <random>
 
 #include "asserts.hpp"
+#include "formula_callable.hpp"
+#include "formula_object.hpp"
+#include "preferences.hpp"
 #include "tbs_ai_player.hpp"
 #include "tbs_game.hpp"
+#include "thread_pool.hpp"
 
 namespace tbs 
 {
-	ai_player* ai_player::create(game& g, int nplayer)
+	namespace
 	{
-		return nullptr; //new default_ai_player(g, nplayer);
+		PREF_INT(tbs_ai_search_ms, 1000, "Default time in milliseconds the tbs search AI spends on each move");
+		PREF_INT(tbs_ai_search_threads, 0, "Number of threads the tbs search AI uses. 0 means one per core, less one");
+#ifndef MT_FFL
+		PREF_INT(tbs_ai_slice_iterations, 20, "Search iterations the tbs search AI runs each time its game processes, when it has to search on the server thread");
+#endif
+
+		//exploration constant for picking which move to look into next.
+		const double UCTExploration = 1.4;
+
+#ifdef MT_FFL
+		threading::thread_pool& search_pool()
+		{
+			static threading::thread_pool* pool = new threading::thread_pool("tbs_ai", g_tbs_ai_search_threads > 0 ? g_tbs_ai_search_threads : std::max(1, SDL_GetCPUCount() - 1), threading::THREAD_ALLOCATES_COLLECTIBLE_OBJECTS);
+			return *pool;
+		}
+#endif
+
+		void run_commands(const variant& cmd, game_logic::FormulaCallable& target)
+		{
+			if(cmd.is_list()) {
+				for(int n = 0; n != cmd.num_elements(); ++n) {
+					run_commands(cmd[n], target);
+				}
+			} else if(cmd.is_callable()) {
+				const game_logic::CommandCallable* command = cmd.try_convert<game_logic::CommandCallable>();
+				if(command) {
+					command->runCommand(target);
+				}
+			}
+		}
+
+		//the game's search hooks. Function values are safe to call from any
+		//thread as long as the functions only touch the state passed to them.
+		struct search_hooks
+		{
+			variant moves_fn, apply_fn, to_move_fn, score_fn;
+
+			bool valid() const {
+				return moves_fn.is_function() && apply_fn.is_function() && to_move_fn.is_function() && score_fn.is_function();
+			}
+
+			std::vector<variant> moves(const variant& state, int player) const {
+				std::vector<variant> args;
+				args.push_back(state);
+				args.push_back(variant(player));
+				variant result = moves_fn(args);
+				return result.is_list() ? result.as_list() : std::vector<variant>();
+			}
+
+			void apply(const variant& state, const variant& move, int player) const {
+				std::vector<variant> args;
+				args.push_back(state);
+				args.push_back(move);
+				args.push_back(variant(player));
+				run_commands(apply_fn(args), *state.mutable_callable());
+			}
+
+			//-1 once the game is over.
+			int to_move(const variant& state) const {
+				std::vector<variant> args;
+				args.push_back(state);
+				variant result = to_move_fn(args);
+				return result.is_null() ? -1 : result.as_int();
+			}
+
+			double score(const variant& state, int player) const {
+				std::vector<variant> args;
+				args.push_back(state);
+				args.push_back(variant(player));
+				return score_fn(args).as_double();
+			}
+		};
+
+		//one independent search tree. Root parallel search grows several of
+		//these at once, each from its own copy of the state, and only
+		//combines how often each root move was tried.
+		class search_tree
+		{
+		public:
+			search_tree(const search_hooks& hooks, variant root_state, int nplayer, const std::vector<variant>& root_moves, int rollout_depth, unsigned seed)
+			  : hooks_(hooks), root_state_(root_state), rollout_depth_(rollout_depth), rng_(seed)
+			{
+				root_.to_move = nplayer;
+				root_.expanded = true;
+				root_.moves = root_moves;
+				for(int n = 0; n != static_cast<int>(root_moves.size()); ++n) {
+					root_.untried.push_back(n);
+				}
+			}
+
+			void iterate()
+			{
+				variant state = game_logic::FormulaObject::deepClone(root_state_);
+
+				//walk down through fully expanded nodes.
+				node* n = &root_;
+				while(n->untried.empty() && n->children.empty() == false) {
+					n = select_child(n);
+					hooks_.apply(state, n->move, n->mover);
+				}
+
+				if(n->expanded == false) {
+					expand(n, state);
+				}
+
+				//try a move from here that we haven't tried before.
+				if(n->untried.empty() == false) {
+					const int pick = std::uniform_int_distribution<int>(0, static_cast<int>(n->untried.size()) - 1)(rng_);
+					const int move_index = n->untried[pick];
+					n->untried[pick] = n->untried.back();
+					n->untried.pop_back();
+
+					n->children.emplace_back(new node);
+					node* child = n->children.back().get();
+					child->parent = n;
+					child->move_index = move_index;
+					child->move = n->moves[move_index];
+					child->mover = n->to_move;
+
+					hooks_.apply(state, child->move, child->mover);
+					n = child;
+				}
+
+				rollout(state);
+
+				std::map<int, double> scores;
+				for(node* p = n; p != nullptr; p = p->parent) {
+					++p->visits;
+					if(p->mover >= 0) {
+						auto itor = scores.find(p->mover);
+						if(itor == scores.end()) {
+							itor = scores.insert(std::pair<int, double>(p->mover, hooks_.score(state, p->mover))).first;
+						}
+
+						p->score += itor->second;
+					}
+				}
+			}
+
+			//how many times each root move was tried, indexed like root_moves.
+			std::vector<int> root_visits() const
+			{
+				std::vector<int> result(root_.moves.size());
+				for(const std::unique_ptr<node>& child : root_.children) {
+					result[child->move_index] = child->visits;
+				}
+
+				return result;
+			}
+
+		private:
+			struct node
+			{
+				node() : parent(nullptr), move_index(-1), mover(-1), to_move(-1), expanded(false), visits(0), score(0.0)
+				{}
+
+				node* parent;
+
+				//the move which led here, and who made it.
+				int move_index;
+				variant move;
+				int mover;
+
+				//who moves from here, and their moves.
+				int to_move;
+				bool expanded;
+				std::vector<variant> moves;
+				std::vector<int> untried;
+
+				std::vector<std::unique_ptr<node>> children;
+
+				int visits;
+				double score;
+			};
+
+			node* select_child(node* n) const
+			{
+				const double log_visits = std::log(static_cast<double>(std::max(1, n->visits)));
+				node* best = nullptr;
+				double best_value = 0.0;
+				for(const std::unique_ptr<node>& child : n->children) {
+					const double value = child->score/child->visits + UCTExploration*std::sqrt(log_visits/child->visits);
+					if(best == nullptr || value > best_value) {
+						best = child.get();
+						best_value = value;
+					}
+				}
+
+				return best;
+			}
+
+			void expand(node* n, const variant& state)
+			{
+				n->expanded = true;
+				n->to_move = hooks_.to_move(state);
+				if(n->to_move < 0) {
+					return;
+				}
+
+				n->moves = hooks_.moves(state, n->to_move);
+				for(int i = 0; i != static_cast<int>(n->moves.size()); ++i) {
+					n->untried.push_back(i);
+				}
+			}
+
+			void rollout(const variant& state)
+			{
+				for(int depth = 0; depth < rollout_depth_; ++depth) {
+					const int player = hooks_.to_move(state);
+					if(player < 0) {
+						return;
+					}
+
+					const std::vector<variant> moves = hooks_.moves(state, player);
+					if(moves.empty()) {
+						return;
+					}
+
+					hooks_.apply(state, moves[std::uniform_int_distribution<int>(0, static_cast<int>(moves.size()) - 1)(rng_)], player);
+				}
+			}
+
+			search_hooks hooks_;
+			variant root_state_;
+			int rollout_depth_;
+			std::mt19937 rng_;
+			node root_;
+		};
+
+		//a search for one move, shared between the player and the jobs
+		//growing its trees.
+		struct search
+		{
+			search() : state_id(-1), remaining(0), iterations(0)
+			{}
+
+			int state_id;
+			std::vector<variant> root_moves;
+
+			threading::mutex mutex;
+			int remaining;
+			std::vector<int> visits;
+			int iterations;
+
+			bool finished() {
+				threading::lock l(mutex);
+				return remaining == 0;
+			}
+
+			void add_result(const std::vector<int>& tree_visits, int tree_iterations) {
+				threading::lock l(mutex);
+				for(int n = 0; n != static_cast<int>(tree_visits.size()); ++n) {
+					visits[n] += tree_visits[n];
+				}
+
+				iterations += tree_iterations;
+				--remaining;
+			}
+
+			variant best_move() const {
+				const int best = static_cast<int>(std::max_element(visits.begin(), visits.end()) - visits.begin());
+				return root_moves[best];
+			}
+		};
+
+		//runs one iteration of a tree's search, returning false if the
+		//game's hooks failed.
+		bool iterate_tree(search_tree& tree)
+		{
+			try {
+				tree.iterate();
+				return true;
+			} catch(validation_failure_exception& e) {
+				LOG_ERROR("tbs search AI failed: " << e.msg);
+			} catch(type_error& e) {
+				LOG_ERROR("tbs search AI failed: " << e.message);
+			} catch(...) {
+				//the result must still be reported, or the search never finishes.
+				LOG_ERROR("tbs search AI failed with an unknown error");
+			}
+
+			return false;
+		}
+
+#ifdef MT_FFL
+		void grow_tree(std::shared_ptr<search> s, std::shared_ptr<search_tree> tree, int deadline)
+		{
+			int iterations = 0;
+			while(iterate_tree(*tree)) {
+				++iterations;
+				if(static_cast<int>(SDL_GetTicks()) >= deadline) {
+					break;
+				}
+			}
+
+			s->add_result(tree->root_visits(), iterations);
+		}
+#endif
+
+		class mcts_ai_player : public ai_player
+		{
+		public:
+			mcts_ai_player(game& g, int nplayer, const search_hooks& hooks, const variant& args)
+			  : ai_player(g, nplayer), hooks_(hooks), checked_state_id_(-1), moved_state_id_(-1),
+			    time_ms_(args["time_ms"].as_int(g_tbs_ai_search_ms)),
+			    rollout_depth_(args["rollout_depth"].as_int(50)),
+			    ntrees_(args["trees"].as_int(0))
+			{
+				if(ntrees_ <= 0) {
+#ifdef MT_FFL
+					ntrees_ = search_pool().size();
+#else
+					ntrees_ = 1;
+#endif
+				}
+
+#ifndef MT_FFL
+				deadline_ = next_tree_ = 0;
+#endif
+			}
+
+			variant play() override
+			{
+				const game& g = get_game();
+				if(search_) {
+#ifndef MT_FFL
+					searchSlice();
+#endif
+					if(search_->finished() == false) {
+						return variant();
+					}
+
+					std::shared_ptr<search> s;
+					s.swap(search_);
+
+					//the game moved on without us, so think again.
+					if(s->state_id != g.state_id()) {
+						return variant();
+					}
+
+					LOG_INFO("tbs search AI " << player_id() << " chose a move from " << s->root_moves.size() << " after " << s->iterations << " iterations");
+					moved_state_id_ = s->state_id;
+					return s->best_move();
+				}
+
+				//only look at a state once, and never move twice in the same
+				//state, in case the game didn't accept our move.
+				if(g.state_id() == checked_state_id_ || g.state_id() == moved_state_id_) {
+					return variant();
+				}
+
+				checked_state_id_ = g.state_id();
+
+				const variant state = g.get_state();
+				if(hooks_.to_move(state) != player_id()) {
+					return variant();
+				}
+
+				std::shared_ptr<search> s(new search);
+				s->state_id = g.state_id();
+				s->root_moves = hooks_.moves(state, player_id());
+				if(s->root_moves.size() <= 1) {
+					moved_state_id_ = s->state_id;
+					return s->root_moves.empty() ? variant() : s->root_moves.front();
+				}
+
+				s->visits.resize(s->root_moves.size());
+				s->remaining = ntrees_;
+
+				const int deadline = static_cast<int>(SDL_GetTicks()) + time_ms_;
+
+				//the trees are given their copies of the state here, so that
+				//the search never looks at the live game.
+				std::vector<std::shared_ptr<search_tree>> trees;
+				for(int n = 0; n != ntrees_; ++n) {
+					const unsigned seed = static_cast<unsigned>(s->state_id*7919 + player_id()*104729 + n);
+					trees.emplace_back(new search_tree(hooks_, game_logic::FormulaObject::deepClone(state), player_id(), s->root_moves, rollout_depth_, seed));
+				}
+
+#ifdef MT_FFL
+				for(const std::shared_ptr<search_tree>& tree : trees) {
+					search_pool().submit(std::bind(grow_tree, s, tree, deadline));
+				}
+#else
+				//without thread safe FFL the search runs on the server thread,
+				//a slice at a time each time the game processes, so the server
+				//keeps serving other games while we think.
+				trees_ = trees;
+				tree_iterations_.assign(trees_.size(), 0);
+				deadline_ = deadline;
+				next_tree_ = 0;
+#endif
+
+				search_ = s;
+				return variant();
+			}
+
+		private:
+#ifndef MT_FFL
+			//grows the trees, taking turns, by a bounded number of iterations,
+			//and reports them to the search once its time is up.
+			void searchSlice()
+			{
+				if(trees_.empty()) {
+					return;
+				}
+
+				for(int n = 0; n < g_tbs_ai_slice_iterations; ++n) {
+					const int index = next_tree_++ % static_cast<int>(trees_.size());
+					if(iterate_tree(*trees_[index]) == false) {
+						deadline_ = 0;
+						break;
+					}
+
+					++tree_iterations_[index];
+				}
+
+				if(static_cast<int>(SDL_GetTicks()) < deadline_) {
+					return;
+				}
+
+				for(int n = 0; n != static_cast<int>(trees_.size()); ++n) {
+					search_->add_result(trees_[n]->root_visits(), tree_iterations_[n]);
+				}
+
+				trees_.clear();
+				tree_iterations_.clear();
+			}
+
+			std::vector<std::shared_ptr<search_tree>> trees_;
+			std::vector<int> tree_iterations_;
+
+			//when the search stops, and which tree it grows next.
+			int deadline_, next_tree_;
+#endif
+
+			search_hooks hooks_;
+			std::shared_ptr<search> search_;
+			int checked_state_id_, moved_state_id_;
+			int time_ms_, rollout_depth_, ntrees_;
+		};
+	}
+
+	ai_player* ai_player::create(game& g, int nplayer, const variant& info)
+	{
+		if(info["bot_type"].as_string_default("") != "mcts") {
+			return nullptr;
+		}
+
+		search_hooks hooks;
+		hooks.moves_fn = g.get_type_member("ai_moves");
+		hooks.apply_fn = g.get_type_member("ai_apply");
+		hooks.to_move_fn = g.get_type_member("ai_player_to_move");
+		hooks.score_fn = g.get_type_member("ai_score");
+		ASSERT_LOG(hooks.valid(), "A tbs game with an mcts bot must define ai_moves, ai_apply, ai_player_to_move and ai_score");
+
+		variant args = info["bot_args"];
+		if(args.is_map() == false) {
+			std::map<variant, variant> m;
+			args = variant(&m);
+		}
+
+		return new mcts_ai_player(g, nplayer, hooks, args);
 	}
 
 	ai_player::ai_player(const game& g, int nplayer)
@@ -32,10 +32,32 @@ namespace tbs
 	class ai_player 
 	{
 	public:
-		static ai_player* create(game& g, int nplayer);
+		//creates the built-in AI asked for by a bot's info, or returns nullptr
+		//if the bot is to be driven by the game's own scripts.
+		//
+		//An info with bot_type "mcts" gets a Monte-Carlo tree search player.
+		//It requires the game's tbs_game class to define:
+		//  ai_moves(object state, int player) -> [map]: the legal moves, as
+		//      the messages the player would send.
+		//  ai_apply(object state, map move, int player) -> commands: makes
+		//      the move on the given state.
+		//  ai_player_to_move(object state) -> int|null: whose turn it is,
+		//      null once the game is over.
+		//  ai_score(object state, int player) -> decimal: how well the player
+		//      is doing, from 0 (lost) to 1 (won).
+		//These are called on copies of the state, from worker threads, so must
+		//only look at the state they are given.
+		//
+		//bot_args may contain time_ms, the search time per move, rollout_depth,
+		//how many random moves to play out from each new position, and trees,
+		//the number of independent searches run in parallel.
+		static ai_player* create(game& g, int nplayer, const variant& info);
 		ai_player(const game& g, int nplayer);
 		virtual ~ai_player();
 
+		//returns the next message this player sends to the game, or null if
+		//it has nothing to send yet. It is called again whenever the game
+		//processes, so a player may return null while it thinks.
 		virtual variant play() = 0;
 		int player_id() const { return nplayer_; }
 	protected:
@@ -63,6 +63,37 @@ namespace tbs
 {
 	extern ffl::IntrusivePtr<http_client> g_game_server_http_client_to_matchmaking_server;
 
+	namespace
+	{
+		//bots made for games running on a shard. Bots run on the io_service
+		//thread, so they're created, kept and destroyed there, rather than
+		//by the game.
+		std::map<const game*, std::vector<ffl::IntrusivePtr<bot>>> g_shard_game_bots;
+
+		ffl::IntrusivePtr<bot> create_bot(server_base* server_ptr, const variant& info)
+		{
+			if(g_tbs_use_shared_mem) {
+				ASSERT_LOG(server_ptr, "no server_ set");
+
+				server* s = dynamic_cast<server*>(server_ptr);
+				ASSERT_LOG(s, "Wrong type of server");
+
+				const int session_id = info["session_id"].as_int();
+				auto p = SharedMemoryPipe::makeInMemoryPair();
+
+				s->add_ipc_client(session_id, p.first);
+
+				ffl::IntrusivePtr<ipc_client> cli(new ipc_client(p.second));
+
+				ffl::IntrusivePtr<bot> new_bot(new bot(*web_server::service(), "127.0.0.1", "23456", info));
+				new_bot->set_ipc_client(cli);
+				return new_bot;
+			}
+
+			return ffl::IntrusivePtr<bot>(new bot(*web_server::service(), "127.0.0.1", formatter() << web_server::port(), info));
+		}
+	}
+
 	class GameType
 	{
 	public:
@@ -115,7 +146,8 @@ namespace tbs
 	extern std::string global_debug_str;
 
 	namespace {
-	game* current_game = nullptr;
+	//games on different tbs server shards run at once, each on its own thread.
+	THREAD_LOCAL game* current_game = nullptr;
 
 	int generate_game_id() {
 		static int id = int(time(nullptr));
@@ -182,6 +214,13 @@ namespace tbs
 	game::~game()
 	{
 		LOG_INFO("DESTROY GAME");
+
+		if(server_ && server_->sharded()) {
+			const game* key = this;
+			server_->run_on_io_service([key]() {
+				g_shard_game_bots.erase(key);
+			});
+		}
 	}
 
 	void game::verify_replay()
@@ -623,6 +662,11 @@ namespace {
 
 		executeCommand(game_type_->add_bot(info["session_id"].as_int(), info["bot_type"].as_string(), info["args"], info["bot_args"]));
 
+		ai_player* ai = ai_player::create(*this, players_.back().side, info);
+		if(ai) {
+			ai_.push_back(std::shared_ptr<ai_player>(ai));
+		}
+
 		//handleEvent("add_bot", map_into_callable(info).get());
 
 	//	ffl::IntrusivePtr<bot> new_bot(new bot(*web_server::service(), "127.0.0.1", formatter() << web_server::port(), info));
@@ -646,6 +690,16 @@ namespace {
 		}
 	}
 
+	variant game::get_state() const
+	{
+		return game_type_->get_state();
+	}
+
+	variant game::get_type_member(const std::string& name) const
+	{
+		return game_type_->object()->queryValue(name);
+	}
+
 	std::vector<std::string> game::get_ai_players() const
 	{
 		std::vector<std::string> result;
@@ -765,6 +819,11 @@ namespace {
 
 		executeCommand(game_type_->process());
 
+		//AI players may be thinking in the background, so check on them.
+		if(started_ && ai_.empty() == false) {
+			ai_play();
+		}
+
 		++cycle_;
 
 		if(state_id_ != starting_state_id) {
@@ -827,31 +886,39 @@ namespace {
 			return variant(&v);
 		DEFINE_SET_FIELD_TYPE("[any]")
 			obj.bots_.clear();
+
+			std::vector<variant> new_bots;
 			for(unsigned n = 0; n != value.num_elements(); ++n) {
 				LOG_INFO("BOT_ADD: " << value[n].write_json());
 				if(value[n].is_callable() && value[n].try_convert<tbs::bot>()) {
 					obj.bots_.push_back(ffl::IntrusivePtr<tbs::bot>(value[n].try_convert<tbs::bot>()));
-				} else if(g_tbs_use_shared_mem) {
-					ASSERT_LOG(obj.server_, "no server_ set");
-
-					server* s = dynamic_cast<server*>(obj.server_);
-					ASSERT_LOG(s, "Wrong type of server");
-
-					const int session_id = value[n]["session_id"].as_int();
-					auto p = SharedMemoryPipe::makeInMemoryPair();
-
-					s->add_ipc_client(session_id, p.first);
-
-					ffl::IntrusivePtr<ipc_client> cli(new ipc_client(p.second));
+				} else {
+					new_bots.push_back(value[n]);
+				}
+			}
 
-					LOG_INFO("CREATED BOT: " << n << "/" << value.num_elements());
-					ffl::IntrusivePtr<bot> new_bot(new bot(*web_server::service(), "127.0.0.1", "23456", value[n]));
-					new_bot->set_ipc_client(cli);
+			if(obj.server_ && obj.server_->sharded()) {
+				//the game may be running on a shard, so the bots are made on
+				//the io_service thread they run on. Variants can't be shared
+				//between threads, so their info is passed as JSON.
+				std::vector<std::string> bots_info;
+				for(const variant& info : new_bots) {
+					bots_info.push_back(info.write_json());
+				}
 
-					obj.bots_.push_back(new_bot);
-				} else {
-					ffl::IntrusivePtr<bot> new_bot(new bot(*web_server::service(), "127.0.0.1", formatter() << web_server::port(), value[n]));
-					obj.bots_.push_back(new_bot);
+				const game* key = &obj;
+				server_base* server_ptr = obj.server_;
+				obj.server_->run_on_io_service([key, server_ptr, bots_info]() {
+					std::vector<ffl::IntrusivePtr<bot>>& bots = g_shard_game_bots[key];
+					bots.clear();
+					for(const std::string& info : bots_info) {
+						bots.push_back(create_bot(server_ptr, json::parse(info, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR)));
+					}
+				});
+			} else {
+				for(const variant& info : new_bots) {
+					LOG_INFO("CREATED BOT: " << obj.bots_.size() << "/" << value.num_elements());
+					obj.bots_.push_back(create_bot(obj.server_, info));
 				}
 			}
 
@@ -878,41 +945,57 @@ namespace {
 			LOG_INFO("WINNER: " << value.write_json());
 			obj.winner_ = value;
 
-			if(g_game_server_http_client_to_matchmaking_server.get() != nullptr) {
-				http_client& client = *g_game_server_http_client_to_matchmaking_server;
-				variant_builder msg;
-				msg.add("type", "server_finished_game");
+			//the matchmaking client belongs to the io_service thread, which
+			//a game running on a shard has to hand this over to, passing
+			//the winner as JSON since variants can't be shared between
+			//threads.
+			const std::string winner_json = value.write_json();
+			auto report_winner = [winner_json]() {
+				const variant value = json::parse(winner_json, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+				if(g_game_server_http_client_to_matchmaking_server.get() != nullptr) {
+					http_client& client = *g_game_server_http_client_to_matchmaking_server;
+					variant_builder msg;
+					msg.add("type", "server_finished_game");
 #if defined(_MSC_VER)
-				msg.add("pid", static_cast<int>(_getpid()));
+					msg.add("pid", static_cast<int>(_getpid()));
 #else
-				msg.add("pid", static_cast<int>(getpid()));
+					msg.add("pid", static_cast<int>(getpid()));
 #endif
 
-				if(value.is_map()) {
-					msg.add("info", value);
+					if(value.is_map()) {
+						msg.add("info", value);
+					}
+
+					bool complete = false;
+
+					client.send_request("POST /server", msg.build().write_json(),
+					  [&complete](std::string response) {
+						complete = true;
+					  },
+					  [&complete](std::string msg) {
+						complete = true;
+						ASSERT_LOG(false, "Could not connect to server: " << msg);
+					  },
+					  [](size_t a, size_t b, bool c) {
+					  });
+
+					while(!complete) {
+						client.process();
+					}
 				}
 
-				bool complete = false;
-
-				client.send_request("POST /server", msg.build().write_json(),
-				  [&complete](std::string response) {
-					complete = true;
-				  },
-				  [&complete](std::string msg) {
-					complete = true;
-					ASSERT_LOG(false, "Could not connect to server: " << msg);
-				  },
-				  [](size_t a, size_t b, bool c) {
-				  });
-			
-				while(!complete) {
-					client.process();
+				if(g_tbs_game_exit_on_winner) {
+					game_logic::flush_all_backed_maps();
+					_exit(0);
 				}
+			};
+
+			if(obj.server_) {
+				obj.server_->run_on_io_service(report_winner);
+			} else {
+				report_winner();
 			}
-			if(g_tbs_game_exit_on_winner) {
-				game_logic::flush_all_backed_maps();
-				_exit(0);
-			}
+
 	END_DEFINE_CALLABLE(game)
 
 
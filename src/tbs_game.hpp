@@ -80,6 +80,11 @@ namespace tbs
 
 		std::vector<std::string> get_ai_players() const;
 
+		//the game's state, as its get_state() gives it, and members of its
+		//tbs_game class. Used by built-in AI players.
+		variant get_state() const;
+		variant get_type_member(const std::string& name) const;
+
 		virtual void remove_player(const std::string& name);
 
 		struct player {
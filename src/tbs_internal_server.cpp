@@ -30,6 +30,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <signal.h>
 #endif
 
 #include "asserts.hpp"
@@ -423,6 +424,40 @@ void terminate_utility_process(bool* complete=nullptr)
 		return g_local_server_port;
 	}
 
+	void spawn_utility_on_localhost(const std::string& utility, const std::vector<std::string>& args)
+	{
+		terminate_utility_process(nullptr);
+
+		std::vector<std::string> child_args;
+		child_args.push_back(formatter() << "--module=" << module::get_module_name());
+		child_args.push_back("--utility=" + utility);
+		child_args.insert(child_args.end(), args.begin(), args.end());
+
+		create_utility_process(g_anura_exe_name, child_args);
+	}
+
+	void kill_utility_on_localhost()
+	{
+#if defined(_MSC_VER)
+		if(child_process) {
+			TerminateProcess(child_process, 0);
+			WaitForSingleObject(child_process, INFINITE);
+			CloseHandle(child_process);
+			CloseHandle(child_thread);
+			CloseHandle(child_stderr);
+			CloseHandle(child_stdout);
+			child_process = 0;
+		}
+#else
+		if(g_child_pid > 0) {
+			kill(g_child_pid, SIGTERM);
+			int status;
+			waitpid(g_child_pid, &status, 0);
+			g_child_pid = 0;
+		}
+#endif
+	}
+
 
 	internal_server_manager::internal_server_manager(bool use_internal_server)
 	{
@@ -47,6 +47,12 @@ namespace tbs
 	//the port, otherwise return 0.
 	int get_server_on_localhost(SharedMemoryPipePtr* ipc_pipe);
 
+	//runs another utility of this executable, such as tbs_server, in an
+	//external process, for tools which need a real server to talk to. It
+	//keeps running until kill_utility_on_localhost() is called.
+	void spawn_utility_on_localhost(const std::string& utility, const std::vector<std::string>& args);
+	void kill_utility_on_localhost();
+
 	class internal_server : public server_base
 	{
 	public:
@@ -0,0 +1,556 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "asserts.hpp"
+#include "filesystem.hpp"
+#include "formatter.hpp"
+#include "formula.hpp"
+#include "json_parser.hpp"
+#include "string_utils.hpp"
+#include "tbs_client.hpp"
+#include "tbs_internal_server.hpp"
+#include "unit_test.hpp"
+#include "variant_utils.hpp"
+
+namespace
+{
+	//one step of a behaviour script. A step either sends a message and
+	//waits for the reply, or drops the client's connection.
+	struct script_step
+	{
+		std::string name;
+
+		//the message to send. Either a map or a formula giving one.
+		variant send;
+		game_logic::FormulaPtr send_formula;
+
+		//the session to send it as. The client's existing session if absent.
+		game_logic::FormulaPtr session_id;
+
+		//must be true of the reply, or the reply counts as an error.
+		game_logic::FormulaPtr expect;
+
+		//gives the client's new data from the reply.
+		game_logic::FormulaPtr store;
+
+		//if true of the reply, run this step again.
+		game_logic::FormulaPtr repeat_while;
+
+		//the name of the step to go to next, or null to carry on in order.
+		game_logic::FormulaPtr next;
+
+		bool disconnect;
+		int delay_ms;
+	};
+
+	struct behaviour_script
+	{
+		std::vector<script_step> steps;
+		std::map<std::string, int> step_index;
+		game_logic::FormulaPtr on_start;
+
+		//where to go when the last step is done, or -1 to stop.
+		int loop_to;
+	};
+
+	behaviour_script parse_script(const variant& v)
+	{
+		behaviour_script result;
+		result.on_start = game_logic::Formula::createOptionalFormula(v["on_start"]);
+
+		for(const variant& item : v["steps"].as_list()) {
+			script_step step;
+			const std::string default_name = formatter() << "step" << result.steps.size();
+			step.name = item["name"].as_string_default(default_name.c_str());
+			step.disconnect = item["disconnect"].as_bool(false);
+			step.delay_ms = item["delay_ms"].as_int(0);
+
+			ASSERT_LOG(step.disconnect || item.has_key("send"), "Load test step " << step.name << " must either send a message or disconnect");
+			if(item["send"].is_string()) {
+				step.send_formula = game_logic::Formula::createOptionalFormula(item["send"]);
+			} else {
+				step.send = item["send"];
+			}
+
+			step.session_id = game_logic::Formula::createOptionalFormula(item["session_id"]);
+			step.expect = game_logic::Formula::createOptionalFormula(item["expect"]);
+			step.store = game_logic::Formula::createOptionalFormula(item["store"]);
+			step.repeat_while = game_logic::Formula::createOptionalFormula(item["repeat_while"]);
+			step.next = game_logic::Formula::createOptionalFormula(item["next"]);
+
+			ASSERT_LOG(result.step_index.count(step.name) == 0, "Duplicate load test step: " << step.name);
+			result.step_index[step.name] = static_cast<int>(result.steps.size());
+			result.steps.push_back(step);
+		}
+
+		ASSERT_LOG(result.steps.empty() == false, "Load test script has no steps");
+
+		result.loop_to = -1;
+		if(v["loop"].is_string()) {
+			auto itor = result.step_index.find(v["loop"].as_string());
+			ASSERT_LOG(itor != result.step_index.end(), "Unknown load test step to loop to: " << v["loop"].as_string());
+			result.loop_to = itor->second;
+		} else if(v["loop"].as_bool(false)) {
+			result.loop_to = 0;
+		}
+
+		return result;
+	}
+
+	//latencies and errors for one step, or for all of them.
+	struct step_stats
+	{
+		step_stats() : requests(0), errors(0)
+		{}
+
+		int requests, errors;
+		std::vector<int> latency_ms;
+		std::map<std::string, int> error_kinds;
+
+		void add_error(const std::string& kind) {
+			++errors;
+			++error_kinds[kind];
+		}
+	};
+
+	int percentile(const std::vector<int>& sorted, int pct)
+	{
+		if(sorted.empty()) {
+			return 0;
+		}
+
+		const size_t index = std::min(sorted.size()-1, (sorted.size()*pct)/100);
+		return sorted[index];
+	}
+
+	variant stats_report(const step_stats& stats, int duration_ms)
+	{
+		std::vector<int> sorted = stats.latency_ms;
+		std::sort(sorted.begin(), sorted.end());
+
+		variant_builder result;
+		result.add("requests", stats.requests);
+		result.add("responses", static_cast<int>(stats.latency_ms.size()));
+		result.add("errors", stats.errors);
+		result.add("error_rate", decimal(stats.requests ? (100.0*stats.errors)/stats.requests : 0.0));
+		result.add("throughput", decimal(duration_ms > 0 ? (1000.0*stats.latency_ms.size())/duration_ms : 0.0));
+		for(int pct : { 50, 90, 99, 100 }) {
+			result.add(formatter() << "p" << pct << "_ms", percentile(sorted, pct));
+		}
+
+		variant_builder kinds;
+		for(auto& p : stats.error_kinds) {
+			kinds.add(p.first, p.second);
+		}
+
+		if(stats.error_kinds.empty() == false) {
+			result.add("error_kinds", kinds.build());
+		}
+
+		return result.build();
+	}
+
+	//a simulated player. Kept small so thousands can share one io_service;
+	//everything it does is driven from the utility's main loop rather than
+	//from timers of its own.
+	struct sim_client
+	{
+		int index;
+		int session_id;
+		ffl::IntrusivePtr<tbs::client> conn;
+		game_logic::MapFormulaCallablePtr vars;
+
+		int step;
+		int next_action_at;
+		int sent_at;
+
+		//connection failures in a row on the current step.
+		int retries;
+
+		bool in_flight;
+		bool has_reply;
+		bool reply_is_error;
+		bool finished;
+	};
+
+	bool wait_for_server(const std::string& host, const std::string& port, int timeout_ms)
+	{
+		boost::asio::io_service service;
+		tcp::resolver resolver(service);
+		const int give_up_at = SDL_GetTicks() + timeout_ms;
+		while(static_cast<int>(SDL_GetTicks()) < give_up_at) {
+			boost::system::error_code error;
+			tcp::resolver::iterator endpoint = resolver.resolve(tcp::resolver::query(host, port), error);
+			if(!error) {
+				tcp::socket socket(service);
+				boost::asio::connect(socket, endpoint, error);
+				if(!error) {
+					return true;
+				}
+			}
+
+			SDL_Delay(100);
+		}
+
+		return false;
+	}
+}
+
+//Drives a tbs_server or tbs_matchmaking_server with many simulated clients
+//at once, all sharing one io_service, and reports throughput, latency
+//percentiles and error rates for the run and for each script step.
+//
+//Clients follow a behaviour script, a JSON document such as:
+//
+//  {
+//    on_start: "{ user: 'bot' + index }",
+//    loop: "play",
+//    steps: [
+//      { name: "login", send: "{ type: 'login', user: data.user, passwd: 'x' }",
+//        expect: "message.type = 'login_success'", store: "data + { session: message.session_id }" },
+//      { name: "matchmake", session_id: "data.session", send: { type: "matchmake" } },
+//      { name: "play", send: "{ type: 'request_updates', state_id: data.state_id }",
+//        store: "data + { state_id: message.state_id }", repeat_while: "message.type != 'game_over'" },
+//      { name: "drop", disconnect: true, delay_ms: 1000 },
+//    ]
+//  }
+//
+//Formulas see the client's index, its data (initialised by on_start), the
+//last reply as message and any connection error as error. Steps run in
+//order unless next names another step; after the last step clients go to
+//the loop step if there is one, or stop. A step whose request fails to
+//connect is tried again on a new connection, waiting twice as long after
+//each failure, starting from --retry-backoff-ms; a client that fails more
+//than --max-retries times in a row gives up and is counted as failed.
+COMMAND_LINE_UTILITY(tbs_load_test)
+{
+	std::string host = "localhost";
+	std::string port = "23456";
+	std::string script_file, output_file, spawn_utility;
+	std::vector<std::string> spawn_args;
+	int nclients = 1000;
+	int ramp_ms = 10000;
+	int duration_ms = 60000;
+	int session_base = 1000000;
+	double max_error_rate = -1.0;
+	int max_p99_ms = -1;
+	int max_retries = 5;
+	int retry_backoff_ms = 100;
+
+	std::vector<std::string>::const_iterator it = args.begin();
+	while(it != args.end()) {
+		const std::string& arg = *it++;
+		if(arg == "--host" && it != args.end()) {
+			host = *it++;
+		} else if(arg == "--port" && it != args.end()) {
+			port = *it++;
+		} else if(arg == "--clients" && it != args.end()) {
+			nclients = atoi(it++->c_str());
+		} else if(arg == "--ramp-ms" && it != args.end()) {
+			ramp_ms = atoi(it++->c_str());
+		} else if(arg == "--duration-ms" && it != args.end()) {
+			duration_ms = atoi(it++->c_str());
+		} else if(arg == "--session-base" && it != args.end()) {
+			session_base = atoi(it++->c_str());
+		} else if(arg == "--spawn" && it != args.end()) {
+			spawn_utility = *it++;
+		} else if(arg == "--server-args" && it != args.end()) {
+			spawn_args = util::split(*it++, ' ');
+		} else if(arg == "--max-error-rate" && it != args.end()) {
+			max_error_rate = atof(it++->c_str());
+		} else if(arg == "--max-p99-ms" && it != args.end()) {
+			max_p99_ms = atoi(it++->c_str());
+		} else if(arg == "--max-retries" && it != args.end()) {
+			max_retries = atoi(it++->c_str());
+		} else if(arg == "--retry-backoff-ms" && it != args.end()) {
+			retry_backoff_ms = atoi(it++->c_str());
+		} else if(arg == "--output" && it != args.end()) {
+			output_file = *it++;
+		} else if(script_file.empty()) {
+			script_file = arg;
+		} else {
+			ASSERT_LOG(false, "Unrecognized argument to tbs_load_test: " << arg);
+		}
+	}
+
+	if(script_file.empty() || nclients <= 0) {
+		std::cerr << "tbs_load_test usage: <script> [--clients N] [--ramp-ms N] [--duration-ms N] [--host H] [--port P] [--session-base N]\n"
+		             "    [--spawn tbs_server|tbs_matchmaking_server] [--server-args ARGS] [--max-error-rate PCT] [--max-p99-ms N] [--output FILE]\n"
+		             "    [--max-retries N] [--retry-backoff-ms N]\n";
+		return;
+	}
+
+	const behaviour_script script = parse_script(json::parse_from_file(script_file));
+
+	if(spawn_utility.empty() == false) {
+		spawn_args.push_back("--port");
+		spawn_args.push_back(port);
+		tbs::spawn_utility_on_localhost(spawn_utility, spawn_args);
+	}
+
+	ASSERT_LOG(wait_for_server(host, port, 30000), "Could not connect to server at " << host << ":" << port);
+
+	boost::asio::io_service io_service;
+
+	std::vector<std::unique_ptr<sim_client>> clients;
+	std::vector<step_stats> stats(script.steps.size());
+	step_stats total;
+
+	const int start_time = SDL_GetTicks();
+	const int end_time = start_time + duration_ms;
+
+	for(int n = 0; n != nclients; ++n) {
+		clients.emplace_back(new sim_client);
+		sim_client& c = *clients.back();
+		c.index = n;
+		c.session_id = session_base + n;
+		c.vars.reset(new game_logic::MapFormulaCallable);
+		c.vars->add("index", variant(n));
+		c.vars->add("data", variant());
+		c.step = 0;
+		c.next_action_at = start_time + static_cast<int>((static_cast<long long>(ramp_ms)*n)/nclients);
+		c.sent_at = 0;
+		c.retries = 0;
+		c.in_flight = c.has_reply = c.reply_is_error = c.finished = false;
+
+		if(script.on_start) {
+			c.vars->add("data", script.on_start->execute(*c.vars));
+		}
+	}
+
+	int nfinished = 0, nfailed = 0;
+	while(static_cast<int>(SDL_GetTicks()) < end_time && nfinished < nclients) {
+		io_service.poll();
+		io_service.reset();
+
+		const int now = SDL_GetTicks();
+		bool did_work = false;
+
+		for(const std::unique_ptr<sim_client>& client_ptr : clients) {
+			sim_client& c = *client_ptr;
+			if(c.finished || c.in_flight) {
+				continue;
+			}
+
+			const script_step& step = script.steps[c.step];
+
+			//a reply came back, so decide what to do next.
+			if(c.has_reply) {
+				did_work = true;
+				c.has_reply = false;
+
+				bool repeat = false;
+				std::string next_step;
+				if(step.disconnect) {
+					//nothing was sent, so there is nothing to measure.
+				} else if(c.reply_is_error) {
+					++stats[c.step].requests;
+					++total.requests;
+					stats[c.step].add_error("connection");
+					total.add_error("connection");
+
+					//retry the same step on a new connection, backing off so
+					//a struggling server isn't hammered. Each failed attempt
+					//counts as a request with a connection error.
+					c.conn.reset();
+					if(c.retries >= max_retries) {
+						LOG_ERROR("Load test client " << c.index << " gave up on " << step.name << " after " << (c.retries+1) << " connection errors");
+						c.finished = true;
+						++nfinished;
+						++nfailed;
+						continue;
+					}
+
+					const int backoff_ms = retry_backoff_ms << std::min(c.retries, 10);
+					++c.retries;
+					c.next_action_at = now + step.delay_ms + backoff_ms;
+					continue;
+				} else {
+					c.retries = 0;
+
+					++stats[c.step].requests;
+					++total.requests;
+					stats[c.step].latency_ms.push_back(now - c.sent_at);
+					total.latency_ms.push_back(now - c.sent_at);
+
+					try {
+						const assert_recover_scope guard;
+						if(step.expect && step.expect->execute(*c.vars).as_bool() == false) {
+							stats[c.step].add_error("expect");
+							total.add_error("expect");
+						}
+
+						if(step.store) {
+							c.vars->add("data", step.store->execute(*c.vars));
+						}
+
+						repeat = step.repeat_while && step.repeat_while->execute(*c.vars).as_bool();
+						if(!repeat && step.next) {
+							const variant next = step.next->execute(*c.vars);
+							if(next.is_string()) {
+								next_step = next.as_string();
+							}
+						}
+					} catch(validation_failure_exception& e) {
+						LOG_ERROR("Load test client " << c.index << " script error in " << step.name << ": " << e.msg);
+						stats[c.step].add_error("script");
+						total.add_error("script");
+						c.finished = true;
+						++nfinished;
+						continue;
+					}
+				}
+
+				if(repeat) {
+					//stay on this step.
+				} else if(next_step.empty() == false) {
+					auto itor = script.step_index.find(next_step);
+					ASSERT_LOG(itor != script.step_index.end(), "Unknown load test step: " << next_step);
+					c.step = itor->second;
+				} else if(++c.step == static_cast<int>(script.steps.size())) {
+					if(script.loop_to < 0) {
+						c.finished = true;
+						++nfinished;
+						continue;
+					}
+
+					c.step = script.loop_to;
+				}
+
+				c.next_action_at = now + script.steps[c.step].delay_ms;
+				continue;
+			}
+
+			if(c.next_action_at > now) {
+				continue;
+			}
+
+			did_work = true;
+
+			if(step.disconnect) {
+				c.conn.reset();
+				c.has_reply = true;
+				c.reply_is_error = false;
+				c.sent_at = now;
+				continue;
+			}
+
+			variant msg;
+			try {
+				const assert_recover_scope guard;
+				if(step.session_id) {
+					const int session_id = step.session_id->execute(*c.vars).as_int(c.session_id);
+					if(session_id != c.session_id) {
+						c.session_id = session_id;
+						c.conn.reset();
+					}
+				}
+
+				msg = step.send_formula ? step.send_formula->execute(*c.vars) : step.send;
+			} catch(validation_failure_exception& e) {
+				LOG_ERROR("Load test client " << c.index << " script error in " << step.name << ": " << e.msg);
+				stats[c.step].add_error("script");
+				total.add_error("script");
+				c.finished = true;
+				++nfinished;
+				continue;
+			}
+
+			if(!c.conn) {
+				c.conn.reset(new tbs::client(host, port, c.session_id, &io_service));
+				c.conn->set_use_local_cache(false);
+			}
+
+			sim_client* client = &c;
+			c.in_flight = true;
+			c.sent_at = now;
+			c.conn->send_request(msg, c.vars, [client](const std::string& type) {
+				//a message may arrive in several parts. Only the first is the reply.
+				if(client->in_flight == false) {
+					return;
+				}
+
+				client->in_flight = false;
+				client->has_reply = true;
+				client->reply_is_error = type.size() >= 16 && std::equal(type.end()-16, type.end(), "connection_error");
+			});
+		}
+
+		if(!did_work) {
+			SDL_Delay(1);
+		}
+	}
+
+	const int elapsed_ms = SDL_GetTicks() - start_time;
+
+	clients.clear();
+
+	if(spawn_utility.empty() == false) {
+		tbs::kill_utility_on_localhost();
+	}
+
+	variant_builder steps;
+	for(int n = 0; n != static_cast<int>(script.steps.size()); ++n) {
+		if(script.steps[n].disconnect == false) {
+			steps.add(script.steps[n].name, stats_report(stats[n], elapsed_ms));
+		}
+	}
+
+	variant_builder report;
+	report.add("clients", nclients);
+	report.add("clients_finished", nfinished);
+	report.add("clients_failed", nfailed);
+	report.add("duration_ms", elapsed_ms);
+	report.add("total", stats_report(total, elapsed_ms));
+	report.add("steps", steps.build());
+
+	const variant result = report.build();
+	std::cout << result.write_json(true) << "\n";
+
+	if(output_file.empty() == false) {
+		sys::write_file(output_file, result.write_json(true));
+	}
+
+	std::vector<int> sorted = total.latency_ms;
+	std::sort(sorted.begin(), sorted.end());
+
+	const double error_rate = total.requests ? (100.0*total.errors)/total.requests : 0.0;
+	if(max_error_rate >= 0.0 && error_rate > max_error_rate) {
+		std::cerr << "tbs_load_test: ERROR RATE " << error_rate << "% EXCEEDS " << max_error_rate << "%\n";
+		exit(1);
+	}
+
+	if(max_p99_ms >= 0 && percentile(sorted, 99) > max_p99_ms) {
+		std::cerr << "tbs_load_test: P99 LATENCY " << percentile(sorted, 99) << "ms EXCEEDS " << max_p99_ms << "ms\n";
+		exit(1);
+	}
+}
@@ -66,7 +66,7 @@ namespace tbs
 		bool g_exit_server = false;
 	}
 
-	server::game_info::game_info(const variant& value) : nlast_touch(-1)
+	server::game_info::game_info(const variant& value) : nlast_touch(-1), shard(-1), processing(false)
 	{
 		game_state = game::create(value);
 	}
@@ -189,6 +189,14 @@ namespace tbs
 	void server::add_ipc_client(int session_id, SharedMemoryPipePtr pipe)
 	{
 		LOG_INFO("server::add_ipc_client: " << session_id);
+		if(sharded()) {
+			//may be called by a game running on a shard.
+			io_service_.post([this, session_id, pipe]() {
+				ipc_clients_[session_id].pipe = pipe;
+			});
+			return;
+		}
+
 		IPCClientInfo& info = ipc_clients_[session_id];
 		info.pipe = pipe;
 	}
@@ -352,7 +360,7 @@ namespace tbs
 
 		if(get_num_heartbeat()%5 == 0) {
 			for(auto g : games()) {
-				for(int n = 0; n < static_cast<int>(g->clients.size()) && n < static_cast<int>(g->game_state->players().size()); ++n) {
+				for(int n = 0; n < static_cast<int>(g->clients.size()) && n < static_cast<int>(g->summary.players_human.size()); ++n) {
 					const int session_id = g->clients[n];
 					if(ipc_clients_.count(session_id)) {
 						continue;
@@ -370,16 +378,17 @@ namespace tbs
 					if(disconnected != recorded_as_disconnected) {
 						if(disconnected) {
 							g->clients_disconnected.insert(session_id);
-							g->game_state->player_disconnect(n);
+							run_on_game(g, [g, n]() { g->game_state->player_disconnect(n); });
 						} else {
 							g->clients_disconnected.erase(session_id);
-							g->game_state->player_reconnect(n);
+							run_on_game(g, [g, n]() { g->game_state->player_reconnect(n); });
 						}
 
 					}
 
 					if(disconnected) {
-						g->game_state->player_disconnected_for(n, time_since_last_contact - DisconnectTimeoutMS);
+						const int disconnected_ms = time_since_last_contact - DisconnectTimeoutMS;
+						run_on_game(g, [g, n, disconnected_ms]() { g->game_state->player_disconnected_for(n, disconnected_ms); });
 					}
 				}
 			}
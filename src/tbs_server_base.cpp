@@ -23,6 +23,7 @@
 
 #include <boost/asio.hpp>
 
+#include "asserts.hpp"
 #include "filesystem.hpp"
 #include "formatter.hpp"
 #include "json_parser.hpp"
@@ -49,13 +50,41 @@ namespace tbs
 	}
 
 	server_base::server_base(boost::asio::io_service& io_service)
-		: timer_(io_service), nheartbeat_(0), scheduled_write_(0), status_id_(0)
+		: io_service_(io_service), timer_(io_service), nheartbeat_(0), scheduled_write_(0), status_id_(0), next_shard_(0)
 	{
 		heartbeat(boost::asio::error::timed_out);
 	}
 
 	server_base::~server_base()
 	{
+		//let each shard finish what it's been given, then join it.
+		for(auto& s : shards_) {
+			s->work.reset();
+		}
+
+		shards_.clear();
+	}
+
+	void server_base::set_num_shards(int nshards)
+	{
+		ASSERT_LOG(games_.empty() && shards_.empty(), "Shards must be set up before any games are created");
+#ifdef MT_FFL
+		for(int n = 0; n < nshards; ++n) {
+			shards_.emplace_back(new shard);
+			shard* s = shards_.back().get();
+			s->work.reset(new boost::asio::io_service::work(s->service));
+			s->thread.reset(new threading::thread(formatter() << "tbs_shard_" << n, [s]() {
+				variant::registerThread();
+				s->service.run();
+			}, threading::THREAD_ALLOCATES_COLLECTIBLE_OBJECTS));
+		}
+
+		LOG_INFO("tbs server running games on " << nshards << " threads");
+#else
+		if(nshards > 0) {
+			LOG_ERROR("Running tbs games on their own threads requires building with MT_FFL. Running them on the main thread instead.");
+		}
+#endif
 	}
 
 	variant server_base::get_server_info()
@@ -110,6 +139,11 @@ namespace tbs
 
 		const game_context context(g->game_state.get());
 		g->game_state->setup_game();
+		g->summary = summarize(*g->game_state);
+
+		if(shards_.empty() == false) {
+			g->shard = next_shard_++ % static_cast<int>(shards_.size());
+		}
 
 		games_.push_back(g);
 
@@ -198,7 +232,10 @@ namespace tbs
 
 			g->clients.push_back(session_id);
 
-			g->game_state->observer_connect(g->clients.size()-1, user);
+			const int nclient = static_cast<int>(g->clients.size())-1;
+			run_on_game(g, [g, nclient, user]() {
+				g->game_state->observer_connect(nclient, user);
+			});
 
 			send_fn(json::parse(formatter() << "{ \"type\": \"observing_game\" }"));
 
@@ -264,18 +301,18 @@ namespace tbs
 		variant_builder value;
 		value.add("type", "game_info");
 		value.add("id", g->game_state->game_id());
-		value.add("started", variant::from_bool(g->game_state->started()));
+		value.add("started", variant::from_bool(g->summary.started));
 
 		size_t index = 0;
 		std::vector<variant> clients;
 		for(int cid : g->clients) {
-			ASSERT_LOG(index < g->game_state->players().size(), "MIS-MATCHED INDEX: " << index << ", " << g->game_state->players().size());
+			ASSERT_LOG(index < g->summary.players_human.size(), "MIS-MATCHED INDEX: " << index << ", " << g->summary.players_human.size());
 			std::map<variant, variant> m;
 			std::map<int, client_info>::const_iterator cinfo = clients_.find(cid);
 			if(cinfo != clients_.end()) {
 				m[variant("nick")] = variant(cinfo->second.user);
 				m[variant("id")] = variant(cid);
-				m[variant("bot")] = variant::from_bool(g->game_state->players()[index].is_human == false);
+				m[variant("bot")] = variant::from_bool(g->summary.players_human[index] == false);
 			}
 			clients.push_back(variant(&m));
 			++index;
@@ -296,14 +333,16 @@ namespace tbs
 				const bool is_first_client = g->clients.front() == session_id;
 				g->clients.erase(std::remove(g->clients.begin(), g->clients.end(), session_id), g->clients.end());
 
-				if(g->game_state->get_player_index(cli_info.user) != -1) {
-					LOG_INFO("sending quit message...");
-					g->game_state->queue_message("{ type: 'player_quit' }");
-					g->game_state->queue_message(formatter() << "{ type: 'message', message: '" << cli_info.user << " has quit' }");
-					flush_game_messages(*g);
-				} else {
-					g->game_state->observer_disconnect(cli_info.user);
-				}
+				const std::string user = cli_info.user;
+				run_on_game(g, [g, user]() {
+					if(g->game_state->get_player_index(user) != -1) {
+						LOG_INFO("sending quit message...");
+						g->game_state->queue_message("{ type: 'player_quit' }");
+						g->game_state->queue_message(formatter() << "{ type: 'message', message: '" << user << " has quit' }");
+					} else {
+						g->game_state->observer_disconnect(user);
+					}
+				});
 
 				if(g->clients.empty()) {
 					deletes.insert(g);
@@ -329,11 +368,76 @@ namespace tbs
 		}
 	}
 
-	void server_base::flush_game_messages(game_info& info)
+	server_base::game_summary server_base::summarize(const game& g)
+	{
+		game_summary result;
+		result.started = g.started();
+		for(const game::player& p : g.players()) {
+			result.players_human.push_back(p.is_human);
+		}
+
+		result.ai_players = g.get_ai_players();
+		return result;
+	}
+
+	void server_base::run_on_io_service(std::function<void()> fn)
+	{
+		if(shards_.empty()) {
+			fn();
+		} else {
+			io_service_.post(fn);
+		}
+	}
+
+	void server_base::run_on_game(game_info_ptr g, std::function<void()> fn, std::function<void()> on_done)
+	{
+		if(shards_.empty()) {
+			fn();
+
+			std::vector<game::message> game_response;
+			g->game_state->swap_outgoing_messages(game_response);
+			g->summary = summarize(*g->game_state);
+			deliver_game_messages(*g, game_response);
+
+			if(on_done) {
+				on_done();
+			}
+			return;
+		}
+
+		shards_[g->shard]->service.post([this, g, fn, on_done]() {
+			std::shared_ptr<std::vector<game::message>> game_response(new std::vector<game::message>);
+			game_summary summary;
+			std::exception_ptr error;
+			try {
+				fn();
+				g->game_state->swap_outgoing_messages(*game_response);
+				summary = summarize(*g->game_state);
+			} catch(...) {
+				error = std::current_exception();
+			}
+
+			//connections belong to the io_service thread, so hand the
+			//results back to it. Errors are rethrown there, as they would
+			//be if the game ran on it.
+			io_service_.post([this, g, game_response, summary, error, on_done]() {
+				if(error) {
+					std::rethrow_exception(error);
+				}
+
+				g->summary = summary;
+				deliver_game_messages(*g, *game_response);
+
+				if(on_done) {
+					on_done();
+				}
+			});
+		});
+	}
+
+	void server_base::deliver_game_messages(game_info& info, const std::vector<game::message>& game_response)
 	{
-		std::vector<game::message> game_response;
-		info.game_state->swap_outgoing_messages(game_response);
-		for(game::message& msg : game_response) {
+		for(const game::message& msg : game_response) {
 			if(msg.recipients.empty()) {
 				for(int session_id : info.clients) {
 					if(session_id != -1) {
@@ -350,8 +454,9 @@ namespace tbs
 					if(player >= 0) {
 						queue_msg(info.clients[player], msg.contents);
 					} else {
-						//A message for observers
-						for(size_t n = info.game_state->players().size(); n < info.clients.size(); ++n) {
+						//A message for observers. The game may be running on its
+						//shard, so its player count comes from the summary.
+						for(size_t n = info.summary.players_human.size(); n < info.clients.size(); ++n) {
 							queue_msg(info.clients[n], msg.contents);
 						}
 					}
@@ -385,12 +490,14 @@ namespace tbs
 				return;
 			}
 
-			const bool game_started = cli_info.game->game_state->started();
-			const game_context context(cli_info.game->game_state.get());
-
 			cli_info.game->nlast_touch = nheartbeat_;
-			cli_info.game->game_state->handle_message(cli_info.nplayer, msg);
-			flush_game_messages(*cli_info.game);
+
+			game_info_ptr g = cli_info.game;
+			const int nplayer = cli_info.nplayer;
+			run_on_game(g, [g, nplayer, msg]() {
+				const game_context context(g->game_state.get());
+				g->game_state->handle_message(nplayer, msg);
+			});
 		}
 	}
 
@@ -422,11 +529,18 @@ namespace tbs
 		timer_.async_wait(std::bind(&server_base::heartbeat, this, std::placeholders::_1));
 
 		for(game_info_ptr g : games_) {
-			g->game_state->process();
-		}
+			//a game still busy with its last cycle skips this one rather
+			//than letting work pile up on its shard.
+			if(g->processing) {
+				continue;
+			}
 
-		for(auto g : games_) {
-			flush_game_messages(*g);
+			g->processing = true;
+			run_on_game(g, [g]() {
+				g->game_state->process();
+			}, [g]() {
+				g->processing = false;
+			});
 		}
 
 		nheartbeat_++;
@@ -491,7 +605,7 @@ namespace tbs
 				items.push_back(value.build());
 			}
 
-			for(const std::string& ai : cli_info.game->game_state->get_ai_players()) {
+			for(const std::string& ai : cli_info.game->summary.ai_players) {
 				variant_builder value;
 
 				value.add("nick", ai);
@@ -23,7 +23,10 @@
 
 #pragma once
 
+#include <memory>
+
 #include "tbs_game.hpp"
+#include "thread.hpp"
 #include "variant.hpp"
 
 namespace tbs
@@ -41,6 +44,32 @@ namespace tbs
 		void clear_games();
 		static variant get_server_info();
 
+		// Runs games on nshards worker threads, each game staying on one
+		// of them, so a game with heavy scripts only delays the games that
+		// share its thread. Connections and the listing of games stay on
+		// the thread running the io_service. Must be called before any
+		// games are created. Requires MT_FFL.
+		void set_num_shards(int nshards);
+
+		bool sharded() const { return shards_.empty() == false; }
+
+		// Runs fn on the thread running the io_service, for a game that
+		// needs to touch things belonging to it. Without shards that is
+		// the game's own thread, so fn runs before returning; otherwise it
+		// is posted.
+		void run_on_io_service(std::function<void()> fn);
+
+		// What the lobby and heartbeats need to know about a game, copied
+		// from it after each time it runs so it can be read while the game
+		// is running on its shard.
+		struct game_summary
+		{
+			game_summary() : started(false) {}
+			bool started;
+			std::vector<bool> players_human;
+			std::vector<std::string> ai_players;
+		};
+
 		struct game_info 
 		{
 			explicit game_info(const variant& value);
@@ -51,6 +80,14 @@ namespace tbs
 			std::set<int> clients_disconnected;
 			int nlast_touch;
 			bool quit_server_on_exit;
+
+			game_summary summary;
+
+			//the shard the game runs on, or -1 when not sharding.
+			int shard;
+
+			//whether a call to process() is queued or running.
+			bool processing;
 		};
 
 		typedef std::shared_ptr<game_info> game_info_ptr;
@@ -97,6 +134,14 @@ namespace tbs
 		int get_num_heartbeat() const { return nheartbeat_; }
 		const std::vector<game_info_ptr>& games() const { return games_; }
 
+		// Runs fn, which may call into the game, on the game's shard and
+		// then delivers the messages the game queued. on_done, if given, is
+		// called afterwards on the io_service thread. Without shards it all
+		// happens before returning.
+		void run_on_game(game_info_ptr g, std::function<void()> fn, std::function<void()> on_done=std::function<void()>());
+
+		boost::asio::io_service& io_service_;
+
 	private:
 		virtual void connect_relay_session(const std::string& host, const std::string& port, int relay_session) {}
 
@@ -105,7 +150,8 @@ namespace tbs
 		variant create_game_info_msg(game_info_ptr g) const;
 		void status_change();
 		void quit_games(int session_id);
-		void flush_game_messages(game_info& info);
+		static game_summary summarize(const game& g);
+		void deliver_game_messages(game_info& info, const std::vector<game::message>& game_response);
 		void schedule_write();
 		void handle_message_internal(client_info& cli_info, const variant& msg);
 		void heartbeat(const boost::system::error_code& error);
@@ -121,5 +167,15 @@ namespace tbs
 
 		// send_fn's waiting on status info.
 		std::vector<send_function> status_fns_;
+
+		struct shard
+		{
+			boost::asio::io_service service;
+			std::unique_ptr<boost::asio::io_service::work> work;
+			std::unique_ptr<threading::thread> thread;
+		};
+
+		std::vector<std::unique_ptr<shard>> shards_;
+		int next_shard_;
 	};
 }
@@ -232,6 +232,7 @@ COMMAND_LINE_UTILITY(tbs_server) {
 	std::vector<IPCSession> ipc_sessions;
 
 	int port = 23456;
+	int nthreads = 0;
 	std::vector<std::string> bot_id;
 	variant config;
 	if(args.size() > 0) {
@@ -255,6 +256,13 @@ COMMAND_LINE_UTILITY(tbs_server) {
 					ASSERT_LOG(port > 0 && port <= 65535, "tbs_server(): Port must lie in the range 1-65535.");
 					++it;
 				}
+			} else if(*it == "--threads") {
+				++it;
+				if(it != args.end()) {
+					nthreads = atoi(it->c_str());
+					ASSERT_LOG(nthreads >= 0, "tbs_server(): --threads must not be negative");
+					++it;
+				}
 			} else if(*it == "--bot") {
 				++it;
 				if(it != args.end()) {
@@ -292,6 +300,7 @@ COMMAND_LINE_UTILITY(tbs_server) {
 	tbs::g_listening_port = port;
 
 	tbs::server s(io_service);
+	s.set_num_shards(nthreads);
 
 	for(auto session : ipc_sessions) {
 		SharedMemoryPipePtr pipe(new SharedMemoryPipe(session.pipe_name, false));
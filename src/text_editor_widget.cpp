@@ -349,6 +349,7 @@ namespace gui
 		}
 
 		refreshScrollbar();
+		invalidate();
 		onChange();
 	}
 
@@ -1761,10 +1762,12 @@ namespace gui
 			return variant("");
 		DEFINE_SET_FIELD
 			obj.text_color_ = KRE::Color(value);
+			obj.invalidate();
 		DEFINE_FIELD(has_focus, "bool")
 			return variant::from_bool(obj.has_focus_);
 		DEFINE_SET_FIELD
 			obj.has_focus_ = value.as_bool();
+			obj.invalidate();
 			if(obj.clear_on_focus_ && obj.has_focus_) {
 				obj.setText("");
 				obj.clear_on_focus_ = false;
@@ -0,0 +1,308 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+#include "asserts.hpp"
+#include "thread_pool.hpp"
+#include "unit_test.hpp"
+#include "variant.hpp"
+
+namespace threading
+{
+	thread_pool::thread_pool(const std::string& name, int nthreads, int flags)
+		: jobs_running_(0), quitting_(false)
+	{
+		ASSERT_LOG(nthreads >= 0, "Illegal number of threads in pool " << name << ": " << nthreads);
+		const bool register_variant_thread = (flags&THREAD_ALLOCATES_COLLECTIBLE_OBJECTS) != 0;
+		for(int n = 0; n != nthreads; ++n) {
+			threads_.emplace_back(new thread(name, std::bind(&thread_pool::worker_loop, this, register_variant_thread), flags));
+		}
+	}
+
+	thread_pool::~thread_pool()
+	{
+		{
+			lock l(mutex_);
+			while(jobs_.empty() == false || jobs_running_ > 0) {
+				work_done_.wait(mutex_);
+			}
+
+			quitting_ = true;
+			work_available_.notify_all();
+		}
+
+		threads_.clear();
+	}
+
+	void thread_pool::submit(std::function<void()> job)
+	{
+		if(threads_.empty()) {
+			job();
+			return;
+		}
+
+		lock l(mutex_);
+		jobs_.push_back(job);
+		work_available_.notify_one();
+	}
+
+	void thread_pool::wait()
+	{
+		std::exception_ptr error;
+		{
+			lock l(mutex_);
+			while(jobs_.empty() == false || jobs_running_ > 0) {
+				work_done_.wait(mutex_);
+			}
+
+			std::swap(error, error_);
+		}
+
+		if(error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	//the state of one parallel_for call. Blocks are claimed through
+	//next_block by whichever thread gets to them first; a helper job that
+	//finds nothing left to claim returns without touching fn, so it may
+	//outlive the call.
+	struct thread_pool::batch
+	{
+		batch(int count, int nblocks, const std::function<void(int)>& fn)
+			: count(count), nblocks(nblocks), fn(fn), next_block(0), blocks_done(0)
+		{}
+
+		const int count, nblocks;
+		const std::function<void(int)>& fn;
+		std::atomic<int> next_block;
+
+		//guarded by the pool's mutex.
+		int blocks_done;
+		std::exception_ptr error;
+	};
+
+	void thread_pool::run_batch_blocks(batch& b)
+	{
+		for(;;) {
+			const int block = b.next_block++;
+			if(block >= b.nblocks) {
+				return;
+			}
+
+			std::exception_ptr error;
+			try {
+				const int begin = (b.count*block)/b.nblocks;
+				const int end = (b.count*(block+1))/b.nblocks;
+				for(int n = begin; n != end; ++n) {
+					b.fn(n);
+				}
+			} catch(...) {
+				error = std::current_exception();
+			}
+
+			lock l(mutex_);
+			if(error && !b.error) {
+				b.error = error;
+			}
+
+			if(++b.blocks_done == b.nblocks) {
+				batch_done_.notify_all();
+			}
+		}
+	}
+
+	void thread_pool::parallel_for(int count, std::function<void(int)> fn)
+	{
+		if(count <= 0) {
+			return;
+		}
+
+		const int nblocks = std::min(count, size() + 1);
+		if(nblocks <= 1) {
+			for(int n = 0; n != count; ++n) {
+				fn(n);
+			}
+			return;
+		}
+
+		auto b = std::make_shared<batch>(count, nblocks, fn);
+		{
+			lock l(mutex_);
+			for(int block = 1; block < nblocks; ++block) {
+				jobs_.push_back([this, b]() { run_batch_blocks(*b); });
+			}
+			work_available_.notify_all();
+		}
+
+		//the calling thread works on the batch too, and finishes it alone if
+		//no worker is free.
+		run_batch_blocks(*b);
+
+		std::exception_ptr error;
+		{
+			lock l(mutex_);
+			while(b->blocks_done < b->nblocks) {
+				batch_done_.wait(mutex_);
+			}
+
+			error = b->error;
+		}
+
+		if(error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	thread_pool& thread_pool::shared()
+	{
+		static thread_pool* pool = new thread_pool("shared_pool", std::max(1, SDL_GetCPUCount() - 1), THREAD_ALLOCATES_COLLECTIBLE_OBJECTS);
+		return *pool;
+	}
+
+	void thread_pool::worker_loop(bool register_variant_thread)
+	{
+		if(register_variant_thread) {
+			variant::registerThread();
+		}
+
+		for(;;) {
+			std::function<void()> job;
+			{
+				lock l(mutex_);
+				while(jobs_.empty() && !quitting_) {
+					work_available_.wait(mutex_);
+				}
+
+				if(jobs_.empty()) {
+					return;
+				}
+
+				job = jobs_.front();
+				jobs_.pop_front();
+				++jobs_running_;
+			}
+
+			std::exception_ptr error;
+			try {
+				job();
+			} catch(...) {
+				error = std::current_exception();
+			}
+
+			lock l(mutex_);
+			--jobs_running_;
+			if(error && !error_) {
+				error_ = error;
+			}
+
+			work_done_.notify_all();
+		}
+	}
+}
+
+UNIT_TEST(thread_pool_nested_parallel_for)
+{
+	threading::thread_pool pool("test_pool", 2);
+	std::atomic<int> total(0);
+	pool.parallel_for(8, [&](int n) {
+		//runs on the pool's workers too, which must not wait on themselves.
+		pool.parallel_for(16, [&](int m) {
+			total += m;
+		});
+	});
+	CHECK_EQ(total.load(), 8*(15*16/2));
+}
+
+UNIT_TEST(thread_pool_parallel_for_exception)
+{
+	threading::thread_pool pool("test_pool", 3);
+	std::vector<int> done(32, 0);
+	bool thrown = false;
+	try {
+		pool.parallel_for(32, [&](int n) {
+			if(n == 5) {
+				throw std::runtime_error("block failed");
+			}
+			done[n] = 1;
+		});
+	} catch(std::runtime_error&) {
+		thrown = true;
+	}
+	CHECK(thrown, "exception from parallel_for block was not rethrown");
+
+	//the failure belongs to that call only.
+	pool.parallel_for(32, [&](int n) { done[n] = 2; });
+	for(int n = 0; n != 32; ++n) {
+		CHECK_EQ(done[n], 2);
+	}
+}
+
+UNIT_TEST(thread_pool_concurrent_batches)
+{
+	threading::thread_pool pool("test_pool", 2);
+
+	//an unrelated job that fails and one that doesn't finish until the
+	//batches are done; neither may hold up or leak into parallel_for.
+	std::atomic<bool> release(false);
+	pool.submit([]() { throw std::runtime_error("unrelated job failed"); });
+	pool.submit([&release]() {
+		while(!release) {
+			std::this_thread::yield();
+		}
+	});
+
+	const int ncallers = 4, count = 100;
+	std::vector<std::vector<int>> results(ncallers);
+	std::vector<std::thread> callers;
+	for(int c = 0; c != ncallers; ++c) {
+		callers.emplace_back([&, c]() {
+			for(int iter = 0; iter != 20; ++iter) {
+				std::vector<int> res(count, 0);
+				pool.parallel_for(count, [&](int n) { res[n] = n*c + iter; });
+				results[c] = res;
+			}
+		});
+	}
+	for(auto& t : callers) {
+		t.join();
+	}
+
+	for(int c = 0; c != ncallers; ++c) {
+		for(int n = 0; n != count; ++n) {
+			CHECK_EQ(results[c][n], n*c + 19);
+		}
+	}
+
+	release = true;
+	bool thrown = false;
+	try {
+		pool.wait();
+	} catch(std::runtime_error&) {
+		thrown = true;
+	}
+	CHECK(thrown, "submitted job's exception was not reported by wait()");
+}
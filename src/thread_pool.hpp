@@ -0,0 +1,92 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "thread.hpp"
+
+namespace threading
+{
+	// A fixed set of worker threads which run jobs submitted to them.
+	//
+	// Threads are created with the given flags, so a pool created with
+	// THREAD_ALLOCATES_COLLECTIBLE_OBJECTS may run FFL. Workers of such a
+	// pool are registered with the variant system on startup.
+	class thread_pool
+	{
+	public:
+		thread_pool(const std::string& name, int nthreads, int flags=0);
+
+		// Waits for all submitted jobs to finish, then stops the workers.
+		~thread_pool();
+
+		int size() const { return static_cast<int>(threads_.size()); }
+
+		// Queue a job to be run on one of the worker threads.
+		void submit(std::function<void()> job);
+
+		// Block until every job submitted so far has finished. If any job
+		// threw, the first exception thrown is rethrown here.
+		void wait();
+
+		// Calls fn(n) for every n in [0, count), spread over the workers and
+		// the calling thread, and blocks until all calls are done. Indexes
+		// are handed out in contiguous blocks so that which thread handles
+		// which index never affects the results written to per-index slots.
+		//
+		// Only this call's blocks are waited for, not other jobs in the
+		// pool, and only an exception thrown by fn is rethrown. The caller
+		// runs any block no worker has picked up yet, so this may be called
+		// from a worker of the same pool.
+		void parallel_for(int count, std::function<void(int)> fn);
+
+		// A process-wide pool sized to the number of CPU cores, which may
+		// run FFL.
+		static thread_pool& shared();
+	private:
+		thread_pool(const thread_pool&);
+		void operator=(const thread_pool&);
+
+		void worker_loop(bool register_variant_thread);
+
+		struct batch;
+		void run_batch_blocks(batch& b);
+
+		std::vector<std::unique_ptr<thread>> threads_;
+
+		mutex mutex_;
+		condition work_available_, work_done_, batch_done_;
+		std::deque<std::function<void()>> jobs_;
+		int jobs_running_;
+		bool quitting_;
+		std::exception_ptr error_;
+	};
+}
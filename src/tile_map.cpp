@@ -21,6 +21,7 @@
 	   distribution.
 */
 
+#include <bitset>
 #include <boost/regex.hpp>
 #include <cmath>
 #include <iostream>
@@ -43,7 +44,9 @@
 #include "random.hpp"
 #include "string_utils.hpp"
 #include "thread.hpp"
+#include "thread_pool.hpp"
 #include "tile_map.hpp"
+#include "unit_test.hpp"
 #include "variant_utils.hpp"
 
 namespace 
@@ -116,28 +119,195 @@ int get_named_zorder(const std::string& key, int default_value)
 	return itor->second;
 }
 
+//A tile pattern regex compiled to a direct test on tile strings. Tile
+//patterns are nearly always alternations of short strings made of literal
+//characters, '.' and [] classes, perhaps ending in .*, and those are
+//matched here without the regex engine. Anything else falls back to
+//boost::regex. Matching is thread safe.
+class TileRegexMatcher
+{
+public:
+	TileRegexMatcher(const boost::regex* re, int id);
+
+	//a small integer unique to this matcher, for indexing tables by.
+	int id() const { return id_; }
+
+	bool match(const char* str) const;
+	bool usesRegex() const { return fallback_ != nullptr; }
+private:
+	typedef std::bitset<256> CharClass;
+	struct Alternative {
+		Alternative() : any_suffix(false) {}
+		std::vector<CharClass> chars;
+		bool any_suffix;
+	};
+
+	bool compile(std::string expr);
+
+	int id_;
+	bool inverted_;
+	const boost::regex* fallback_;
+	std::vector<Alternative> alternatives_;
+};
+
+TileRegexMatcher::TileRegexMatcher(const boost::regex* re, int id)
+  : id_(id), inverted_(false), fallback_(nullptr)
+{
+	if(reinterpret_cast<intptr_t>(re)&1) {
+		//the low bit in the re pointer is set, meaning this is an inverted
+		//match.
+		inverted_ = true;
+		re = reinterpret_cast<const boost::regex*>(reinterpret_cast<intptr_t>(re)-1);
+	}
+
+	if(!compile(re->str())) {
+		alternatives_.clear();
+		fallback_ = re;
+	}
+}
+
+bool TileRegexMatcher::compile(std::string expr)
+{
+	//regex_match() always matches the whole string, so anchors add nothing.
+	if(!expr.empty() && expr.front() == '^') {
+		expr.erase(expr.begin());
+	}
+
+	if(!expr.empty() && expr.back() == '$' && (expr.size() < 2 || expr[expr.size()-2] != '\\')) {
+		expr.pop_back();
+	}
+
+	if(expr.size() >= 2 && expr.front() == '(' && expr.back() == ')' && std::count(expr.begin(), expr.end(), '(') == 1 && std::count(expr.begin(), expr.end(), ')') == 1) {
+		expr = std::string(expr.begin()+1, expr.end()-1);
+	}
+
+	std::vector<std::string> alternatives;
+	util::split(expr, alternatives, '|', 0);
+
+	for(const std::string& alt : alternatives) {
+		Alternative a;
+		for(size_t i = 0; i < alt.size(); ) {
+			const char c = alt[i];
+			if(c == '.' && i+1 < alt.size() && alt[i+1] == '*') {
+				if(i+2 != alt.size()) {
+					return false;
+				}
+
+				a.any_suffix = true;
+				break;
+			} else if(c == '.') {
+				CharClass cc;
+				cc.set();
+				a.chars.push_back(cc);
+				++i;
+			} else if(c == '[') {
+				const size_t end = alt.find(']', i+1);
+				if(end == std::string::npos || end == i+1) {
+					return false;
+				}
+
+				std::string body(alt.begin() + i + 1, alt.begin() + end);
+				const bool negate = body[0] == '^';
+				if(negate) {
+					body.erase(body.begin());
+				}
+
+				if(body.empty() || std::count(body.begin(), body.end(), '\\') || std::count(body.begin(), body.end(), '[')) {
+					return false;
+				}
+
+				CharClass cc;
+				for(size_t n = 0; n < body.size(); ++n) {
+					if(n+2 < body.size() && body[n+1] == '-') {
+						for(int ch = static_cast<unsigned char>(body[n]); ch <= static_cast<unsigned char>(body[n+2]); ++ch) {
+							cc.set(ch);
+						}
+						n += 2;
+					} else {
+						cc.set(static_cast<unsigned char>(body[n]));
+					}
+				}
+
+				if(negate) {
+					cc.flip();
+				}
+
+				a.chars.push_back(cc);
+				i = end + 1;
+			} else if(strchr("\\()*+?{}|^$]", c)) {
+				return false;
+			} else {
+				CharClass cc;
+				cc.set(static_cast<unsigned char>(c));
+				a.chars.push_back(cc);
+				++i;
+			}
+		}
+
+		alternatives_.push_back(a);
+	}
+
+	return true;
+}
+
+bool TileRegexMatcher::match(const char* str) const
+{
+	bool result = false;
+	if(fallback_) {
+		result = boost::regex_match(str, str + strlen(str), *fallback_);
+	} else {
+		const size_t len = strlen(str);
+		for(const Alternative& a : alternatives_) {
+			if(len < a.chars.size() || (len != a.chars.size() && !a.any_suffix)) {
+				continue;
+			}
+
+			bool match = true;
+			for(size_t n = 0; n != a.chars.size() && match; ++n) {
+				match = a.chars[n].test(static_cast<unsigned char>(str[n]));
+			}
+
+			if(match) {
+				result = true;
+				break;
+			}
+		}
+	}
+
+	return result != inverted_;
+}
+
 namespace 
 {
-	typedef std::map<const boost::regex*, bool> regex_match_map;
-	std::map<boost::array<char, 4>, regex_match_map> re_matches;
+	threading::mutex& tile_matchers_mutex()
+	{
+		static threading::mutex* m = new threading::mutex;
+		return *m;
+	}
 
-	bool match_regex(boost::array<char, 4> str, const boost::regex* re) 
+	std::map<const boost::regex*, std::unique_ptr<TileRegexMatcher>>& tile_matchers()
 	{
-		if(reinterpret_cast<intptr_t>(re)&1) {
-			//the low bit in the re pointer is set, meaning this is an inverted
-			//match.
-			return !match_regex(str, reinterpret_cast<const boost::regex*>(reinterpret_cast<intptr_t>(re)-1));
-		}
+		static std::map<const boost::regex*, std::unique_ptr<TileRegexMatcher>>* instance = new std::map<const boost::regex*, std::unique_ptr<TileRegexMatcher>>;
+		return *instance;
+	}
 
-		std::map<const boost::regex*, bool>& m = re_matches[str];
-		std::map<const boost::regex*, bool>::const_iterator i = m.find(re);
-		if(i != m.end()) {
-			return i->second;
+	//gets the matcher for a regex from the pool. Matchers live as long as
+	//the pool does.
+	const TileRegexMatcher* get_tile_matcher(const boost::regex* re)
+	{
+		threading::lock l(tile_matchers_mutex());
+		std::unique_ptr<TileRegexMatcher>& m = tile_matchers()[re];
+		if(!m) {
+			m.reset(new TileRegexMatcher(re, static_cast<int>(tile_matchers().size())-1));
 		}
 
-		const bool match = boost::regex_match(str.data(), str.data() + strlen(str.data()), *re);
-		m[re] = match;
-		return match;
+		return m.get();
+	}
+
+	int num_tile_matchers()
+	{
+		threading::lock l(tile_matchers_mutex());
+		return static_cast<int>(tile_matchers().size());
 	}
 
 	struct is_whitespace 
@@ -186,7 +356,7 @@ struct TilePattern
 			main_tile = 4;
 		}
 
-		current_tile_pattern = &get_regex_from_pool(patterns[main_tile].empty() ? "^$" : patterns[main_tile]);
+		current_tile_matcher = get_tile_matcher(&get_regex_from_pool(patterns[main_tile].empty() ? "^$" : patterns[main_tile]));
 
 		for(std::vector<std::string>::size_type n = 0; n != patterns.size(); ++n) {
 			if(n == main_tile) {
@@ -214,15 +384,15 @@ struct TilePattern
 	}
 
 	std::string tile_id;
-	const boost::regex* current_tile_pattern;
+	const TileRegexMatcher* current_tile_matcher;
 
 	struct SurroundingTile {
 		SurroundingTile(int x, int y, const std::string& s)
-		  : xoffset(x), yoffset(y), pattern(&get_regex_from_pool(s))
+		  : xoffset(x), yoffset(y), matcher(get_tile_matcher(&get_regex_from_pool(s)))
 		{}
 		int xoffset;
 		int yoffset;
-		const boost::regex* pattern;
+		const TileRegexMatcher* matcher;
 	};
 
 	std::vector<SurroundingTile> surrounding_tiles;
@@ -430,7 +600,6 @@ TileMap::TileMap() : xpos_(0), ypos_(0), x_speed_(100), y_speed_(100), zorder_(0
 
 	//make an entry for the empty string.
 	pattern_index_.push_back(PatternIndexEntry());
-	pattern_index_.back().matching_patterns.push_back(&get_regex_from_pool(""));
 }
 
 TileMap::TileMap(variant node)
@@ -460,7 +629,6 @@ TileMap::TileMap(variant node)
 
 	//make an entry for the empty string.
 	pattern_index_.push_back(PatternIndexEntry());
-	pattern_index_.back().matching_patterns.push_back(&get_regex_from_pool(""));
 
 	{
 	const std::string& tiles_str = node["tiles"].as_string();
@@ -544,97 +712,86 @@ TileMap::~TileMap()
 
 void TileMap::buildPatterns()
 {
-	std::vector<const boost::regex*> all_regexes;
-
 	patterns_version_ = current_patterns_version;
 	const unsigned begin_time = profile::get_tick_time();
 	patterns_.clear();
-	for(const TilePattern& p : patterns) {
-		std::vector<const boost::regex*> re;
-		std::vector<const boost::regex*> accepted_re;
-		if(!p.current_tile_pattern->empty()) {
-			re.push_back(p.current_tile_pattern);
-		}
-		
-		for(const TilePattern::SurroundingTile& t : p.surrounding_tiles) {
-			re.push_back(t.pattern);
+	multi_patterns_.clear();
+	multi_pattern_matchers_.clear();
+
+	//look up the multi tile patterns' matchers first, as that may create
+	//matchers, and the tables below are sized by how many there are.
+	std::vector<std::vector<const TileRegexMatcher*>> multi_matchers;
+	for(const MultiTilePattern& p : MultiTilePattern::getAll()) {
+		multi_matchers.push_back(std::vector<const TileRegexMatcher*>());
+		for(int y = 0; y < p.height(); ++y) {
+			for(int x = 0; x < p.width(); ++x) {
+				multi_matchers.back().push_back(get_tile_matcher(p.getTileAt(x, y).re));
+			}
 		}
+	}
 
-		int matches = 0;
-		for(PatternIndexEntry& e : pattern_index_) {
-			for(const boost::regex*& regex : re) {
-				if(regex && match_regex(e.str, regex)) {
-					accepted_re.push_back(regex);
-					regex = nullptr;
-					++matches;
-					if(matches == re.size()) {
-						break;
-					}
+	const int nmatchers = num_tile_matchers();
+	for(PatternIndexEntry& e : pattern_index_) {
+		e.match_bits.assign((nmatchers + 63)/64, 0);
+		e.candidates.clear();
+	}
+
+	//which matchers accept some entry in this map: -1 if not known yet.
+	std::vector<int> matches_any(nmatchers, -1);
+	auto evaluate = [this, &matches_any](const TileRegexMatcher* m) {
+		int& result = matches_any[m->id()];
+		if(result == -1) {
+			result = 0;
+			for(PatternIndexEntry& e : pattern_index_) {
+				if(m->match(e.str.data())) {
+					e.match_bits[m->id()/64] |= uint64_t(1) << (m->id()%64);
+					result = 1;
 				}
 			}
+		}
 
-			if(matches == re.size()) {
-				break;
-			}
+		return result == 1;
+	};
+
+	//a pattern can only apply to this map if every one of its tiles is
+	//matched by something in it.
+	for(const TilePattern& p : patterns) {
+		bool viable = evaluate(p.current_tile_matcher);
+		for(auto t = p.surrounding_tiles.begin(); viable && t != p.surrounding_tiles.end(); ++t) {
+			viable = evaluate(t->matcher);
 		}
 
-		if(matches == re.size()) {
-			all_regexes.insert(all_regexes.end(), accepted_re.begin(), accepted_re.end());
+		if(viable) {
 			patterns_.push_back(&p);
 		}
 	}
 
+	int index = 0;
 	for(const MultiTilePattern& p : MultiTilePattern::getAll()) {
-		std::vector<const boost::regex*> re;
-		std::vector<const boost::regex*> accepted_re;
-
-		re.reserve(p.width()*p.height());
-		for(int x = 0; x < p.width(); ++x) {
-			for(int y = 0; y < p.height(); ++y) {
-				re.push_back(p.getTileAt(x, y).re);
-			}
+		const std::vector<const TileRegexMatcher*>& matchers = multi_matchers[index++];
+		bool viable = true;
+		for(auto m = matchers.begin(); viable && m != matchers.end(); ++m) {
+			viable = evaluate(*m);
 		}
 
-		int matches = 0;
-		for(PatternIndexEntry& e : pattern_index_) {
-			for(const boost::regex*& regex : re) {
-				if(regex && match_regex(e.str, regex)) {
-					accepted_re.push_back(regex);
-					regex = nullptr;
-					++matches;
-					if(matches == re.size()) {
-						break;
-					}
-				}
-			}
-
-			if(matches == re.size()) {
-				break;
-			}
-		}
-
-		if(matches == re.size()) {
-			all_regexes.insert(all_regexes.end(), accepted_re.begin(), accepted_re.end());
+		if(viable) {
 			multi_patterns_.push_back(&p);
+			multi_pattern_matchers_.push_back(std::vector<int>());
+			for(const TileRegexMatcher* m : matchers) {
+				multi_pattern_matchers_.back().push_back(m->id());
+			}
 		}
 	}
 
-	std::sort(all_regexes.begin(), all_regexes.end());
-	all_regexes.erase(std::unique(all_regexes.begin(), all_regexes.end()), all_regexes.end());
-
 	for(PatternIndexEntry& e : pattern_index_) {
-		e.matching_patterns.clear();
-
-		for(const boost::regex* re : all_regexes) {
-			if(match_regex(e.str, re)) {
-				e.matching_patterns.push_back(re);
+		for(int n = 0; n != static_cast<int>(patterns_.size()); ++n) {
+			if(e.matches(patterns_[n]->current_tile_matcher->id())) {
+				e.candidates.push_back(n);
 			}
 		}
 	}
 
-	const unsigned end_time = profile::get_tick_time();
-	static unsigned total_time = 0;
-	total_time += (end_time - begin_time);
+	LOG_DEBUG("built tile patterns: " << patterns_.size() << " of " << patterns.size() << " patterns, " << pattern_index_.size() << " tile types: " << (profile::get_tick_time() - begin_time));
 }
 
 const std::vector<const TilePattern*>& TileMap::getPatterns() const
@@ -747,29 +904,12 @@ const TileMap::PatternIndexEntry& TileMap::getTileEntry(int y, int x) const
 	return pattern_index_[map_[y][x]];
 }
 
-namespace 
-{
-	struct cstr_less 
-	{
-		bool operator()(const char* a, const char* b) const {
-			return strcmp(a, b) < 0;
-		}
-	};
-
-	typedef std::map<const char*, std::vector<const TilePattern*>, cstr_less> TilePatternCacheMap;
-	struct TilePatternCache 
-	{
-		TilePatternCacheMap cache;
-	};
-}
-
 int TileMap::getVariations(int x, int y) const
 {
 	x -= xpos_/TileSize;
 	y -= ypos_/TileSize;
-	TilePatternCache cache;
 	bool face_right = false;
-	const TilePattern* p = getMatchingPattern(x, y, cache, &face_right);
+	const TilePattern* p = getMatchingPattern(x, y, &face_right);
 	if(p == nullptr) {
 		return 0;
 	}
@@ -855,6 +995,7 @@ namespace
 
 void TileMap::applyMatchingMultiPattern(int& x, int y,
 	const MultiTilePattern& pattern,
+	const std::vector<int>& matchers,
 	point_map<LevelObject*>& mapping,
 	std::map<point_zorder, LevelObject*>& different_zorder_mapping) const
 {
@@ -869,7 +1010,7 @@ void TileMap::applyMatchingMultiPattern(int& x, int y,
 		const int ypos = pattern.tryOrder()[n].loc.y;
 
 		const PatternIndexEntry& entry = getTileEntry(y + ypos, x + xpos);
-		if(std::find(entry.matching_patterns.begin(), entry.matching_patterns.end(), pattern.getTileAt(xpos, ypos).re) == entry.matching_patterns.end()) {
+		if(!entry.matches(matchers[ypos*pattern.width() + xpos])) {
 			//the regex doesn't match
 			match = false;
 
@@ -910,6 +1051,17 @@ void TileMap::applyMatchingMultiPattern(int& x, int y,
 void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 {
 	const int begin_time = profile::get_tick_time();
+	getPatterns();
+
+	point_map<LevelObject*> multi_pattern_matches;
+	buildMultiPatternTiles(&multi_pattern_matches, tiles, r);
+
+	const int ntiles = buildTileRows(-g_tile_pattern_search_border, static_cast<int>(map_.size()) + g_tile_pattern_search_border, multi_pattern_matches, tiles, r);
+	LOG_DEBUG("done build tiles: " << ntiles << " " << (profile::get_tick_time() - begin_time));
+}
+
+int TileMap::width() const
+{
 	int width = 0;
 	for(const auto& row : map_) {
 		int rs = static_cast<int>(row.size());
@@ -918,10 +1070,16 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 		}
 	}
 
-	point_map<LevelObject*> multi_pattern_matches;
+	return width;
+}
+
+void TileMap::buildMultiPatternTiles(point_map<LevelObject*>* multi_pattern_matches, std::vector<LevelTile>* tiles, const rect* r) const
+{
+	const int width = this->width();
 	std::map<point_zorder, LevelObject*> different_zorder_multi_pattern_matches;
 
-	for(const MultiTilePattern* p : multi_patterns_) {
+	for(int n = 0; n != static_cast<int>(multi_patterns_.size()); ++n) {
+		const MultiTilePattern* p = multi_patterns_[n];
 		for(int y = -p->height(); y < static_cast<int>(map_.size()) + p->height(); ++y) {
 			const int ypos = ypos_ + y*TileSize;
 	
@@ -930,14 +1088,13 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 			}
 
 			for(int x = -p->width(); x < width + p->width(); ++x) {
-				applyMatchingMultiPattern(x, y, *p, multi_pattern_matches, different_zorder_multi_pattern_matches);
+				applyMatchingMultiPattern(x, y, *p, multi_pattern_matchers_[n], *multi_pattern_matches, different_zorder_multi_pattern_matches);
 			}
 		}
 	}
 
 	//add all tiles in different zorders to our own.
 	for(auto& i : different_zorder_multi_pattern_matches) {
-		const LevelObject* obj = i.second;
 		const int x = i.first.first.x;
 		const int y = i.first.first.y;
 
@@ -953,12 +1110,14 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 		t.face_right = false;
 		tiles->emplace_back(t);
 	}
+}
 
-
-	TilePatternCache cache;
+int TileMap::buildTileRows(int begin_row, int end_row, const point_map<LevelObject*>& multi_pattern_matches, std::vector<LevelTile>* tiles, const rect* r) const
+{
+	const int width = this->width();
 
 	int ntiles = 0;
-	for(int y = -g_tile_pattern_search_border; y < static_cast<int>(map_.size()) + g_tile_pattern_search_border; ++y) {
+	for(int y = begin_row; y < end_row; ++y) {
 		const int ypos = ypos_ + y*TileSize;
 
 		if((r && ypos < r->y()) || (r && ypos > r->y2())) {
@@ -982,7 +1141,7 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 			}
 
 			bool face_right = true;
-			const TilePattern* p = getMatchingPattern(x, y, cache, &face_right);
+			const TilePattern* p = getMatchingPattern(x, y, &face_right);
 			if(p == nullptr) {
 				continue;
 			}
@@ -1031,11 +1190,68 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 			}
 		}
 	}
-	LOG_DEBUG("done build tiles: " << ntiles << " " << (profile::get_tick_time() - begin_time));
+
+	return ntiles;
+}
+
+void TileMap::buildTiles(const std::vector<const TileMap*>& maps, std::vector<LevelTile>* tiles)
+{
+#ifdef MT_FFL
+	//compiling a map's patterns writes to it, so do that before going wide.
+	for(const TileMap* m : maps) {
+		m->getPatterns();
+	}
+
+	//split every map into bands of rows, which are built independently.
+	//Each band's tiles go in their own vector so the result is in the same
+	//order as building the maps one row at a time.
+	const int RowsPerBand = 16;
+	struct Band { int map, begin_row, end_row; };
+	std::vector<Band> bands;
+	for(int n = 0; n != static_cast<int>(maps.size()); ++n) {
+		const int end_row = static_cast<int>(maps[n]->map_.size()) + g_tile_pattern_search_border;
+		for(int y = -g_tile_pattern_search_border; y < end_row; y += RowsPerBand) {
+			Band b = { n, y, std::min(y + RowsPerBand, end_row) };
+			bands.push_back(b);
+		}
+	}
+
+	if(bands.size() > 1) {
+		threading::thread_pool& pool = threading::thread_pool::shared();
+
+		std::vector<point_map<LevelObject*>> multi_pattern_matches(maps.size());
+		std::vector<std::vector<LevelTile>> multi_pattern_tiles(maps.size());
+		pool.parallel_for(static_cast<int>(maps.size()), [&](int n) {
+			maps[n]->buildMultiPatternTiles(&multi_pattern_matches[n], &multi_pattern_tiles[n], nullptr);
+		});
+
+		std::vector<std::vector<LevelTile>> band_tiles(bands.size());
+		pool.parallel_for(static_cast<int>(bands.size()), [&](int n) {
+			const Band& b = bands[n];
+			maps[b.map]->buildTileRows(b.begin_row, b.end_row, multi_pattern_matches[b.map], &band_tiles[n], nullptr);
+		});
+
+		auto band = bands.begin();
+		for(int n = 0; n != static_cast<int>(maps.size()); ++n) {
+			tiles->insert(tiles->end(), multi_pattern_tiles[n].begin(), multi_pattern_tiles[n].end());
+			for(; band != bands.end() && band->map == n; ++band) {
+				const std::vector<LevelTile>& v = band_tiles[band - bands.begin()];
+				tiles->insert(tiles->end(), v.begin(), v.end());
+			}
+		}
+
+		return;
+	}
+#endif
+
+	for(const TileMap* m : maps) {
+		m->buildTiles(tiles);
+	}
 }
 
-const TilePattern* TileMap::getMatchingPattern(int x, int y, TilePatternCache& cache, bool* face_right) const
+const TilePattern* TileMap::getMatchingPattern(int x, int y, bool* face_right) const
 {
+	getPatterns();
 
 	if (!*getTile(y, x) &&
 	    !*getTile(y-1, x) &&
@@ -1045,39 +1261,27 @@ const TilePattern* TileMap::getMatchingPattern(int x, int y, TilePatternCache& c
 		return nullptr;
 	}
 
-	const int xpos = xpos_ + x*TileSize;
+	//only made if a pattern has a filter to run.
+	ffl::IntrusivePtr<FilterCallable> callable;
 
-	ffl::IntrusivePtr<FilterCallable> callable_ptr(new FilterCallable(*this, x, y));
-	FilterCallable& callable = *callable_ptr;
+	//the patterns whose middle tile matches the current tile, in order.
+	const std::vector<int>& candidates = getTileEntry(y, x).candidates;
 
-	const char* current_tile = getTile(y,x);
+	for(int index : candidates) {
+		const TilePattern& p = *patterns_[index];
+		if(p.filter_formula) {
+			if(!callable) {
+				callable.reset(new FilterCallable(*this, x, y));
+			}
 
-	//we build a cache of all of the patterns which have some chance of
-	//matching the current tile.
-	TilePatternCacheMap::iterator itor = cache.cache.find(current_tile);
-	if(itor == cache.cache.end()) {
-		itor = cache.cache.insert(std::pair<const char*,std::vector<const TilePattern*> >(current_tile, std::vector<const TilePattern*>())).first;
-		for(const TilePattern* p : getPatterns()) {
-			if(!p->current_tile_pattern->empty() && !boost::regex_match(current_tile, current_tile + strlen(current_tile), *p->current_tile_pattern)) {
+			if(p.filter_formula->execute(*callable).as_bool() == false) {
 				continue;
 			}
-
-			itor->second.push_back(&*p);
-		}
-	}
-
-	const std::vector<const TilePattern*>& matching_patterns = itor->second;
-
-	for(const TilePattern* ptr : matching_patterns) {
-		const TilePattern& p = *ptr;
-		if(p.filter_formula && p.filter_formula->execute(callable).as_bool() == false) {
-			continue;
 		}
 
 		bool match = true;
 		for(const TilePattern::SurroundingTile& t : p.surrounding_tiles) {
-			const PatternIndexEntry& entry = getTileEntry(y + t.yoffset, x + t.xoffset);
-			if(std::find(entry.matching_patterns.begin(), entry.matching_patterns.end(), t.pattern) == entry.matching_patterns.end()) {
+			if(!getTileEntry(y + t.yoffset, x + t.xoffset).matches(t.matcher->id())) {
 				match = false;
 				break;
 			}
@@ -1096,8 +1300,7 @@ const TilePattern* TileMap::getMatchingPattern(int x, int y, TilePatternCache& c
 			match = true;
 
 			for(const TilePattern::SurroundingTile& t : p.surrounding_tiles) {
-				const PatternIndexEntry& entry = getTileEntry(y + t.yoffset, x - t.xoffset);
-				if(std::find(entry.matching_patterns.begin(), entry.matching_patterns.end(), t.pattern) == entry.matching_patterns.end()) {
+				if(!getTileEntry(y + t.yoffset, x - t.xoffset).matches(t.matcher->id())) {
 					match = false;
 					break;
 				}
@@ -1192,3 +1395,35 @@ int TileMap::getPatternIndexEntry(const tile_string& str) {
 	buildPatterns();
 	return index;
 }
+
+UNIT_TEST(tile_regex_matcher)
+{
+	const char* patterns[] = {
+		"", "bck", "^bck$", "(bck|ebk)", "bck|ebk|", "b.k", "b[cd]k", "b[^c]k", "[a-c]..",
+		"bc.*", "(bc.*|x)", "!bck", "!(b.*)", "b(c|e)k", "bc?k", "[ ]", "\\w+",
+	};
+
+	const char* strings[] = {
+		"", "bck", "ebk", "bdk", "bek", "bc", "bcka", "x", "abc", " ", "b k", "bk",
+	};
+
+	int id = 0;
+	for(const char* p : patterns) {
+		const boost::regex* re = &get_regex_from_pool(p);
+		TileRegexMatcher matcher(re, id++);
+
+		const bool inverted = (reinterpret_cast<intptr_t>(re)&1) != 0;
+		if(inverted) {
+			re = reinterpret_cast<const boost::regex*>(reinterpret_cast<intptr_t>(re)-1);
+		}
+
+		for(const char* str : strings) {
+			const bool expected = boost::regex_match(str, *re) != inverted;
+			CHECK(matcher.match(str) == expected, "tile matcher for '" << p << "' disagrees with regex on '" << str << "'");
+		}
+	}
+
+	//alternations with groups or repeats aren't compiled.
+	CHECK_EQ(TileRegexMatcher(&get_regex_from_pool("b(c|e)k"), 0).usesRegex(), true);
+	CHECK_EQ(TileRegexMatcher(&get_regex_from_pool("(bck|b[de]k|x.*)"), 0).usesRegex(), false);
+}
@@ -44,11 +44,6 @@ int get_named_zorder(const std::string& key, int default_value=0);
 struct TilePattern;
 class MultiTilePattern;
 
-namespace 
-{
-	struct TilePatternCache;
-}
-
 class TileMap
 {
 public:
@@ -64,6 +59,11 @@ public:
 
 	variant write() const;
 	void buildTiles(std::vector<LevelTile>* tiles, const rect* r=nullptr) const;
+
+	//builds the tiles of several maps, appending them to tiles in the same
+	//order as calling buildTiles() on each map in turn would. When FFL is
+	//thread safe the maps are built in parallel.
+	static void buildTiles(const std::vector<const TileMap*>& maps, std::vector<LevelTile>* tiles);
 	bool setTile(int xpos, int ypos, const std::string& str);
 	int zorder() const { return zorder_; }
 	int getXSpeed() const { return x_speed_; }
@@ -92,7 +92,16 @@ private:
 	const std::vector<const TilePattern*>& getPatterns() const;
 
 	int variation(int x, int y) const;
-	const TilePattern* getMatchingPattern(int x, int y, TilePatternCache& cache, bool* face_right) const;
+	const TilePattern* getMatchingPattern(int x, int y, bool* face_right) const;
+
+	int width() const;
+
+	//the two phases of buildTiles(). Multi tile patterns are applied over
+	//the whole map first, then single tile patterns row by row, skipping
+	//any cell a multi tile pattern claimed. Rows are independent of each
+	//other so any range of them may be built separately.
+	void buildMultiPatternTiles(point_map<LevelObject*>* multi_pattern_matches, std::vector<LevelTile>* tiles, const rect* r) const;
+	int buildTileRows(int begin_row, int end_row, const point_map<LevelObject*>& multi_pattern_matches, std::vector<LevelTile>* tiles, const rect* r) const;
 	variant getValue(const std::string& key) const { return variant(); }
 	int xpos_, ypos_;
 	int x_speed_, y_speed_;
@@ -104,12 +113,18 @@ private:
 	std::vector<std::vector<int>> map_;
 
 	//an entry which holds one of the strings found in this map, as well
-	//as the patterns it matches.
+	//as which tile pattern regexes it matches, as a bit per matcher id, and
+	//the indexes into patterns_ whose middle tile it matches, in order.
 	struct PatternIndexEntry 
 	{
 		PatternIndexEntry() { for(int n = 0; n != str.size(); ++n) { str[n] = 0; } }
+		bool matches(int matcher_id) const {
+			return (match_bits[matcher_id/64] >> (matcher_id%64))&1;
+		}
+
 		tile_string str;
-		mutable std::vector<const boost::regex*> matching_patterns;
+		std::vector<uint64_t> match_bits;
+		std::vector<int> candidates;
 	};
 
 	const PatternIndexEntry& getTileEntry(int y, int x) const;
@@ -118,8 +133,10 @@ private:
 
 	int getPatternIndexEntry(const tile_string& str);
 
-	//the subset of all multi tile patterns which might be valid for this map.
+	//the subset of all multi tile patterns which might be valid for this map,
+	//with the matcher id of each of their tiles, indexed by y*width + x.
 	std::vector<const MultiTilePattern*> multi_patterns_;
+	std::vector<std::vector<int>> multi_pattern_matchers_;
 
 	typedef std::pair<point, int> point_zorder;
 	//function to apply the first found matching multi pattern.
@@ -128,6 +145,7 @@ private:
 	//to this tile_map.
 	void applyMatchingMultiPattern(int& x, int y,
 		const MultiTilePattern& pattern,
+		const std::vector<int>& matchers,
 		point_map<LevelObject*>& mapping,
 		std::map<point_zorder, LevelObject*>& different_zorder_mapping) const;
 
@@ -0,0 +1,276 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DisplayDevice.hpp"
+#include "RenderTarget.hpp"
+#include "WindowManager.hpp"
+
+#include "asserts.hpp"
+#include "controls.hpp"
+#include "draw_scene.hpp"
+#include "entity.hpp"
+#include "filesystem.hpp"
+#include "formatter.hpp"
+#include "formula_profiler.hpp"
+#include "json_parser.hpp"
+#include "level.hpp"
+#include "random.hpp"
+#include "unit_test.hpp"
+#include "variant_utils.hpp"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	//a checksum of the simulation state which is cheap enough to take every
+	//cycle and stable across runs of the same level with the same controls.
+	int level_state_checksum(const Level& lvl)
+	{
+		uint32_t sum = static_cast<uint32_t>(lvl.cycle());
+		for(const EntityPtr& e : lvl.get_chars()) {
+			const uint32_t values[] = {
+				static_cast<uint32_t>(e->centiX()), static_cast<uint32_t>(e->centiY()),
+				static_cast<uint32_t>(e->velocityX()), static_cast<uint32_t>(e->velocityY()),
+				static_cast<uint32_t>(e->getId()), static_cast<uint32_t>(e->isFacingRight()),
+			};
+
+			//FNV-1a over the values, order dependent so swapped objects are caught.
+			for(uint32_t v : values) {
+				for(int n = 0; n != 4; ++n) {
+					sum ^= (v >> (n*8))&0xFF;
+					sum *= 16777619u;
+				}
+			}
+		}
+
+		return static_cast<int>(sum&0x7FFFFFFF);
+	}
+
+	uint64_t percentile(const std::vector<uint64_t>& sorted, int pct)
+	{
+		if(sorted.empty()) {
+			return 0;
+		}
+
+		const size_t index = std::min(sorted.size()-1, (sorted.size()*pct)/100);
+		return sorted[index];
+	}
+
+	std::vector<unsigned char> read_control_stream(const std::string& fname)
+	{
+		std::vector<unsigned char> result;
+		variant v = json::parse_from_file(fname);
+		if(v.is_map()) {
+			v = v["controls"];
+		}
+
+		ASSERT_LOG(v.is_list(), "Control stream " << fname << " must be a list of key states, one per cycle");
+		for(const variant& item : v.as_list()) {
+			result.push_back(static_cast<unsigned char>(item.as_int()));
+		}
+
+		return result;
+	}
+}
+
+//Runs a level without presenting anything to the screen for a fixed number
+//of cycles, feeding it a recorded control stream. Reports per-cycle timing
+//and a per-subsystem breakdown, and the final state checksum so that
+//optimizations can be checked for both speed and determinism.
+//
+//Each subsystem's time excludes the subsystems nested inside it, so the
+//breakdown adds up. TILES is timed as tiles are drawn, so it's only
+//reported with --draw.
+//
+//The control stream is a JSON list with one integer per cycle, each being a
+//bit mask of controls::CONTROL_ITEM values, optionally wrapped in
+//{controls: [...]}. Cycles past the end of the stream have no keys pressed.
+UTILITY(benchmark_level)
+{
+	std::string level_file;
+	std::string controls_file;
+	std::string output_file;
+	int ncycles = 1000;
+	int nwarmup = 0;
+	bool draw = false;
+	bool has_expected_checksum = false;
+	int expected_checksum = 0;
+
+	std::vector<std::string>::const_iterator it = args.begin();
+	while(it != args.end()) {
+		const std::string& arg = *it++;
+		if(arg == "--cycles" && it != args.end()) {
+			ncycles = atoi(it++->c_str());
+		} else if(arg == "--warmup" && it != args.end()) {
+			nwarmup = atoi(it++->c_str());
+		} else if(arg == "--controls" && it != args.end()) {
+			controls_file = *it++;
+		} else if(arg == "--expect-checksum" && it != args.end()) {
+			has_expected_checksum = true;
+			expected_checksum = atoi(it++->c_str());
+		} else if(arg == "--output" && it != args.end()) {
+			output_file = *it++;
+		} else if(arg == "--draw") {
+			draw = true;
+		} else if(level_file.empty()) {
+			level_file = arg;
+		} else {
+			ASSERT_LOG(false, "Unrecognized argument to benchmark_level: " << arg);
+		}
+	}
+
+	if(level_file.empty() || ncycles <= 0) {
+		std::cerr << "benchmark_level usage: <level> [--cycles N] [--warmup N] [--controls FILE] [--draw] [--expect-checksum N] [--output FILE]\n";
+		return;
+	}
+
+	std::vector<unsigned char> control_stream;
+	if(controls_file.empty() == false) {
+		control_stream = read_control_stream(controls_file);
+	}
+
+	rng::seed_from_int(0);
+
+	ffl::IntrusivePtr<Level> lvl(new Level(level_file));
+	lvl->finishLoading();
+	lvl->setAsCurrentLevel();
+
+	//hold a lock for the whole run so no real input ever reaches the level.
+	controls::local_controls_lock base_lock;
+
+	auto wnd = KRE::WindowManager::getMainWindow();
+	KRE::RenderTargetPtr fbo;
+	if(draw) {
+		fbo = KRE::DisplayDevice::renderTargetInstance(wnd->width(), wnd->height());
+		fbo->setClearColor(KRE::Color(0,0,0));
+	}
+
+	std::vector<uint64_t> cycle_ns, draw_ns;
+	cycle_ns.reserve(ncycles);
+	std::map<std::string, uint64_t> subsystem_ns;
+
+	const int total_cycles = nwarmup + ncycles;
+	for(int n = 0; n != total_cycles; ++n) {
+		const bool measuring = n >= nwarmup;
+
+		std::unique_ptr<formula_profiler::InstrumentationScope> instrumentation;
+		if(measuring) {
+			instrumentation.reset(new formula_profiler::InstrumentationScope);
+		}
+
+		const unsigned char keys = n < static_cast<int>(control_stream.size()) ? control_stream[n] : 0;
+		controls::local_controls_lock lock(keys);
+
+		const Clock::time_point begin_process = Clock::now();
+		lvl->process();
+		lvl->process_draw();
+		update_camera_position(*lvl, last_draw_position(), nullptr, draw);
+		const Clock::time_point end_process = Clock::now();
+
+		if(draw) {
+			fbo->apply();
+			fbo->clear();
+			render_scene(*lvl, last_draw_position());
+			fbo->unapply();
+		}
+
+		if(measuring) {
+			cycle_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end_process - begin_process).count());
+			if(draw) {
+				draw_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - end_process).count());
+			}
+
+			formula_profiler::take_instrumentation_totals(&subsystem_ns);
+		}
+	}
+
+	const int checksum = level_state_checksum(*lvl);
+
+	uint64_t total_ns = 0;
+	for(uint64_t ns : cycle_ns) {
+		total_ns += ns;
+	}
+
+	std::vector<uint64_t> sorted_cycles = cycle_ns;
+	std::sort(sorted_cycles.begin(), sorted_cycles.end());
+	std::vector<uint64_t> sorted_draws = draw_ns;
+	std::sort(sorted_draws.begin(), sorted_draws.end());
+
+	//the subsystems we always report, even when they took no time. Tiles
+	//are only timed while they're drawn, so only with --draw.
+	const char* subsystems[] = { "COLLISION", "USER_COLLISIONS", "FFL", "COMMANDS", "PARTICLES", "WATER" };
+	for(const char* s : subsystems) {
+		subsystem_ns[s];
+	}
+
+	if(draw) {
+		subsystem_ns["TILES"];
+	}
+
+	variant_builder report;
+	report.add("level", lvl->id());
+	report.add("cycles", ncycles);
+	report.add("checksum", checksum);
+	report.add("mean_us", static_cast<int>(total_ns/cycle_ns.size()/1000));
+
+	variant_builder process_percentiles;
+	for(int pct : { 50, 90, 99, 100 }) {
+		process_percentiles.add(formatter() << "p" << pct << "_us", static_cast<int>(percentile(sorted_cycles, pct)/1000));
+	}
+	report.add("process", process_percentiles.build());
+
+	if(draw) {
+		variant_builder draw_percentiles;
+		for(int pct : { 50, 90, 99, 100 }) {
+			draw_percentiles.add(formatter() << "p" << pct << "_us", static_cast<int>(percentile(sorted_draws, pct)/1000));
+		}
+		report.add("draw", draw_percentiles.build());
+	}
+
+	variant_builder breakdown;
+	for(auto& p : subsystem_ns) {
+		breakdown.add(p.first, static_cast<int>(p.second/cycle_ns.size()/1000));
+	}
+	report.add("subsystems_mean_us", breakdown.build());
+
+	const variant result = report.build();
+	std::cout << result.write_json(true) << "\n";
+
+	if(output_file.empty() == false) {
+		sys::write_file(output_file, result.write_json(true));
+	}
+
+	if(has_expected_checksum && checksum != expected_checksum) {
+		std::cerr << "benchmark_level: CHECKSUM MISMATCH: got " << checksum << " expected " << expected_checksum << "\n";
+		exit(1);
+	}
+}
@@ -0,0 +1,1002 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <istream>
+#include <map>
+#include <sstream>
+#include <streambuf>
+#include <unordered_set>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#define VFS_USE_MMAP
+#endif
+
+#include <boost/filesystem.hpp>
+
+#include "asserts.hpp"
+#include "compress.hpp"
+#include "filesystem.hpp"
+#include "preferences.hpp"
+#include "profile_timer.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
+#include "vfs.hpp"
+#include "zlib.h"
+
+namespace vfs
+{
+	const char* const PackFileName = "module.pack";
+
+	namespace 
+	{
+		PREF_BOOL(vfs_watch_dirs, false, "Watch every directory in the module file index so files added or removed outside of the game are noticed. Uses one file watch per directory.");
+
+		//Pack layout. All integers are little endian.
+		//
+		//  header: magic[8] version:u32 nentries:u32 index_offset:u64 index_size:u64
+		//  entry data
+		//  index: nentries * { path_len:u32 path[path_len] offset:u64 size:u32 stored_size:u32 flags:u32 }
+		//
+		//Uncompressed entries start on a page boundary.
+		const char PackMagic[8] = { 'A', 'N', 'U', 'R', 'A', 'P', 'A', 'K' };
+		const uint32_t PackVersion = 1;
+		const size_t PackHeaderSize = 32;
+		const uint64_t PackPageSize = 4096;
+
+		//files smaller than this aren't worth compressing.
+		const size_t MinCompressSize = 64;
+
+		void put_u32(std::string& s, uint32_t n)
+		{
+			for(int i = 0; i != 4; ++i) {
+				s.push_back(static_cast<char>((n >> (i*8))&0xFF));
+			}
+		}
+
+		void put_u64(std::string& s, uint64_t n)
+		{
+			put_u32(s, static_cast<uint32_t>(n&0xFFFFFFFF));
+			put_u32(s, static_cast<uint32_t>(n >> 32));
+		}
+
+		uint32_t get_u32(const char* p)
+		{
+			const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+			return u[0] | (u[1] << 8) | (u[2] << 16) | (static_cast<uint32_t>(u[3]) << 24);
+		}
+
+		uint64_t get_u64(const char* p)
+		{
+			return get_u32(p) | (static_cast<uint64_t>(get_u32(p+4)) << 32);
+		}
+
+		bool starts_with(const std::string& s, const std::string& prefix)
+		{
+			return s.size() >= prefix.size() && std::equal(prefix.begin(), prefix.end(), s.begin());
+		}
+
+		//an absolute version of path for comparing paths given in different
+		//forms, with a trailing / if it's a directory.
+		std::string absolute_path(const std::string& p, bool dir)
+		{
+			std::string result = boost::filesystem::absolute(boost::filesystem::path(p)).generic_string();
+
+			std::string::size_type pos;
+			while((pos = result.find("/./")) != std::string::npos) {
+				result.erase(pos, 2);
+			}
+
+			if(result.size() >= 2 && result.compare(result.size()-2, 2, "/.") == 0) {
+				result.resize(result.size()-1);
+			}
+
+			if(dir && (result.empty() || result.back() != '/')) {
+				result.push_back('/');
+			}
+
+			return result;
+		}
+
+		//the form paths are held in the index in. Windows file names aren't
+		//case sensitive, so neither are lookups in the index there.
+		std::string index_key(const std::string& path)
+		{
+#ifdef _WIN32
+			std::string result = path;
+			std::transform(result.begin(), result.end(), result.begin(), ::tolower);
+			return result;
+#else
+			return path;
+#endif
+		}
+
+		//whether a path is relative and in the simple form the index holds
+		//paths in.
+		bool is_indexable(const std::string& rel_path)
+		{
+			if(rel_path.empty() || rel_path.front() == '/' || rel_path.back() == '/') {
+				return false;
+			}
+
+			if(rel_path.find_first_of("\\:") != std::string::npos || rel_path.find("//") != std::string::npos) {
+				return false;
+			}
+
+			std::string::size_type begin = 0;
+			while(begin != std::string::npos) {
+				const std::string::size_type end = rel_path.find('/', begin);
+				const std::string::size_type len = (end == std::string::npos ? rel_path.size() : end) - begin;
+				if((len == 1 && rel_path[begin] == '.') || (len == 2 && rel_path.compare(begin, 2, "..") == 0)) {
+					return false;
+				}
+
+				begin = end == std::string::npos ? end : end + 1;
+			}
+
+			return true;
+		}
+
+		struct Mount 
+		{
+			std::string dir, abs_dir;
+			PackArchivePtr pack;
+		};
+
+		struct DirIndex 
+		{
+			DirIndex() : complete(true) {}
+			std::string root, top, abs_root, abs_dir;
+			std::unordered_set<std::string> files;
+			std::vector<int> watches;
+
+			//false if the directory couldn't be fully read.
+			bool complete;
+		};
+
+		typedef std::shared_ptr<DirIndex> DirIndexPtr;
+
+		//reads from memory inside a pack, keeping the pack open.
+		class PackEntryBuf : public std::streambuf
+		{
+		public:
+			PackEntryBuf(PackArchivePtr pack, const char* data, size_t size) : pack_(pack)
+			{
+				char* p = const_cast<char*>(data);
+				setg(p, p, p + size);
+			}
+		protected:
+			pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+			{
+				off_type pos = off;
+				if(dir == std::ios_base::cur) {
+					pos += gptr() - eback();
+				} else if(dir == std::ios_base::end) {
+					pos += egptr() - eback();
+				}
+
+				return seekpos(pos_type(pos), which);
+			}
+
+			pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+			{
+				const off_type n = static_cast<off_type>(pos);
+				if((which&std::ios_base::in) == 0 || n < 0 || n > egptr() - eback()) {
+					return pos_type(off_type(-1));
+				}
+
+				setg(eback(), eback() + n, egptr());
+				return pos;
+			}
+		private:
+			PackArchivePtr pack_;
+		};
+
+		class PackEntryStream : public std::istream
+		{
+		public:
+			PackEntryStream(PackArchivePtr pack, const char* data, size_t size) : std::istream(nullptr), buf_(pack, data, size)
+			{
+				rdbuf(&buf_);
+			}
+		private:
+			PackEntryBuf buf_;
+		};
+
+		threading::mutex& vfs_mutex()
+		{
+			static threading::mutex* m = new threading::mutex;
+			return *m;
+		}
+
+		std::vector<Mount>& mounts()
+		{
+			static std::vector<Mount>* instance = new std::vector<Mount>;
+			return *instance;
+		}
+
+		std::atomic<bool> g_have_mounts(false);
+
+		//the directories mount_dir() has looked at, mapped to their absolute
+		//paths.
+		std::map<std::string, std::string>& checked_dirs()
+		{
+			static std::map<std::string, std::string>* instance = new std::map<std::string, std::string>;
+			return *instance;
+		}
+
+		//indexes keyed by root + top.
+		std::map<std::string, DirIndexPtr>& indexes()
+		{
+			static std::map<std::string, DirIndexPtr>* instance = new std::map<std::string, DirIndexPtr>;
+			return *instance;
+		}
+
+		std::string normalize_dir(const std::string& dir)
+		{
+			if(dir.empty() || dir.back() == '/') {
+				return dir;
+			}
+
+			return dir + "/";
+		}
+
+		void mount_dir_locked(const std::string& passed_dir)
+		{
+			const std::string dir = normalize_dir(passed_dir);
+			if(checked_dirs().count(dir)) {
+				return;
+			}
+
+			checked_dirs()[dir] = absolute_path(dir, true);
+
+			const std::string fname = dir + PackFileName;
+			boost::system::error_code ec;
+			if(!boost::filesystem::is_regular_file(boost::filesystem::path(fname), ec)) {
+				return;
+			}
+
+			PackArchivePtr pack = PackArchive::open(fname);
+			if(!pack) {
+				LOG_ERROR("Could not open pack " << fname);
+				return;
+			}
+
+			Mount m;
+			m.dir = dir;
+			m.abs_dir = checked_dirs()[dir];
+			m.pack = pack;
+			mounts().push_back(m);
+			g_have_mounts = true;
+
+			LOG_INFO("Mounted " << fname << ": " << pack->paths().size() << " files");
+		}
+
+		//finds the mount holding fname, if any, and the path of fname within
+		//the pack.
+		const Mount* find_mount(const std::string& fname, std::string* rel)
+		{
+			const bool absolute = sys::is_path_absolute(fname);
+			for(const Mount& m : mounts()) {
+				const std::string& dir = absolute ? m.abs_dir : m.dir;
+				if(starts_with(fname, dir)) {
+					std::string::size_type begin = dir.size();
+					while(begin < fname.size() && fname[begin] == '/') {
+						++begin;
+					}
+
+					*rel = fname.substr(begin);
+					if(m.pack->find(*rel)) {
+						return &m;
+					}
+				}
+			}
+
+			return nullptr;
+		}
+
+		//calls fn for every mount which covers dir, with the path of dir within
+		//the mount, ending in a / unless it's the whole mount.
+		void for_each_mount_over(const std::string& passed_dir, std::function<void(const Mount&, const std::string&)> fn)
+		{
+			const std::string dir = normalize_dir(passed_dir);
+			const bool absolute = sys::is_path_absolute(dir);
+			for(const Mount& m : mounts()) {
+				const std::string& mdir = absolute ? m.abs_dir : m.dir;
+				if(starts_with(dir, mdir)) {
+					fn(m, dir.substr(mdir.size()));
+				}
+			}
+		}
+
+		void drop_index(std::map<std::string, DirIndexPtr>::iterator i)
+		{
+			for(int handle : i->second->watches) {
+				sys::remove_notify_on_file_modification(handle);
+			}
+
+			indexes().erase(i);
+		}
+
+		void invalidate_index(const std::string& key)
+		{
+			threading::lock l(vfs_mutex());
+			auto i = indexes().find(key);
+			if(i != indexes().end()) {
+				LOG_DEBUG("Directory changed, dropping file index of " << key);
+				drop_index(i);
+			}
+		}
+
+		void watch_dir(DirIndex& idx, const std::string& dir)
+		{
+			if(g_vfs_watch_dirs) {
+				const std::string key = idx.root + idx.top;
+				idx.watches.push_back(sys::notify_on_file_modification(dir, [key]() { invalidate_index(key); }));
+			}
+		}
+
+		DirIndexPtr build_index(const std::string& root, const std::string& top)
+		{
+			namespace fs = boost::filesystem;
+
+			const int begin_time = profile::get_tick_time();
+
+			mount_dir_locked(root);
+
+			DirIndexPtr idx(new DirIndex);
+			idx->root = root;
+			idx->top = top;
+			idx->abs_root = absolute_path(root, true);
+			idx->abs_dir = absolute_path(root + top, true);
+
+			boost::system::error_code ec;
+			if(top.empty()) {
+				const std::string dir = root.empty() ? "." : root;
+				if(fs::is_directory(fs::path(dir), ec)) {
+					watch_dir(*idx, dir);
+					for(fs::directory_iterator i(fs::path(dir), ec), end; !ec && i != end; i.increment(ec)) {
+						if(fs::is_regular_file(i->path(), ec)) {
+							idx->files.insert(index_key(i->path().filename().generic_string()));
+						}
+					}
+				}
+			} else {
+				const std::string dir = root + top;
+				if(fs::is_directory(fs::path(dir), ec)) {
+					watch_dir(*idx, dir);
+					for(fs::recursive_directory_iterator i(fs::path(dir), fs::symlink_option::recurse, ec), end; !ec && i != end; i.increment(ec)) {
+						const std::string path = i->path().generic_string();
+						if(fs::is_directory(i->path(), ec)) {
+							watch_dir(*idx, path);
+						} else if(starts_with(path, root)) {
+							idx->files.insert(index_key(path.substr(root.size())));
+						}
+					}
+				}
+			}
+
+			if(ec) {
+				LOG_WARN("Could not index " << root << top << ": " << ec.message());
+				idx->complete = false;
+			}
+
+			const std::string prefix = top.empty() ? top : top + "/";
+			for(const Mount& m : mounts()) {
+				if(m.dir != normalize_dir(root)) {
+					continue;
+				}
+
+				const std::vector<std::string>& paths = m.pack->paths();
+				for(auto i = std::lower_bound(paths.begin(), paths.end(), prefix); i != paths.end() && starts_with(*i, prefix); ++i) {
+					if(!top.empty() || i->find('/') == std::string::npos) {
+						idx->files.insert(index_key(*i));
+					}
+				}
+			}
+
+			LOG_DEBUG("Indexed " << idx->files.size() << " files under " << root << top << ": " << (profile::get_tick_time() - begin_time) << "ms");
+			return idx;
+		}
+	}
+
+	PackArchive::PackArchive() : data_(nullptr), size_(0), mapped_(false)
+	{
+	}
+
+	PackArchive::~PackArchive()
+	{
+#ifdef VFS_USE_MMAP
+		if(mapped_) {
+			munmap(const_cast<char*>(data_), size_);
+		}
+#endif
+	}
+
+	PackArchivePtr PackArchive::open(const std::string& fname)
+	{
+		PackArchivePtr result(new PackArchive);
+
+#ifdef VFS_USE_MMAP
+		const int fd = ::open(fname.c_str(), O_RDONLY);
+		if(fd < 0) {
+			return PackArchivePtr();
+		}
+
+		struct stat st;
+		if(fstat(fd, &st) == 0 && st.st_size > 0) {
+			void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+			if(p != MAP_FAILED) {
+				result->data_ = static_cast<const char*>(p);
+				result->size_ = static_cast<size_t>(st.st_size);
+				result->mapped_ = true;
+			}
+		}
+
+		close(fd);
+
+		if(!result->mapped_) {
+			return PackArchivePtr();
+		}
+#else
+		std::ifstream file(fname.c_str(), std::ios_base::binary);
+		if(!file) {
+			return PackArchivePtr();
+		}
+
+		std::stringstream ss;
+		ss << file.rdbuf();
+		result->buffer_ = ss.str();
+		result->data_ = result->buffer_.data();
+		result->size_ = result->buffer_.size();
+#endif
+
+		if(!result->parseIndex()) {
+			return PackArchivePtr();
+		}
+
+		return result;
+	}
+
+	PackArchivePtr PackArchive::fromData(std::string data)
+	{
+		PackArchivePtr result(new PackArchive);
+		result->buffer_.swap(data);
+		result->data_ = result->buffer_.data();
+		result->size_ = result->buffer_.size();
+		if(!result->parseIndex()) {
+			return PackArchivePtr();
+		}
+
+		return result;
+	}
+
+	bool PackArchive::parseIndex()
+	{
+		if(size_ < PackHeaderSize || memcmp(data_, PackMagic, sizeof(PackMagic)) != 0 || get_u32(data_ + 8) != PackVersion) {
+			return false;
+		}
+
+		const uint32_t nentries = get_u32(data_ + 12);
+		const uint64_t index_offset = get_u64(data_ + 16);
+		const uint64_t index_size = get_u64(data_ + 24);
+		if(index_offset > size_ || index_size > size_ - index_offset) {
+			return false;
+		}
+
+		const char* p = data_ + index_offset;
+		const char* end = p + index_size;
+		for(uint32_t n = 0; n != nentries; ++n) {
+			if(end - p < 4) {
+				return false;
+			}
+
+			const uint32_t path_len = get_u32(p);
+			p += 4;
+			if(static_cast<uint64_t>(end - p) < static_cast<uint64_t>(path_len) + 20) {
+				return false;
+			}
+
+			std::string path(p, p + path_len);
+			p += path_len;
+
+			Entry e;
+			e.offset = get_u64(p);
+			e.size = get_u32(p + 8);
+			e.stored_size = get_u32(p + 12);
+			e.flags = get_u32(p + 16);
+			p += 20;
+
+			if(e.offset > size_ || e.stored_size > size_ - e.offset) {
+				return false;
+			}
+
+			if((e.flags&ENTRY_COMPRESSED) == 0 && e.size != e.stored_size) {
+				return false;
+			}
+
+			entries_[path] = e;
+			paths_.push_back(path);
+		}
+
+		std::sort(paths_.begin(), paths_.end());
+		return true;
+	}
+
+	const PackArchive::Entry* PackArchive::find(const std::string& path) const
+	{
+		auto i = entries_.find(path);
+		if(i == entries_.end()) {
+			return nullptr;
+		}
+
+		return &i->second;
+	}
+
+	const char* PackArchive::mappedData(const Entry& e) const
+	{
+		if(e.flags&ENTRY_COMPRESSED) {
+			return nullptr;
+		}
+
+		return data_ + e.offset;
+	}
+
+	std::string PackArchive::read(const Entry& e) const
+	{
+		if((e.flags&ENTRY_COMPRESSED) == 0) {
+			return std::string(data_ + e.offset, e.size);
+		}
+
+		std::string result(e.size, '\0');
+		uLongf len = static_cast<uLongf>(e.size);
+		const int res = uncompress(reinterpret_cast<Bytef*>(&result[0]), &len, reinterpret_cast<const Bytef*>(data_ + e.offset), static_cast<uLong>(e.stored_size));
+		ASSERT_LOG(res == Z_OK && len == e.size, "Corrupt pack entry at offset " << e.offset << ": zlib result " << res);
+		return result;
+	}
+
+	uint64_t write_pack(std::ostream& out, const std::vector<std::string>& passed_paths, std::function<std::string(const std::string&)> read_fn, const PackOptions& options)
+	{
+		std::vector<std::string> paths = passed_paths;
+		std::sort(paths.begin(), paths.end());
+		paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+		uint64_t pos = PackHeaderSize;
+		out.write(std::string(PackHeaderSize, '\0').data(), PackHeaderSize);
+
+		std::string index;
+		for(const std::string& path : paths) {
+			const std::string contents = read_fn(path);
+			ASSERT_LOG(contents.size() < 0xFFFFFFFFu, "File too large to pack: " << path);
+
+			PackArchive::Entry e;
+			e.size = e.stored_size = static_cast<uint32_t>(contents.size());
+			e.flags = 0;
+
+			std::vector<char> compressed;
+			if(!options.store_all && contents.size() >= MinCompressSize) {
+				compressed = zip::compress(std::vector<char>(contents.begin(), contents.end()), options.compression_level);
+
+				//only keep the compressed version if it saves something
+				//worthwhile, otherwise the entry is better off mappable.
+				if(compressed.size() < contents.size() - contents.size()/8) {
+					e.flags |= PackArchive::ENTRY_COMPRESSED;
+					e.stored_size = static_cast<uint32_t>(compressed.size());
+				}
+			}
+
+			if((e.flags&PackArchive::ENTRY_COMPRESSED) == 0 && pos%PackPageSize != 0) {
+				const uint64_t padding = PackPageSize - pos%PackPageSize;
+				out.write(std::string(static_cast<size_t>(padding), '\0').data(), padding);
+				pos += padding;
+			}
+
+			e.offset = pos;
+			if(e.flags&PackArchive::ENTRY_COMPRESSED) {
+				out.write(&compressed[0], compressed.size());
+			} else {
+				out.write(contents.data(), contents.size());
+			}
+
+			pos += e.stored_size;
+
+			put_u32(index, static_cast<uint32_t>(path.size()));
+			index += path;
+			put_u64(index, e.offset);
+			put_u32(index, e.size);
+			put_u32(index, e.stored_size);
+			put_u32(index, e.flags);
+		}
+
+		const uint64_t index_offset = pos;
+		out.write(index.data(), index.size());
+		pos += index.size();
+
+		std::string header(PackMagic, PackMagic + sizeof(PackMagic));
+		put_u32(header, PackVersion);
+		put_u32(header, static_cast<uint32_t>(paths.size()));
+		put_u64(header, index_offset);
+		put_u64(header, index.size());
+		out.seekp(0);
+		out.write(header.data(), header.size());
+		out.seekp(0, std::ios_base::end);
+
+		return pos;
+	}
+
+	void mount_dir(const std::string& dir)
+	{
+		threading::lock l(vfs_mutex());
+		mount_dir_locked(dir);
+	}
+
+	bool read_mounted_file(const std::string& fname, std::string* contents)
+	{
+		if(!g_have_mounts) {
+			return false;
+		}
+
+		PackArchivePtr pack;
+		const PackArchive::Entry* entry = nullptr;
+		{
+			threading::lock l(vfs_mutex());
+			std::string rel;
+			const Mount* m = find_mount(fname, &rel);
+			if(m == nullptr) {
+				return false;
+			}
+
+			pack = m->pack;
+			entry = pack->find(rel);
+		}
+
+		*contents = pack->read(*entry);
+		return true;
+	}
+
+	std::unique_ptr<std::istream> open_mounted_file(const std::string& fname)
+	{
+		if(!g_have_mounts) {
+			return std::unique_ptr<std::istream>();
+		}
+
+		threading::lock l(vfs_mutex());
+		std::string rel;
+		const Mount* m = find_mount(fname, &rel);
+		if(m == nullptr) {
+			return std::unique_ptr<std::istream>();
+		}
+
+		const PackArchive::Entry* entry = m->pack->find(rel);
+		const char* data = m->pack->mappedData(*entry);
+		if(data == nullptr) {
+			return std::unique_ptr<std::istream>();
+		}
+
+		return std::unique_ptr<std::istream>(new PackEntryStream(m->pack, data, entry->size));
+	}
+
+	bool mounted_file_exists(const std::string& fname)
+	{
+		if(!g_have_mounts) {
+			return false;
+		}
+
+		threading::lock l(vfs_mutex());
+		std::string rel;
+		return find_mount(fname, &rel) != nullptr;
+	}
+
+	void get_mounted_files_in_dir(const std::string& dir, std::vector<std::string>* files, std::vector<std::string>* dirs)
+	{
+		if(!g_have_mounts) {
+			return;
+		}
+
+		threading::lock l(vfs_mutex());
+		for_each_mount_over(dir, [files, dirs](const Mount& m, const std::string& prefix) {
+			const std::vector<std::string>& paths = m.pack->paths();
+			for(auto i = std::lower_bound(paths.begin(), paths.end(), prefix); i != paths.end() && starts_with(*i, prefix); ++i) {
+				const std::string::size_type slash = i->find('/', prefix.size());
+				if(slash == std::string::npos) {
+					if(files) {
+						files->push_back(i->substr(prefix.size()));
+					}
+				} else if(dirs) {
+					std::string d = i->substr(prefix.size(), slash - prefix.size());
+					if(dirs->empty() || dirs->back() != d) {
+						dirs->push_back(d);
+					}
+				}
+			}
+		});
+	}
+
+	void get_mounted_files_under_dir(const std::string& dir, std::function<void(const std::string& fname, const std::string& full_path)> fn)
+	{
+		if(!g_have_mounts) {
+			return;
+		}
+
+		std::vector<std::pair<std::string, std::string>> results;
+		{
+			threading::lock l(vfs_mutex());
+			const bool absolute = sys::is_path_absolute(dir);
+			for_each_mount_over(dir, [&results, absolute](const Mount& m, const std::string& prefix) {
+				const std::vector<std::string>& paths = m.pack->paths();
+				for(auto i = std::lower_bound(paths.begin(), paths.end(), prefix); i != paths.end() && starts_with(*i, prefix); ++i) {
+					const std::string::size_type slash = i->rfind('/');
+					results.push_back(std::make_pair(slash == std::string::npos ? *i : i->substr(slash+1), (absolute ? m.abs_dir : m.dir) + *i));
+				}
+			});
+		}
+
+		//called without the lock held, so fn may use the file system.
+		for(const auto& p : results) {
+			fn(p.first, p.second);
+		}
+	}
+
+	IndexResult find_indexed_file(const std::string& root, const std::string& rel_path)
+	{
+#ifdef HAVE_CONFIG_H
+		//installed builds may have data split between the working directory
+		//and DATADIR, which sys::find_file() knows how to search.
+		return IndexResult::UNINDEXED;
+#else
+		if(!is_indexable(rel_path)) {
+			return IndexResult::UNINDEXED;
+		}
+
+		const std::string::size_type slash = rel_path.find('/');
+		const std::string top = slash == std::string::npos ? std::string() : rel_path.substr(0, slash);
+
+		threading::lock l(vfs_mutex());
+		DirIndexPtr& idx = indexes()[root + top];
+		if(!idx) {
+			idx = build_index(root, top);
+		}
+
+		if(!idx->complete) {
+			return IndexResult::UNINDEXED;
+		}
+
+		return idx->files.count(index_key(rel_path)) ? IndexResult::FOUND : IndexResult::NOT_FOUND;
+#endif
+	}
+
+	void note_file_written(const std::string& path)
+	{
+		const std::string::size_type slash = path.rfind('/');
+		if(path.compare(slash == std::string::npos ? 0 : slash+1, std::string::npos, PackFileName) == 0) {
+			//a new pack has to be mounted, which means starting over.
+			invalidate_path(slash == std::string::npos ? std::string() : path.substr(0, slash+1));
+			return;
+		}
+
+		threading::lock l(vfs_mutex());
+		if(indexes().empty()) {
+			return;
+		}
+
+		const std::string abs_path = index_key(absolute_path(path, false));
+		for(auto& i : indexes()) {
+			DirIndex& idx = *i.second;
+			if(!starts_with(abs_path, index_key(idx.abs_dir))) {
+				continue;
+			}
+
+			const std::string rel = abs_path.substr(idx.abs_root.size());
+			if(!idx.top.empty() || rel.find('/') == std::string::npos) {
+				idx.files.insert(rel);
+			}
+		}
+	}
+
+	bool index_misses_are_final()
+	{
+		return g_vfs_watch_dirs;
+	}
+
+	void invalidate_path(const std::string& path)
+	{
+		threading::lock l(vfs_mutex());
+		if(indexes().empty() && checked_dirs().empty()) {
+			return;
+		}
+
+		const std::string abs_path = absolute_path(path, false);
+		const std::string abs_dir = absolute_path(path, true);
+
+		//drop any index holding the path, or held under it.
+		for(auto i = indexes().begin(); i != indexes().end(); ) {
+			if(starts_with(abs_path, i->second->abs_dir) || starts_with(i->second->abs_dir, abs_dir)) {
+				drop_index(i++);
+			} else {
+				++i;
+			}
+		}
+
+		//unmount any pack that was removed or replaced.
+		for(auto i = checked_dirs().begin(); i != checked_dirs().end(); ) {
+			if(abs_path == i->second + PackFileName || starts_with(i->second, abs_dir)) {
+				const std::string dir = i->first;
+				auto m = std::remove_if(mounts().begin(), mounts().end(), [&dir](const Mount& m) { return m.dir == dir; });
+				mounts().erase(m, mounts().end());
+				checked_dirs().erase(i++);
+			} else {
+				++i;
+			}
+		}
+
+		g_have_mounts = mounts().empty() == false;
+	}
+}
+
+UNIT_TEST(vfs_pack)
+{
+	std::map<std::string, std::string> files;
+	files["top.cfg"] = "{}";
+	files["empty.txt"] = "";
+	files["data/level.cfg"] = std::string(5000, 'x');
+
+	//a file which won't compress, so it gets stored.
+	std::string noise;
+	uint32_t seed = 1;
+	for(int n = 0; n != 10000; ++n) {
+		seed = seed*1103515245 + 12345;
+		noise.push_back(static_cast<char>(seed >> 16));
+	}
+	files["data/sub/noise.bin"] = noise;
+
+	std::vector<std::string> paths;
+	for(const auto& p : files) {
+		paths.push_back(p.first);
+	}
+
+	std::ostringstream s;
+	const uint64_t nbytes = vfs::write_pack(s, paths, [&files](const std::string& path) { return files[path]; });
+	CHECK_EQ(nbytes, s.str().size());
+
+	vfs::PackArchivePtr pack = vfs::PackArchive::fromData(s.str());
+	CHECK(pack, "Could not read back the pack");
+	CHECK_EQ(pack->paths().size(), files.size());
+
+	for(const auto& p : files) {
+		const vfs::PackArchive::Entry* e = pack->find(p.first);
+		CHECK(e != nullptr, "Missing pack entry " << p.first);
+		CHECK_EQ(pack->read(*e), p.second);
+	}
+
+	const vfs::PackArchive::Entry* compressed = pack->find("data/level.cfg");
+	CHECK(compressed->flags&vfs::PackArchive::ENTRY_COMPRESSED, "Compressible entry was stored");
+	CHECK(pack->mappedData(*compressed) == nullptr, "Compressed entry has mapped data");
+
+	const vfs::PackArchive::Entry* stored = pack->find("data/sub/noise.bin");
+	CHECK(pack->mappedData(*stored) != nullptr, "Stored entry has no mapped data");
+	CHECK_EQ(stored->offset%4096, 0);
+	CHECK_EQ(memcmp(pack->mappedData(*stored), noise.data(), noise.size()), 0);
+
+	CHECK(pack->find("data/missing.cfg") == nullptr, "Found a file which isn't in the pack");
+	CHECK(pack->find("data") == nullptr, "Found a directory as a file");
+
+	std::string truncated = s.str();
+	truncated.resize(truncated.size() - 1);
+	CHECK(!vfs::PackArchive::fromData(truncated), "Accepted a truncated pack");
+	CHECK(!vfs::PackArchive::fromData("not a pack"), "Accepted a non-pack");
+}
+
+//Builds the pack for a module directory, which may then be shipped in place
+//of the loose files. module.cfg, which is needed to find the module in the
+//first place, is always left out, as are images, sounds and other media
+//which are loaded straight from disk, unless --include-media is given.
+COMMAND_LINE_UTILITY(build_module_pack)
+{
+	namespace fs = boost::filesystem;
+
+	std::string dir, output;
+	vfs::PackOptions options;
+	bool include_media = false;
+
+	std::vector<std::string>::const_iterator it = args.begin();
+	while(it != args.end()) {
+		const std::string& arg = *it++;
+		if(arg == "--output" && it != args.end()) {
+			output = *it++;
+		} else if(arg == "--compression" && it != args.end()) {
+			options.compression_level = atoi(it++->c_str());
+		} else if(arg == "--store") {
+			options.store_all = true;
+		} else if(arg == "--include-media") {
+			include_media = true;
+		} else if(dir.empty()) {
+			dir = arg;
+		} else {
+			ASSERT_LOG(false, "Unrecognized argument to build_module_pack: " << arg);
+		}
+	}
+
+	if(dir.empty()) {
+		std::cerr << "build_module_pack usage: <module dir> [--output FILE] [--compression 0-9] [--store] [--include-media]\n";
+		return;
+	}
+
+	if(dir.back() != '/') {
+		dir += "/";
+	}
+
+	if(output.empty()) {
+		output = dir + vfs::PackFileName;
+	}
+
+	const char* media_extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".ogg", ".wav", ".mp3", ".ttf", ".otf", ".ivf", ".webm" };
+
+	std::vector<std::string> paths;
+	for(fs::recursive_directory_iterator i((fs::path(dir))), end; i != end; ++i) {
+		const std::string fname = i->path().filename().generic_string();
+		if(!fname.empty() && fname[0] == '.') {
+			if(fs::is_directory(i->path())) {
+				i.no_push();
+			}
+			continue;
+		}
+
+		if(!fs::is_regular_file(i->path())) {
+			continue;
+		}
+
+		const std::string path = i->path().generic_string().substr(dir.size());
+		if(path == "module.cfg" || fname == vfs::PackFileName) {
+			continue;
+		}
+
+		const std::string ext = i->path().extension().generic_string();
+		if(!include_media && std::find(std::begin(media_extensions), std::end(media_extensions), ext) != std::end(media_extensions)) {
+			continue;
+		}
+
+		paths.push_back(path);
+	}
+
+	std::ofstream out(output.c_str(), std::ios_base::binary);
+	ASSERT_LOG(out, "Could not open " << output << " for writing");
+
+	uint64_t input_bytes = 0;
+	const uint64_t nbytes = vfs::write_pack(out, paths, [&dir, &input_bytes](const std::string& path) {
+		std::string contents = sys::read_file(dir + path);
+		input_bytes += contents.size();
+		return contents;
+	}, options);
+
+	std::cout << "Packed " << paths.size() << " files, " << input_bytes << " bytes into " << output << ", " << nbytes << " bytes\n";
+}
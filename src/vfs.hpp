@@ -0,0 +1,148 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The virtual file system which sits under the sys:: file functions.
+//
+// It does two things. It keeps an index of the files found under each
+// module directory, so module::map_file() can resolve a path without
+// touching the disk. And it mounts pack archives over module directories,
+// so a module can be shipped as a handful of large files rather than tens
+// of thousands of small ones.
+namespace vfs
+{
+	//the name of the pack which, if found in a module directory, is mounted
+	//over that directory.
+	extern const char* const PackFileName;
+
+	//A read-only archive of files. Each entry is either compressed, or
+	//stored as-is at a page-aligned offset so it can be read straight out of
+	//the memory mapped archive without a copy.
+	class PackArchive
+	{
+	public:
+		enum { ENTRY_COMPRESSED = 1 };
+
+		struct Entry {
+			uint64_t offset;
+			uint32_t size;
+			uint32_t stored_size;
+			uint32_t flags;
+		};
+
+		//opens the pack in fname, memory mapping it where the platform
+		//allows. Returns nullptr if the file isn't a valid pack.
+		static std::shared_ptr<PackArchive> open(const std::string& fname);
+
+		//a pack held in memory rather than a file.
+		static std::shared_ptr<PackArchive> fromData(std::string data);
+
+		~PackArchive();
+
+		const Entry* find(const std::string& path) const;
+
+		//the contents of an uncompressed entry in place in the archive, or
+		//nullptr if the entry is compressed.
+		const char* mappedData(const Entry& e) const;
+
+		std::string read(const Entry& e) const;
+
+		//every path in the pack, sorted.
+		const std::vector<std::string>& paths() const { return paths_; }
+	private:
+		PackArchive();
+		PackArchive(const PackArchive&);
+		void operator=(const PackArchive&);
+
+		bool parseIndex();
+
+		const char* data_;
+		size_t size_;
+		bool mapped_;
+		std::string buffer_;
+
+		std::unordered_map<std::string, Entry> entries_;
+		std::vector<std::string> paths_;
+	};
+
+	typedef std::shared_ptr<PackArchive> PackArchivePtr;
+
+	struct PackOptions 
+	{
+		PackOptions() : compression_level(-1), store_all(false) {}
+		int compression_level;
+
+		//if set nothing is compressed, so every entry can be mapped.
+		bool store_all;
+	};
+
+	//writes a pack holding the given paths, which are relative to the
+	//directory the pack will be mounted over, getting the contents of each
+	//path from read_fn. Returns the number of bytes written.
+	uint64_t write_pack(std::ostream& out, const std::vector<std::string>& paths, std::function<std::string(const std::string&)> read_fn, const PackOptions& options=PackOptions());
+
+	//mounts dir + PackFileName over dir if there is such a file. Mounting
+	//a directory which has already been looked at does nothing.
+	void mount_dir(const std::string& dir);
+
+	//used by the sys:: file functions to see the files in mounted packs.
+	//Files on disk always take precedence over packed ones, so these are
+	//only consulted once the disk has come up empty.
+	bool read_mounted_file(const std::string& fname, std::string* contents);
+	bool mounted_file_exists(const std::string& fname);
+	void get_mounted_files_in_dir(const std::string& dir, std::vector<std::string>* files, std::vector<std::string>* dirs);
+	void get_mounted_files_under_dir(const std::string& dir, std::function<void(const std::string& fname, const std::string& full_path)> fn);
+
+	//a stream reading a stored entry straight out of the mapped pack, with
+	//no copy made. Returns nullptr if fname isn't in a mounted pack, or if
+	//its entry is compressed.
+	std::unique_ptr<std::istream> open_mounted_file(const std::string& fname);
+
+	enum class IndexResult { FOUND, NOT_FOUND, UNINDEXED };
+
+	//looks up root + rel_path in the index of files under root, which is
+	//built per top level directory of root the first time one of its
+	//files is looked up. UNINDEXED means the index can't answer for a path
+	//of this form and the caller should look on disk. Lookups ignore case
+	//on Windows.
+	IndexResult find_indexed_file(const std::string& root, const std::string& rel_path);
+
+	//whether NOT_FOUND can be trusted. It can only when the indexed
+	//directories are watched, since otherwise files written without going
+	//through sys::, or by another process, aren't in the index until they
+	//are noted.
+	bool index_misses_are_final();
+
+	//keep the index up to date with changes made through sys::.
+	void note_file_written(const std::string& path);
+	void invalidate_path(const std::string& path);
+}
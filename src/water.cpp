@@ -21,6 +21,7 @@
 	   distribution.
 */
 
+#include <algorithm>
 #include <iostream>
 #include <math.h>
 
@@ -40,11 +41,107 @@
 namespace 
 {
 	const int WaterZorder = 15;
+
+	//the water is drawn as columns this many pixels wide, so its surface
+	//can follow the waves.
+	const int WaveStep = 4;
+
+	//waves move anything drawn within this many pixels of the surface.
+	const int SurfaceDepth = 4;
+
+	//how many waves, over all areas, the water shader can draw.
+	const int MaxGpuWaves = 32;
+
+	const double WaveDecay = 0.996;
+
+	PREF_BOOL(water_gpu_waves, true, "Move the waves on the surface of water in a shader, rather than rebuilding the surface every frame while waves are present.");
+
+	//moves vertices at the surface of the water by the waves passed in as
+	//uniforms, using the same formulas as Water::wave.
+	const char* const water_vs =
+		"uniform mat4 u_mvp_matrix;\n"
+		"uniform float u_cycle;\n"
+		"uniform int u_num_waves;\n"
+		"uniform vec4 u_wave_motion[32];\n" //xpos, xvelocity, left_bound, right_bound
+		"uniform vec4 u_wave_shape[32];\n" //height, length, delta_length, start_cycle
+		"uniform float u_wave_y[32];\n" //the surface the wave is on
+		"attribute vec2 a_position;\n"
+		"attribute vec4 a_color;\n"
+		"varying vec4 v_color;\n"
+		"void main()\n"
+		"{\n"
+		"    vec2 pos = a_position;\n"
+		"    for(int n = 0; n < 32; ++n) {\n"
+		"        if(n >= u_num_waves) {\n"
+		"            break;\n"
+		"        }\n"
+		"        vec4 m = u_wave_motion[n];\n"
+		"        vec4 s = u_wave_shape[n];\n"
+		"        float depth = a_position.y - u_wave_y[n];\n"
+		"        if(depth < 0.0 || depth > 4.0 || a_position.x < m.z || a_position.x > m.w) {\n"
+		"            continue;\n"
+		"        }\n"
+		"        float t = u_cycle - s.w;\n"
+		"        float width = max(m.w - m.z, 1.0);\n"
+		"        float p = mod(m.x - m.z + m.y*t, width*2.0);\n"
+		"        float xpos = m.z + (p <= width ? p : width*2.0 - p);\n"
+		"        float len = s.y + s.z*t;\n"
+		"        float d = abs(a_position.x - xpos);\n"
+		"        if(len > 0.0 && d < len) {\n"
+		"            pos.y -= s.x*pow(0.996, t)*0.5*(1.0 + cos(3.14159265*d/len));\n"
+		"        }\n"
+		"    }\n"
+		"    v_color = a_color;\n"
+		"    gl_Position = u_mvp_matrix * vec4(pos,0.0,1.0);\n"
+		"}\n";
+
+	const char* const water_fs =
+		"#ifdef GL_ES\n"
+		"precision mediump float;\n"
+		"#endif\n"
+		"uniform vec4 u_color;\n"
+		"varying vec4 v_color;\n"
+		"void main()\n"
+		"{\n"
+		"    gl_FragColor = v_color * u_color;\n"
+		"}\n";
+
+	KRE::ShaderProgramPtr get_water_shader()
+	{
+		static KRE::ShaderProgramPtr shader;
+		if(!shader) {
+			std::vector<KRE::ShaderData> shader_data;
+			shader_data.emplace_back(KRE::ProgramType::VERTEX, water_vs);
+			shader_data.emplace_back(KRE::ProgramType::FRAGMENT, water_fs);
+
+			std::vector<KRE::ActiveMapping> uniform_map;
+			uniform_map.emplace_back("mvp_matrix", "u_mvp_matrix");
+			uniform_map.emplace_back("color", "u_color");
+
+			std::vector<KRE::ActiveMapping> attribute_map;
+			attribute_map.emplace_back("position", "a_position");
+			attribute_map.emplace_back("color", "a_color");
+
+			shader = KRE::ShaderProgram::createShader("water_surface", shader_data, uniform_map, attribute_map);
+		}
+
+		return shader;
+	}
 }
 
 Water::Water()
   : KRE::SceneObject("water"),
-    zorder_(WaterZorder)
+    zorder_(WaterZorder),
+	cycle_(0),
+	gpu_waves_(false),
+	areas_dirty_(true),
+	waves_dirty_(true),
+	num_gpu_waves_(0),
+	u_cycle_(-1),
+	u_num_waves_(-1),
+	u_wave_motion_(-1),
+	u_wave_shape_(-1),
+	u_wave_y_(-1)
 {
 	init();
 }
@@ -52,6 +149,16 @@ Water::Water()
 Water::Water(variant water_node) 
 	: KRE::SceneObject("water"),
 	zorder_(parse_zorder(water_node["zorder"], variant("water"))),
+	cycle_(0),
+	gpu_waves_(false),
+	areas_dirty_(true),
+	waves_dirty_(true),
+	num_gpu_waves_(0),
+	u_cycle_(-1),
+	u_num_waves_(-1),
+	u_wave_motion_(-1),
+	u_wave_shape_(-1),
+	u_wave_y_(-1),
 	current_x_formula_(game_logic::Formula::createOptionalFormula(water_node["current_x_formula"])),
 	current_y_formula_(game_logic::Formula::createOptionalFormula(water_node["current_y_formula"]))
 {
@@ -72,7 +179,18 @@ void Water::init()
 {
 	using namespace KRE;
 
-	setShader(ShaderProgram::getProgram("attr_color_shader"));
+	gpu_waves_ = g_water_gpu_waves;
+	if(gpu_waves_) {
+		setShader(get_water_shader()->clone());
+		getShader()->setUniformDrawFunction(std::bind(&Water::setWaveUniforms, this));
+		u_cycle_ = getShader()->getUniform("u_cycle");
+		u_num_waves_ = getShader()->getUniform("u_num_waves");
+		u_wave_motion_ = getShader()->getUniform("u_wave_motion");
+		u_wave_shape_ = getShader()->getUniform("u_wave_shape");
+		u_wave_y_ = getShader()->getUniform("u_wave_y");
+	} else {
+		setShader(ShaderProgram::getProgram("attr_color_shader"));
+	}
 	auto ab = DisplayDevice::createAttributeSet(true);
 	waterline_.reset(new Attribute<vertex_color>(AccessFreqHint::DYNAMIC, AccessTypeHint::DRAW));
 	waterline_->addAttributeDesc(AttributeDesc(AttrType::POSITION, 2, AttrFormat::FLOAT, false, sizeof(vertex_color), offsetof(vertex_color, vertex)));
@@ -91,7 +209,7 @@ void Water::init()
 	line1_->addAttributeDesc(AttributeDesc(AttrType::POSITION, 2, AttrFormat::FLOAT, false, sizeof(vertex_color), offsetof(vertex_color, vertex)));
 	line1_->addAttributeDesc(AttributeDesc(AttrType::COLOR, 4, AttrFormat::UNSIGNED_BYTE, true, sizeof(vertex_color), offsetof(vertex_color, color)));
 	seg1->addAttribute(AttributeBasePtr(line1_));
-	seg1->setDrawMode(DrawMode::LINE_STRIP);
+	seg1->setDrawMode(DrawMode::LINES);
 	addAttributeSet(seg1);
 
 	auto seg2 = DisplayDevice::createAttributeSet(true);
@@ -99,7 +217,7 @@ void Water::init()
 	line2_->addAttributeDesc(AttributeDesc(AttrType::POSITION, 2, AttrFormat::FLOAT, false, sizeof(vertex_color), offsetof(vertex_color, vertex)));
 	line2_->addAttributeDesc(AttributeDesc(AttrType::COLOR, 4, AttrFormat::UNSIGNED_BYTE, true, sizeof(vertex_color), offsetof(vertex_color, color)));
 	seg2->addAttribute(AttributeBasePtr(line2_));
-	seg2->setDrawMode(DrawMode::LINE_STRIP);
+	seg2->setDrawMode(DrawMode::LINES);
 	seg2->setColor(Color(0.0f, 0.9f, 0.75f, 0.5f));
 	addAttributeSet(seg2);
 }
@@ -124,6 +242,7 @@ void Water::addRect(const rect& r, const KRE::Color& color, variant obj)
 {
 	LOG_INFO("ADD WATER: " << r);
 	areas_.emplace_back(r, color, obj);
+	areas_dirty_ = true;
 }
 
 void Water::deleteRect(const rect& r)
@@ -131,6 +250,7 @@ void Water::deleteRect(const rect& r)
 	for(std::vector<area>::iterator i = areas_.begin(); i != areas_.end(); ) {
 		if(r == i->rect_) {
 			i = areas_.erase(i);
+			areas_dirty_ = waves_dirty_ = true;
 		} else {
 			++i;
 		}
@@ -149,8 +269,25 @@ void Water::addWave(const point& p, double xvelocity, double height, double leng
 					break;
 				}
 			}
-			wave wv = { (double)p.x, xvelocity, height, length, delta_height, delta_length, bounds.first, bounds.second };
+			wave wv = { (double)p.x, xvelocity, height, length, delta_height, delta_length, bounds.first, bounds.second, cycle_, cycle_ };
+
+			//work out when the wave will have died away: when it has
+			//decayed to half a pixel high, or shrunk to nothing.
+			int lifetime = height > 0.5 ? static_cast<int>(ceil(log(0.5/height)/log(WaveDecay))) : 0;
+
+			if(length <= 0) {
+				lifetime = 0;
+			} else if(delta_length < 0) {
+				lifetime = std::min(lifetime, static_cast<int>(ceil(-length/delta_length)));
+			}
+
+			wv.end_cycle = cycle_ + lifetime;
 			a.waves_.push_back(wv);
+
+			waves_dirty_ = true;
+			if(!gpu_waves_) {
+				a.dirty_ = true;
+			}
 			return;
 		}
 	}
@@ -158,53 +295,199 @@ void Water::addWave(const point& p, double xvelocity, double height, double leng
 
 void Water::preRender(const KRE::WindowPtr& wm) const
 {
-	std::vector<KRE::vertex_color> water_rect;
-	std::vector<KRE::vertex_color> line1;
-	std::vector<KRE::vertex_color> line2;
-
+	//only areas which have changed are rebuilt, and the buffers are only
+	//uploaded again if one has.
+	bool rebuild = areas_dirty_;
 	for(const area& a : areas_) {
-		drawArea(a, &water_rect, &line1, &line2);
+		if(a.dirty_) {
+			a.water_rect_.clear();
+			a.line1_.clear();
+			a.line2_.clear();
+			drawArea(a, gpu_waves_ ? -1 : cycle_, &a.water_rect_, &a.line1_, &a.line2_);
+			a.dirty_ = false;
+			rebuild = true;
+		}
+	}
+
+	if(rebuild) {
+		std::vector<KRE::vertex_color> water_rect;
+		std::vector<KRE::vertex_color> line1;
+		std::vector<KRE::vertex_color> line2;
+
+		for(const area& a : areas_) {
+			water_rect.insert(water_rect.end(), a.water_rect_.begin(), a.water_rect_.end());
+			line1.insert(line1.end(), a.line1_.begin(), a.line1_.end());
+			line2.insert(line2.end(), a.line2_.begin(), a.line2_.end());
+		}
+
+		waterline_->update(&water_rect);
+		line1_->update(&line1);
+		line2_->update(&line2);
+		areas_dirty_ = false;
 	}
 
-	waterline_->update(&water_rect);
-	line1_->update(&line1);
-	line2_->update(&line2);
+	if(gpu_waves_ && waves_dirty_) {
+		wave_motion_.clear();
+		wave_shape_.clear();
+		wave_y_.clear();
+		num_gpu_waves_ = 0;
+		for(const area& a : areas_) {
+			for(const wave& w : a.waves_) {
+				if(num_gpu_waves_ == MaxGpuWaves) {
+					break;
+				}
+
+				wave_motion_.push_back(static_cast<float>(w.xpos));
+				wave_motion_.push_back(static_cast<float>(w.xvelocity));
+				wave_motion_.push_back(static_cast<float>(w.left_bound));
+				wave_motion_.push_back(static_cast<float>(w.right_bound));
+				wave_shape_.push_back(static_cast<float>(w.height));
+				wave_shape_.push_back(static_cast<float>(w.length));
+				wave_shape_.push_back(static_cast<float>(w.delta_length));
+				wave_shape_.push_back(static_cast<float>(w.start_cycle));
+				wave_y_.push_back(static_cast<float>(a.rect_.y()));
+				++num_gpu_waves_;
+			}
+		}
+
+		//the uniforms are always set in full.
+		wave_motion_.resize(MaxGpuWaves*4);
+		wave_shape_.resize(MaxGpuWaves*4);
+		wave_y_.resize(MaxGpuWaves);
+		waves_dirty_ = false;
+	}
 }
 
-bool Water::drawArea(const Water::area& a, std::vector<KRE::vertex_color>* water_rect, std::vector<KRE::vertex_color>* line1, std::vector<KRE::vertex_color>* line2) const
+void Water::setWaveUniforms() const
 {
-	return true;
+	getShader()->setUniformValue(u_cycle_, static_cast<float>(cycle_));
+	getShader()->setUniformValue(u_num_waves_, num_gpu_waves_);
+	if(num_gpu_waves_ > 0) {
+		getShader()->setUniformValue(u_wave_motion_, &wave_motion_[0]);
+		getShader()->setUniformValue(u_wave_shape_, &wave_shape_[0]);
+		getShader()->setUniformValue(u_wave_y_, &wave_y_[0]);
+	}
+}
+
+void Water::drawArea(const Water::area& a, int waves_cycle, std::vector<KRE::vertex_color>* water_rect, std::vector<KRE::vertex_color>* line1, std::vector<KRE::vertex_color>* line2) const
+{
+	const glm::u8vec4 water_color = a.color_.as_u8vec4();
+	const glm::u8vec4 line_color(250, 240, 205, 255);
+	const glm::u8vec4 line2_color(255, 255, 255, 255);
+
+	auto surface = [&a, waves_cycle](int x) {
+		double y = a.rect_.y();
+		if(waves_cycle >= 0) {
+			for(const wave& w : a.waves_) {
+				y -= w.offsetAt(waves_cycle, x);
+			}
+		}
+		return static_cast<float>(y);
+	};
+
+	const float bottom = static_cast<float>(a.rect_.y2());
+	for(int x = a.rect_.x(); x < a.rect_.x2(); x += WaveStep) {
+		const int next_x = std::min(x + WaveStep, a.rect_.x2());
+		const float x1 = static_cast<float>(x);
+		const float x2 = static_cast<float>(next_x);
+		const float y1 = surface(x);
+		const float y2 = surface(next_x);
+
+		water_rect->emplace_back(glm::vec2(x1, y1), water_color);
+		water_rect->emplace_back(glm::vec2(x2, y2), water_color);
+		water_rect->emplace_back(glm::vec2(x1, bottom), water_color);
+		water_rect->emplace_back(glm::vec2(x2, y2), water_color);
+		water_rect->emplace_back(glm::vec2(x2, bottom), water_color);
+		water_rect->emplace_back(glm::vec2(x1, bottom), water_color);
+	}
+
+	//the lines along the surface are only drawn where it isn't solid.
+	std::vector<std::pair<int, int>> segments = a.surface_segments_;
+	if(segments.empty()) {
+		segments.push_back(std::make_pair(a.rect_.x(), a.rect_.x2()));
+	}
+
+	for(const std::pair<int, int>& seg : segments) {
+		for(int x = seg.first; x < seg.second; x += WaveStep) {
+			const int next_x = std::min(x + WaveStep, seg.second);
+			const float x1 = static_cast<float>(x);
+			const float x2 = static_cast<float>(next_x);
+			const float y1 = surface(x);
+			const float y2 = surface(next_x);
+
+			line1->emplace_back(glm::vec2(x1, y1), line_color);
+			line1->emplace_back(glm::vec2(x2, y2), line_color);
+			line2->emplace_back(glm::vec2(x1, y1 + SurfaceDepth/2), line2_color);
+			line2->emplace_back(glm::vec2(x2, y2 + SurfaceDepth/2), line2_color);
+		}
+	}
 }
 
 void Water::process(const Level& lvl)
 {
+	++cycle_;
+
 	for(area& a : areas_) {
-		initAreaSurfaceSegments(lvl, a);
+		if(!a.surface_segments_init_) {
+			initAreaSurfaceSegments(lvl, a);
+			a.dirty_ = true;
+		}
 
-		for(wave& w : a.waves_) {
-			w.process();
+		const size_t nwaves = a.waves_.size();
+		const int cycle = cycle_;
+		a.waves_.erase(std::remove_if(a.waves_.begin(), a.waves_.end(), 
+			[cycle](const Water::wave& w){ return cycle >= w.end_cycle; }), 
+			a.waves_.end());
 
-			//if the wave has hit the edge, then turn it around.
-			if(w.xpos < w.left_bound && w.xvelocity < 0) {
-				w.xvelocity *= -1.0;
+		if(a.waves_.size() != nwaves) {
+			waves_dirty_ = true;
+			if(!gpu_waves_) {
+				a.dirty_ = true;
 			}
+		}
 
-			if(w.xpos > w.right_bound && w.xvelocity > 0) {
-				w.xvelocity *= -1.0;
-			}
+		//without the shader the surface has to be rebuilt as the waves move.
+		if(!gpu_waves_ && !a.waves_.empty()) {
+			a.dirty_ = true;
 		}
+	}
+}
 
-		a.waves_.erase(std::remove_if(a.waves_.begin(), a.waves_.end(), 
-			[](const Water::wave& w){ return w.height <= 0.5 || w.length <= 0; }), 
-			a.waves_.end());
+double Water::wave::xposAt(int cycle) const
+{
+	//the wave bounces back and forth between its bounds.
+	const double width = std::max(1, right_bound - left_bound);
+	double p = fmod(xpos - left_bound + xvelocity*(cycle - start_cycle), width*2);
+	if(p < 0) {
+		p += width*2;
 	}
+
+	return left_bound + (p <= width ? p : width*2 - p);
+}
+
+double Water::wave::heightAt(int cycle) const
+{
+	return height*pow(WaveDecay, cycle - start_cycle);
 }
 
-void Water::wave::process() 
+double Water::wave::lengthAt(int cycle) const
 {
-	xpos += xvelocity;
-	height *= 0.996;
-	length += delta_length;
+	return length + delta_length*(cycle - start_cycle);
+}
+
+double Water::wave::offsetAt(int cycle, double x) const
+{
+	if(x < left_bound || x > right_bound) {
+		return 0.0;
+	}
+
+	const double len = lengthAt(cycle);
+	const double d = std::abs(x - xposAt(cycle));
+	if(len <= 0.0 || d >= len) {
+		return 0.0;
+	}
+
+	return heightAt(cycle)*0.5*(1.0 + cos(M_PI*d/len));
 }
 
 void Water::getCurrent(const Entity& e, int* velocity_x, int* velocity_y) const
@@ -268,6 +551,7 @@ Water::area::area(const rect& r, const KRE::Color& color, variant obj)
 	: rect_(r), 
 	color_(color), 
 	surface_segments_init_(false), 
-	obj_(obj)
+	obj_(obj),
+	dirty_(true)
 {
 }
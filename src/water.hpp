@@ -56,6 +56,9 @@ public:
 
 	void addWave(const point& p, double xvelocity, double height, double length, double delta_height, double delta_length);
 
+	//A wave is described by its state when it was made, so where it is at
+	//any later cycle can be worked out directly, by the CPU or in the
+	//water shader, without stepping it each frame.
 	struct wave {
 		double xpos;
 		double xvelocity;
@@ -66,7 +69,17 @@ public:
 
 		int left_bound, right_bound;
 
-		void process();
+		int start_cycle;
+
+		//the cycle at which the wave has died away.
+		int end_cycle;
+
+		double xposAt(int cycle) const;
+		double heightAt(int cycle) const;
+		double lengthAt(int cycle) const;
+
+		//how far the surface at x is raised by the wave.
+		double offsetAt(int cycle, double x) const;
 	};
 	
 	void preRender(const KRE::WindowPtr& wm) const;
@@ -86,16 +99,40 @@ private:
 
 		KRE::Color color_;
 		variant obj_;
+
+		//the area's vertices, rebuilt only when dirty_ is set.
+		mutable std::vector<KRE::vertex_color> water_rect_, line1_, line2_;
+		mutable bool dirty_;
 	};
 
 	std::vector<area> areas_;
 
 	static void initAreaSurfaceSegments(const Level& lvl, area& a);
 
-	bool drawArea(const area& a, std::vector<KRE::vertex_color>* wr, std::vector<KRE::vertex_color>* l1, std::vector<KRE::vertex_color>* l2) const;
+	//builds the vertices for an area. waves_cycle is the cycle to place the
+	//waves at, or -1 to leave the surface flat for the shader to move.
+	void drawArea(const area& a, int waves_cycle, std::vector<KRE::vertex_color>* wr, std::vector<KRE::vertex_color>* l1, std::vector<KRE::vertex_color>* l2) const;
+
+	void setWaveUniforms() const;
 
 	int zorder_;
 
+	int cycle_;
+
+	//whether the waves are moved by the shader rather than by rebuilding
+	//the surface every frame.
+	bool gpu_waves_;
+
+	//set when an area is added or removed, so the buffers must be
+	//rebuilt, and when the set of waves changes, so the wave uniforms must
+	//be repacked.
+	mutable bool areas_dirty_, waves_dirty_;
+
+	mutable std::vector<float> wave_motion_, wave_shape_, wave_y_;
+	mutable int num_gpu_waves_;
+
+	int u_cycle_, u_num_waves_, u_wave_motion_, u_wave_shape_, u_wave_y_;
+
 	std::shared_ptr<KRE::Attribute<KRE::vertex_color>> waterline_;
 	std::shared_ptr<KRE::Attribute<KRE::vertex_color>> line1_;
 	std::shared_ptr<KRE::Attribute<KRE::vertex_color>> line2_;
@@ -23,8 +23,10 @@
 #include <functional>
 
 #include "Canvas.hpp"
-#include "WindowManager.hpp"
 #include "ClipScope.hpp"
+#include "ModelMatrixScope.hpp"
+#include "RenderTarget.hpp"
+#include "WindowManager.hpp"
 
 #include "asserts.hpp"
 #include "i18n.hpp"
@@ -38,6 +40,26 @@
 
 namespace gui 
 {
+	namespace
+	{
+		PREF_BOOL(retained_widgets, true, "Let widgets marked as retained cache their sub-tree in a render target between changes");
+
+		RetainedDrawStats& retained_draw_stats()
+		{
+			static RetainedDrawStats res;
+			return res;
+		}
+	}
+
+	RetainedDrawStats get_retained_draw_stats(bool reset)
+	{
+		RetainedDrawStats res = retained_draw_stats();
+		if(reset) {
+			retained_draw_stats() = RetainedDrawStats();
+		}
+		return res;
+	}
+
 	Widget::Widget() 
 		: x_(0), 
 		  y_(0), 
@@ -70,7 +92,10 @@ namespace gui
 		  scale_(1.0f),  
 		  position_(),
 		  color_(),
-		  draw_color_()
+		  draw_color_(),
+		  retained_(false),
+		  dirty_(true),
+		  mouse_inside_(false)
 		{
 		}
 
@@ -106,7 +131,10 @@ namespace gui
 		  scale_(1.0f), 
 		  position_(),
 		  color_(),
-		  draw_color_()
+		  draw_color_(),
+		  retained_(v["retained"].as_bool(false)),
+		  dirty_(true),
+		  mouse_inside_(false)
 	{
 		setAlpha(display_alpha_ < 0 ? 0 : (display_alpha_ > 256 ? 256 : display_alpha_));
 		if(v.has_key("width")) {
@@ -285,7 +313,12 @@ namespace gui
 
 	void Widget::process() {
 		handleProcess();
+		const KRE::Color old_color = draw_color_;
 		draw_color_.setAlpha(disabled() ? disabledOpacity() : getAlpha());
+		// on_process can change anything about the widget, so don't trust the cache.
+		if(on_process_ || draw_color_ != old_color) {
+			invalidate();
+		}
 	}
 
 	void Widget::normalizeEvent(SDL_Event* event, bool translate_coords)
@@ -362,27 +395,161 @@ namespace gui
 
 		const bool must_swallow = swallow_all_events_ && event.type != SDL_QUIT;
 
-		return handleEvent(event, claimed) || must_swallow;
+		const bool changes_appearance = eventChangesAppearance(event);
+		const bool res = handleEvent(event, claimed);
+		if(changes_appearance || res != claimed) {
+			invalidate();
+		}
+		return res || must_swallow;
+	}
+
+	bool Widget::eventChangesAppearance(const SDL_Event& event)
+	{
+		switch(event.type) {
+		case SDL_MOUSEMOTION: {
+			// Hover states only change when the pointer crosses the widget's edge,
+			// but dragging inside it (sliders, scrollbars) can change anything.
+			const bool inside = inWidget(event.motion.x, event.motion.y);
+			const bool crossed = inside != mouse_inside_;
+			mouse_inside_ = inside;
+			return crossed || (inside && event.motion.state != 0);
+		}
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP:
+			return mouse_inside_ || inWidget(event.button.x, event.button.y);
+		case SDL_MOUSEWHEEL:
+			return mouse_inside_;
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:
+		case SDL_TEXTINPUT:
+		case SDL_TEXTEDITING:
+			return hasFocus();
+		default:
+			return false;
+		}
 	}
 
 	void Widget::draw(int xt, int yt, float rotate, float scale) const
+	{
+		if(visible_) {
+			if(retained_ && g_retained_widgets) {
+				drawRetained(xt, yt, rotate, scale);
+			} else {
+				drawContents(xt, yt, rotate, scale);
+			}
+		}
+	}
+
+	void Widget::drawContents(int xt, int yt, float rotate, float scale) const
+	{
+		using namespace KRE;
+		ModelManager2D mm(xt, yt, rotate, scale);
+		Canvas::ColorManager cm(draw_color_);
+		if(frame_set_ != nullptr) {
+			frame_set_->blit(x() - getPadWidth() - frame_set_->cornerHeight(),
+				y() - getPadHeight() - frame_set_->cornerHeight(), 
+				width() + getPadWidth()*2 + 2*frame_set_->cornerHeight(), 
+				height() + getPadHeight()*2 + 2*frame_set_->cornerHeight(), resolution_ != 0);
+		}
+
+		if(clip_area_) {
+			ClipScope::Manager clip_scope(*clip_area_, Canvas::getInstance()->getCamera());
+			handleDraw();
+		} else {
+			handleDraw();
+		}
+	}
+
+	rect Widget::retainedArea() const
+	{
+		int border_w = 0, border_h = 0;
+		if(frame_set_ != nullptr) {
+			border_w = getPadWidth() + frame_set_->cornerHeight();
+			border_h = getPadHeight() + frame_set_->cornerHeight();
+		}
+		return rect(x() - border_w, y() - border_h, width() + border_w*2, height() + border_h*2);
+	}
+
+	void Widget::drawRetained(int xt, int yt, float rotate, float scale) const
 	{
 		using namespace KRE;
-		if(visible_) {			 
-			ModelManager2D mm(xt, yt, rotate, scale);
-			Canvas::ColorManager cm(draw_color_);
-			if(frame_set_ != nullptr) {
-				frame_set_->blit(x() - getPadWidth() - frame_set_->cornerHeight(),
-					y() - getPadHeight() - frame_set_->cornerHeight(), 
-					width() + getPadWidth()*2 + 2*frame_set_->cornerHeight(), 
-					height() + getPadHeight()*2 + 2*frame_set_->cornerHeight(), resolution_ != 0);
+		const rect area = retainedArea();
+		if(area.w() <= 0 || area.h() <= 0) {
+			drawContents(xt, yt, rotate, scale);
+			return;
+		}
+
+		RetainedCache& cache = retained_cache_;
+		if(cache.rt == nullptr || cache.area != area || isSubtreeDirty()) {
+			if(cache.rt == nullptr || cache.rt->width() != area.w() || cache.rt->height() != area.h()) {
+				cache.rt = RenderTarget::create(area.w(), area.h(), 1, false, true);
+				cache.rt->setClearColor(Color(0, 0, 0, 0));
 			}
+			{
+				RenderTarget::RenderScope rt_scope(cache.rt, rect(0, 0, area.w(), area.h()));
+				Canvas::DimScope dim_scope(area.w(), area.h());
+				ModelManager2D mm;
+				mm.setIdentity();
+				drawContents(-area.x(), -area.y(), 0, 1.0f);
+			}
+			cache.area = area;
+			clearSubtreeDirty();
+			++retained_draw_stats().misses;
+		} else {
+			++retained_draw_stats().hits;
+		}
 
-			if(clip_area_) {
-				ClipScope::Manager clip_scope(*clip_area_, Canvas::getInstance()->getCamera());
-				handleDraw();
-			} else {
-				handleDraw();
+		// The render target is stored bottom-up, so flip it vertically when
+		// blitting it back over the area it was rendered from.
+		auto tex = cache.rt->getTexture();
+		const rectf uv = tex->getTextureCoords(0, rect(0, 0, area.w(), area.h()));
+		const float x1 = static_cast<float>(area.x1()), y1 = static_cast<float>(area.y1());
+		const float x2 = static_cast<float>(area.x2()), y2 = static_cast<float>(area.y2());
+		std::vector<vertex_texcoord> vtc;
+		vtc.emplace_back(glm::vec2(x1, y1), glm::vec2(uv.x1(), uv.y2()));
+		vtc.emplace_back(glm::vec2(x2, y1), glm::vec2(uv.x2(), uv.y2()));
+		vtc.emplace_back(glm::vec2(x1, y2), glm::vec2(uv.x1(), uv.y1()));
+		vtc.emplace_back(glm::vec2(x1, y2), glm::vec2(uv.x1(), uv.y1()));
+		vtc.emplace_back(glm::vec2(x2, y1), glm::vec2(uv.x2(), uv.y2()));
+		vtc.emplace_back(glm::vec2(x2, y2), glm::vec2(uv.x2(), uv.y1()));
+
+		// The cache already has draw_color_ applied, and like a widget drawn
+		// directly it mustn't pick up the enclosing widget's color as well.
+		ModelManager2D mm(xt, yt, rotate, scale);
+		Canvas::ColorManager cm(Color::colorWhite());
+		Canvas::getInstance()->blitTexture(tex, vtc, 0);
+	}
+
+	void Widget::setRetained(bool retained)
+	{
+		retained_ = retained;
+		if(!retained_) {
+			retained_cache_.rt.reset();
+		}
+		invalidate();
+	}
+
+	bool Widget::isSubtreeDirty() const
+	{
+		// A focused widget may be animating a caret or similar, so it is
+		// always considered dirty.
+		if(dirty_ || hasFocus()) {
+			return true;
+		}
+		for(const WidgetPtr& w : getChildren()) {
+			if(w && w->isSubtreeDirty()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Widget::clearSubtreeDirty() const
+	{
+		dirty_ = false;
+		for(const WidgetPtr& w : getChildren()) {
+			if(w) {
+				w->clearSubtreeDirty();
 			}
 		}
 	}
@@ -415,6 +582,7 @@ namespace gui
 	void Widget::setClipArea(const rect& area)
 	{
 		clip_area_.reset(new rect(area));
+		invalidate();
 	}
 
 	void Widget::setClipAreaToDim()
@@ -425,6 +593,7 @@ namespace gui
 	void Widget::clearClipArea()
 	{
 		clip_area_.reset();
+		invalidate();
 	}
 
 	ConstWidgetPtr Widget::getWidgetById(const std::string& id) const
@@ -454,6 +623,7 @@ namespace gui
 	{
 		display_alpha_ = a;
 		draw_color_.setAlpha(a);
+		invalidate();
 	}
 
 	void Widget::surrenderReferences(GarbageCollector* collector)
@@ -502,7 +672,7 @@ namespace gui
 	DEFINE_FIELD(visible, "bool")
 		return variant::from_bool(obj.visible_);
 	DEFINE_SET_FIELD
-		obj.visible_ = value.as_bool();
+		obj.setVisible(value.as_bool());
 
 	DEFINE_FIELD(id, "string")
 		return variant(obj.id_);
@@ -525,21 +695,25 @@ namespace gui
 		return variant(obj.width());
 	DEFINE_SET_FIELD
 		obj.w_ = value.as_int();
+		obj.invalidate();
 
 	DEFINE_FIELD(width, "int")
 		return variant(obj.width());
 	DEFINE_SET_FIELD
 		obj.w_ = value.as_int();
+		obj.invalidate();
 
 	DEFINE_FIELD(h, "int")
 		return variant(obj.height());
 	DEFINE_SET_FIELD
 		obj.h_ = value.as_int();
+		obj.invalidate();
 
 	DEFINE_FIELD(height, "int")
 		return variant(obj.height());
 	DEFINE_SET_FIELD
 		obj.h_ = value.as_int();
+		obj.invalidate();
 
 	DEFINE_FIELD(frame_set_name, "string")
 		return variant(obj.frame_set_name_);
@@ -575,11 +749,12 @@ namespace gui
 		return variant::from_bool(obj.disabled_);
 	DEFINE_SET_FIELD
 		obj.disabled_ = value.as_bool();
+		obj.invalidate();
 
 	DEFINE_FIELD(disabled_opacity, "int")
 		return variant(static_cast<int>(obj.disabled_opacity_));
 	DEFINE_SET_FIELD
-		obj.disabled_opacity_ = value.as_int();
+		obj.setDisabledOpacity(value.as_int());
 
 	DEFINE_FIELD(clip_area, "[int]|null")
 		if(obj.clip_area_) {
@@ -615,6 +790,11 @@ namespace gui
 	DEFINE_SET_FIELD_TYPE("decimal|int")
 		obj.setScale(value.as_float());
 
+	DEFINE_FIELD(retained, "bool")
+		return variant::from_bool(obj.retained_);
+	DEFINE_SET_FIELD
+		obj.setRetained(value.as_bool());
+
 	END_DEFINE_CALLABLE(Widget)
 
 	bool Widget::inWidget(int xloc, int yloc) const
@@ -639,6 +819,7 @@ namespace gui
 			frame_set_.reset();
 		}
 		frame_set_name_ = frame; 
+		invalidate();
 	}
 
 	void Widget::setTooltipText(const std::string& str)
@@ -772,6 +953,9 @@ namespace gui
 		if(getDrawColor() != KRE::Color::colorWhite()) {
 			res.add("draw_color", getDrawColor().write());
 		}
+		if(isRetained()) {
+			res.add("retained", true);
+		}
 		return res.build();
 	}
 
@@ -779,6 +963,7 @@ namespace gui
 	{
 		color_ = color;
 		handleColorChanged();
+		invalidate();
 	}
 
 	bool WidgetSortZOrder::operator()(const WidgetPtr& lhs, const WidgetPtr& rhs) const
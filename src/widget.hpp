@@ -31,6 +31,7 @@
 #include "geometry.hpp"
 #include "Texture.hpp"
 #include "Color.hpp"
+#include "RenderFwd.hpp"
 
 #include "asserts.hpp"
 #include "formula.hpp"
@@ -46,6 +47,18 @@ namespace game_logic
 
 namespace gui 
 {
+	// Counts of retained widget draws that were served from their cached
+	// render target (hits) or had to re-render their sub-tree (misses).
+	struct RetainedDrawStats
+	{
+		RetainedDrawStats() : hits(0), misses(0) {}
+		int hits;
+		int misses;
+	};
+
+	// Returns the counts accumulated since the last call with reset=true.
+	RetainedDrawStats get_retained_draw_stats(bool reset=false);
+
 	class Widget : public game_logic::FormulaCallable
 	{
 	public:
@@ -57,8 +70,8 @@ namespace gui
 		bool processEvent(const point& p, const SDL_Event& event, bool claimed);
 		void draw(int xt=0, int yt=0, float rotate=0, float scale=1.0f) const;
 
-		virtual void setLoc(int x, int y) { true_x_ = x_ = x; true_y_ = y_ = y; recalcLoc(); }
-		virtual void setDim(int w, int h) { w_ = w; h_ = h; recalcLoc(); }
+		virtual void setLoc(int x, int y) { true_x_ = x_ = x; true_y_ = y_ = y; recalcLoc(); invalidate(); }
+		virtual void setDim(int w, int h) { w_ = w; h_ = h; recalcLoc(); invalidate(); }
 
 		int x() const;
 		int y() const;
@@ -78,16 +91,16 @@ namespace gui
 		std::string tooltipFont() const { return tooltip_font_; }
 		KRE::Color tooltipColor() const { return tooltip_color_; }
 		bool visible() { return visible_; }
-		void setVisible(bool visible) { visible_ = visible; }
+		void setVisible(bool visible) { visible_ = visible; invalidate(); }
 		void setId(const std::string& new_id) { id_ = new_id; }
 		const std::string& id() const { return id_; }
 		bool disabled() const { return disabled_; }
-		void enable(bool val=true) { disabled_ = val; }
+		void enable(bool val=true) { disabled_ = val; invalidate(); }
 		bool claimMouseEvents() const { return claim_mouse_events_; }
 		void setClaimMouseEvents(bool claim=true) { claim_mouse_events_ = claim; }
 
 		int disabledOpacity() const { return disabled_opacity_; }
-		void setDisabledOpacity(int n) { disabled_opacity_ = std::min(255, std::max(n, 0)); }
+		void setDisabledOpacity(int n) { disabled_opacity_ = std::min(255, std::max(n, 0)); invalidate(); }
 
 		bool drawWithObjectShader() const { return draw_with_object_shader_; }
 		void setDrawWithObjectShader(bool dwos=true) { draw_with_object_shader_ = dwos; }
@@ -108,7 +121,7 @@ namespace gui
 		int zorder() const { return zorder_; }
 
 		int getFrameResolution() const { return resolution_; }
-		void setFrameResolution(int r) { resolution_ = r; }
+		void setFrameResolution(int r) { resolution_ = r; invalidate(); }
 		void setFrameSet(const std::string& frame);
 		std::string frameSetName() const { return frame_set_name_; }
 
@@ -117,12 +130,12 @@ namespace gui
 
 		int getPadWidth() const { return pad_w_; }
 		int getPadHeight() const { return pad_h_; }
-		void setPadding(int pw, int ph) { pad_w_ = pw; pad_h_ = ph; }
+		void setPadding(int pw, int ph) { pad_w_ = pw; pad_h_ = ph; invalidate(); }
 
 		HORIZONTAL_ALIGN hAlign() const { return align_h_; }
 		VERTICAL_ALIGN vAlign() const { return align_v_; }
-		void setHAlign(HORIZONTAL_ALIGN h) { align_h_ = h; recalcLoc(); }
-		void setVAlign(VERTICAL_ALIGN v) { align_v_ = v; recalcLoc(); }
+		void setHAlign(HORIZONTAL_ALIGN h) { align_h_ = h; recalcLoc(); invalidate(); }
+		void setVAlign(VERTICAL_ALIGN v) { align_v_ = v; recalcLoc(); invalidate(); }
 
 		virtual std::vector<WidgetPtr> getChildren() const { return std::vector<WidgetPtr>(); }
 
@@ -151,9 +164,19 @@ namespace gui
 		void setColor(const KRE::Color& color);
 		const KRE::Color& getColor() const { return color_; }
 
-		void setDrawColor(const KRE::Color& color) { draw_color_ = color; }
+		void setDrawColor(const KRE::Color& color) { draw_color_ = color; invalidate(); }
 		const KRE::Color& getDrawColor() const { return draw_color_; }
 
+		// A retained widget renders itself and its children into a render target
+		// and re-blits that until something in the sub-tree is invalidated.
+		bool isRetained() const { return retained_; }
+		void setRetained(bool retained=true);
+
+		// Marks this widget as needing to be redrawn. Any retained ancestor
+		// re-renders its cache on the next draw.
+		void invalidate() { dirty_ = true; }
+		bool isSubtreeDirty() const;
+
 		virtual WidgetPtr clone() const = 0;
 	protected:
 		Widget();
@@ -182,6 +205,23 @@ namespace gui
 		virtual void visitValues(game_logic::FormulaCallableVisitor& visitor) override {}
 		virtual void handleColorChanged() {}
 
+		void drawContents(int xt, int yt, float rotate, float scale) const;
+		void drawRetained(int xt, int yt, float rotate, float scale) const;
+		rect retainedArea() const;
+		void clearSubtreeDirty() const;
+		bool eventChangesAppearance(const SDL_Event& event);
+
+		// Copies of a widget start with an empty cache rather than sharing
+		// the render target of the original.
+		struct RetainedCache
+		{
+			RetainedCache() {}
+			RetainedCache(const RetainedCache&) {}
+			RetainedCache& operator=(const RetainedCache&) { return *this; }
+			KRE::RenderTargetPtr rt;
+			rect area;
+		};
+
 		int x_, y_;
 		int w_, h_;
 		int true_x_;
@@ -228,6 +268,11 @@ namespace gui
 
 		KRE::Color color_;
 		KRE::Color draw_color_;
+
+		bool retained_;
+		mutable bool dirty_;
+		bool mouse_inside_;
+		mutable RetainedCache retained_cache_;
 	};
 
 	// Functor to sort widgets by z-ordering.
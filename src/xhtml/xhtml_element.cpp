@@ -663,7 +663,8 @@ namespace xhtml
 				  width_(240),
 				  height_(100),
 				  img_src_("button.svg"),
-				  tex_(KRE::svg_texture_from_file(img_src_, width_, height_))
+				  raster_svg_(false),
+				  tex_()
 			{
 			}
 			void init() override {
@@ -673,15 +674,20 @@ namespace xhtml
 					tex_ = KRE::Texture::createTexture(img_src_);
 					width_ = tex_->width();
 					height_ = tex_->height();
+				} else {
+					raster_svg_ = !KRE::svg_file_has_mesh(img_src_);
 				}
 				setDimensions(rect(0, 0, width_, height_));
 			}
 			void handleSetDimensions(const rect& r) override {
-				if(width_ != r.w() || height_ != r.h()) {
-					width_ = r.w();
-					height_ = r.h();
-					tex_ = KRE::svg_texture_from_file(img_src_, width_, height_);
+				// The default button image is normally a cached SVG mesh, so resizing
+				// doesn't need to rasterise anything. If it can't be tessellated, it's
+				// rasterised once for each size it's given.
+				if(raster_svg_ && (tex_ == nullptr || width_ != r.w() || height_ != r.h())) {
+					tex_ = KRE::svg_texture_from_file(img_src_, r.w(), r.h());
 				}
+				width_ = r.w();
+				height_ = r.h();
 			}
 			bool isReplaced() const override { return true; }
 			KRE::SceneObjectPtr getRenderable() override
@@ -689,12 +695,13 @@ namespace xhtml
 				if(tex_ != nullptr) {
 					return std::make_shared<KRE::Blittable>(tex_);
 				}
-				return nullptr;
+				return KRE::svg_renderable_from_file(img_src_, width_, height_);
 			}
 			int width_;
 			int height_;
 			std::string img_src_;
 			bool dims_set_;
+			bool raster_svg_;
 			KRE::TexturePtr tex_;
 		};
 		ElementRegistrar<ButtonElement> button_element(ElementId::BUTTON, "button");